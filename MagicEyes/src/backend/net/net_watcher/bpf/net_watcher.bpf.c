@@ -79,8 +79,6 @@ bpf_map_lookup_or_try_init(void *map, const void *key, const void *init) {
 
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
-#define MAX_CONN 1000
-
 // 存储每个packet_tuple包所对应的ktime_info时间戳
 struct {
     __uint(type, BPF_MAP_TYPE_LRU_HASH);
@@ -104,7 +102,75 @@ struct {
     __uint(type, BPF_MAP_TYPE_RINGBUF);
     __uint(max_entries, 256 * 1024);
 } netfilter_rb SEC(".maps");
-// 存储每个tcp连接所对应的conn_t
+
+// 每个 ring buffer 的事件数、丢弃数和最大积压字节数，用于评估缓冲区大小
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, RB_NR);
+    __type(key, u32);
+    __type(value, struct rb_stat);
+} rb_stats SEC(".maps");
+
+// 按连接聚合的各层时延直方图，用户态每个输出间隔读取并清空
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, MAX_CONN);
+    __type(key, struct layer_key);
+    __type(value, struct layer_hist);
+} layer_hists SEC(".maps");
+
+// layer_hist 超过 BPF 栈大小，新建条目时从这里取全零的初始值
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, u32);
+    __type(value, struct layer_hist);
+} zero_hist SEC(".maps");
+
+// 每个 socket 上尚未收到响应的 HTTP 请求
+struct http_req {
+    u64 ts;
+    u32 path_hash;
+    u16 method;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, MAX_CONN);
+    __type(key, struct sock *);
+    __type(value, struct http_req);
+} http_reqs SEC(".maps");
+
+// tcp_recvmsg 入口保存的用户缓冲区，返回时从中解析收到的数据
+struct http_recv {
+    struct sock *sk;
+    const void *buf;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 10240);
+    __type(key, u32); // tid
+    __type(value, struct http_recv);
+} http_recvs SEC(".maps");
+
+// 按 (method, path_hash, status) 聚合的请求时延，用户态每个输出间隔读取并清空
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, HTTP_MAX_ENTRIES);
+    __type(key, struct http_key);
+    __type(value, struct http_stat);
+} http_stats_map SEC(".maps");
+
+// 抽样保存的路径哈希到路径前缀的映射，供用户态还原路径
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 1024);
+    __type(key, u32);
+    __type(value, char[HTTP_PATH_LEN]);
+} http_paths SEC(".maps");
+
+// 存储每个tcp连接所对应的conn_t，容量由用户态在加载前设置
 struct {
     __uint(type, BPF_MAP_TYPE_LRU_HASH);
     __uint(max_entries, MAX_CONN);
@@ -112,6 +178,14 @@ struct {
     __type(value, struct conn_t);
 } conns_info SEC(".maps");
 
+// conns_info 的写入/关闭计数，用户态据此和当前条目数推算 LRU 淘汰的连接数
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, u32);
+    __type(value, struct conn_stat);
+} conn_stats SEC(".maps");
+
 // 根据ptid存储sock指针，从而在上下文无sock的内核探测点获得sock
 struct {
     __uint(type, BPF_MAP_TYPE_LRU_HASH);
@@ -146,6 +220,9 @@ const volatile int filter_dport = 0;
 const volatile int filter_sport = 0;
 const volatile int all_conn = 0, err_packet = 0, extra_conn_info = 0,
                    layer_time = 0, http_info = 0, retrans_info = 0, udp_info =0,net_filter = 0;
+const volatile int http_stats = 0;           // 在内核中解析 HTTP 请求/响应并聚合时延
+const volatile int hist_mode = 0;            // 在内核中聚合各层时延，不再逐包输出
+const volatile unsigned int packet_sample = 0; // hist_mode 下每 packet_sample 个包仍输出一个事件，0 表示不输出
 
 /* help macro */
 
@@ -272,7 +349,7 @@ sk_ack_backlog);   //backlog传入连接请求的当前最大排队队列大小
 初始化pack_t结构
 #define PACKET_INIT_WITH_COMMON_INFO
     struct pack_t *packet;        //创建pack_t指针
-    packet = bpf_ringbuf_reserve(&rb, sizeof(*packet), 0);
+    packet = rb_reserve(&rb, RB_PACKET, sizeof(*packet));
 //为pack_t结构体分配内存空间 if (!packet) {                //分配失败 return 0;
     }
     packet->err = 0;             //err
@@ -282,7 +359,7 @@ sk_ack_backlog);   //backlog传入连接请求的当前最大排队队列大小
 */
 #define PACKET_INIT_WITH_COMMON_INFO                                           \
     struct pack_t *packet;                                                     \
-    packet = bpf_ringbuf_reserve(&rb, sizeof(*packet), 0);                     \
+    packet = rb_reserve(&rb, RB_PACKET, sizeof(*packet));                      \
     if (!packet) {                                                             \
         return 0;                                                              \
     }                                                                          \
@@ -293,7 +370,116 @@ sk_ack_backlog);   //backlog传入连接请求的当前最大排队队列大小
 
 /* help macro end */
 
+/* 在 ring buffer 中预留一个事件，并记录该 ring buffer 的丢弃数和积压 */
+static __always_inline void *rb_reserve(void *ringbuf, u32 idx, u64 size) {
+    struct rb_stat *stat = bpf_map_lookup_elem(&rb_stats, &idx);
+    void *e = bpf_ringbuf_reserve(ringbuf, size, 0);
+
+    if (stat) {
+        if (!e) {
+            stat->drops++;
+        } else {
+            u64 backlog = bpf_ringbuf_query(ringbuf, BPF_RB_AVAIL_DATA);
+
+            stat->events++;
+            if (backlog > stat->max_backlog)
+                stat->max_backlog = backlog;
+        }
+    }
+    return e;
+}
+
 /* help functions */
+static __always_inline void conn_insert(struct sock *sk, struct conn_t *conn) {
+    u32 zero = 0;
+    struct conn_stat *stat = bpf_map_lookup_elem(&conn_stats, &zero);
+    long err = bpf_map_update_elem(&conns_info, &sk, conn, BPF_ANY);
+
+    if (!stat)
+        return;
+    if (err)
+        stat->update_fails++;
+    else
+        stat->inserts++;
+}
+
+static __always_inline u32 log2_u32(u32 v) {
+    u32 r, shift;
+
+    r = (v > 0xFFFF) << 4;
+    v >>= r;
+    shift = (v > 0xFF) << 3;
+    v >>= shift;
+    r |= shift;
+    shift = (v > 0xF) << 2;
+    v >>= shift;
+    r |= shift;
+    shift = (v > 0x3) << 1;
+    v >>= shift;
+    r |= shift;
+    r |= (v >> 1);
+    return r;
+}
+
+static __always_inline u32 log2_u64(u64 v) {
+    u32 hi = v >> 32;
+
+    if (hi)
+        return log2_u32(hi) + 32;
+    return log2_u32(v);
+}
+
+static __always_inline void hist_add(struct layer_hist *h, int layer, u64 delta) {
+    u32 slot = log2_u64(delta);
+
+    if (slot >= LAYER_MAX_SLOTS)
+        slot = LAYER_MAX_SLOTS - 1;
+    __sync_fetch_and_add(&h->count[layer], 1);
+    __sync_fetch_and_add(&h->sum[layer], delta);
+    __sync_fetch_and_add(&h->slots[layer][slot], 1);
+}
+
+// 记录一个包在三层之间的时延及其总和，base 为 LAYER_RX_MAC_IP 或 LAYER_TX_TCP_IP
+static __always_inline void record_layer_delay(struct sock *sk, int base, u64 d0,
+                                               u64 d1, u64 d2) {
+    struct layer_key key = {};
+    struct layer_hist *h;
+    u32 zero = 0;
+
+    // 某一层没有记录到时间戳时差值会溢出，丢弃该样本
+    if ((s64)d0 < 0 || (s64)d1 < 0 || (s64)d2 < 0)
+        return;
+
+    key.family = BPF_CORE_READ(sk, __sk_common.skc_family);
+    key.sport = BPF_CORE_READ(sk, __sk_common.skc_num);
+    key.dport = __bpf_ntohs(BPF_CORE_READ(sk, __sk_common.skc_dport));
+    if (key.family == AF_INET) {
+        key.saddr = BPF_CORE_READ(sk, __sk_common.skc_rcv_saddr);
+        key.daddr = BPF_CORE_READ(sk, __sk_common.skc_daddr);
+    } else {
+        bpf_probe_read_kernel(&key.saddr_v6, sizeof(key.saddr_v6),
+                              &sk->__sk_common.skc_v6_rcv_saddr.in6_u.u6_addr32);
+        bpf_probe_read_kernel(&key.daddr_v6, sizeof(key.daddr_v6),
+                              &sk->__sk_common.skc_v6_daddr.in6_u.u6_addr32);
+    }
+
+    h = bpf_map_lookup_elem(&layer_hists, &key);
+    if (!h) {
+        struct layer_hist *init = bpf_map_lookup_elem(&zero_hist, &zero);
+
+        if (!init)
+            return;
+        bpf_map_update_elem(&layer_hists, &key, init, BPF_NOEXIST);
+        h = bpf_map_lookup_elem(&layer_hists, &key);
+        if (!h)
+            return;
+    }
+    hist_add(h, base, d0);
+    hist_add(h, base + 1, d1);
+    hist_add(h, base + 2, d2);
+    hist_add(h, base + 3, d0 + d1 + d2);
+}
+
 // 将struct sock类型的指针转化为struct tcp_sock类型的指针
 static struct tcp_sock *tcp_sk(const struct sock *sk) {
     return (struct tcp_sock *)sk;
@@ -371,6 +557,144 @@ static void get_pkt_tuple_v6(struct packet_tuple *pkt_tuple,
 
     pkt_tuple->tran_flag = 1; // tcp包
 }
+/* 6.4 起 iov_iter 的 iov 改名为 __iov */
+struct iov_iter___new {
+    const struct iovec *__iov;
+} __attribute__((preserve_access_index));
+
+/* 取 msghdr 中第一段用户缓冲区，兼容 ITER_UBUF（6.0+）和 iov/__iov 两种命名的 iovec 迭代器 */
+static __always_inline const void *msg_user_buf(struct msghdr *msg) {
+    struct iov_iter___new *iter = (void *)&msg->msg_iter;
+
+    if (bpf_core_enum_value_exists(enum iter_type, ITER_UBUF) &&
+        BPF_CORE_READ(msg, msg_iter.iter_type) ==
+            bpf_core_enum_value(enum iter_type, ITER_UBUF))
+        return BPF_CORE_READ(msg, msg_iter.ubuf);
+    if (bpf_core_field_exists(iter->__iov))
+        return BPF_CORE_READ(iter, __iov, iov_base);
+    if (bpf_core_field_exists(msg->msg_iter.iov))
+        return BPF_CORE_READ(msg, msg_iter.iov, iov_base);
+    return NULL;
+}
+
+static __always_inline int http_method(const char *h, int *len) {
+    if (h[0] == 'G' && h[1] == 'E' && h[2] == 'T' && h[3] == ' ') {
+        *len = 4;
+        return HTTP_GET;
+    }
+    if (h[0] == 'P' && h[1] == 'O' && h[2] == 'S' && h[3] == 'T' && h[4] == ' ') {
+        *len = 5;
+        return HTTP_POST;
+    }
+    if (h[0] == 'P' && h[1] == 'U' && h[2] == 'T' && h[3] == ' ') {
+        *len = 4;
+        return HTTP_PUT;
+    }
+    if (h[0] == 'D' && h[1] == 'E' && h[2] == 'L' && h[3] == 'E' && h[4] == 'T' &&
+        h[5] == 'E' && h[6] == ' ') {
+        *len = 7;
+        return HTTP_DELETE;
+    }
+    if (h[0] == 'H' && h[1] == 'E' && h[2] == 'A' && h[3] == 'D' && h[4] == ' ') {
+        *len = 5;
+        return HTTP_HEAD;
+    }
+    if (h[0] == 'P' && h[1] == 'A' && h[2] == 'T' && h[3] == 'C' && h[4] == 'H' &&
+        h[5] == ' ') {
+        *len = 6;
+        return HTTP_PATCH;
+    }
+    if (h[0] == 'O' && h[1] == 'P' && h[2] == 'T' && h[3] == 'I' && h[4] == 'O' &&
+        h[5] == 'N' && h[6] == 'S' && h[7] == ' ') {
+        *len = 8;
+        return HTTP_OPTIONS;
+    }
+    return HTTP_UNKNOWN;
+}
+
+// "HTTP/1.x NNN" 返回状态码，否则返回 0
+static __always_inline int http_status(const char *h) {
+    if (h[0] != 'H' || h[1] != 'T' || h[2] != 'T' || h[3] != 'P' || h[4] != '/' ||
+        h[5] != '1' || h[6] != '.' || h[8] != ' ')
+        return 0;
+    if (h[9] < '1' || h[9] > '5' || h[10] < '0' || h[10] > '9' || h[11] < '0' ||
+        h[11] > '9')
+        return 0;
+    return (h[9] - '0') * 100 + (h[10] - '0') * 10 + (h[11] - '0');
+}
+
+static __always_inline void http_record(struct http_req *req, int status) {
+    struct http_key key = {.path_hash = req->path_hash,
+                           .method = req->method,
+                           .status = status};
+    struct http_stat *stat, zero = {};
+    u64 delta = (bpf_ktime_get_ns() - req->ts) / 1000;
+    u32 slot;
+
+    stat = bpf_map_lookup_or_try_init(&http_stats_map, &key, &zero);
+    if (!stat)
+        return;
+    slot = log2_u64(delta);
+    if (slot >= HTTP_MAX_SLOTS)
+        slot = HTTP_MAX_SLOTS - 1;
+    __sync_fetch_and_add(&stat->count, 1);
+    __sync_fetch_and_add(&stat->sum_us, delta);
+    __sync_fetch_and_add(&stat->slots[slot], 1);
+    if (delta > stat->max_us)
+        stat->max_us = delta;
+}
+
+/*
+ * 只解析负载开头的请求行/状态行：请求记录方法和路径前缀哈希，
+ * 同一 socket 上随后出现的响应与之配对并计入时延统计，不再向用户态复制负载
+ */
+static __always_inline void http_parse(struct sock *sk, const void *buf) {
+    char head[16] = {};
+    char path[HTTP_PATH_LEN] = {};
+    struct http_req req = {}, *pending;
+    int status, mlen = 0, done = 0;
+    u32 hash = 2166136261u;
+
+    if (!buf || bpf_probe_read_user(head, sizeof(head), buf))
+        return;
+
+    status = http_status(head);
+    if (status) {
+        pending = bpf_map_lookup_elem(&http_reqs, &sk);
+        if (pending) {
+            http_record(pending, status);
+            bpf_map_delete_elem(&http_reqs, &sk);
+        }
+        return;
+    }
+
+    req.method = http_method(head, &mlen);
+    if (req.method == HTTP_UNKNOWN)
+        return;
+    bpf_probe_read_user(path, sizeof(path), buf + mlen);
+#pragma unroll
+    for (int i = 0; i < HTTP_PATH_LEN; i++) {
+        char c = path[i];
+
+        if (c == ' ' || c == '?' || c == '\r' || c == '\0')
+            done = 1;
+        if (done) {
+            path[i] = 0;
+            continue;
+        }
+        hash = (hash ^ (u8)c) * 16777619u;
+    }
+    req.path_hash = hash;
+    req.ts = bpf_ktime_get_ns();
+    // 流水线请求只计第一个，直到收到响应
+    bpf_map_update_elem(&http_reqs, &sk, &req, BPF_NOEXIST);
+
+    // 路径表只做抽样写入，热点路径很快会被记录，冷门路径由用户态显示为哈希值
+    if (!bpf_map_lookup_elem(&http_paths, &hash) &&
+        bpf_get_prandom_u32() % 16 == 0)
+        bpf_map_update_elem(&http_paths, &hash, path, BPF_NOEXIST);
+}
+
 /* help functions end */
 
 /**
@@ -396,11 +720,7 @@ int BPF_KRETPROBE(inet_csk_accept_exit, // 接受tcp连接
     CONN_ADD_ADDRESS // conn_t结构中增加地址信息
 
         // 更新/插入conns_info中的键值对
-        int err = bpf_map_update_elem(&conns_info, &sk, &conn, BPF_ANY);
-    if (err) { // 更新错误
-        // bpf_printk("inet_accept update err.\n");
-        return 0;
-    }
+        conn_insert(sk, &conn);
 
     return 0;
 }
@@ -448,11 +768,8 @@ int BPF_KRETPROBE(tcp_v4_connect_exit, int ret) {
 
     CONN_ADD_ADDRESS // conn_t结构中增加地址信息
 
-        long err = bpf_map_update_elem(&conns_info, &sk, &conn, BPF_ANY);
+        conn_insert(sk, &conn);
     // 更新conns_info中sk对应的conn
-    if (err) {
-        return 0;
-    }
     return 0;
 }
 
@@ -490,11 +807,8 @@ int BPF_KRETPROBE(tcp_v6_connect_exit, int ret) {
 
     CONN_ADD_ADDRESS // conn_t结构中增加地址信息
 
-        long err = bpf_map_update_elem(&conns_info, &sk, &conn, BPF_ANY);
+        conn_insert(sk, &conn);
     // 更新conns_info中sk对应的conn
-    if (err) {
-        return 0;
-    }
     // bpf_printk("tcp_v4_connect_exit update sk: %p.\n", sk);
     return 0;
 }
@@ -506,6 +820,10 @@ int BPF_KRETPROBE(tcp_v6_connect_exit, int ret) {
 /* erase CLOSED TCP connection */
 SEC("kprobe/tcp_set_state")
 int BPF_KPROBE(tcp_set_state, struct sock *sk, int state) {
+    // 未收到响应就关闭的连接，其挂起的请求不能留给复用该 sock 地址的新连接
+    if (http_stats && state == TCP_CLOSE) {
+        bpf_map_delete_elem(&http_reqs, &sk);
+    }
     if (all_conn) {
         return 0;
     }
@@ -514,7 +832,13 @@ int BPF_KPROBE(tcp_set_state, struct sock *sk, int state) {
     if (state == TCP_CLOSE && value != NULL) { // TCP_CLOSE置1 说明关闭连接
         // delete
         bpf_map_delete_elem(&sock_stores, &value->ptid); // 删除sock_stores
-        bpf_map_delete_elem(&conns_info, &sk);           // 删除conns_info
+        if (!bpf_map_delete_elem(&conns_info, &sk)) {    // 删除conns_info
+            u32 zero = 0;
+            struct conn_stat *stat = bpf_map_lookup_elem(&conn_stats, &zero);
+
+            if (stat)
+                stat->closes++;
+        }
     }
     return 0;
 }
@@ -798,6 +1122,14 @@ int BPF_KPROBE(skb_copy_datagram_iter, struct sk_buff *skb) {
     }
     // bpf_printk("rx enter app layer.\n");
 
+    if (hist_mode) {
+        record_layer_delay(sk, LAYER_RX_MAC_IP, tinfo->ip_time - tinfo->mac_time,
+                           tinfo->tran_time - tinfo->ip_time,
+                           tinfo->app_time - tinfo->tran_time);
+        if (!packet_sample || bpf_get_prandom_u32() % packet_sample)
+            return 0;
+    }
+
     PACKET_INIT_WITH_COMMON_INFO
 
     if (layer_time) {
@@ -880,7 +1212,7 @@ int BPF_KPROBE(tcp_validate_incoming, struct sock *sk, struct sk_buff *skb) {
         return 0;
     }
     struct pack_t *packet;
-    packet = bpf_ringbuf_reserve(&rb, sizeof(*packet), 0);
+    packet = rb_reserve(&rb, RB_PACKET, sizeof(*packet));
     if (!packet) {
         return 0;
     }
@@ -914,7 +1246,7 @@ int BPF_KRETPROBE(__skb_checksum_complete_exit, int ret) {
         return 0;
     }
     struct pack_t *packet;
-    packet = bpf_ringbuf_reserve(&rb, sizeof(*packet), 0);
+    packet = rb_reserve(&rb, RB_PACKET, sizeof(*packet));
     if (!packet) {
         return 0;
     }
@@ -1004,7 +1336,10 @@ int BPF_KPROBE(tcp_sendmsg, struct sock *sk, struct msghdr *msg, size_t size) {
 
     // TX HTTP info
     if (http_info) {
-        unsigned char *user_data = BPF_CORE_READ(msg, msg_iter.iov, iov_base);
+        const void *user_data = msg_user_buf(msg);
+        if (user_data == NULL) {
+            return 0;
+        }
         tinfo = (struct ktime_info *)bpf_map_lookup_or_try_init(
             &timestamps, &pkt_tuple, &zero);
         if (tinfo == NULL) {
@@ -1178,6 +1513,13 @@ int BPF_KPROBE(dev_hard_start_xmit, struct sk_buff *skb) {
     if (!sk) {
         return 0;
     }
+    if (hist_mode) {
+        record_layer_delay(sk, LAYER_TX_TCP_IP, tinfo->ip_time - tinfo->tran_time,
+                           tinfo->mac_time - tinfo->ip_time,
+                           tinfo->qdisc_time - tinfo->mac_time);
+        if (!packet_sample || bpf_get_prandom_u32() % packet_sample)
+            return 0;
+    }
     PACKET_INIT_WITH_COMMON_INFO
     // 记录各层的时间差值
     if (layer_time) {
@@ -1199,6 +1541,59 @@ int BPF_KPROBE(dev_hard_start_xmit, struct sk_buff *skb) {
 };
 /**** send path end ****/
 
+/**** http ****/
+/*!
+ * \brief: 发送方向的 HTTP 解析，与 tcp_sendmsg 的时间戳探针分开以免共用 BPF 栈
+ */
+SEC("kprobe/tcp_sendmsg")
+int BPF_KPROBE(tcp_sendmsg_http, struct sock *sk, struct msghdr *msg) {
+    if (!http_stats) {
+        return 0;
+    }
+    if (!bpf_map_lookup_elem(&conns_info, &sk)) {
+        return 0;
+    }
+    http_parse(sk, msg_user_buf(msg));
+    return 0;
+}
+
+/*!
+ * \brief: 在 tcp_recvmsg 返回时解析已复制到用户缓冲区的数据，
+ *         与数据在 skb 线性区还是分页中无关
+ */
+SEC("kprobe/tcp_recvmsg")
+int BPF_KPROBE(tcp_recvmsg, struct sock *sk, struct msghdr *msg) {
+    if (!http_stats) {
+        return 0;
+    }
+    if (!bpf_map_lookup_elem(&conns_info, &sk)) {
+        return 0;
+    }
+    u32 tid = bpf_get_current_pid_tgid();
+    struct http_recv recv = {.sk = sk, .buf = msg_user_buf(msg)};
+
+    if (recv.buf) {
+        bpf_map_update_elem(&http_recvs, &tid, &recv, BPF_ANY);
+    }
+    return 0;
+}
+
+SEC("kretprobe/tcp_recvmsg")
+int BPF_KRETPROBE(tcp_recvmsg_exit, int ret) {
+    u32 tid = bpf_get_current_pid_tgid();
+    struct http_recv *recv = bpf_map_lookup_elem(&http_recvs, &tid);
+
+    if (!recv) {
+        return 0;
+    }
+    if (ret > 0) {
+        http_parse(recv->sk, recv->buf);
+    }
+    bpf_map_delete_elem(&http_recvs, &tid);
+    return 0;
+}
+/**** http end ****/
+
 /**** retrans ****/
 
 /* 在进入快速恢复阶段时，不管是基于Reno或者SACK的快速恢复，
@@ -1288,7 +1683,7 @@ int BPF_KPROBE(__udp_enqueue_schedule_skb, struct sock *sk,
     struct udp_message *udp_message =
         bpf_map_lookup_elem(&timestamps, &pkt_tuple);
     ;
-    message = bpf_ringbuf_reserve(&udp_rb, sizeof(*message), 0);
+    message = rb_reserve(&udp_rb, RB_UDP, sizeof(*message));
     if (!message) {
         return 0;
     }
@@ -1356,7 +1751,7 @@ int BPF_KPROBE(ip_send_skb, struct net *net,struct sk_buff *skb) {
     struct udp_message *message;
     struct udp_message *udp_message =
         bpf_map_lookup_elem(&timestamps, pt);
-    message = bpf_ringbuf_reserve(&udp_rb, sizeof(*message), 0);
+    message = rb_reserve(&udp_rb, RB_UDP, sizeof(*message));
     if (!message) {
         return 0;
     }
@@ -1422,7 +1817,7 @@ int BPF_KPROBE(ip_local_deliver_finish) {
 
     struct netfilter *message;
     struct netfilter *netfilter =bpf_map_lookup_elem(&netfilter_time, pkt_tuple);
-    message = bpf_ringbuf_reserve(&netfilter_rb, sizeof(*message), 0);
+    message = rb_reserve(&netfilter_rb, RB_NETFILTER, sizeof(*message));
     if (!message) {
         return 0;
     }
@@ -1479,7 +1874,7 @@ int BPF_KPROBE(ip_finish_output) {
     tinfo->ip_finish_output_time = bpf_ktime_get_ns() / 1000;
     struct netfilter *message;
     struct netfilter *netfilter =bpf_map_lookup_elem(&netfilter_time, pkt_tuple);
-    message = bpf_ringbuf_reserve(&netfilter_rb, sizeof(*message), 0);
+    message = rb_reserve(&netfilter_rb, RB_NETFILTER, sizeof(*message));
     if(!message){
         return 0;
     }
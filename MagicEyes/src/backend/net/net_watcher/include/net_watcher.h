@@ -85,6 +85,89 @@ struct pack_t {
     int rx;                              // rx packet(1) or tx packet(0)
 };
 
+enum rb_index {
+    RB_PACKET,    // rb
+    RB_UDP,       // udp_rb
+    RB_NETFILTER, // netfilter_rb
+    RB_NR,
+};
+
+struct rb_stat {
+    unsigned long long events;      // 成功写入的事件数
+    unsigned long long drops;       // 缓冲区满而丢弃的事件数
+    unsigned long long max_backlog; // 写入时观察到的最大未消费字节数
+};
+
+#define HTTP_PATH_LEN 32     // 参与哈希和保存的路径前缀长度
+#define HTTP_MAX_SLOTS 32
+#define HTTP_MAX_ENTRIES 4096
+
+enum http_method {
+    HTTP_UNKNOWN,
+    HTTP_GET,
+    HTTP_POST,
+    HTTP_PUT,
+    HTTP_DELETE,
+    HTTP_HEAD,
+    HTTP_PATCH,
+    HTTP_OPTIONS,
+    HTTP_METHOD_NR,
+};
+
+struct http_key {
+    unsigned int path_hash; // 路径前缀（不含查询参数）的 FNV-1a 哈希
+    unsigned short method;
+    unsigned short status;
+};
+
+struct http_stat {
+    unsigned long long count;
+    unsigned long long sum_us;
+    unsigned long long max_us;
+    unsigned int slots[HTTP_MAX_SLOTS]; // log2(us) 直方图
+};
+
+// conns_info 等连接表的默认容量，可通过 -C 在加载前调整
+#define MAX_CONN 1000
+
+struct conn_stat {
+    unsigned long long inserts;      // 写入 conns_info 的连接数
+    unsigned long long closes;       // 连接关闭时删除的条目数
+    unsigned long long update_fails; // 写入失败的次数
+};
+
+#define LAYER_MAX_SLOTS 32
+
+// 各层时延，RX 方向依次为 MAC->IP、IP->TCP、TCP->APP，TX 方向依次为 TCP->IP、IP->MAC、MAC->XMIT
+enum layer_delay {
+    LAYER_RX_MAC_IP,
+    LAYER_RX_IP_TCP,
+    LAYER_RX_TCP_APP,
+    LAYER_RX_TOTAL,
+    LAYER_TX_TCP_IP,
+    LAYER_TX_IP_MAC,
+    LAYER_TX_MAC_XMIT,
+    LAYER_TX_TOTAL,
+    LAYER_NR,
+};
+
+struct layer_key {
+    unsigned __int128 saddr_v6;
+    unsigned __int128 daddr_v6;
+    unsigned int saddr;
+    unsigned int daddr;
+    unsigned short sport;
+    unsigned short dport;
+    unsigned short family;
+    unsigned short pad;
+};
+
+struct layer_hist {
+    unsigned long long count[LAYER_NR];
+    unsigned long long sum[LAYER_NR];                 // us
+    unsigned int slots[LAYER_NR][LAYER_MAX_SLOTS];    // log2(us) 直方图
+};
+
 struct udp_message {
     unsigned int saddr;
     unsigned int daddr;
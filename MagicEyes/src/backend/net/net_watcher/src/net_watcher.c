@@ -20,12 +20,21 @@
 #include <arpa/inet.h>
 #include <bpf/bpf.h>
 #include <bpf/libbpf.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "net_watcher/include/net_watcher.h"
@@ -39,6 +48,42 @@ static char err_file_path[1024];
 static char packets_file_path[1024];
 static char udp_file_path[1024];
 
+/* 长期打开的日志文件，使用用户态大缓冲区，按大小/时间轮转，由主循环定期 flush */
+struct log_writer {
+    char path[1024];
+    FILE *fp;
+    char *buf;
+    size_t size;   // 当前文件已写入的字节数
+    time_t opened; // 当前文件的创建时间
+};
+
+#define LOG_BUF_SIZE (1 << 20)
+
+static unsigned long log_max_size = 64UL << 20; // 超过该大小轮转，0 表示不按大小轮转
+static int log_max_age = 0;                     // 超过该秒数轮转，0 表示不按时间轮转
+static int log_keep = 3;                        // 保留 path.1 ~ path.N 个历史文件
+
+static struct log_writer err_log, packets_log, udp_log;
+static int conns_fd = -1;
+static char *conns_prev;
+static size_t conns_prev_len;
+
+static unsigned int max_conns = MAX_CONN; // conns_info 等连接表的容量
+static int conn_delta = 0;                // connects.log 只追加新建/变化/关闭的连接
+static struct log_writer conns_log;       // 增量模式下的 connects.log
+static unsigned int conns_live;           // 最近一次遍历到的连接数
+static unsigned long long conns_dump_us;  // 最近一次遍历连接表的耗时
+static long bench_conns = 0;
+static int http_interval = 0;  // HTTP 时延统计的输出间隔（秒）
+static long bench_http = 0;
+static pid_t bench_pid = -1;
+
+static long bench_events = 0;
+static int rb_stats_interval = 0;
+static int hist_interval = 0;          // 各层时延直方图的输出间隔（秒），0 表示逐包输出
+static unsigned int packet_sample = 0; // 直方图模式下每 N 个包输出一个事件
+static unsigned int hist_conns = MAX_CONN; // layer_hists 的容量，未开启 -H 时只保留 1 个占位条目
+
 static int sport = 0, dport = 0; // for filter
 static int all_conn = 0, err_packet = 0, extra_conn_info = 0, layer_time = 0,
            http_info = 0, retrans_info = 0, udp_info = 0,net_filter = 0; // flag
@@ -56,6 +101,19 @@ static const struct argp_option opts[] = {
     {"dport", 'd', "DPORT", 0, "trace this destination port only"},
     {"udp", 'u', 0, 0, "trace the udp message"},
     {"net_filter",'n',0,0,"trace ipv4 packget filter "},
+    {"log-size", 'L', "MB", 0, "rotate log files larger than MB (default 64, 0 to disable)"},
+    {"log-age", 'A', "SEC", 0, "rotate log files older than SEC (default 0, disabled)"},
+    {"log-keep", 'K', "N", 0, "keep N rotated log files (default 3)"},
+    {"rb-stats", 'S', "SEC", 0, "print ring buffer event/drop/backlog counters every SEC seconds"},
+    {"hist", 'H', "SEC", 0, "aggregate per-connection layer delay histograms in kernel and print them every SEC seconds"},
+    {"sample", 'p', "N", 0, "with -H, still log one of every N packet events (default 0, none)"},
+    {"hist-conns", 'M', "N", 0, "with -H, aggregate histograms for at most N connections (default 1000)"},
+    {"max-conns", 'C', "N", 0, "track at most N connections (default 1000)"},
+    {"conn-delta", 'D', 0, 0, "append only new, changed and closed connections to connects.log"},
+    {"bench-conns", 'O', "N", 0, "open N loopback connections and report connection table dump time"},
+    {"http-stats", 'I', "SEC", 0, "parse HTTP/1.x in kernel and print request latency per method/path/status every SEC seconds"},
+    {"bench-http", 'W', "N", 0, "run N requests against a local HTTP server while tracing and report requests/sec"},
+    {"bench", 'B', "N", 0, "replay N synthetic packet events into the log and report events/sec"},
     {}};
 
 static error_t parse_arg(int key, char *arg, struct argp_state *state) {
@@ -91,6 +149,53 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
     case 'n':
         net_filter = 1;
         break;
+    case 'L':
+        log_max_size = strtoul(arg, &end, 10) << 20;
+        break;
+    case 'A':
+        log_max_age = strtol(arg, &end, 10);
+        break;
+    case 'K':
+        log_keep = strtol(arg, &end, 10);
+        break;
+    case 'S':
+        rb_stats_interval = strtol(arg, &end, 10);
+        break;
+    case 'H':
+        hist_interval = strtol(arg, &end, 10);
+        break;
+    case 'p':
+        packet_sample = strtoul(arg, &end, 10);
+        break;
+    case 'M':
+        hist_conns = strtoul(arg, &end, 10);
+        if (!hist_conns) {
+            fprintf(stderr, "Invalid hist-conns: %s\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case 'C':
+        max_conns = strtoul(arg, &end, 10);
+        if (!max_conns) {
+            fprintf(stderr, "Invalid max-conns: %s\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case 'D':
+        conn_delta = 1;
+        break;
+    case 'O':
+        bench_conns = strtol(arg, &end, 10);
+        break;
+    case 'I':
+        http_interval = strtol(arg, &end, 10);
+        break;
+    case 'W':
+        bench_http = strtol(arg, &end, 10);
+        break;
+    case 'B':
+        bench_events = strtol(arg, &end, 10);
+        break;
     default:
         return ARGP_ERR_UNKNOWN;
     }
@@ -117,100 +222,370 @@ static void bytes_to_str(char *str, unsigned long long num) {
     }
 }
 
-static int print_conns(struct net_watcher_bpf *skel) {
+static int log_open(struct log_writer *w, const char *path) {
+    if (path != w->path)
+        snprintf(w->path, sizeof(w->path), "%s", path);
+    w->fp = fopen(w->path, "w");
+    if (w->fp == NULL) {
+        fprintf(stderr, "Failed to open %s: (%s)\n", w->path, strerror(errno));
+        return -errno;
+    }
+    if (!w->buf)
+        w->buf = malloc(LOG_BUF_SIZE);
+    if (w->buf)
+        setvbuf(w->fp, w->buf, _IOFBF, LOG_BUF_SIZE);
+    w->size = 0;
+    w->opened = time(NULL);
+    return 0;
+}
 
-    FILE *file = fopen(connects_file_path, "w+");
-    if (file == NULL) {
-        fprintf(stderr, "Failed to open connects.log: (%s)\n", strerror(errno));
-        return 0;
+static void log_rotate(struct log_writer *w) {
+    char from[1040], to[1040];
+
+    fclose(w->fp);
+    w->fp = NULL;
+    for (int i = log_keep - 1; i >= 1; i--) {
+        snprintf(from, sizeof(from), "%s.%d", w->path, i);
+        snprintf(to, sizeof(to), "%s.%d", w->path, i + 1);
+        rename(from, to);
+    }
+    if (log_keep > 0) {
+        snprintf(to, sizeof(to), "%s.1", w->path);
+        rename(w->path, to);
+    }
+    log_open(w, w->path);
+}
+
+static void log_write(struct log_writer *w, const char *data, size_t len) {
+    if (!w->fp)
+        return;
+    fwrite(data, 1, len, w->fp);
+    w->size += len;
+    if (log_max_size && w->size >= log_max_size)
+        log_rotate(w);
+}
+
+static void log_printf(struct log_writer *w, const char *fmt, ...) {
+    va_list args;
+    int n;
+
+    if (!w->fp)
+        return;
+    va_start(args, fmt);
+    n = vfprintf(w->fp, fmt, args);
+    va_end(args);
+    if (n > 0)
+        w->size += n;
+    if (log_max_size && w->size >= log_max_size)
+        log_rotate(w);
+}
+
+/* 由主循环每轮调用一次，按时间的轮转也在这里检查，避免每个事件都取时间 */
+static void log_flush(struct log_writer *w) {
+    if (!w->fp)
+        return;
+    fflush(w->fp);
+    if (log_max_age && time(NULL) - w->opened >= log_max_age)
+        log_rotate(w);
+}
+
+static void log_close(struct log_writer *w) {
+    if (w->fp)
+        fclose(w->fp);
+    w->fp = NULL;
+    free(w->buf);
+    w->buf = NULL;
+}
+
+static void format_conn(FILE *file, const struct conn_t *d) {
+    char s_str[INET_ADDRSTRLEN];
+    char d_str[INET_ADDRSTRLEN];
+
+    char s_str_v6[INET6_ADDRSTRLEN];
+    char d_str_v6[INET6_ADDRSTRLEN];
+
+    char s_ip_port_str[INET6_ADDRSTRLEN + 6];
+    char d_ip_port_str[INET6_ADDRSTRLEN + 6];
+
+    if (d->family == AF_INET) {
+        sprintf(s_ip_port_str, "%s:%d",
+                inet_ntop(AF_INET, &d->saddr, s_str, sizeof(s_str)),
+                d->sport);
+        sprintf(d_ip_port_str, "%s:%d",
+                inet_ntop(AF_INET, &d->daddr, d_str, sizeof(d_str)),
+                d->dport);
+    } else { // AF_INET6
+        sprintf(
+            s_ip_port_str, "%s:%d",
+            inet_ntop(AF_INET6, &d->saddr_v6, s_str_v6, sizeof(s_str_v6)),
+            d->sport);
+        sprintf(
+            d_ip_port_str, "%s:%d",
+            inet_ntop(AF_INET6, &d->daddr_v6, d_str_v6, sizeof(d_str_v6)),
+            d->dport);
+    }
+    char received_bytes[11], acked_bytes[11];
+    bytes_to_str(received_bytes, d->bytes_received);
+    bytes_to_str(acked_bytes, d->bytes_acked);
+    fprintf(file,
+            "connection{pid=\"%d\",sock=\"%p\",src=\"%s\",dst=\"%s\","
+            "is_server=\"%d\"",
+            d->pid, d->sock, s_ip_port_str, d_ip_port_str, d->is_server);
+    if (extra_conn_info) {
+        fprintf(file,
+                ",backlog=\"%u\""
+                ",maxbacklog=\"%u\""
+                ",rwnd=\"%u\""
+                ",cwnd=\"%u\""
+                ",ssthresh=\"%u\""
+                ",sndbuf=\"%u\""
+                ",wmem_queued=\"%u\""
+                ",rx_bytes=\"%s\""
+                ",tx_bytes=\"%s\""
+                ",srtt=\"%u\""
+                ",duration=\"%llu\""
+                ",total_retrans=\"%u\"",
+                d->tcp_backlog, d->max_tcp_backlog, d->rcv_wnd, d->snd_cwnd,
+                d->snd_ssthresh, d->sndbuf, d->sk_wmem_queued, received_bytes,
+                acked_bytes, d->srtt, d->duration, d->total_retrans);
+    } else {
+        fprintf(file,
+                ",backlog=\"-\",maxbacklog=\"-\",cwnd=\"-\",ssthresh=\"-\","
+                "sndbuf=\"-\",wmem_queued=\"-\",rx_bytes=\"-\",tx_bytes=\"-"
+                "\",srtt=\"-\",duration=\"-\",total_retrans=\"-\"");
+    }
+    if (retrans_info) {
+        fprintf(file, ",fast_retrans=\"%u\",timeout_retrans=\"%u\"",
+                d->fastRe, d->timeout);
+    } else {
+        fprintf(file, ",fast_retrans=\"-\",timeout_retrans=\"-\"");
+    }
+    fprintf(file, "} 0\n");
+}
+
+/*
+ * 增量模式下按 sock 指针记录每个连接上次输出时的内容摘要，只输出新建、变化和已消失的连接。
+ * 开放寻址表容量为连接表容量的 2 倍以上，每个间隔结束时把仍存在的条目搬到备用表中。
+ */
+struct conn_entry {
+    const void *sock;
+    unsigned int digest;
+    unsigned int gen;
+};
+
+static struct conn_entry *conn_table, *conn_spare;
+static unsigned int conn_table_bits, conn_table_used, conn_gen;
+
+static unsigned int conn_digest(const struct conn_t *d) {
+    const unsigned char *p = (const unsigned char *)d;
+    unsigned int h = 2166136261u;
+
+    for (size_t i = 0; i < sizeof(*d); i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+static struct conn_entry *conn_slot(struct conn_entry *table, const void *sock) {
+    size_t mask = (1UL << conn_table_bits) - 1;
+    size_t i = ((unsigned long)sock * 0x9E3779B97F4A7C15ULL) >> (64 - conn_table_bits);
+
+    while (table[i].sock && table[i].sock != sock)
+        i = (i + 1) & mask;
+    return &table[i];
+}
+
+static int conn_table_init(unsigned int max) {
+    conn_table_bits = 1;
+    while ((1UL << conn_table_bits) < 2UL * max)
+        conn_table_bits++;
+    conn_table = calloc(1UL << conn_table_bits, sizeof(*conn_table));
+    conn_spare = calloc(1UL << conn_table_bits, sizeof(*conn_spare));
+    if (!conn_table || !conn_spare) {
+        fprintf(stderr, "Failed to allocate connection table\n");
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+/* 返回该连接自上个间隔以来是否新建或发生变化 */
+static int conn_changed(const struct conn_t *d) {
+    struct conn_entry *e = conn_slot(conn_table, d->sock);
+    unsigned int digest = conn_digest(d);
+    int changed = !e->sock || e->digest != digest;
+
+    if (!e->sock) {
+        // 上个间隔的旧条目尚未清理时表可能接近满，此时只输出不记录
+        if (conn_table_used >= (3UL << conn_table_bits) / 4)
+            return 1;
+        e->sock = d->sock;
+        conn_table_used++;
+    }
+    e->digest = digest;
+    e->gen = conn_gen;
+    return changed;
+}
+
+/* 输出本间隔未再出现的连接，并把其余条目搬到备用表 */
+static void conn_reap(FILE *file) {
+    size_t size = 1UL << conn_table_bits;
+    struct conn_entry *tmp;
+
+    memset(conn_spare, 0, size * sizeof(*conn_spare));
+    conn_table_used = 0;
+    for (size_t i = 0; i < size; i++) {
+        const struct conn_entry *e = &conn_table[i];
+
+        if (!e->sock)
+            continue;
+        if (e->gen != conn_gen) {
+            fprintf(file, "connection_closed{sock=\"%p\"} 0\n", e->sock);
+            continue;
+        }
+        *conn_slot(conn_spare, e->sock) = *e;
+        conn_table_used++;
     }
+    tmp = conn_table;
+    conn_table = conn_spare;
+    conn_spare = tmp;
+}
 
-    int map_fd = bpf_map__fd(skel->maps.conns_info);
+static void visit_conn(FILE *file, const struct conn_t *d) {
+    if (!conn_delta || conn_changed(d))
+        format_conn(file, d);
+}
+
+/* 不支持批量读取的内核上逐个遍历 */
+static unsigned int dump_conns_slow(int map_fd, FILE *file) {
     struct sock *sk = NULL;
+    unsigned int n = 0;
 
     while (bpf_map_get_next_key(map_fd, &sk, &sk) == 0) {
-        // fprintf(stdout, "next_sk: (%p)\n", sk);
         struct conn_t d = {};
         int err = bpf_map_lookup_elem(map_fd, &sk, &d);
         if (err) {
             fprintf(stderr, "Failed to read value from the conns map: (%s)\n",
                     strerror(errno));
-            return 0;
-        }
-        char s_str[INET_ADDRSTRLEN];
-        char d_str[INET_ADDRSTRLEN];
-
-        char s_str_v6[INET6_ADDRSTRLEN];
-        char d_str_v6[INET6_ADDRSTRLEN];
-
-        char s_ip_port_str[INET6_ADDRSTRLEN + 6];
-        char d_ip_port_str[INET6_ADDRSTRLEN + 6];
-
-        if (d.family == AF_INET) {
-            sprintf(s_ip_port_str, "%s:%d",
-                    inet_ntop(AF_INET, &d.saddr, s_str, sizeof(s_str)),
-                    d.sport);
-            sprintf(d_ip_port_str, "%s:%d",
-                    inet_ntop(AF_INET, &d.daddr, d_str, sizeof(d_str)),
-                    d.dport);
-        } else { // AF_INET6
-            sprintf(
-                s_ip_port_str, "%s:%d",
-                inet_ntop(AF_INET6, &d.saddr_v6, s_str_v6, sizeof(s_str_v6)),
-                d.sport);
-            sprintf(
-                d_ip_port_str, "%s:%d",
-                inet_ntop(AF_INET6, &d.daddr_v6, d_str_v6, sizeof(d_str_v6)),
-                d.dport);
-        }
-        char received_bytes[11], acked_bytes[11];
-        bytes_to_str(received_bytes, d.bytes_received);
-        bytes_to_str(acked_bytes, d.bytes_acked);
-        fprintf(file,
-                "connection{pid=\"%d\",sock=\"%p\",src=\"%s\",dst=\"%s\","
-                "is_server=\"%d\"",
-                d.pid, d.sock, s_ip_port_str, d_ip_port_str, d.is_server);
-        if (extra_conn_info) {
-            fprintf(file,
-                    ",backlog=\"%u\""
-                    ",maxbacklog=\"%u\""
-                    ",rwnd=\"%u\""
-                    ",cwnd=\"%u\""
-                    ",ssthresh=\"%u\""
-                    ",sndbuf=\"%u\""
-                    ",wmem_queued=\"%u\""
-                    ",rx_bytes=\"%s\""
-                    ",tx_bytes=\"%s\""
-                    ",srtt=\"%u\""
-                    ",duration=\"%llu\""
-                    ",total_retrans=\"%u\"",
-                    d.tcp_backlog, d.max_tcp_backlog, d.rcv_wnd, d.snd_cwnd,
-                    d.snd_ssthresh, d.sndbuf, d.sk_wmem_queued, received_bytes,
-                    acked_bytes, d.srtt, d.duration, d.total_retrans);
-        } else {
-            fprintf(file,
-                    ",backlog=\"-\",maxbacklog=\"-\",cwnd=\"-\",ssthresh=\"-\","
-                    "sndbuf=\"-\",wmem_queued=\"-\",rx_bytes=\"-\",tx_bytes=\"-"
-                    "\",srtt=\"-\",duration=\"-\",total_retrans=\"-\"");
+            break;
         }
-        if (retrans_info) {
-            fprintf(file, ",fast_retrans=\"%u\",timeout_retrans=\"%u\"",
-                    d.fastRe, d.timeout);
-        } else {
-            fprintf(file, ",fast_retrans=\"-\",timeout_retrans=\"-\"");
+        visit_conn(file, &d);
+        n++;
+    }
+    return n;
+}
+
+#define CONN_BATCH 4096
+
+/* 按 CONN_BATCH 分批读取 conns_info，用户态内存与连接表容量无关 */
+static unsigned int dump_conns(int map_fd, FILE *file) {
+    static struct sock *keys[CONN_BATCH];
+    static struct conn_t vals[CONN_BATCH];
+    unsigned long long out_batch;
+    void *in = NULL;
+    unsigned int n = 0;
+    __u32 count;
+    int err;
+
+    for (;;) {
+        count = CONN_BATCH;
+        err = bpf_map_lookup_batch(map_fd, in, &out_batch, keys, vals, &count, NULL);
+        if (err && err != -ENOENT) {
+            if (!in && (err == -EINVAL || err == -ENOTSUP || err == -EOPNOTSUPP))
+                return dump_conns_slow(map_fd, file);
+            fprintf(stderr, "Failed to read the conns map: (%s)\n", strerror(-err));
+            break;
         }
-        fprintf(file, "} 0\n");
+        for (__u32 i = 0; i < count; i++)
+            visit_conn(file, &vals[i]);
+        n += count;
+        if (err)
+            break;
+        in = &out_batch;
+    }
+    return n;
+}
+
+static int print_conns(struct net_watcher_bpf *skel) {
+    struct timespec start, end;
+    char *buf = NULL;
+    size_t len = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    /* 先在内存中生成整个快照（或增量），再一次性写入 connects.log */
+    FILE *file = open_memstream(&buf, &len);
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open connects.log: (%s)\n", strerror(errno));
+        return 0;
     }
+
+    conn_gen++;
+    conns_live = dump_conns(bpf_map__fd(skel->maps.conns_info), file);
+    if (conn_delta)
+        conn_reap(file);
     fclose(file);
+
+    if (conn_delta) {
+        log_write(&conns_log, buf, len);
+        free(buf);
+    } else if (len != conns_prev_len || memcmp(buf, conns_prev, len)) {
+        if (pwrite(conns_fd, buf, len, 0) < 0 || ftruncate(conns_fd, len) < 0)
+            fprintf(stderr, "Failed to write connects.log: (%s)\n", strerror(errno));
+        free(conns_prev);
+        conns_prev = buf;
+        conns_prev_len = len;
+    } else {
+        free(buf);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    conns_dump_us = (end.tv_sec - start.tv_sec) * 1000000ULL +
+                    (end.tv_nsec - start.tv_nsec) / 1000;
     return 0;
 }
 
+static void get_http_data(char *http_data, const struct pack_t *pack_info) {
+    if (strstr((char *)pack_info->data, "HTTP/1")) {
+
+        for (int i = 0; i < sizeof(pack_info->data); ++i) {
+            if (pack_info->data[i] == '\r') {
+                http_data[i] = '\0';
+                break;
+            }
+            http_data[i] = pack_info->data[i];
+        }
+    } else {
+
+        sprintf(http_data, "-");
+    }
+}
+
+static int format_packet(char *line, size_t size, const struct pack_t *pack_info,
+                         const char *http_data) {
+    int len;
+
+    if (layer_time) {
+        len = snprintf(
+            line, size,
+            "packet{sock=\"%p\",seq=\"%u\",ack=\"%u\","
+            "mac_time=\"%llu\",ip_time=\"%llu\",tran_time=\"%llu\",http_"
+            "info=\"%s\",rx=\"%d\"} \n",
+            pack_info->sock, pack_info->seq, pack_info->ack,
+            pack_info->mac_time, pack_info->ip_time, pack_info->tran_time,
+            http_data, pack_info->rx);
+    } else {
+        len = snprintf(line, size,
+                       "packet{sock=\"%p\",seq=\"%u\",ack=\"%u\","
+                       "mac_time=\"%d\",ip_time=\"%d\",tran_time=\"%d\",http_"
+                       "info=\"%s\",rx=\"%d\"} \n",
+                       pack_info->sock, pack_info->seq, pack_info->ack, 0, 0, 0,
+                       http_data, pack_info->rx);
+    }
+    return len < size ? len : size - 1;
+}
+
 static int print_packet(void *ctx, void *packet_info, size_t size) {
     if (udp_info || net_filter)
         return 0;
     const struct pack_t *pack_info = packet_info;
     if (pack_info->err) {
-        FILE *file = fopen(err_file_path, "a");
         char reason[20];
         if (pack_info->err == 1) {
             printf("[X] invalid SEQ: sock = %p,seq= %u,ack = %u\n",
@@ -223,64 +598,33 @@ static int print_packet(void *ctx, void *packet_info, size_t size) {
             printf("UNEXPECTED packet error %d.\n", pack_info->err);
             sprintf(reason, "Unkonwn");
         }
-        fprintf(file,
-                "error{sock=\"%p\",seq=\"%u\",ack=\"%u\","
-                "reason=\"%s\"} \n",
-                pack_info->sock, pack_info->seq, pack_info->ack, reason);
-        fclose(file);
+        log_printf(&err_log,
+                   "error{sock=\"%p\",seq=\"%u\",ack=\"%u\","
+                   "reason=\"%s\"} \n",
+                   pack_info->sock, pack_info->seq, pack_info->ack, reason);
     } else {
-        FILE *file = fopen(packets_file_path, "a");
-        char http_data[256];
+        char http_data[256], line[512];
+        int len;
 
-        if (strstr((char *)pack_info->data, "HTTP/1")) {
-
-            for (int i = 0; i < sizeof(pack_info->data); ++i) {
-                if (pack_info->data[i] == '\r') {
-                    http_data[i] = '\0';
-                    break;
-                }
-                http_data[i] = pack_info->data[i];
-            }
-        } else {
-
-            sprintf(http_data, "-");
-        }
+        get_http_data(http_data, pack_info);
         if (layer_time) {
             printf("%-22p %-10u %-10u %-10llu %-10llu %-10llu %-5d %s\n",
                    pack_info->sock, pack_info->seq, pack_info->ack,
                    pack_info->mac_time, pack_info->ip_time,
                    pack_info->tran_time, pack_info->rx, http_data);
-            fprintf(
-                file,
-                "packet{sock=\"%p\",seq=\"%u\",ack=\"%u\","
-                "mac_time=\"%llu\",ip_time=\"%llu\",tran_time=\"%llu\",http_"
-                "info=\"%s\",rx=\"%d\"} \n",
-                pack_info->sock, pack_info->seq, pack_info->ack,
-                pack_info->mac_time, pack_info->ip_time, pack_info->tran_time,
-                http_data, pack_info->rx);
         } else {
             printf("%-22p %-10u %-10u %-10d %-10d %-10d %-5d %s\n",
                    pack_info->sock, pack_info->seq, pack_info->ack, 0, 0, 0,
                    pack_info->rx, http_data);
-            fprintf(file,
-                    "packet{sock=\"%p\",seq=\"%u\",ack=\"%u\","
-                    "mac_time=\"%d\",ip_time=\"%d\",tran_time=\"%d\",http_"
-                    "info=\"%s\",rx=\"%d\"} \n",
-                    pack_info->sock, pack_info->seq, pack_info->ack, 0, 0, 0,
-                    http_data, pack_info->rx);
         }
-        fclose(file);
+        len = format_packet(line, sizeof(line), pack_info, http_data);
+        log_write(&packets_log, line, len);
     }
     return 0;
 }
 static int print_udp(void *ctx, void *packet_info, size_t size) {
     if (!udp_info)
         return 0;
-    FILE *file = fopen(udp_file_path, "a+");//追加
-     if (file == NULL) {
-        fprintf(stderr, "Failed to open udp.log: (%s)\n", strerror(errno));
-        return 0;
-    }
     char d_str[INET_ADDRSTRLEN];
     char s_str[INET_ADDRSTRLEN];
     const struct udp_message *pack_info = packet_info;
@@ -292,17 +636,14 @@ static int print_udp(void *ctx, void *packet_info, size_t size) {
            inet_ntop(AF_INET, &saddr, s_str, sizeof(s_str)),
            inet_ntop(AF_INET, &daddr, d_str, sizeof(d_str)), pack_info->sport,
            pack_info->dport, pack_info->tran_time,pack_info->rx,pack_info->len);
-    fprintf(
-            file,
+    log_printf(
+            &udp_log,
             "packet{saddr=\"%s\",daddr=\"%s\",sport=\"%u\","
             "dport=\"%u\",udp_time=\"%llu\",rx=\"%d\",len=\"%d\"} \n",
             inet_ntop(AF_INET, &saddr, s_str, sizeof(s_str)),
             inet_ntop(AF_INET, &daddr, d_str, sizeof(d_str)), pack_info->sport,
             pack_info->dport, pack_info->tran_time,pack_info->rx,pack_info->len);
-    //fseek(file, 0, SEEK_END); //指针移动到文件头部
     }
-    
-    fclose(file);
     return 0;
 }
 static int print_netfilter(void *ctx, void *packet_info, size_t size) {
@@ -324,6 +665,467 @@ static int print_netfilter(void *ctx, void *packet_info, size_t size) {
     return 0;
 }
 
+/* 输出每个 ring buffer 的累计事件数、丢弃数和最大积压，积压接近容量说明消费跟不上 */
+static void print_rb_stats(struct net_watcher_bpf *skel) {
+    static const char *names[RB_NR] = {"rb", "udp_rb", "netfilter_rb"};
+    struct bpf_map *maps[RB_NR] = {skel->maps.rb, skel->maps.udp_rb,
+                                   skel->maps.netfilter_rb};
+    int ncpu = libbpf_num_possible_cpus();
+    struct rb_stat *values;
+
+    if (ncpu <= 0)
+        return;
+    values = calloc(ncpu, sizeof(*values));
+    if (!values)
+        return;
+
+    for (unsigned int i = 0; i < RB_NR; i++) {
+        struct rb_stat total = {};
+        unsigned int size = bpf_map__max_entries(maps[i]);
+
+        if (bpf_map_lookup_elem(bpf_map__fd(skel->maps.rb_stats), &i, values))
+            continue;
+        for (int cpu = 0; cpu < ncpu; cpu++) {
+            total.events += values[cpu].events;
+            total.drops += values[cpu].drops;
+            if (values[cpu].max_backlog > total.max_backlog)
+                total.max_backlog = values[cpu].max_backlog;
+        }
+        fprintf(stderr,
+                "%-12s events %-10llu drops %-10llu max backlog %llu/%u bytes "
+                "(%.1f%%)\n",
+                names[i], total.events, total.drops, total.max_backlog, size,
+                size ? total.max_backlog * 100.0 / size : 0);
+    }
+    free(values);
+}
+
+#define LAYER_TOP_CONNS 20
+
+static const char *layer_names[LAYER_NR] = {
+    "rx mac->ip", "rx ip->tcp", "rx tcp->app", "rx total",
+    "tx tcp->ip", "tx ip->mac", "tx mac->xmit", "tx total",
+};
+
+struct layer_conn {
+    struct layer_key key;
+    struct layer_hist hist;
+};
+
+static int cmp_layer_conn(const void *a, const void *b) {
+    const struct layer_conn *x = a, *y = b;
+    unsigned long long nx = x->hist.count[LAYER_RX_TOTAL] + x->hist.count[LAYER_TX_TOTAL];
+    unsigned long long ny = y->hist.count[LAYER_RX_TOTAL] + y->hist.count[LAYER_TX_TOTAL];
+
+    return nx < ny ? 1 : nx > ny ? -1 : 0;
+}
+
+/* 由 log2 直方图估算分位数，返回所在桶的上界（us） */
+static unsigned long long layer_percentile(const struct layer_hist *h, int layer,
+                                           double p) {
+    unsigned long long target = h->count[layer] * p, seen = 0;
+
+    for (int i = 0; i < LAYER_MAX_SLOTS; i++) {
+        seen += h->slots[layer][i];
+        if (seen > target)
+            return (1ULL << (i + 1)) - 1;
+    }
+    return (1ULL << LAYER_MAX_SLOTS) - 1;
+}
+
+static double layer_avg(const struct layer_hist *h, int layer) {
+    return h->count[layer] ? (double)h->sum[layer] / h->count[layer] : 0;
+}
+
+static void print_layer_log2(const struct layer_hist *h, int layer) {
+    unsigned int max = 0;
+    int last = -1;
+
+    for (int i = 0; i < LAYER_MAX_SLOTS; i++) {
+        if (h->slots[layer][i]) {
+            last = i;
+            if (h->slots[layer][i] > max)
+                max = h->slots[layer][i];
+        }
+    }
+    if (last < 0)
+        return;
+    printf("%s (us): count %llu avg %.1f p50 %llu p99 %llu\n", layer_names[layer],
+           h->count[layer], layer_avg(h, layer), layer_percentile(h, layer, 0.5),
+           layer_percentile(h, layer, 0.99));
+    for (int i = 0; i <= last; i++) {
+        int width = (unsigned long long)h->slots[layer][i] * 40 / max;
+
+        printf("%10llu -> %-10llu : %-10u |%-40.*s|\n", i ? 1ULL << i : 0,
+               (1ULL << (i + 1)) - 1, h->slots[layer][i], width,
+               "****************************************");
+    }
+}
+
+/* 按流量降序插入前 LAYER_TOP_CONNS 个连接 */
+static void layer_top_insert(struct layer_conn *top, unsigned int *nr_top,
+                             const struct layer_conn *c) {
+    unsigned int i = *nr_top;
+
+    if (i == LAYER_TOP_CONNS) {
+        if (cmp_layer_conn(c, &top[i - 1]) >= 0)
+            return;
+        i--;
+    } else {
+        (*nr_top)++;
+    }
+    for (; i > 0 && cmp_layer_conn(c, &top[i - 1]) < 0; i--)
+        top[i] = top[i - 1];
+    top[i] = *c;
+}
+
+/* 读取并清空内核中按连接聚合的各层时延，输出流量最大的连接和全局分布；
+ * 按 CONN_BATCH 分批读取，用户态只保留一批 key 和前 LAYER_TOP_CONNS 个连接 */
+static void print_layer_hists(struct net_watcher_bpf *skel) {
+    static struct layer_key keys[CONN_BATCH];
+    static struct layer_conn top[LAYER_TOP_CONNS];
+    int fd = bpf_map__fd(skel->maps.layer_hists);
+    unsigned int max = bpf_map__max_entries(skel->maps.layer_hists);
+    struct layer_conn cur;
+    struct layer_hist total = {};
+    struct layer_key next;
+    char s_str[INET6_ADDRSTRLEN], d_str[INET6_ADDRSTRLEN];
+    unsigned int n = 0, nr, nr_top = 0;
+    bool more;
+
+    more = !bpf_map_get_next_key(fd, NULL, &next);
+    while (more && n < max) {
+        keys[0] = next;
+        nr = 1;
+        while (nr < CONN_BATCH && !bpf_map_get_next_key(fd, &keys[nr - 1], &keys[nr]))
+            nr++;
+        // 删除本批之前先取得下一批的起点，避免边遍历边删除导致遍历重新开始
+        more = nr == CONN_BATCH && !bpf_map_get_next_key(fd, &keys[nr - 1], &next);
+        for (unsigned int i = 0; i < nr; i++) {
+            if (bpf_map_lookup_elem(fd, &keys[i], &cur.hist))
+                continue;
+            bpf_map_delete_elem(fd, &keys[i]);
+            cur.key = keys[i];
+            n++;
+            for (int l = 0; l < LAYER_NR; l++) {
+                total.count[l] += cur.hist.count[l];
+                total.sum[l] += cur.hist.sum[l];
+                for (int j = 0; j < LAYER_MAX_SLOTS; j++)
+                    total.slots[l][j] += cur.hist.slots[l][j];
+            }
+            layer_top_insert(top, &nr_top, &cur);
+        }
+    }
+
+    time_t now = time(NULL);
+    printf("\n%.24s  %u connections\n", ctime(&now), n);
+    printf("%-40s %-40s %8s %8s %8s %8s %8s %8s %8s %8s %8s %8s\n", "SADDR:SPORT",
+           "DADDR:DPORT", "RX", "MAC->IP", "IP->TCP", "TCP->APP", "RX_P99", "TX",
+           "TCP->IP", "IP->MAC", "MAC->DEV", "TX_P99");
+    for (unsigned int i = 0; i < nr_top; i++) {
+        const struct layer_key *k = &top[i].key;
+        const struct layer_hist *h = &top[i].hist;
+        char src[64], dst[64];
+
+        if (k->family == AF_INET) {
+            inet_ntop(AF_INET, &k->saddr, s_str, sizeof(s_str));
+            inet_ntop(AF_INET, &k->daddr, d_str, sizeof(d_str));
+        } else {
+            inet_ntop(AF_INET6, &k->saddr_v6, s_str, sizeof(s_str));
+            inet_ntop(AF_INET6, &k->daddr_v6, d_str, sizeof(d_str));
+        }
+        snprintf(src, sizeof(src), "%s:%u", s_str, k->sport);
+        snprintf(dst, sizeof(dst), "%s:%u", d_str, k->dport);
+        printf("%-40s %-40s %8llu %8.1f %8.1f %8.1f %8llu %8llu %8.1f %8.1f %8.1f "
+               "%8llu\n",
+               src, dst, h->count[LAYER_RX_TOTAL], layer_avg(h, LAYER_RX_MAC_IP),
+               layer_avg(h, LAYER_RX_IP_TCP), layer_avg(h, LAYER_RX_TCP_APP),
+               layer_percentile(h, LAYER_RX_TOTAL, 0.99), h->count[LAYER_TX_TOTAL],
+               layer_avg(h, LAYER_TX_TCP_IP), layer_avg(h, LAYER_TX_IP_MAC),
+               layer_avg(h, LAYER_TX_MAC_XMIT),
+               layer_percentile(h, LAYER_TX_TOTAL, 0.99));
+    }
+    for (int l = 0; l < LAYER_NR; l++)
+        print_layer_log2(&total, l);
+    fflush(stdout);
+}
+
+static const char *http_method_names[HTTP_METHOD_NR] = {
+    "-", "GET", "POST", "PUT", "DELETE", "HEAD", "PATCH", "OPTIONS",
+};
+
+struct http_entry {
+    struct http_key key;
+    struct http_stat stat;
+};
+
+static int cmp_http_entry(const void *a, const void *b) {
+    const struct http_entry *x = a, *y = b;
+
+    return x->stat.count < y->stat.count ? 1 : x->stat.count > y->stat.count ? -1 : 0;
+}
+
+static unsigned long long http_percentile(const struct http_stat *stat, double p) {
+    unsigned long long target = stat->count * p, seen = 0;
+
+    for (int i = 0; i < HTTP_MAX_SLOTS; i++) {
+        seen += stat->slots[i];
+        if (seen > target)
+            return (1ULL << (i + 1)) - 1;
+    }
+    return (1ULL << HTTP_MAX_SLOTS) - 1;
+}
+
+/* 读取并清空按 (method, path, status) 聚合的 HTTP 时延，路径由内核抽样的路径表还原 */
+static void print_http_stats(struct net_watcher_bpf *skel) {
+    int fd = bpf_map__fd(skel->maps.http_stats_map);
+    int paths_fd = bpf_map__fd(skel->maps.http_paths);
+    struct http_entry *entries;
+    struct http_key key, next;
+    void *prev = NULL;
+    unsigned int n = 0;
+
+    entries = calloc(HTTP_MAX_ENTRIES, sizeof(*entries));
+    if (!entries)
+        return;
+    while (n < HTTP_MAX_ENTRIES && !bpf_map_get_next_key(fd, prev, &next)) {
+        entries[n++].key = next;
+        key = next;
+        prev = &key;
+    }
+    for (unsigned int i = 0; i < n; i++) {
+        if (bpf_map_lookup_elem(fd, &entries[i].key, &entries[i].stat))
+            continue;
+        bpf_map_delete_elem(fd, &entries[i].key);
+    }
+    qsort(entries, n, sizeof(*entries), cmp_http_entry);
+
+    time_t now = time(NULL);
+    printf("\n%.24s  %u http request groups\n", ctime(&now), n);
+    printf("%-8s %-34s %-6s %10s %10s %10s %10s\n", "METHOD", "PATH", "STATUS",
+           "COUNT", "AVG(us)", "P99(us)", "MAX(us)");
+    for (unsigned int i = 0; i < n; i++) {
+        const struct http_key *k = &entries[i].key;
+        const struct http_stat *st = &entries[i].stat;
+        char path[HTTP_PATH_LEN + 1] = {};
+
+        if (!st->count)
+            continue;
+        if (bpf_map_lookup_elem(paths_fd, &k->path_hash, path))
+            snprintf(path, sizeof(path), "#%08x", k->path_hash);
+        printf("%-8s %-34s %-6u %10llu %10.1f %10llu %10llu\n",
+               k->method < HTTP_METHOD_NR ? http_method_names[k->method] : "-",
+               path, k->status, st->count, (double)st->sum_us / st->count,
+               http_percentile(st, 0.99), st->max_us);
+    }
+    fflush(stdout);
+    free(entries);
+}
+
+/* 由写入/关闭计数和当前条目数推算被 LRU 淘汰的连接数，淘汰数持续增长说明 -C 设置过小 */
+static void print_conn_stats(struct net_watcher_bpf *skel) {
+    int ncpu = libbpf_num_possible_cpus();
+    struct conn_stat total = {}, *values;
+    unsigned long long evicted;
+    __u32 zero = 0;
+
+    if (ncpu <= 0)
+        return;
+    values = calloc(ncpu, sizeof(*values));
+    if (!values)
+        return;
+    if (!bpf_map_lookup_elem(bpf_map__fd(skel->maps.conn_stats), &zero, values)) {
+        for (int cpu = 0; cpu < ncpu; cpu++) {
+            total.inserts += values[cpu].inserts;
+            total.closes += values[cpu].closes;
+            total.update_fails += values[cpu].update_fails;
+        }
+    }
+    evicted = total.inserts > total.closes + conns_live
+                  ? total.inserts - total.closes - conns_live
+                  : 0;
+    fprintf(stderr,
+            "%-12s live %u/%u inserts %llu closes %llu evicted %llu update_fails "
+            "%llu dump %.1f ms\n",
+            "conns_info", conns_live, max_conns, total.inserts, total.closes,
+            evicted, total.update_fails, conns_dump_us / 1000.0);
+    free(values);
+}
+
+static double elapsed_since(const struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec - start->tv_sec + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* 回放合成的 packet 事件，比较每个事件 fopen/fclose 与 log_writer 的吞吐量 */
+static int run_bench(long n) {
+    struct pack_t pack = {.sock = (void *)0xffff888012345678, .rx = 1};
+    struct log_writer w = {};
+    struct timespec start;
+    char path[1040], line[512], http_data[256];
+    double legacy, buffered;
+    int len;
+
+    snprintf(path, sizeof(path), "%s.bench", packets_file_path);
+    strcpy((char *)pack.data, "GET /index.html HTTP/1.1\r\nHost: localhost\r\n");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < n; i++) {
+        pack.seq = i;
+        pack.ack = i + 1;
+        get_http_data(http_data, &pack);
+        len = format_packet(line, sizeof(line), &pack, http_data);
+        FILE *file = fopen(path, "a");
+        if (file == NULL) {
+            fprintf(stderr, "Failed to open %s: (%s)\n", path, strerror(errno));
+            return 1;
+        }
+        fwrite(line, 1, len, file);
+        fclose(file);
+    }
+    legacy = elapsed_since(&start);
+    unlink(path);
+
+    if (log_open(&w, path))
+        return 1;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < n; i++) {
+        pack.seq = i;
+        pack.ack = i + 1;
+        get_http_data(http_data, &pack);
+        len = format_packet(line, sizeof(line), &pack, http_data);
+        log_write(&w, line, len);
+    }
+    log_flush(&w);
+    buffered = elapsed_since(&start);
+    log_close(&w);
+
+    unlink(path);
+    for (int i = 1; i <= log_keep; i++) {
+        snprintf(line, sizeof(line), "%s.%d", path, i);
+        unlink(line);
+    }
+
+    printf("%ld events\n", n);
+    printf("fopen/fclose per event: %12.0f events/s\n", n / legacy);
+    printf("buffered log writer:    %12.0f events/s (%.1fx)\n", n / buffered,
+           legacy / buffered);
+    return 0;
+}
+
+/* 建立 n 条回环 TCP 连接（客户端和服务端共 2n 个 socket），测量连接表的遍历耗时 */
+static int run_conn_bench(struct net_watcher_bpf *skel, long n) {
+    struct sockaddr_in addr = {.sin_family = AF_INET,
+                               .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t addrlen = sizeof(addr);
+    struct rlimit rl = {.rlim_cur = 2 * n + 64, .rlim_max = 2 * n + 64};
+    int *fds, lfd, err = 0;
+    long opened = 0;
+
+    if (setrlimit(RLIMIT_NOFILE, &rl))
+        fprintf(stderr, "Failed to raise RLIMIT_NOFILE: (%s)\n", strerror(errno));
+    fds = calloc(2 * n, sizeof(*fds));
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (!fds || lfd < 0 || bind(lfd, (struct sockaddr *)&addr, addrlen) ||
+        listen(lfd, SOMAXCONN) ||
+        getsockname(lfd, (struct sockaddr *)&addr, &addrlen)) {
+        fprintf(stderr, "Failed to set up listener: (%s)\n", strerror(errno));
+        err = -errno;
+        goto out;
+    }
+    for (; opened < n; opened++) {
+        int cfd = socket(AF_INET, SOCK_STREAM, 0);
+
+        if (cfd < 0 || connect(cfd, (struct sockaddr *)&addr, sizeof(addr))) {
+            fprintf(stderr, "Stopped after %ld connections: (%s)\n", opened,
+                    strerror(errno));
+            if (cfd >= 0)
+                close(cfd);
+            break;
+        }
+        fds[2 * opened] = cfd;
+        fds[2 * opened + 1] = accept(lfd, NULL, NULL);
+    }
+
+    // 第一次遍历输出全部连接，之后连接不变，增量模式下只剩遍历本身的开销
+    for (int round = 0; round < 3; round++) {
+        print_conns(skel);
+        printf("dump %d: %u connections in %.1f ms\n", round, conns_live,
+               conns_dump_us / 1000.0);
+    }
+    print_conn_stats(skel);
+
+out:
+    if (fds) {
+        for (long i = 0; i < 2 * opened; i++)
+            if (fds[i] > 0)
+                close(fds[i]);
+    }
+    if (lfd >= 0)
+        close(lfd);
+    free(fds);
+    return err;
+}
+
+static int http_bench_server(int lfd) {
+    static const char resp[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+    char buf[1024];
+    int fd = accept(lfd, NULL, NULL);
+
+    if (fd < 0)
+        return 1;
+    while (read(fd, buf, sizeof(buf)) > 0) {
+        if (write(fd, resp, sizeof(resp) - 1) < 0)
+            break;
+    }
+    close(fd);
+    return 0;
+}
+
+/* 在子进程中用一条长连接发起 n 个请求，比较 -i 与 -I 时的吞吐即可看出逐包复制负载的开销 */
+static int http_bench_client(long n) {
+    static const char req[] = "GET /api/items/42?verbose=1 HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    struct sockaddr_in addr = {.sin_family = AF_INET,
+                               .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t addrlen = sizeof(addr);
+    struct timespec start;
+    char buf[1024];
+    double elapsed;
+    int lfd, fd;
+    pid_t server;
+
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, addrlen) || listen(lfd, 1) ||
+        getsockname(lfd, (struct sockaddr *)&addr, &addrlen)) {
+        fprintf(stderr, "Failed to set up listener: (%s)\n", strerror(errno));
+        return 1;
+    }
+    server = fork();
+    if (server == 0)
+        _exit(http_bench_server(lfd));
+    close(lfd);
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        fprintf(stderr, "Failed to connect: (%s)\n", strerror(errno));
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < n; i++) {
+        if (write(fd, req, sizeof(req) - 1) < 0 || read(fd, buf, sizeof(buf)) <= 0) {
+            fprintf(stderr, "Request %ld failed: (%s)\n", i, strerror(errno));
+            break;
+        }
+    }
+    elapsed = elapsed_since(&start);
+    close(fd);
+    waitpid(server, NULL, 0);
+    printf("%ld http requests in %.2fs, %.0f requests/s\n", n, elapsed, n / elapsed);
+    return 0;
+}
+
 int main(int argc, char **argv) {
     char *last_slash = strrchr(argv[0], '/');
     if (last_slash) {
@@ -338,8 +1140,10 @@ int main(int argc, char **argv) {
     strcat(packets_file_path, "data/packets.log");
     strcat(udp_file_path,"data/udp.log");
     struct ring_buffer *rb = NULL;
-    struct ring_buffer *udp_rb = NULL;
-    struct ring_buffer *netfilter_rb = NULL;
+    struct itimerspec its = {};
+    struct epoll_event ev = {};
+    int timer_fd = -1, epoll_fd = -1;
+    unsigned long ticks = 0;
     struct net_watcher_bpf *skel;
     int err;
     /* Parse command line arguments */
@@ -349,6 +1153,9 @@ int main(int argc, char **argv) {
             return err;
     }
 
+    if (bench_events > 0)
+        return run_bench(bench_events);
+
     /* Cleaner handling of Ctrl-C */
     signal(SIGINT, sig_handler);
     signal(SIGTERM, sig_handler);
@@ -366,12 +1173,34 @@ int main(int argc, char **argv) {
     skel->rodata->all_conn = all_conn;
     skel->rodata->err_packet = err_packet;
     skel->rodata->extra_conn_info = extra_conn_info;
+    // 直方图模式同样依赖各层打点，打点只在 layer_time 打开时进行
+    if (hist_interval > 0)
+        layer_time = 1;
     skel->rodata->layer_time = layer_time;
+    skel->rodata->hist_mode = hist_interval > 0;
+    skel->rodata->http_stats = http_interval > 0;
+    skel->rodata->packet_sample = packet_sample;
     skel->rodata->http_info = http_info;
     skel->rodata->retrans_info = retrans_info;
     skel->rodata->udp_info = udp_info;
     skel->rodata->net_filter = net_filter;
 
+    if (bpf_map__set_max_entries(skel->maps.conns_info, max_conns) ||
+        bpf_map__set_max_entries(skel->maps.sock_stores, max_conns) ||
+        bpf_map__set_max_entries(skel->maps.layer_hists, hist_interval > 0 ? hist_conns : 1) ||
+        bpf_map__set_max_entries(skel->maps.http_reqs, http_interval > 0 ? max_conns : 1)) {
+        err = -1;
+        fprintf(stderr, "Failed to set connection table size\n");
+        goto cleanup;
+    }
+
+    // 不做 HTTP 统计时不挂载对应探针，避免每次 tcp_sendmsg/tcp_recvmsg 的空跑开销
+    if (http_interval <= 0) {
+        bpf_program__set_autoload(skel->progs.tcp_sendmsg_http, false);
+        bpf_program__set_autoload(skel->progs.tcp_recvmsg, false);
+        bpf_program__set_autoload(skel->progs.tcp_recvmsg_exit, false);
+    }
+
     err = net_watcher_bpf__load(skel);
     if (err) {
         fprintf(stderr, "Failed to load and verify BPF skeleton\n");
@@ -396,63 +1225,140 @@ int main(int argc, char **argv) {
           printf("%-22s %-10s %-10s %-10s %-10s %-10s %-5s %s\n", "SOCK", "SEQ",
                "ACK", "MAC_TIME", "IP_TIME", "TRAN_TIME", "RX", "HTTP");
     }
-    udp_rb =ring_buffer__new(bpf_map__fd(skel->maps.udp_rb), print_udp, NULL, NULL);
-    if (!udp_rb) {
+    /* 所有 ring buffer 由同一个 ring_buffer 管理器消费，数据到达即处理 */
+    rb = ring_buffer__new(bpf_map__fd(skel->maps.rb), print_packet, NULL, NULL);
+    if (!rb) {
         err = -1;
         fprintf(stderr, "Failed to create ring buffer\n");
         goto cleanup;
     }
-    netfilter_rb =ring_buffer__new(bpf_map__fd(skel->maps.netfilter_rb), print_netfilter, NULL, NULL);
-    if (!netfilter_rb) {
-        err = -1;
-        fprintf(stderr, "Failed to create ring buffer\n");
+    if ((err = ring_buffer__add(rb, bpf_map__fd(skel->maps.udp_rb), print_udp, NULL)) ||
+        (err = ring_buffer__add(rb, bpf_map__fd(skel->maps.netfilter_rb), print_netfilter, NULL))) {
+        fprintf(stderr, "Failed to add ring buffer: %d\n", err);
         goto cleanup;
     }
-    /* Set up ring buffer polling */
-    rb = ring_buffer__new(bpf_map__fd(skel->maps.rb), print_packet, NULL, NULL);
-    if (!rb) {
-        err = -1;
-        fprintf(stderr, "Failed to create ring buffer\n");
+
+    /* 连接表刷新和日志 flush 由独立的 1 秒定时器驱动 */
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (timer_fd < 0 || epoll_fd < 0) {
+        err = -errno;
+        fprintf(stderr, "Failed to create timer: (%s)\n", strerror(errno));
         goto cleanup;
     }
-    FILE *err_file = fopen(err_file_path, "w+");
-    if (err_file == NULL) {
-        fprintf(stderr, "Failed to open err.log: (%s)\n", strerror(errno));
-        return 0;
+    its.it_value.tv_sec = 1;
+    its.it_interval.tv_sec = 1;
+    if (timerfd_settime(timer_fd, 0, &its, NULL)) {
+        err = -errno;
+        fprintf(stderr, "Failed to arm timer: (%s)\n", strerror(errno));
+        goto cleanup;
     }
-    fclose(err_file);
-    FILE *packet_file = fopen(packets_file_path, "w+");
-    if (packet_file == NULL) {
-        fprintf(stderr, "Failed to open packets.log: (%s)\n", strerror(errno));
-        return 0;
+    ev.events = EPOLLIN;
+    ev.data.fd = ring_buffer__epoll_fd(rb);
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev)) {
+        err = -errno;
+        fprintf(stderr, "Failed to add ring buffer to epoll: (%s)\n", strerror(errno));
+        goto cleanup;
     }
-    fclose(packet_file);
-    FILE *udp_file = fopen(udp_file_path, "w+");
-    if (udp_file == NULL) {
-        fprintf(stderr, "Failed to open udp.log: (%s)\n", strerror(errno));
-        return 0;
+    ev.data.fd = timer_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev)) {
+        err = -errno;
+        fprintf(stderr, "Failed to add timer to epoll: (%s)\n", strerror(errno));
+        goto cleanup;
+    }
+
+    if ((err = log_open(&err_log, err_file_path)) ||
+        (err = log_open(&packets_log, packets_file_path)) ||
+        (err = log_open(&udp_log, udp_file_path)))
+        goto cleanup;
+    if (conn_delta) {
+        if ((err = conn_table_init(max_conns)) ||
+            (err = log_open(&conns_log, connects_file_path)))
+            goto cleanup;
+    } else {
+        conns_fd = open(connects_file_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (conns_fd < 0) {
+            err = -errno;
+            fprintf(stderr, "Failed to open connects.log: (%s)\n", strerror(errno));
+            goto cleanup;
+        }
+    }
+
+    if (bench_conns > 0) {
+        err = run_conn_bench(skel, bench_conns);
+        goto cleanup;
+    }
+    if (bench_http > 0) {
+        fflush(stdout);
+        bench_pid = fork();
+        if (bench_pid == 0)
+            _exit(http_bench_client(bench_http));
     }
-    fclose(udp_file);
 
     /* Process events */
     while (!exiting) {
-        err = ring_buffer__poll(rb, 100 /* timeout, ms */);
-        err = ring_buffer__poll(udp_rb, 100 /* timeout, ms */);
-        err = ring_buffer__poll(netfilter_rb, 100 /* timeout, ms */);
-        print_conns(skel);
-        sleep(1);
+        struct epoll_event events[2];
+        int n = epoll_wait(epoll_fd, events, 2, -1);
+
         /* Ctrl-C will cause -EINTR */
-        if (err == -EINTR) {
-            err = 0;
+        if (n < 0) {
+            err = errno == EINTR ? 0 : -errno;
+            if (err)
+                printf("Error polling ring buffer: %d\n", err);
             break;
         }
-        if (err < 0) {
-            printf("Error polling perf buffer: %d\n", err);
-            break;
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == timer_fd) {
+                uint64_t expirations;
+
+                if (read(timer_fd, &expirations, sizeof(expirations)) < 0)
+                    continue;
+                print_conns(skel);
+                log_flush(&err_log);
+                log_flush(&packets_log);
+                log_flush(&udp_log);
+                log_flush(&conns_log);
+                ticks++;
+                if (rb_stats_interval && ticks % rb_stats_interval == 0) {
+                    print_rb_stats(skel);
+                    print_conn_stats(skel);
+                }
+                if (hist_interval > 0 && ticks % hist_interval == 0)
+                    print_layer_hists(skel);
+                if (http_interval > 0 && ticks % http_interval == 0)
+                    print_http_stats(skel);
+                if (bench_pid > 0 && waitpid(bench_pid, NULL, WNOHANG) == bench_pid)
+                    exiting = true;
+                continue;
+            }
+            err = ring_buffer__consume(rb);
+            if (err < 0) {
+                printf("Error polling ring buffer: %d\n", err);
+                goto cleanup;
+            }
+            err = 0;
         }
     }
+    if (http_interval > 0)
+        print_http_stats(skel);
+    print_rb_stats(skel);
+    print_conn_stats(skel);
 
 cleanup:
+    log_close(&err_log);
+    log_close(&conns_log);
+    log_close(&packets_log);
+    log_close(&udp_log);
+    if (conns_fd >= 0)
+        close(conns_fd);
+    if (timer_fd >= 0)
+        close(timer_fd);
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+    ring_buffer__free(rb);
+    free(conns_prev);
+    free(conn_table);
+    free(conn_spare);
     net_watcher_bpf__destroy(skel);
     return err < 0 ? -err : 0;
 }
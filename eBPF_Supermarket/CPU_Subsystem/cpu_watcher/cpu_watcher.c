@@ -18,10 +18,19 @@
 #include <argp.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <sys/resource.h>
 #include <bpf/libbpf.h>
+#include <bpf/bpf.h>
 #include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
 #include <unistd.h> 
 #include <linux/perf_event.h>
 #include <asm/unistd.h>
@@ -57,6 +66,10 @@ static struct env {
     bool PREEMPT;
     bool SCHEDULE_DELAY;
 	bool MQ_DELAY;
+	bool PERCPU;
+	int nr_modes;//开启的模式数量
+	const char *heatmap;//调度延迟热力图的输出文件
+	int slot_ms;//热力图时间槽宽度(ms)
     int freq;
 } env = {
     .time = 0,
@@ -67,6 +80,10 @@ static struct env {
     .PREEMPT = false,
     .SCHEDULE_DELAY = false,
 	.MQ_DELAY = false,
+	.PERCPU = false,
+	.nr_modes = 0,
+	.heatmap = NULL,
+	.slot_ms = 100,
     .freq = 99
 };
 
@@ -78,14 +95,20 @@ struct preempt_bpf *preempt_skel;
 struct schedule_delay_bpf *sd_skel;
 struct mq_delay_bpf *mq_skel;
 
-u64 softirq = 0;//初始化softirq;
-u64 irqtime = 0;//初始化irq;
-u64 idle = 0;//初始化idle;s
-u64 sched = 0;
+/* sar 中按CPU累计的指标 */
+enum sar_metric {
+	SAR_CSWCH,
+	SAR_IRQ,
+	SAR_SOFTIRQ,
+	SAR_IDLE,
+	SAR_KTHREAD,
+	SAR_UTHREAD,
+	SAR_TICK_USER,
+	SAR_METRIC_NR,
+};
+
+u64 sar_prev[SAR_METRIC_NR][MAX_CPU_NR];//各指标在每个CPU上的上一次累计值
 u64 proc = 0;
-unsigned long ktTime = 0;
-unsigned long utTime = 0;
-u64 tick_user = 0;//初始化sys;
 
 int sc_sum_time = 0 ;
 int sc_max_time = 0 ;
@@ -93,20 +116,22 @@ int sc_min_time = SYSCALL_MIN_TIME ;
 int sys_call_count = 0;
 
 
-int preempt_count = 0 ;
-int sum_preemptTime = 0 ;
-int preempt_start_print = 0 ;
 
 /*设置传参*/
-const char argp_program_doc[] ="cpu wacher is in use ....\n";
+const char argp_program_doc[] ="cpu wacher is in use ....\n"
+"\n"
+"Any combination of -s, -c, -S, -p, -d and -m can be enabled at the same time.\n";
 static const struct argp_option opts[] = {
 	{ "time", 't', "TIME-SEC", 0, "Max Running Time(0 for infinite)" },
 	{"libbpf_sar", 's',	0,0,"print sar_info (the data of cpu)"},
+	{"percpu", 'P',	0,0,"print sar_info of every cpu (used with -s)"},
 	{"cs_delay", 'c',	0,0,"print cs_delay (the data of cpu)"},
 	{"syscall_delay", 'S',	0,0,"print syscall_delay (the data of syscall)"},
 	{"preempt_time", 'p',	0,0,"print preempt_time (the data of preempt_schedule)"},
 	{"schedule_delay", 'd',	0,0,"print schedule_delay (the data of cpu)"},
 	{"mq_delay", 'm',	0,0,"print mq_delay"},
+	{"heatmap", 'H',	"FILE",0,"record per-cpu schedule_delay heatmap to FILE (implies -d)"},
+	{"slot", 'w',	"MS",0,"heatmap time slot width in ms (10-1000, default 100)"},
 	{ NULL, 'h', NULL, OPTION_HIDDEN, "show the full help" },
 	{0},
 };
@@ -119,21 +144,40 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
                 	break;
 		case 's':
 			env.SAR = true;
+			env.nr_modes++;
+			break;
+		case 'P':
+			env.PERCPU = true;
 			break;
 		case 'c':
 			env.CS_DELAY = true;
+			env.nr_modes++;
 			break;		
 		case 'S':
 			env.SYSCALL_DELAY = true;
+			env.nr_modes++;
 			break;			
 		case 'p':
 			env.PREEMPT = true;
+			env.nr_modes++;
 			break;
 		case 'd':
 			env.SCHEDULE_DELAY = true;
+			env.nr_modes++;
 			break;
 		case 'm':
 			env.MQ_DELAY = true;
+			env.nr_modes++;
+			break;
+		case 'H':
+			env.heatmap = arg;
+			break;
+		case 'w':
+			env.slot_ms = strtol(arg, NULL, 10);
+			if (env.slot_ms < 10 || env.slot_ms > 1000) {
+				fprintf(stderr, "Invalid heatmap slot width: %s\n", arg);
+				argp_usage(state);
+			}
 			break;
 		case 'h':
 			argp_state_help(state, stderr, ARGP_HELP_STD_HELP);
@@ -222,126 +266,106 @@ u64 find_ksym(const char* target_symbol) {
     return symbol_address;
 }
 
+/*读取每CPU数组中key对应的各CPU值*/
+static int lookup_percpu(struct bpf_map *map, int key, u64 *vals)
+{
+	int err = bpf_map_lookup_elem(bpf_map__fd(map), &key, vals);
+	if (err < 0)
+		fprintf(stderr, "failed to lookup infos of %s: %d\n", bpf_map__name(map), err);
+	return err;
+}
+
+/*输出一行sar数据，d为该CPU（或全系统）在本周期内各指标的增量*/
+static void print_sar_line(const char *cpu, u64 __proc, int runqlen, const u64 *d)
+{
+	time_t now = time(NULL);
+	struct tm *localTime = localtime(&now);
+	u64 dtaUTRaw = d[SAR_TICK_USER]/(99.0000) * 1000000000;
+	u64 dtaSysc = d[SAR_UTHREAD] > dtaUTRaw ? d[SAR_UTHREAD] - dtaUTRaw : dtaUTRaw - d[SAR_UTHREAD];
+	u64 dtaSys = d[SAR_KTHREAD] + dtaSysc;
+
+	printf("%02d:%02d:%02d ", localTime->tm_hour, localTime->tm_min, localTime->tm_sec);
+	if (env.PERCPU)
+		printf("%4s ", cpu);
+	printf("%8llu %8llu %6d %8llu %10llu  %8llu  %10llu  %8llu %8llu %8llu\n",
+			__proc,d[SAR_CSWCH],runqlen,d[SAR_IRQ]/1000,d[SAR_SOFTIRQ]/1000,d[SAR_IDLE]/1000000,
+			d[SAR_KTHREAD]/1000,dtaSysc / 1000000,dtaUTRaw/1000000,dtaSys / 1000000);
+}
+
+static void print_sar_header(void)
+{
+	printf("  time   ");
+	if (env.PERCPU)
+		printf(" CPU ");
+	printf(" proc/s  cswch/s  runqlen  irqTime/us  softirq/us  idle/ms  kthread/us  sysc/ms  utime/ms  sys/ms \n");
+}
+
 static int print_all()
 {
-	/*proc:*/
-	int key_proc = 1;
-	int err_proc, fd_proc = bpf_map__fd(sar_skel->maps.countMap);
-	u64 total_forks;
-	err_proc = bpf_map_lookup_elem(fd_proc, &key_proc, &total_forks); 
-	if (err_proc < 0) {
-		fprintf(stderr, "failed to lookup infos of total_forks: %d\n", err_proc);
+	struct bpf_map *maps[SAR_METRIC_NR] = {
+		[SAR_CSWCH] = sar_skel->maps.countMap,
+		[SAR_IRQ] = sar_skel->maps.irq_Last_time,
+		[SAR_SOFTIRQ] = sar_skel->maps.softirqLastTime,
+		[SAR_IDLE] = sar_skel->maps.idleLastTime,
+		[SAR_KTHREAD] = sar_skel->maps.kt_LastTime,
+		[SAR_UTHREAD] = sar_skel->maps.ut_LastTime,
+		[SAR_TICK_USER] = sar_skel->maps.tick_user,
+	};
+	u64 vals[MAX_CPU_NR];
+	u64 delta[MAX_CPU_NR][SAR_METRIC_NR];
+	u64 total[SAR_METRIC_NR] = {};
+	int runqlen[MAX_CPU_NR] = {};
+	int total_runqlen = 0;
+	int err, fd, cpu, m;
+	char name[8];
+
+	/*proc: 各CPU读到的fork总数取最大值*/
+	err = lookup_percpu(sar_skel->maps.countMap, 1, vals);
+	if (err < 0)
 		return -1;
-	}
+	u64 total_forks = 0;
+	for (cpu = 0; cpu < nr_cpus; cpu++)
+		if (vals[cpu] > total_forks)
+			total_forks = vals[cpu];
 	u64 __proc;
 	__proc = total_forks - proc;
 	proc = total_forks;
-	/*cswch:*/
-	int key_cswch = 0;
-	int err_cswch, fd_cswch = bpf_map__fd(sar_skel->maps.countMap);
-	u64 sched_total;
-	err_cswch = bpf_map_lookup_elem(fd_cswch, &key_cswch, &sched_total);
-	if (err_cswch < 0) {
-		fprintf(stderr, "failed to lookup infos of sched_total: %d\n", err_cswch);
-		return -1;
-	}
-	u64 __sched;
-	__sched = sched_total - sched;
-	sched = sched_total;
-
-	 /*runqlen:*/ 
-	int key_runqlen = 0;
-	int err_runqlen, fd_runqlen = bpf_map__fd(sar_skel->maps.runqlen);
-	int runqlen;
-	err_runqlen = bpf_map_lookup_elem(fd_runqlen, &key_runqlen, &runqlen);
-	if (err_runqlen < 0) {
-		fprintf(stderr, "failed to lookup infos of runqlen: %d\n", err_runqlen);
-		return -1;
-	}
-
-	/*irqtime:*/
-	int key_irqtime = 0;
-	int err_irqtime, fd_irqtime = bpf_map__fd(sar_skel->maps.irq_Last_time);
-	u64 __irqtime;
-    __irqtime = irqtime;
-	err_irqtime = bpf_map_lookup_elem(fd_irqtime, &key_irqtime, &irqtime);
-	if (err_irqtime < 0) {
-		fprintf(stderr, "failed to lookup infos of irqtime: %d\n", err_irqtime);
-		return -1;
-	}
-    u64 dtairqtime = (irqtime - __irqtime);
-
-	/*softirq:*/
-	int key_softirq = 0;
-	int err_softirq, fd_softirq = bpf_map__fd(sar_skel->maps.softirqLastTime);
-	u64 __softirq;
-    __softirq = softirq;
-	err_softirq = bpf_map_lookup_elem(fd_softirq, &key_softirq, &softirq); 
-	if (err_softirq < 0) {
-		fprintf(stderr, "failed to lookup infos of softirq: %d\n", err_softirq);
-		return -1;
-	}
-    u64 dtasoftirq = (softirq - __softirq);
 
-	/*idle*/
-	int key_idle = 0;
-	int err_idle, fd_idle = bpf_map__fd(sar_skel->maps.idleLastTime);
-	u64 __idle;
-    __idle = idle;
-	err_idle = bpf_map_lookup_elem(fd_idle, &key_idle, &idle);
-	if (err_idle < 0) {
-		fprintf(stderr, "failed to lookup infos of idle: %d\n", err_idle);
-		return -1;
-	}
-    u64 dtaidle = (idle - __idle);	
-
-	/*kthread*/
-	int key_kthread = 0;
-	int err_kthread, fd_kthread = bpf_map__fd(sar_skel->maps.kt_LastTime);
-	unsigned long  _ktTime=0; 
-	_ktTime = ktTime;
-	err_kthread = bpf_map_lookup_elem(fd_kthread, &key_kthread,&ktTime);
-	if (err_kthread < 0) {
-		fprintf(stderr, "failed to lookup infos: %d\n", err_kthread);
-		return -1;
+	/*cswch、irqtime、softirq、idle、kthread、uthread、sys: 每CPU累计值的增量*/
+	for (m = 0; m < SAR_METRIC_NR; m++) {
+		err = lookup_percpu(maps[m], 0, vals);
+		if (err < 0)
+			return -1;
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			delta[cpu][m] = vals[cpu] - sar_prev[m][cpu];
+			sar_prev[m][cpu] = vals[cpu];
+			total[m] += delta[cpu][m];
+		}
 	}
-	unsigned long dtaKT = ktTime -_ktTime;
 
-	/*Uthread*/
-	int key_uthread = 0;
-	int err_uthread, fd_uthread = bpf_map__fd(sar_skel->maps.ut_LastTime);
-	unsigned long  _utTime=0; 
-	_utTime = utTime;
-	err_uthread = bpf_map_lookup_elem(fd_uthread, &key_uthread,&utTime);
-	if (err_uthread < 0) {
-		fprintf(stderr, "failed to lookup infos: %d\n", err_uthread);
-		return -1;
-	}
-	unsigned long dtaUT = utTime -_utTime;
-
-	/*sys*/
-	int key_sys = 0,next_key;
-	int err_sys, fd_sys = bpf_map__fd(sar_skel->maps.tick_user);
-	u64 __tick_user =0 ;// 用于存储从映射中查找到的值
-	__tick_user = tick_user;
-	//tick_user = 0;
-	err_sys = bpf_map_lookup_elem(fd_sys, &key_sys, &tick_user);
-	if (err_sys < 0) {
-		fprintf(stderr, "failed to lookup infos of sys: %d\n", err_sys);
-		return -1;
+	/*runqlen: 以CPU号为键*/
+	fd = bpf_map__fd(sar_skel->maps.runqlen);
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		err = bpf_map_lookup_elem(fd, &cpu, &runqlen[cpu]);
+		if (err < 0) {
+			fprintf(stderr, "failed to lookup infos of runqlen: %d\n", err);
+			return -1;
+		}
+		total_runqlen += runqlen[cpu];
 	}
-	u64 dtaTickUser = tick_user - __tick_user;
-	u64 dtaUTRaw = dtaTickUser/(99.0000) * 1000000000; 
-	u64 dtaSysc = abs(dtaUT - dtaUTRaw);
-	u64 dtaSys = dtaKT + dtaSysc ;
 
 	if(env.enable_proc){
-		time_t now = time(NULL);
-		struct tm *localTime = localtime(&now);
-		printf("%02d:%02d:%02d %8llu %8llu %6d %8llu %10llu  %8llu  %10llu  %8llu %8lu %8lu\n",
-				localTime->tm_hour, localTime->tm_min, localTime->tm_sec,
-				__proc,__sched,runqlen,dtairqtime/1000,dtasoftirq/1000,dtaidle/1000000,
-				dtaKT/1000,dtaSysc / 1000000,dtaUTRaw/1000000,dtaSys / 1000000);
+		if (env.PERCPU) {
+			printf("\n");
+			print_sar_header();
+		}
+		print_sar_line("all", __proc, total_runqlen, total);
+		if (env.PERCPU) {
+			for (cpu = 0; cpu < nr_cpus; cpu++) {
+				snprintf(name, sizeof(name), "%d", cpu);
+				print_sar_line(name, __proc, runqlen[cpu], delta[cpu]);
+			}
+		}
 	}
 	else{
 		env.enable_proc = true;
@@ -350,112 +374,101 @@ static int print_all()
     return 0;
 }
 
-int count[25]={0};//定义一个count数组，用于汇总schedul()调度时间，以log2(时间间隔)为统计依据；
-static int handle_event(void *ctx, void *data,unsigned long data_sz)
+static void print_stars(unsigned int val, unsigned int val_max, int width)
 {
-	const struct event *e = data;
-	printf("t1:%lu  t2:%lu  delay:%lu\n",e->t1,e->t2,e->delay);
+	int num_stars, num_spaces, i;
+	bool need_plus;
 
-	int dly=(int)(e->delay),i=0;
-	while (dly > 1){
-		dly /= 2;
-		i ++;
-	}
-	count[i]++;//记录时间间隔次数;
-	return 0;
-}
-static int print_hstgram(int i,int max,int per_len)
-{
-	int cnt=count[i];
-	if(per_len==1){
-		while(cnt>0){//打印
-			printf("*");
-			cnt--;
-		}
-	}
-	while(cnt-per_len>=0){//打印
+	num_stars = (val < val_max ? val : val_max) * width / val_max;
+	num_spaces = width - num_stars;
+	need_plus = val > val_max;
+
+	for (i = 0; i < num_stars; i++)
 		printf("*");
-		cnt-=per_len;
-	}
-	printf("\n");
-	return per_len;
+	for (i = 0; i < num_spaces; i++)
+		printf(" ");
+	if (need_plus)
+		printf("+");
 }
-double pow(int n,int k)//实现pow函数
-{
-	if (k > 0)
-		return n * pow(n, k - 1);
-	else if (k == 0)
-		return 1;
-	else
-		return 1.0 / pow(n, -k);
-}
-static void histogram()
+
+/*按log2区间输出直方图*/
+static void print_log2_hist(unsigned int *vals, int vals_size, const char *val_type)
 {
-	int log10[15]={0},max=0,per_len=1;
-	for(int i=0;i<10;i++){//log10(count[i]);
-		int tmp=count[i],cnt=0;
-		while (tmp >= 10){
-			tmp /= 10;
-			cnt ++;//幂次
-		}
-		log10[cnt]++;
+	int stars_max = 40, idx_max = -1;
+	unsigned int val, val_max = 0;
+	unsigned long long low, high;
+	int stars, width, i;
+
+	for (i = 0; i < vals_size; i++) {
+		val = vals[i];
+		if (val > 0)
+			idx_max = i;
+		if (val > val_max)
+			val_max = val;
 	}
 
-	for(int i=0;i<10;i++){//找log10里的最大值；
-		if(max<log10[i])
-			max=i;
-	}
+	if (idx_max < 0)
+		return;
 
-	while(max>0){//pow(10,max);
-		per_len *=10 ;
-		max--;
-	}
+	printf("%*s%-*s : count    distribution\n", idx_max <= 32 ? 5 : 15, "",
+		idx_max <= 32 ? 19 : 29, val_type);
 
-	time_t now = time(NULL);// 获取当前时间
-	struct tm *localTime = localtime(&now);// 将时间转换为本地时间结构
-	printf("\nTime : %02d:%02d:%02d \n",localTime->tm_hour, localTime->tm_min, localTime->tm_sec);
-	printf("%-24s \t%-12s \t%-12s \n","cs_delay","Count","Distribution");
-	printf("%d\t=>\t%-8d \t%-12d \t|",0,1,count[0]);
-	print_hstgram(0,max,per_len);
-	printf("%d\t=>\t%-8d \t%-12d \t|",2,3,count[1]);
-	print_hstgram(1,max,per_len);
-	for(int i=2;i<20;i++){
-		printf("%d\t=>\t%-8d \t%-12d \t|",(int)pow(2,i),(int)pow(2,(i+1))-1,count[i]);
-		print_hstgram(i,max,per_len);
-	}
-	printf("per_len = %d\n",per_len);
+	if (idx_max <= 32)
+		stars = stars_max;
+	else
+		stars = stars_max / 2;
+
+	for (i = 0; i <= idx_max; i++) {
+		low = (1ULL << (i + 1)) >> 1;
+		high = (1ULL << (i + 1)) - 1;
+		if (low == high)
+			low -= 1;
+		val = vals[i];
+		width = idx_max <= 32 ? 10 : 20;
+		printf("%*lld -> %-*lld : %-8d |", width, low, width, high, val);
+		print_stars(val, val_max, stars);
+		printf("|\n");
+	}
 }
 
-
-// static void max_print(){
-
-// 	int sc_average_time = sc_sum_time/sys_call_count;
-// 	printf("Average_Syscall_Time: %8d ms\n",sc_average_time);
-// 	printf("MAX_Syscall_Time: %8d ms\n",sc_max_time);
-// 	printf("MIN_Syscall_Time: %8d ms\n",sc_min_time);
-// }
-static int syscall_delay_print(void *ctx, void *data,unsigned long data_sz)
+/*
+ * 读取每CPU直方图并合并，与上一周期的快照prev相减后输出本周期的分布。
+ * cs_delay、syscall_delay、preempt在内核态只更新直方图，不再逐事件输出。
+ */
+static struct hist cs_prev, sc_prev, preempt_prev;
+static int print_hist(struct bpf_map *map, struct hist *prev, const char *title, const char *unit)
 {
+	struct hist vals[MAX_CPU_NR], sum = {}, delta;
+	int key = 0, err, cpu, i;
+
+	err = bpf_map_lookup_elem(bpf_map__fd(map), &key, vals);
+	if (err < 0) {
+		fprintf(stderr, "failed to lookup infos of %s: %d\n", bpf_map__name(map), err);
+		return -1;
+	}
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		for (i = 0; i < MAX_SLOTS; i++)
+			sum.slots[i] += vals[cpu].slots[i];
+		sum.count += vals[cpu].count;
+		sum.sum += vals[cpu].sum;
+	}
+	for (i = 0; i < MAX_SLOTS; i++)
+		delta.slots[i] = sum.slots[i] - prev->slots[i];
+	delta.count = sum.count - prev->count;
+	delta.sum = sum.sum - prev->sum;
+	*prev = sum;
 
-	const struct syscall_events *e = data;
-	printf("pid: %-8llu comm: %-10s syscall_id: %-8ld delay: %-8llu\n",
-		e->pid,e->comm,e->syscall_id,e->delay);
+	printf("\n");
+	printf("%s: count %llu  avg %llu %s\n", title, delta.count,
+		delta.count ? delta.sum / delta.count : 0, unit);
+	print_log2_hist(delta.slots, MAX_SLOTS, unit);
 	return 0;
 }
-//抢占时间输出
-static int preempt_print(void *ctx, void *data, unsigned long data_sz)
-{
-    const struct preempt_event *e = data;
-    printf("%-16s %-7d %-7d %-11llu\n", e->comm, e->prev_pid, e->next_pid, e->duration);
-    preempt_count++;
-    sum_preemptTime += e->duration;
-    return 0;
-}
 
 static int schedule_print(struct bpf_map *sys_fd)
 {
-    int key = 0;
-    struct sum_schedule info;
+    int key = 0, cpu;
+    struct sum_schedule vals[MAX_CPU_NR], info = {};
     int err, fd = bpf_map__fd(sys_fd);
     time_t now = time(NULL);
     struct tm *localTime = localtime(&now);
@@ -464,40 +477,258 @@ static int schedule_print(struct bpf_map *sys_fd)
     int sec = localTime->tm_sec;
     unsigned long long avg_delay;
     
-    err = bpf_map_lookup_elem(fd, &key, &info);
+    err = bpf_map_lookup_elem(fd, &key, vals);
     if (err < 0) {
         fprintf(stderr, "failed to lookup infos: %d\n", err);
         return -1;
     }
+    /* 合并各CPU的部分统计 */
+    for (cpu = 0; cpu < nr_cpus; cpu++) {
+        info.sum_count += vals[cpu].sum_count;
+        info.sum_delay += vals[cpu].sum_delay;
+        if (vals[cpu].max_delay > info.max_delay)
+            info.max_delay = vals[cpu].max_delay;
+        if (vals[cpu].min_delay && (!info.min_delay || vals[cpu].min_delay < info.min_delay))
+            info.min_delay = vals[cpu].min_delay;
+    }
+    if (!info.sum_count)
+        return 0;
     avg_delay = info.sum_delay / info.sum_count;
     printf("%02d:%02d:%02d | %-15lf %-15lf %-15lf |\n",
            hour, min, sec, avg_delay / 1000.0, info.max_delay / 1000.0, info.min_delay / 1000.0);
     return 0;
 }
 
-static int mq_event(void *ctx, void *data,unsigned long data_sz)
+/*根据inode号在/dev/mqueue中查找消息队列的名字*/
+static void mq_name(u64 ino, char *buf, size_t size)
+{
+	struct dirent *ent;
+	struct stat st;
+	char path[PATH_MAX];
+	DIR *dir = opendir("/dev/mqueue");
+
+	snprintf(buf, size, "ino:%llu", ino);
+	if (!dir)
+		return;
+	while ((ent = readdir(dir)) != NULL) {
+		snprintf(path, sizeof(path), "/dev/mqueue/%s", ent->d_name);
+		if (!stat(path, &st) && st.st_ino == ino) {
+			snprintf(buf, size, "/%s", ent->d_name);
+			break;
+		}
+	}
+	closedir(dir);
+}
+
+/*
+ * 每个周期读取并清空各消息队列的每CPU统计，合并后输出
+ * 每秒的收发消息数、字节数以及消息在队列中的驻留时间分布。
+ * 读取与删除由 lookup_and_delete_batch 一次完成，不会丢失两者之间 BPF 侧的累加。
+ */
+#define MQ_BATCH 64
+static int print_mq_stats(struct bpf_map *map)
+{
+	int fd = bpf_map__fd(map);
+	static struct mq_stat vals[MQ_BATCH * MAX_CPU_NR];
+	u64 keys[MQ_BATCH], out_batch;
+	void *in = NULL;
+	struct mq_stat *v, sum;
+	char name[NAME_MAX + 2];
+	__u32 count;
+	bool done = false;
+	int err, cpu, i, k;
+
+	printf("%-24s %10s %10s %12s %12s %12s %12s\n", "QUEUE", "SEND/s", "RECV/s",
+		"SEND_KB/s", "RECV_KB/s", "AVG_RES/us", "MAX_RES/us");
+	while (!done) {
+		count = MQ_BATCH;
+		err = bpf_map_lookup_and_delete_batch(fd, in, &out_batch, keys, vals, &count, NULL);
+		if (err < 0) {
+			if (errno != ENOENT) {
+				fprintf(stderr, "failed to read mq_stats: %s\n", strerror(errno));
+				return -1;
+			}
+			done = true;
+		}
+		in = &out_batch;
+
+		for (k = 0; k < (int)count; k++) {
+			v = &vals[k * nr_cpus];
+			memset(&sum, 0, sizeof(sum));
+			for (cpu = 0; cpu < nr_cpus; cpu++) {
+				sum.sent += v[cpu].sent;
+				sum.received += v[cpu].received;
+				sum.bytes_sent += v[cpu].bytes_sent;
+				sum.bytes_received += v[cpu].bytes_received;
+				sum.residency_sum += v[cpu].residency_sum;
+				if (v[cpu].residency_max > sum.residency_max)
+					sum.residency_max = v[cpu].residency_max;
+				for (i = 0; i < MAX_SLOTS; i++)
+					sum.slots[i] += v[cpu].slots[i];
+			}
+
+			mq_name(keys[k], name, sizeof(name));
+			printf("%-24s %10llu %10llu %12.2f %12.2f %12llu %12llu\n", name, sum.sent, sum.received,
+				sum.bytes_sent / 1024.0, sum.bytes_received / 1024.0,
+				sum.received ? sum.residency_sum / sum.received : 0, sum.residency_max);
+			print_log2_hist(sum.slots, MAX_SLOTS, "usecs");
+		}
+	}
+	return 0;
+}
+
+static u64 clock_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static FILE *heatmap_fp;
+static u64 heatmap_last;//已经导出的最后一个时间槽编号
+
+static int heatmap_open(void)
+{
+	struct heatmap_header hdr = {
+		.magic = HEATMAP_MAGIC,
+		.version = HEATMAP_VERSION,
+		.nr_cpus = nr_cpus,
+		.nr_buckets = MAX_SLOTS,
+		.slot_ns = env.slot_ms * 1000000ULL,
+	};
+
+	heatmap_fp = fopen(env.heatmap, "wb");
+	if (!heatmap_fp) {
+		fprintf(stderr, "Failed to open %s: %s\n", env.heatmap, strerror(errno));
+		return -errno;
+	}
+	hdr.mono_to_real_ns = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC);
+	fwrite(&hdr, sizeof(hdr), 1, heatmap_fp);
+	heatmap_last = clock_ns(CLOCK_MONOTONIC) / hdr.slot_ns;
+	return 0;
+}
+
+/*
+ * 导出所有已经结束且还在环中的时间槽，正在写入的当前槽留到下一次导出。
+ * 环长为HEATMAP_SLOTS，槽宽不小于10ms，每秒导出一次不会丢失时间槽。
+ */
+static int heatmap_export(struct bpf_map *map)
+{
+	u64 slot_ns = env.slot_ms * 1000000ULL;
+	u64 cur = clock_ns(CLOCK_MONOTONIC) / slot_ns, id;
+	struct heat_slot vals[MAX_CPU_NR];
+	struct heat_record rec;
+	u32 idx, counts[MAX_SLOTS];
+	int fd = bpf_map__fd(map), err, cpu, b, n;
+
+	if (cur - heatmap_last > HEATMAP_SLOTS)
+		heatmap_last = cur - HEATMAP_SLOTS;
+	for (id = heatmap_last + 1; id < cur; id++) {
+		idx = id % HEATMAP_SLOTS;
+		err = bpf_map_lookup_elem(fd, &idx, vals);
+		if (err < 0) {
+			fprintf(stderr, "failed to lookup infos of heatmap: %d\n", err);
+			return -1;
+		}
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			/*该CPU在这个时间段内没有调度事件，槽中仍是更早的数据*/
+			if (vals[cpu].slot_id != id)
+				continue;
+			rec.slot_id = id;
+			rec.cpu = cpu;
+			rec.mask = 0;
+			for (b = 0, n = 0; b < MAX_SLOTS; b++) {
+				if (!vals[cpu].buckets[b])
+					continue;
+				rec.mask |= 1U << b;
+				counts[n++] = vals[cpu].buckets[b];
+			}
+			if (!n)
+				continue;
+			fwrite(&rec, sizeof(rec), 1, heatmap_fp);
+			fwrite(counts, sizeof(counts[0]), n, heatmap_fp);
+		}
+	}
+	heatmap_last = cur - 1;
+	return fflush(heatmap_fp) ? -errno : 0;
+}
+
+static void print_schedule_header(void)
+{
+	printf("%-8s %s\n",  "  TIME ", "avg_delay/μs     max_delay/μs     min_delay/μs");
+}
+
+/*
+ * 由同一个定时器每秒触发一次，按固定顺序输出所有开启的周期性模式，
+ * 使各模式的数据落在同一个时间窗口内。
+ */
+static int print_interval(void)
 {
 	time_t now = time(NULL);// 获取当前时间
 	struct tm *localTime = localtime(&now);// 将时间转换为本地时间结构
-	printf("\n\nTime: %02d:%02d:%02d\n",localTime->tm_hour, localTime->tm_min, localTime->tm_sec);
-	printf("-----------------------------------------------------------------------------------------------------------\n");
-	const struct mq_events *e = data;
-	printf("Mqdes: %-8llu msg_len: %-8llu msg_prio: %-8llu\n",e->mqdes,e->msg_len,e->msg_prio);
-	printf("SND_PID: %-8lu SND_enter_time: %-16llu\n",
-		e->send_pid,e->send_enter_time);
-	printf("-----------------------------------------------------------------------------------------------------------\n");
-	printf("RCV_PID: %-8lu RCV_enter_time: %-16llu RCV_exit_time: %-16llu\n",
-		e->rcv_pid,e->rcv_enter_time,e->rcv_exit_time);
-	printf("RCV_Delay: %-8.2fms\nDelay: %-8.2fms\n\n",(e->rcv_exit_time - e->rcv_enter_time)/1000000.0,e->delay/1000000.0);
-	
+	int err;
+
+	if (env.nr_modes > 1 || env.CS_DELAY || env.SYSCALL_DELAY || env.PREEMPT || env.MQ_DELAY)
+		printf("\nTime : %02d:%02d:%02d \n",localTime->tm_hour, localTime->tm_min, localTime->tm_sec);
+	if (env.SAR) {
+		if (env.nr_modes > 1 && !env.PERCPU && env.enable_proc)
+			print_sar_header();
+		err = print_all();
+		if (err < 0)
+			return err;
+	}
+	if (env.SCHEDULE_DELAY) {
+		if (env.nr_modes > 1)
+			print_schedule_header();
+		err = schedule_print(sd_skel->maps.sys_schedule);
+		if (err < 0)
+			return err;
+		if (heatmap_fp) {
+			err = heatmap_export(sd_skel->maps.heatmap);
+			if (err < 0)
+				return err;
+		}
+	}
+	if (env.CS_DELAY) {
+		err = print_hist(cs_skel->maps.hists, &cs_prev, "cs_delay", "usecs");
+		if (err < 0)
+			return err;
+	}
+	if (env.SYSCALL_DELAY) {
+		err = print_hist(sc_skel->maps.hists, &sc_prev, "syscall_delay", "usecs");
+		if (err < 0)
+			return err;
+	}
+	if (env.PREEMPT) {
+		err = print_hist(preempt_skel->maps.hists, &preempt_prev, "preempt", "nsecs");
+		if (err < 0)
+			return err;
+	}
+	if (env.MQ_DELAY) {
+		err = print_mq_stats(mq_skel->maps.mq_stats);
+		if (err < 0)
+			return err;
+	}
+	fflush(stdout);
 	return 0;
 }
 
+/*epoll事件来源*/
+enum epoll_source {
+	TIMER_SOURCE,
+};
+#define MAX_EPOLL_EVENTS 4
 
 int main(int argc, char **argv)
 {
-	struct ring_buffer *rb = NULL;
-	int err;
+	struct epoll_event ev, events[MAX_EPOLL_EVENTS];
+	struct itimerspec its = {
+		.it_interval = { .tv_sec = 1 },
+		.it_value = { .tv_sec = 1 },
+	};
+	int epoll_fd = -1, timer_fd = -1;
+	int err = 0, n, i;
 	err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
 	if (err)
 		return err;
@@ -508,6 +739,16 @@ int main(int argc, char **argv)
 	/* Cleaner handling of Ctrl-C */
 	signal(SIGINT, sig_handler);
 	signal(SIGTERM, sig_handler);
+	signal(SIGALRM, sig_handler);
+
+	if (env.heatmap && !env.SCHEDULE_DELAY) {
+		env.SCHEDULE_DELAY = true;
+		env.nr_modes++;
+	}
+	if (!env.nr_modes) {
+		printf("正在开发中......\n-c	打印cs_delay:\t对内核函数schedule()的执行时长进行测试;\n-s	sar工具;\n-S	打印sc_delay:\t系统调用运行延迟进行检测; \n-p	打印preempt_time:\t对抢占调度时间输出;\n-d	打印schedule_delay:\t调度时延;\n-m	打印mq_delay:\t消息队列通信时延;\n以上参数可以同时开启;\n");
+		return 0;
+	}
 
 	nr_cpus = libbpf_num_possible_cpus();
 	if (nr_cpus < 0) {
@@ -521,7 +762,7 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-
+	/*各模式的骨架相互独立，可以任意组合加载到同一个进程中*/
 	if (env.CS_DELAY)
 	{
 		/* Load and verify BPF application */
@@ -529,105 +770,103 @@ int main(int argc, char **argv)
 		if (!cs_skel)
 		{
 			fprintf(stderr, "Failed to open and load BPF skeleton\n");
-			return 1;
+			err = 1;
+			goto cleanup;
 		}
 		/* Load & verify BPF programs */
 		err = cs_delay_bpf__load(cs_skel);
 		if (err)
 		{
 			fprintf(stderr, "Failed to load and verify BPF skeleton\n");
-			goto cs_delay_cleanup;
+			goto cleanup;
 		}
 		/* Attach tracepoints */
 		err = cs_delay_bpf__attach(cs_skel);
 		if (err)
 		{
 			fprintf(stderr, "Failed to attach BPF skeleton\n");
-			goto cs_delay_cleanup;
-		}
-		rb = ring_buffer__new(bpf_map__fd(cs_skel->maps.rb), handle_event, NULL, NULL);	//ring_buffer__new() API，允许在不使用额外选项数据结构下指定回调
-		if (!rb) {
-			err = -1;
-			fprintf(stderr, "Failed to create ring buffer\n");
-			goto cs_delay_cleanup;
+			goto cleanup;
 		}
-	}else if (env.PREEMPT) {
+	}
+	if (env.PREEMPT) {
 		preempt_skel = preempt_bpf__open();
 		if (!preempt_skel) {
 			fprintf(stderr, "Failed to open and load BPF skeleton\n");
-			return 1;
+			err = 1;
+			goto cleanup;
 		}
 
 		err = preempt_bpf__load(preempt_skel);
 		if (err) {
 			fprintf(stderr, "Failed to load and verify BPF skeleton\n");
-			goto preempt_cleanup;
+			goto cleanup;
 		}
 
 		err = preempt_bpf__attach(preempt_skel);
 		if (err) {
 			fprintf(stderr, "Failed to attach BPF skeleton\n");
-			goto preempt_cleanup;
-		}
-
-		rb = ring_buffer__new(bpf_map__fd(preempt_skel->maps.rb), preempt_print, NULL, NULL);
-		if (!rb) {
-			err = -1;
-			fprintf(stderr, "Failed to create ring buffer\n");
-			goto preempt_cleanup;
+			goto cleanup;
 		}
-	}else if (env.SYSCALL_DELAY){
+	}
+	if (env.SYSCALL_DELAY){
 		/* Load and verify BPF application */
 		sc_skel = sc_delay_bpf__open();
 		if (!sc_skel)
 		{
 			fprintf(stderr, "Failed to open and load BPF skeleton\n");
-			return 1;
+			err = 1;
+			goto cleanup;
 		}
 		/* Load & verify BPF programs */
 		err = sc_delay_bpf__load(sc_skel);
 		if (err)
 		{
 			fprintf(stderr, "Failed to load and verify BPF skeleton\n");
-			goto sc_delay_cleanup;
+			goto cleanup;
 		}
 		/* Attach tracepoints */
 		err = sc_delay_bpf__attach(sc_skel);
 		if (err)
 		{
 			fprintf(stderr, "Failed to attach BPF skeleton\n");
-			goto sc_delay_cleanup;
-		}
-		rb = ring_buffer__new(bpf_map__fd(sc_skel->maps.rb), syscall_delay_print, NULL, NULL);	//ring_buffer__new() API，允许在不使用额外选项数据结构下指定回调
-		if (!rb) {
-			err = -1;
-			fprintf(stderr, "Failed to create ring buffer\n");
-			goto sc_delay_cleanup;		
+			goto cleanup;
 		}
-	}else if(env.SCHEDULE_DELAY){
+	}
+	if(env.SCHEDULE_DELAY){
 		sd_skel = schedule_delay_bpf__open();
 		if (!sd_skel) {
 			fprintf(stderr, "Failed to open and load BPF skeleton\n");
-			return 1;
+			err = 1;
+			goto cleanup;
 		}
+		if (env.heatmap)
+			sd_skel->rodata->heatmap_slot_ns = env.slot_ms * 1000000ULL;
 		err = schedule_delay_bpf__load(sd_skel);
 		if (err) {
 			fprintf(stderr, "Failed to load and verify BPF skeleton\n");
-			goto schedule_cleanup;
+			goto cleanup;
 		}
 		err = schedule_delay_bpf__attach(sd_skel);
 		if (err) {
 			fprintf(stderr, "Failed to attach BPF skeleton\n");
-			goto schedule_cleanup;
+			goto cleanup;
 		}
-		printf("%-8s %s\n",  "  TIME ", "avg_delay/μs     max_delay/μs     min_delay/μs");
-	}else if (env.SAR){
+		if (env.heatmap) {
+			err = heatmap_open();
+			if (err)
+				goto cleanup;
+		}
+		if (env.nr_modes == 1)
+			print_schedule_header();
+	}
+	if (env.SAR){
 		/* Load and verify BPF application */
 		sar_skel = sar_bpf__open();
 		if (!sar_skel)
 		{
 			fprintf(stderr, "Failed to open and load BPF skeleton\n");
-			return 1;
+			err = 1;
+			goto cleanup;
 		}
 		sar_skel->rodata->forks_addr = (u64)find_ksym(symbol_name);
 		/* Load & verify BPF programs */
@@ -635,170 +874,113 @@ int main(int argc, char **argv)
 		if (err)
 		{
 			fprintf(stderr, "Failed to load and verify BPF skeleton\n");
-			goto sar_cleanup;
+			goto cleanup;
 		}
 
 		/*perf_event加载*/
 		err = open_and_attach_perf_event(env.freq, sar_skel->progs.tick_update, links);
 		if (err)
-			goto sar_cleanup;
+			goto cleanup;
 
 		err = sar_bpf__attach(sar_skel);
 		if (err)
 		{
 			fprintf(stderr, "Failed to attach BPF skeleton\n");
-			goto sar_cleanup;
+			goto cleanup;
 		}
-		printf("  time    proc/s  cswch/s  runqlen  irqTime/us  softirq/us  idle/ms  kthread/us  sysc/ms  utime/ms  sys/ms \n");
-	}else if(env.MQ_DELAY){
+		if (env.nr_modes == 1 && !env.PERCPU)
+			print_sar_header();
+	}
+	if(env.MQ_DELAY){
 		/* Load and verify BPF application */
 		mq_skel = mq_delay_bpf__open();
 		if (!mq_skel)
 		{
 			fprintf(stderr, "Failed to open and load BPF skeleton\n");
-			return 1;
+			err = 1;
+			goto cleanup;
 		}
 		/* Load & verify BPF programs */
 		err = mq_delay_bpf__load(mq_skel);
 		if (err)
 		{
 			fprintf(stderr, "Failed to load and verify BPF skeleton\n");
-			goto mq_delay_cleanup;
+			goto cleanup;
 		}
 		/* Attach tracepoints */
 		err = mq_delay_bpf__attach(mq_skel);
 		if (err)
 		{
 			fprintf(stderr, "Failed to attach BPF skeleton\n");
-			goto mq_delay_cleanup;
-		}
-		rb = ring_buffer__new(bpf_map__fd(mq_skel->maps.rb), mq_event, NULL, NULL);	//ring_buffer__new() API，允许在不使用额外选项数据结构下指定回调
-		if (!rb) {
-			err = -1;
-			fprintf(stderr, "Failed to create ring buffer\n");
-			goto mq_delay_cleanup;
+			goto cleanup;
 		}
 	}
+
+	/*所有模式共用一个epoll循环，定时器每秒触发一次周期性输出*/
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		err = -errno;
+		fprintf(stderr, "Failed to create epoll: %s\n", strerror(errno));
+		goto cleanup;
+	}
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (timer_fd < 0 || timerfd_settime(timer_fd, 0, &its, NULL) < 0) {
+		err = -errno;
+		fprintf(stderr, "Failed to create timer: %s\n", strerror(errno));
+		goto cleanup;
+	}
+	ev.events = EPOLLIN;
+	ev.data.u32 = TIMER_SOURCE;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) < 0) {
+		err = -errno;
+		fprintf(stderr, "Failed to add timer to epoll: %s\n", strerror(errno));
+		goto cleanup;
+	}
+
 	while (!exiting) {
-		if(env.SAR){
-			sleep(1);
-			err = print_all();
-			if (err == -EINTR) {
-				err = 0;
-				break;
-			}
-			if (err < 0) {
-        	    printf("Error polling perf buffer: %d\n", err);
-				break;
-			}
-		}
-        else if(env.CS_DELAY){
-			sleep(1);
-			err = ring_buffer__poll(rb, 1000 /* timeout, s */);
-			if (err == -EINTR) {
-				err = 0;
-				break;
-			}
-			if (err < 0) {
-        	    printf("Error polling perf buffer: %d\n", err);
-				break;
-			}
-			histogram();
+		n = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+		/* Ctrl-C will cause EINTR */
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			err = -errno;
+			fprintf(stderr, "Error waiting for events: %s\n", strerror(errno));
+			break;
 		}
-		else if(env.SYSCALL_DELAY){
-			err = ring_buffer__poll(rb, 100 /* timeout, ms */);		//ring_buffer__poll(),轮询打开ringbuf缓冲区。如果有事件，handle_event函数会执行	
-			/* Ctrl-C will cause -EINTR */
-			if (err == -EINTR) {
-				err = 0;
-				break;
-			}
-			if (err < 0) {
-				printf("Error polling perf buffer: %d\n", err);
-				break;
-			}
-			time_t now = time(NULL);// 获取当前时间
-			struct tm *localTime = localtime(&now);// 将时间转换为本地时间结构
-			printf("\n\nTime: %02d:%02d:%02d\n",localTime->tm_hour, localTime->tm_min, localTime->tm_sec);
-			printf("----------------------------------------------------------------------------------------------------------\n");
-			sleep(1);			
-		}
-		else if (env.PREEMPT) {
-			err = ring_buffer__poll(rb, 100 /* timeout, ms */);
-			if (err == -EINTR) {
-				err = 0;
-				break;
-			}
-			if (err < 0) {
-				printf("Error polling perf buffer: %d\n", err);
-				break;
-			}
-			time_t now = time(NULL);
-			struct tm *localTime = localtime(&now);
-			if (!preempt_start_print) {
-				preempt_start_print = 1;
-			} else {
-				printf("----------------------------------------------------------------------------------------------------------\n");
-				printf("\nAverage_preempt_Time: %8d ns\n", sum_preemptTime / preempt_count);
-			}
-			printf("\nTime: %02d:%02d:%02d\n", localTime->tm_hour, localTime->tm_min, localTime->tm_sec);
-			printf("%-12s %-8s %-8s %11s\n", "COMM", "prev_pid", "next_pid", "duration_ns");
-			preempt_count = 0;
-			sum_preemptTime = 0;
-			sleep(2);
-		}
-		else if (env.SCHEDULE_DELAY){
-			err = schedule_print(sd_skel->maps.sys_schedule);
-			if (err == -EINTR) {
-				err = 0;
-				break;
-			}
-			if (err < 0) {
+		for (i = 0; i < n; i++) {
+			switch (events[i].data.u32) {
+			case TIMER_SOURCE: {
+				u64 expirations;
+				if (read(timer_fd, &expirations, sizeof(expirations)) < 0)
+					break;
+				err = print_interval();
 				break;
 			}
-			sleep(1);
-		}
-        else if(env.MQ_DELAY){
-			err = ring_buffer__poll(rb, 1000 /* timeout, s */);
-			if (err == -EINTR) {
-				err = 0;
-				break;
 			}
-			if (err < 0) {
-        	    printf("Error polling perf buffer: %d\n", err);
+			if (err < 0)
 				break;
-			}
 		}
-		else {
-			printf("正在开发中......\n-c	打印cs_delay:\t对内核函数schedule()的执行时长进行测试;\n-s	sar工具;\n-y	打印sc_delay:\t系统调用运行延迟进行检测; \n-p	打印preempt_time:\t对抢占调度时间输出;\n");
+		if (err < 0)
 			break;
-		}
+		err = 0;
 	}
 
-cs_delay_cleanup:
-	ring_buffer__free(rb);
+cleanup:
+	if (heatmap_fp) {
+		heatmap_export(sd_skel->maps.heatmap);
+		fclose(heatmap_fp);
+	}
+	if (timer_fd >= 0)
+		close(timer_fd);
+	if (epoll_fd >= 0)
+		close(epoll_fd);
+	for (i = 0; i < nr_cpus; i++)
+		bpf_link__destroy(links[i]);
 	cs_delay_bpf__destroy(cs_skel);
-	return err < 0 ? -err : 0;
-
-sar_cleanup:
 	sar_bpf__destroy(sar_skel);
-	return err < 0 ? -err : 0;
-
-sc_delay_cleanup:
-	ring_buffer__free(rb);
 	sc_delay_bpf__destroy(sc_skel);
-	return err < 0 ? -err : 0;
-
-preempt_cleanup:
-	ring_buffer__free(rb);
 	preempt_bpf__destroy(preempt_skel);
-	return err < 0 ? -err : 0;
-
-schedule_cleanup:
 	schedule_delay_bpf__destroy(sd_skel);
-	return err < 0 ? -err : 0;
-
-mq_delay_cleanup:
-	ring_buffer__free(rb);
 	mq_delay_bpf__destroy(mq_skel);
-	return err < 0 ? -err : 0;
+	return err < 0 ? -err : err;
 }
@@ -88,40 +88,16 @@ typedef __kernel_mqd_t	mqd_t;
     } name SEC(".maps")
 
 /*----------------------------------------------*/
-/*          cs_delay结构体                     */
-/*----------------------------------------------*/
-#ifndef __CS_DELAY_H
-#define __CS_DELAY_H
-struct event {
-	long unsigned int t1;
-	long unsigned int t2;
-	long unsigned int delay;   
+/*   cs_delay、syscall_delay、preempt直方图结构体   */
+/*----------------------------------------------*/
+#define MAX_SLOTS 32
+//每CPU的log2延迟直方图，用户态按周期读取并合并
+struct hist {
+	unsigned int slots[MAX_SLOTS];
+	u64 count;
+	u64 sum;
 };
-#endif /* __CS_DELAY_H */
 
-/*----------------------------------------------*/
-/*          syscall_delay结构体                     */
-/*----------------------------------------------*/
-struct syscall_flags{
-	long unsigned int start_time;
-	int syscall_id;
-};
-
-struct syscall_events {//每个进程一个
-    int pid,count;
-    char comm[TASK_COMM_LEN];
-    u64 delay;
-    u64 syscall_id;
-};
-/*----------------------------------------------*/
-/*         preempt_event结构体                     */
-/*----------------------------------------------*/
-struct preempt_event{
-	pid_t prev_pid;
-	pid_t next_pid;
-	unsigned long long duration;
-	char comm[TASK_COMM_LEN];
-};
 /*----------------------------------------------*/
 /*         schedule_delay相关结构体                     */
 /*----------------------------------------------*/
@@ -145,46 +121,59 @@ struct sum_schedule{
 };
 
 /*----------------------------------------------*/
-/*         mq_delay相关结构体                     */
+/*         调度延迟热力图相关结构体                 */
 /*----------------------------------------------*/
-struct mq_events {
-    int send_pid;
-    int rcv_pid;
-    mqd_t mqdes;
-        size_t msg_len;
-        unsigned int msg_prio;
-        
-        u64 send_enter_time;
-        u64 send_exit_time;
-        u64 send_delay;
+#define HEATMAP_SLOTS 256 //每CPU时间槽环的长度
+#define HEATMAP_MAGIC "CWHM"
+#define HEATMAP_VERSION 1
+//一个时间槽内某个CPU上的调度延迟分布，buckets[i]为延迟落在[2^i, 2^(i+1))us的次数
+struct heat_slot {
+	u64 slot_id;//时间槽编号，即 时间戳(ns)/槽宽
+	unsigned int buckets[MAX_SLOTS];
+};
+/*
+ * 热力图文件格式：文件头后跟若干条记录，每条记录为一个 (时间槽, CPU)，
+ * 其后紧跟 mask 中每个置位的桶的计数(u32)，全零的记录不写出。
+ */
+struct heatmap_header {
+	char magic[4];//"CWHM"
+	u32 version;
+	u32 nr_cpus;
+	u32 nr_buckets;
+	u64 slot_ns;//时间槽宽度
+	long long mono_to_real_ns;//slot_id*slot_ns加上该值即为墙上时间
+};
+struct heat_record {
+	u64 slot_id;
+	u32 cpu;
+	u32 mask;//非零桶的位图
+};
 
-        u64 rcv_enter_time;
-        u64 rcv_exit_time;
-        u64 rcv_delay;
-        u64 delay;
+/*----------------------------------------------*/
+/*         mq_delay相关结构体                     */
+/*----------------------------------------------*/
+//发送端：do_mq_timedsend到load_msg返回之间按pid暂存
+struct mq_send_info {
+	u64 ino;//消息队列的inode号，用于标识队列
+	const char *u_msg_ptr;
+	const void *src;
+	u64 msg_len;
+	u64 msg_ptr;//load_msg生成的消息块，do_mq_timedsend成功返回时才计入发送
 };
-struct send_events {
-    int send_pid;
-    u64 Key_msg_ptr;
-    
-    mqd_t mqdes;
-        size_t msg_len;
-        unsigned int msg_prio;
-        const char *u_msg_ptr;
-        const void  *src;
-        u64 send_enter_time;
-        u64 send_exit_time;
+//以消息块msg_msg指针为键，记录消息入队的队列和时间
+struct mq_msg_info {
+	u64 ino;
+	u64 enqueue_time;
 };
-struct rcv_events {
-    int rcv_pid;
-    u64 Key_msg_ptr;
-    mqd_t mqdes;
-        size_t msg_len;
-        unsigned int msg_prio; 
-        const char *u_msg_ptr;
-        const void  *dest;
-        u64 rcv_enter_time;
-        u64 rcv_exit_time;
+//每个消息队列的统计，驻留时间为消息从入队到被接收端取出的时间(us)
+struct mq_stat {
+	u64 sent;
+	u64 received;
+	u64 bytes_sent;
+	u64 bytes_received;
+	u64 residency_sum;
+	u64 residency_max;
+	unsigned int slots[MAX_SLOTS];
 };
 /*----------------------------------------------*/
 /*          cswch_args结构体                     */
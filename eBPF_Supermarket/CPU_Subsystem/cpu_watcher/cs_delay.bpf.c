@@ -3,23 +3,22 @@
 #include <bpf/bpf_core_read.h>
 #include <bpf/bpf_tracing.h>
 #include "cpu_watcher.h"
+#include "bits.bpf.h"
 
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
-//记录时间戳；
-BPF_ARRAY(start,int,u64,1);
-struct {
-	__uint(type, BPF_MAP_TYPE_RINGBUF);
-	__uint(max_entries, 256 * 1024);
-} rb SEC(".maps");
+//记录时间戳，以pid为键，进程在schedule()中可能迁移到其他CPU；
+BPF_HASH(start,pid_t,u64,MAX_ENTRIES);
+//schedule()执行时长的每CPU直方图(us)；
+BPF_PERCPU_ARRAY(hists,int,struct hist,1);
 
 SEC("kprobe/schedule")
 int BPF_KPROBE(schedule)
 {
 	u64 t1;
 	t1 = bpf_ktime_get_ns()/1000;
-	int key =0;
-	bpf_map_update_elem(&start,&key,&t1,BPF_ANY);
+	pid_t pid = bpf_get_current_pid_tgid();
+	bpf_map_update_elem(&start,&pid,&t1,BPF_ANY);
 	return 0;
 }
 
@@ -27,24 +26,30 @@ SEC("kretprobe/schedule")
 int BPF_KRETPROBE(schedule_exit)
 {	
 	u64 t2 = bpf_ktime_get_ns()/1000;
-	u64 t1,delay;
+	u64 delay;
+	pid_t pid = bpf_get_current_pid_tgid();
 	int key = 0;
-	u64 *val = bpf_map_lookup_elem(&start,&key);
+	u64 *val = bpf_map_lookup_elem(&start,&pid);
 	if (val != 0) 
 	{
-        	t1 = *val;
-        	delay = t2 - t1;
-			bpf_map_delete_elem(&start, &key);
+        	delay = t2 - *val;
+			bpf_map_delete_elem(&start, &pid);
 	}else{
 		return 0;
 	}
-	struct event *e;
-	e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
-	if (!e)	return 0;	
-	e->t1=t1;
-	e->t2=t2;
-	e->delay=delay;
-	bpf_ringbuf_submit(e, 0);
+	struct hist *h = bpf_map_lookup_elem(&hists,&key);
+	if (!h)	return 0;
+	h->slots[log2_slot(delay)]++;
+	h->count++;
+	h->sum += delay;
 	return 0;
 }
 
+//进程退出后不会再从schedule()返回，在此删除其时间戳，避免条目泄漏；
+SEC("tracepoint/sched/sched_process_exit")
+int sched_process_exit(void *ctx)
+{
+	pid_t pid = bpf_get_current_pid_tgid();
+	bpf_map_delete_elem(&start,&pid);
+	return 0;
+}
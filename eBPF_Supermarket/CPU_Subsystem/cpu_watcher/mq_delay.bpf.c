@@ -21,62 +21,63 @@
 #include <bpf/bpf_core_read.h>
 
 #include "cpu_watcher.h"
+#include "bits.bpf.h"
 
 
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
+#define MAX_ERRNO 4095
 
-BPF_HASH(send_msg1,pid_t,struct send_events,1024);//记录pid->u_msg_ptr的关系；do_mq_timedsend入参
-BPF_HASH(send_msg2,u64,struct send_events,1024);//记录msg->time的关系；
-BPF_HASH(rcv_msg1,pid_t,struct rcv_events,1024);//记录pid->u_msg_ptr的关系；do_mq_timedsend入参
+BPF_HASH(send_msg,pid_t,struct mq_send_info,1024);//记录pid->发送信息的关系；do_mq_timedsend入参
+//消息块->入队信息；发送失败或队列被删除时消息由free_msg释放，使用LRU防止残留条目占满map
 struct {
-	__uint(type, BPF_MAP_TYPE_RINGBUF);
-	__uint(max_entries, 256 * 1024);
-} rb SEC(".maps");
-
-// int print_send_info(struct send_events * mq_send_info,int flag){
-// 	bpf_printk("---------------------test----------------------------test--------------------------test--------------------------------------------test---------------------test---------------------test\n");
-// 	bpf_printk("send_msg_prio: %-8lu\n",mq_send_info->msg_prio);
-// 	bpf_printk("mqdes: %-08lu  send_pid: %-08lu  send_enter_time: %-16lu\n",mq_send_info->mqdes,mq_send_info->send_pid,mq_send_info->send_enter_time);
-// 	if(flag > 0){
-// 		bpf_printk("u_msg_ptr: 0x%08lx  src: 0x%08lx\n",mq_send_info->u_msg_ptr,mq_send_info->src);
-// 		if(flag==2)	bpf_printk("Key_msg_ptr: 0x%08lx  \n",mq_send_info->Key_msg_ptr);
-// 	}
-// 	bpf_printk("---------------------test----------------------------test--------------------------test--------------------------------------------test---------------------test---------------------test\n");
-// 	return 0;
-// }
-
-// int print_rcv_info(struct rcv_events * mq_rcv_info,int flag){
-// 	bpf_printk("---------------------test----------------------------test--------------------------test--------------------------------------------test---------------------test---------------------test\n");
-// 	bpf_printk("rcv_msg_prio: %-8lu\n",mq_rcv_info->msg_prio);	
-// 	bpf_printk("mqdes: %-08lu  rcv_pid: %-08lu  rcv_enter_time: %-16lu\n",mq_rcv_info->mqdes,mq_rcv_info->rcv_pid,mq_rcv_info->rcv_enter_time);
-// 	if(flag > 0){
-// 		bpf_printk("u_msg_ptr: 0x%08lx  dest: 0x%08lx\n",mq_rcv_info->u_msg_ptr,mq_rcv_info->dest);
-// 		if(flag==2)	bpf_printk("Key_msg_ptr: 0x%08lx  \n",mq_rcv_info->Key_msg_ptr);
-// 	}
-// 	bpf_printk("---------------------test----------------------------test--------------------------test--------------------------------------------test---------------------test---------------------test\n");
-// 	return 0;
-// }
-	
-
-/*获取 mq_send_info -> send_time send_pid mdqes u_msg_ptr msg_len msg_prio*/
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, MAX_ENTRIES);
+	__type(key, u64);
+	__type(value, struct mq_msg_info);
+} mq_msgs SEC(".maps");
+//每个消息队列的每CPU统计，以队列inode号为键
+BPF_PERCPU_HASH(mq_stats,u64,struct mq_stat,1024);
+
+static __always_inline struct mq_stat *get_mq_stat(u64 ino)
+{
+	struct mq_stat *stat = bpf_map_lookup_elem(&mq_stats, &ino);
+	if (stat)
+		return stat;
+
+	struct mq_stat zero = {};
+	bpf_map_update_elem(&mq_stats, &ino, &zero, BPF_NOEXIST);
+	return bpf_map_lookup_elem(&mq_stats, &ino);
+}
+
+/*通过描述符mqdes找到消息队列文件的inode号*/
+static __always_inline u64 get_mq_ino(mqd_t mqdes)
+{
+	struct task_struct *task = (struct task_struct *)bpf_get_current_task();
+	struct file **fds = BPF_CORE_READ(task, files, fdt, fd);
+	struct file *file;
+
+	if (mqdes < 0 || bpf_probe_read_kernel(&file, sizeof(file), &fds[mqdes]) || !file)
+		return 0;
+	return BPF_CORE_READ(file, f_inode, i_ino);
+}
+
+/*获取 mq_send_info -> ino u_msg_ptr msg_len*/
 SEC("kprobe/do_mq_timedsend")
 int BPF_KPROBE(mq_timedsend,mqd_t mqdes, const char *u_msg_ptr,
 		size_t msg_len, unsigned int msg_prio,
 		struct timespec64 *ts)
 {
-	u64 send_enter_time = bpf_ktime_get_ns();//开始发送信息时间；
 	int pid = bpf_get_current_pid_tgid();//发送端pid
 
-	/*将消息暂存至send_events结构体中*/
-	struct send_events mq_send_info ={};
-	mq_send_info.send_pid= pid;
-	mq_send_info.send_enter_time = send_enter_time;
-		mq_send_info.mqdes= mqdes;
-		mq_send_info.msg_len = msg_len;
-		mq_send_info.msg_prio = msg_prio;
-		mq_send_info.u_msg_ptr = u_msg_ptr;
+	/*将消息暂存至mq_send_info结构体中*/
+	struct mq_send_info mq_send_info ={};
+	mq_send_info.ino = get_mq_ino(mqdes);
+	mq_send_info.msg_len = msg_len;
+	mq_send_info.u_msg_ptr = u_msg_ptr;
+	if (!mq_send_info.ino)
+		return 0;
 
-	bpf_map_update_elem(&send_msg1, &pid, &mq_send_info, BPF_ANY);//pid->u_msg_ptr
+	bpf_map_update_elem(&send_msg, &pid, &mq_send_info, BPF_ANY);//pid->mq_send_info
 	return 0;	
 } 	
 
@@ -85,7 +86,7 @@ SEC("kprobe/load_msg")
 int BPF_KPROBE(load_msg_enter,const void *src, size_t len){
 	int pid = bpf_get_current_pid_tgid();//发送端pid
 	/*记录load入参src*/
-	struct send_events *mq_send_info = bpf_map_lookup_elem(&send_msg1, &pid);
+	struct mq_send_info *mq_send_info = bpf_map_lookup_elem(&send_msg, &pid);
 	if(!mq_send_info){
 		return 0;
 	}else{
@@ -94,121 +95,90 @@ int BPF_KPROBE(load_msg_enter,const void *src, size_t len){
 	return 0;		
 }
 
-/*获取消息块作为key，并建立 message -> mq_send_info 的哈希表*/
+/*消息块已生成，此时尚未检查队列是否已满，先记录消息块指针，等do_mq_timedsend返回时再确认入队*/
 SEC("kretprobe/load_msg")
 int BPF_KRETPROBE(load_msg_exit,void *ret){
 	int pid = bpf_get_current_pid_tgid();//发送端pid
-	/*构建消息块结构体，作为key*/
-	struct send_events *mq_send_info = bpf_map_lookup_elem(&send_msg1, &pid);
+	struct mq_send_info *mq_send_info = bpf_map_lookup_elem(&send_msg, &pid);
 	if(!mq_send_info){
 		return 0;
 	}
 
-	/*make key*/
-	u64 Key_msg_ptr;
-	if(mq_send_info->u_msg_ptr == mq_send_info->src && pid == mq_send_info->send_pid){
-		/*该load_msg为do_mq_timedsend调用*/
-		Key_msg_ptr =(u64)ret;
-		mq_send_info->Key_msg_ptr = Key_msg_ptr;
-	}
-	else {
+	/*该load_msg为do_mq_timedsend调用，且未出错*/
+	if(mq_send_info->u_msg_ptr != mq_send_info->src || (unsigned long)ret >= (unsigned long)-MAX_ERRNO){
+		bpf_map_delete_elem(&send_msg,&pid);
 		return 0;
 	}
-	/*已经获得key*/
-	bpf_map_update_elem(&send_msg2, &Key_msg_ptr, mq_send_info, BPF_ANY);//key_messege->mq_send_info;
-	bpf_map_delete_elem(&send_msg1,&pid);
+
+	/*接收端正在等待时消息直接交给接收端，store_msg可能先于do_mq_timedsend返回，
+	  因此先以当前时间登记消息块，成功返回时若消息仍在队列中再更新为入队时间*/
+	struct mq_msg_info msg_info = {
+		.ino = mq_send_info->ino,
+		.enqueue_time = bpf_ktime_get_ns(),
+	};
+	u64 Key_msg_ptr = (u64)ret;
+	bpf_map_update_elem(&mq_msgs, &Key_msg_ptr, &msg_info, BPF_ANY);//消息块->入队信息
+	mq_send_info->msg_ptr = Key_msg_ptr;
 	return 0;		
 }
-/*-----------------------------------------------------------------------------发送端--------------------------------------------------------------------------------------------------------*/
-/*																				分界   																										*/
-/*-----------------------------------------------------------------------------接收端--------------------------------------------------------------------------------------------------------*/                                                                                                                                                                                     
-/*接收端*/
-SEC("kprobe/do_mq_timedreceive")
-int BPF_KPROBE(mq_timedreceive_entry,mqd_t mqdes, const char __user *u_msg_ptr,
-		size_t msg_len, unsigned int msg_prio,
-		struct timespec64 *ts)
-{
-	u64 rcv_enter_time = bpf_ktime_get_ns();
-	int pid = bpf_get_current_pid_tgid();
 
-	/*赋值*/
-	struct rcv_events mq_rcv_info ={};
-	mq_rcv_info.rcv_pid= pid;
-	mq_rcv_info.rcv_enter_time = rcv_enter_time;
-		mq_rcv_info.mqdes= mqdes;
-		mq_rcv_info.u_msg_ptr = u_msg_ptr;
-	bpf_map_update_elem(&rcv_msg1, &pid, &mq_rcv_info, BPF_ANY);//pid->u_msg_ptr	
+/*发送完成：队列已满时的阻塞等待、超时和被信号打断都在此之前，只统计成功的发送*/
+SEC("kretprobe/do_mq_timedsend")
+int BPF_KRETPROBE(mq_timedsend_exit,int ret){
+	int pid = bpf_get_current_pid_tgid();//发送端pid
+	struct mq_send_info *mq_send_info = bpf_map_lookup_elem(&send_msg, &pid);
+	if(!mq_send_info){
+		return 0;
+	}
 
+	if(ret == 0 && mq_send_info->msg_ptr){
+		u64 Key_msg_ptr = mq_send_info->msg_ptr;
+		struct mq_msg_info *msg_info = bpf_map_lookup_elem(&mq_msgs, &Key_msg_ptr);
+		if(msg_info)
+			msg_info->enqueue_time = bpf_ktime_get_ns();
+
+		struct mq_stat *stat = get_mq_stat(mq_send_info->ino);
+		if(stat){
+			stat->sent++;
+			stat->bytes_sent += mq_send_info->msg_len;
+		}
+	}
+	bpf_map_delete_elem(&send_msg,&pid);
 	return 0;
 }
-
+/*-----------------------------------------------------------------------------发送端--------------------------------------------------------------------------------------------------------*/
+/*																				分界   																										*/
+/*-----------------------------------------------------------------------------接收端--------------------------------------------------------------------------------------------------------*/                                                                                                                                                                                     
+/*接收端将消息块拷贝到用户态，即消息出队，计算该消息在队列中的驻留时间*/
 SEC("kprobe/store_msg")
 int BPF_KPROBE(store_msg,void __user *dest, struct msg_msg *msg, size_t len)
 {
-	int pid = bpf_get_current_pid_tgid();
-	
-	/*make key*/
 	u64 Key_msg_ptr = (u64)msg;
-	struct send_events *mq_send_info = bpf_map_lookup_elem(&send_msg2, &Key_msg_ptr);
-	if(!mq_send_info){
-		return 0;
-	}
-	
-	struct rcv_events *mq_rcv_info = bpf_map_lookup_elem(&rcv_msg1, &pid);
-	if(!mq_rcv_info){
+	struct mq_msg_info *msg_info = bpf_map_lookup_elem(&mq_msgs, &Key_msg_ptr);
+	if(!msg_info){
 		return 0;
 	}
-	/*拿到mq_rcv_info*/
-	if(dest == mq_rcv_info->u_msg_ptr && pid == mq_rcv_info->rcv_pid){
-		mq_rcv_info->Key_msg_ptr = Key_msg_ptr;
-		mq_rcv_info->dest = dest;
-		mq_rcv_info->msg_prio = BPF_CORE_READ(msg,m_type);
-		mq_rcv_info->msg_len = BPF_CORE_READ(msg,m_ts);
-	}else{
-		return 0;
+
+	u64 residency = (bpf_ktime_get_ns() - msg_info->enqueue_time) / 1000;
+	struct mq_stat *stat = get_mq_stat(msg_info->ino);
+	if(stat){
+		stat->received++;
+		stat->bytes_received += BPF_CORE_READ(msg,m_ts);
+		stat->residency_sum += residency;
+		if(residency > stat->residency_max)
+			stat->residency_max = residency;
+		stat->slots[log2_slot(residency)]++;
 	}
+	bpf_map_delete_elem(&mq_msgs, &Key_msg_ptr);
 	return 0;
 }
 
-SEC("kretprobe/do_mq_timedreceive")
-int BPF_KRETPROBE(do_mq_timedreceive_exit,void *ret){
-	u64 rcv_exit_time = bpf_ktime_get_ns();
-	int pid = bpf_get_current_pid_tgid();
-	u64 send_enter_time,delay;
-	u64 Key;
-	
-	/*获取发送端、接收端信息*/
-	struct rcv_events *mq_rcv_info = bpf_map_lookup_elem(&rcv_msg1, &pid);
-	if(!mq_rcv_info){
-		return 0;
-	}	
-	Key = mq_rcv_info->Key_msg_ptr;
-	struct send_events *mq_send_info = bpf_map_lookup_elem(&send_msg2,&Key);
-	if(!mq_send_info){
-		return 0;
-	}
+/*消息块被释放（已接收、发送失败或队列被删除），删除其入队信息*/
+SEC("kprobe/free_msg")
+int BPF_KPROBE(free_msg,struct msg_msg *msg)
+{
+	u64 Key_msg_ptr = (u64)msg;
 
-	send_enter_time = mq_send_info->send_enter_time;
-	delay = rcv_exit_time - send_enter_time;
-
-	/*ringbuffer传值*/
-	struct mq_events *e;
-	e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
-	if (!e)	return 0;
-	e->send_pid = mq_send_info->send_pid;
-	e->rcv_pid = pid;
-	e->mqdes = mq_send_info->mqdes;
-		e->msg_len = mq_send_info->msg_len;
-		e->msg_prio = mq_send_info->msg_prio;
-
-		e->send_enter_time = mq_send_info->send_enter_time;
-
-		e->rcv_enter_time = mq_rcv_info->rcv_enter_time;
-		e->rcv_exit_time = rcv_exit_time;
-		e->delay = delay;
-	bpf_ringbuf_submit(e, 0);
-	bpf_map_delete_elem(&send_msg2, &Key);//暂时性删除
-	bpf_map_delete_elem(&rcv_msg1,&pid);//删除rcv_msg1  map;
+	bpf_map_delete_elem(&mq_msgs, &Key_msg_ptr);
 	return 0;
-
 }
@@ -3,6 +3,7 @@
 #include <bpf/bpf_core_read.h>
 #include <bpf/bpf_tracing.h>
 #include "cpu_watcher.h"
+#include "bits.bpf.h"
 
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
@@ -10,11 +11,8 @@ char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
 // 记录时间戳
 BPF_HASH(preemptTime, pid_t, u64, 4096);
-
-struct {
-    __uint(type, BPF_MAP_TYPE_RINGBUF);
-    __uint(max_entries, 256 * 1024);
-} rb SEC(".maps");
+// 抢占时长的每CPU直方图(ns)
+BPF_PERCPU_ARRAY(hists, int, struct hist, 1);
 
 SEC("tp_btf/sched_switch")
 int BPF_PROG(sched_switch, bool preempt, struct task_struct *prev, struct task_struct *next) {
@@ -41,16 +39,15 @@ int BPF_KPROBE(finish_task_switch, struct task_struct *prev) {
     val = bpf_map_lookup_elem(&preemptTime, &pid);
     if (val) {
         u64 delta = end_time - *val;
-        struct preempt_event *e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
-        if (!e) {
+        int key = 0;
+        bpf_map_delete_elem(&preemptTime, &pid);
+        struct hist *h = bpf_map_lookup_elem(&hists, &key);
+        if (!h) {
             return 0;
-        }   
-        e->prev_pid = pid;
-        e->next_pid = bpf_get_current_pid_tgid() >> 32;
-        e->duration = delta;
-        bpf_get_current_comm(&e->comm, sizeof(e->comm));
-        bpf_ringbuf_submit(e, 0);
-        bpf_map_delete_elem(&preemptTime, &pid);    
+        }
+        h->slots[log2_slot(delta)]++;
+        h->count++;
+        h->sum += delta;
     }
     
     return 0;
@@ -11,29 +11,30 @@ const volatile long long unsigned int forks_addr = 0;
 #define PF_IDLE			0x00000002	/* I am an IDLE thread */
 #define PF_KTHREAD		0x00200000	/* I am a kernel thread */
 
-// 计数表格，第0项为所统计fork数，第1项为进程切换数
-BPF_ARRAY(countMap,int,u64,3);
-// 记录开始的时间
-BPF_ARRAY(procStartTime,pid_t,u64,4096);
-//存储运行队列长度
-BPF_ARRAY(runqlen,u32,int,1);
-//记录软中断开始时间
-BPF_HASH(softirqCpuEnterTime,u32,u64,4096);
-//记录软中断结束时间
-BPF_HASH(softirqLastTime,u32,u64,1);
-// 记录开始的时间
-BPF_HASH(irq_cpu_enter_start,u32,u64,8192);
-//记录上次中断时间
-BPF_ARRAY(irq_Last_time,u32,u64,1);
+// 以下累计值均为每CPU数组，各CPU只修改自己的副本，由用户态按CPU汇总
+// 计数表格，第0项为进程切换数，第1项为读取到的fork总数
+BPF_PERCPU_ARRAY(countMap,int,u64,3);
+// 记录进程开始运行的时间，以pid为键，进程下CPU时删除
+BPF_HASH(procStartTime,pid_t,u64,MAX_ENTRIES);
+//存储各CPU运行队列长度，以CPU号为键
+BPF_ARRAY(runqlen,u32,int,MAX_CPU_NR);
+//记录软中断开始时间（同一CPU上软中断不会嵌套）
+BPF_PERCPU_ARRAY(softirqCpuEnterTime,u32,u64,1);
+//记录软中断累计时间
+BPF_PERCPU_ARRAY(softirqLastTime,u32,u64,1);
+// 记录硬中断开始时间
+BPF_PERCPU_ARRAY(irq_cpu_enter_start,u32,u64,1);
+//记录硬中断累计时间
+BPF_PERCPU_ARRAY(irq_Last_time,u32,u64,1);
 // 储存cpu进入空闲的起始时间
-BPF_ARRAY(idleStart,u32,u64,128);
+BPF_PERCPU_ARRAY(idleStart,u32,u64,1);
 // 储存cpu进入空闲的持续时间
-BPF_ARRAY(idleLastTime,u32,u64,1);
+BPF_PERCPU_ARRAY(idleLastTime,u32,u64,1);
 // 储存cpu运行内核线程的时间
-BPF_ARRAY(kt_LastTime,u32,u64,1);
+BPF_PERCPU_ARRAY(kt_LastTime,u32,u64,1);
 // 储存cpu运行用户线程的时间
-BPF_ARRAY(ut_LastTime,u32,u64,1);
-BPF_ARRAY(tick_user,u32,u64,1);
+BPF_PERCPU_ARRAY(ut_LastTime,u32,u64,1);
+BPF_PERCPU_ARRAY(tick_user,u32,u64,1);
 BPF_ARRAY(symAddr,u32,u64,1);
 // 统计fork数
 //SEC("kprobe/finish_task_switch.isra.0")
@@ -60,17 +61,15 @@ int trace_sched_switch2(struct cswch_args *info) {
 	pid_t prev = info->prev_pid, next = info->next_pid;
 	if (prev != next) {
 		u32 key = 0;
-		u64 *valp, delta, cur;
-		struct task_struct *ts;
+		u64 *valp;
 		pid_t pid = next;
 		u64 time = bpf_ktime_get_ns();
-		bpf_map_update_elem(&procStartTime,&pid,&time,BPF_ANY);
+		// 各CPU的idle进程pid均为0，不记录
+		if (pid != 0)
+			bpf_map_update_elem(&procStartTime,&pid,&time,BPF_ANY);
 		valp =  bpf_map_lookup_elem(&countMap,&key);
-		if (!valp) {
-			u64 initval = 1;
-			bpf_map_update_elem(&countMap,&key,&initval,BPF_ANY);
-		}
-		else *valp += 1;
+		if (valp)
+			*valp += 1;
 	}
 	return 0;
 }
@@ -79,28 +78,26 @@ SEC("kprobe/finish_task_switch")
 //SEC("kprobe/finish_task_switch.isra.0")
 int BPF_KPROBE(finish_task_switch,struct task_struct *prev){
 	pid_t pid=BPF_CORE_READ(prev,pid);
+	unsigned int flags = BPF_CORE_READ(prev,flags);
 	u64 *val, time = bpf_ktime_get_ns();
 	u64 delta;
-	// 记录内核进程（非IDLE）运行时间
-	if ((BPF_CORE_READ(prev,flags) & PF_KTHREAD) && pid!= 0) {
-		val = bpf_map_lookup_elem(&procStartTime, &pid);
-		if (val) {
-			u32 key = 0;
-			delta = time - *val;
-			val = bpf_map_lookup_elem(&kt_LastTime, &key);
-			if (val) *val += delta;
-			else bpf_map_update_elem(&kt_LastTime, &key, &delta, BPF_ANY);
-		}// 记录用户进程的运行时间
-	}else if (!(BPF_CORE_READ(prev,flags) & PF_KTHREAD) && !(BPF_CORE_READ(prev,flags) &PF_IDLE)) {
-		val = bpf_map_lookup_elem(&procStartTime, &pid);
-		if (val) {
-		u32 key = 0;
- 		delta = (time - *val);
- 		val = bpf_map_lookup_elem(&ut_LastTime, &key);
-		if (val) *val += delta;
- 		else bpf_map_update_elem(&ut_LastTime, &key, &delta, BPF_ANY);
-		}
-	} 
+	u32 key = 0;
+
+	if (pid == 0 || (flags & PF_IDLE))
+		return 0;
+	val = bpf_map_lookup_elem(&procStartTime, &pid);
+	if (!val)
+		return 0;
+	delta = time - *val;
+	bpf_map_delete_elem(&procStartTime, &pid);
+
+	// 记录内核进程（非IDLE）运行时间，否则记录用户进程的运行时间
+	if (flags & PF_KTHREAD)
+		val = bpf_map_lookup_elem(&kt_LastTime, &key);
+	else
+		val = bpf_map_lookup_elem(&ut_LastTime, &key);
+	if (val)
+		*val += delta;
 	return 0;
 
 }
@@ -108,8 +105,8 @@ int BPF_KPROBE(finish_task_switch,struct task_struct *prev){
 //统计运行队列长度
 SEC("kprobe/update_rq_clock")
 int BPF_KPROBE(update_rq_clock,struct rq *rq){
-    u32 key = 0;
-    u64 val = BPF_CORE_READ(rq,nr_running);
+    u32 key = BPF_CORE_READ(rq,cpu);
+    int val = BPF_CORE_READ(rq,nr_running);
     bpf_map_update_elem(&runqlen,&key,&val,BPF_ANY);
     return 0;
 }
@@ -117,7 +114,7 @@ int BPF_KPROBE(update_rq_clock,struct rq *rq){
 //软中断
 SEC("tracepoint/irq/softirq_entry")
 int trace_softirq_entry(struct __softirq_info *info) {
-	u32 key = info->vec;
+	u32 key = 0;
 	u64 val = bpf_ktime_get_ns();
 	bpf_map_update_elem(&softirqCpuEnterTime, &key, &val, BPF_ANY);
 	return 0;
@@ -125,25 +122,23 @@ int trace_softirq_entry(struct __softirq_info *info) {
 
 SEC("tracepoint/irq/softirq_exit")
 int trace_softirq_exit(struct __softirq_info *info) {
-	u32 key = info->vec;
+	u32 key = 0;
 	u64 now = bpf_ktime_get_ns(), *valp = 0;
 	valp =bpf_map_lookup_elem(&softirqCpuEnterTime, &key);
-	if (valp) {
+	if (valp && *valp) {
 		// 找到表项
 		u64 last_time = now - *valp;
-		u32 key0 = 0;
-		valp = bpf_map_lookup_elem(&softirqLastTime, &key0);
-		if (!valp) bpf_map_update_elem(&softirqLastTime, &key0, &last_time, BPF_ANY);
-		else *valp += last_time;
+		*valp = 0;
+		valp = bpf_map_lookup_elem(&softirqLastTime, &key);
+		if (valp) *valp += last_time;
 	}	
 	return 0;
 }
 
-/*irqtime：CPU响应irq中断所占用的时间。
-注意这是所有CPU时间的叠加，平均到每个CPU应该除以CPU个数。*/
+/*irqtime：CPU响应irq中断所占用的时间，按CPU分别累计。*/
 SEC("tracepoint/irq/irq_handler_entry")
 int trace_irq_handler_entry(struct __irq_info *info) {
-	u32 key = info->irq;
+	u32 key = 0;
 	u64 ts = bpf_ktime_get_ns();
     bpf_map_update_elem(&irq_cpu_enter_start, &key, &ts, BPF_ANY);
 	return 0;
@@ -151,16 +146,14 @@ int trace_irq_handler_entry(struct __irq_info *info) {
 
 SEC("tracepoint/irq/irq_handler_exit")
 int trace_irq_handler_exit(struct __irq_info *info) {
-	u32 key = info->irq;
+	u32 key = 0;
 	u64 now = bpf_ktime_get_ns(), *ts = 0;
     ts = bpf_map_lookup_elem(&irq_cpu_enter_start, &key);
-	if (ts) {
+	if (ts && *ts) {
         u64 last_time = now - *ts;
-	    u32 key0 = 0;
-		ts = bpf_map_lookup_elem(&irq_Last_time, &key0);
-		if (!ts)   
-			 bpf_map_update_elem(&irq_Last_time, &key0, &last_time, BPF_ANY);
-		else        
+		*ts = 0;
+		ts = bpf_map_lookup_elem(&irq_Last_time, &key);
+		if (ts)
 			*ts += last_time;
 	}
 	return 0;
@@ -171,18 +164,17 @@ int trace_irq_handler_exit(struct __irq_info *info) {
 SEC("tracepoint/power/cpu_idle")
 int trace_cpu_idle(struct idleStruct *pIDLE) {
 	u64 delta, time = bpf_ktime_get_ns();
-	u32 key = pIDLE->cpu_id;
+	u32 key = 0;
+	// cpu_idle 在进入/退出空闲的CPU上触发，直接使用每CPU数组
 	if (pIDLE->state == -1) {
 		u64 *valp = bpf_map_lookup_elem(&idleStart,&key);
 		if (valp && *valp != 0) {
 			delta = time - *valp;
-			key = 0;
+			*valp = 0;
 			valp = bpf_map_lookup_elem(&idleLastTime,&key);
 			if (valp) *valp += delta;
-			else bpf_map_update_elem(&idleLastTime,&key,&delta,BPF_ANY);//初次记录持续空闲时间;
 		}
 	} else {
-		u64 val = time;
 		bpf_map_update_elem(&idleStart,&key,&time,BPF_ANY);
 	}
 	return 0;
@@ -206,10 +198,8 @@ int tick_update(struct pt_regs *ctx) {
 
 	// 记录用户态时间，直接从头文件arch/x86/include/asm/ptrace.h中引用
 	if (user_mode(ctx)) {
-		u64 initval = 1;
 		valp = bpf_map_lookup_elem(&tick_user, &key);
 		if (valp) *valp += 1;
-		else bpf_map_update_elem(&tick_user, &key, &initval, BPF_ANY);
 	}
 
 	unsigned long total_forks;
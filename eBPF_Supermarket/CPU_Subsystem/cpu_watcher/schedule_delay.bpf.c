@@ -3,13 +3,18 @@
 #include <bpf/bpf_core_read.h>
 #include <bpf/bpf_tracing.h>
 #include "cpu_watcher.h"
+#include "bits.bpf.h"
 
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
 #define TASK_RUNNING			0x0000
 
 BPF_HASH(has_scheduled,struct proc_id, bool, 10240);
 BPF_HASH(enter_schedule,struct proc_id, struct schedule_event, 10240);
-BPF_ARRAY(sys_schedule,int,struct sum_schedule,1);
+BPF_PERCPU_ARRAY(sys_schedule,int,struct sum_schedule,1);//按CPU累计，由用户态合并
+//调度延迟热力图：每CPU的时间槽环，每个槽记录该时间段内的log2(us)延迟分布
+BPF_PERCPU_ARRAY(heatmap,u32,struct heat_slot,HEATMAP_SLOTS);
+
+const volatile u64 heatmap_slot_ns = 0;//热力图时间槽宽度，0表示不记录热力图
 
 
 SEC("tp_btf/sched_wakeup")
@@ -107,16 +112,7 @@ int BPF_PROG(sched_switch, bool preempt, struct task_struct *prev, struct task_s
     }   
     delay = current_time - schedule_event->enter_time;
     sum_schedule = bpf_map_lookup_elem(&sys_schedule, &key);
-    if (!sum_schedule) {
-        struct sum_schedule sum_schedule= {};
-        sum_schedule.sum_count++;
-        sum_schedule.sum_delay += delay;
-        if (delay > sum_schedule.max_delay)
-            sum_schedule.max_delay = delay;
-        if (sum_schedule.min_delay == 0 || delay < sum_schedule.min_delay)
-            sum_schedule.min_delay = delay;
-        bpf_map_update_elem(&sys_schedule, &key, &sum_schedule, BPF_ANY);
-    } else {
+    if (sum_schedule) {
         sum_schedule->sum_count++;
         sum_schedule->sum_delay += delay;
         if (delay > sum_schedule->max_delay)
@@ -124,6 +120,19 @@ int BPF_PROG(sched_switch, bool preempt, struct task_struct *prev, struct task_s
         if (sum_schedule->min_delay == 0 || delay < sum_schedule->min_delay)
             sum_schedule->min_delay = delay;
     }
+    if (heatmap_slot_ns) {
+        u64 slot_id = current_time / heatmap_slot_ns;
+        u32 idx = slot_id % HEATMAP_SLOTS;
+        struct heat_slot *slot = bpf_map_lookup_elem(&heatmap, &idx);
+        if (slot) {
+            //环中的槽已属于更早的时间段，重新开始计数
+            if (slot->slot_id != slot_id) {
+                __builtin_memset(slot->buckets, 0, sizeof(slot->buckets));
+                slot->slot_id = slot_id;
+            }
+            slot->buckets[log2_slot(delay / 1000)]++;
+        }
+    }
     return 0;
 }
 
@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+# Copyright 2023 The LMP Authors.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# 将 cpu_watcher -H 记录的调度延迟热力图文件转换为本地可以打开的 HTML/SVG
+#
+# 用法: ./heatmap.py heatmap.data -o heatmap.html [--cpus 0,2-3] [--merge 10]
+
+import argparse
+import math
+import struct
+import sys
+import time
+from html import escape
+
+HEADER = struct.Struct('<4sIIIQq')
+RECORD = struct.Struct('<QII')
+CELL_W = 4
+CELL_H = 12
+LABEL_W = 110
+
+
+def load(path):
+    """返回 (header, {cpu: {slot_id: [counts...]}})"""
+    with open(path, 'rb') as f:
+        data = f.read()
+    magic, version, nr_cpus, nr_buckets, slot_ns, mono_to_real = HEADER.unpack_from(data, 0)
+    if magic != b'CWHM' or version != 1:
+        sys.exit('%s: not a cpu_watcher heatmap file' % path)
+    hdr = dict(nr_cpus=nr_cpus, nr_buckets=nr_buckets, slot_ns=slot_ns, mono_to_real=mono_to_real)
+    cpus = {}
+    off = HEADER.size
+    while off + RECORD.size <= len(data):
+        slot_id, cpu, mask = RECORD.unpack_from(data, off)
+        off += RECORD.size
+        n = bin(mask).count('1')
+        counts = struct.unpack_from('<%dI' % n, data, off)
+        off += 4 * n
+        buckets = [0] * nr_buckets
+        i = 0
+        for b in range(nr_buckets):
+            if mask & (1 << b):
+                buckets[b] = counts[i]
+                i += 1
+        cpus.setdefault(cpu, {})[slot_id] = buckets
+    return hdr, cpus
+
+
+def parse_cpus(spec):
+    cpus = set()
+    for part in spec.split(','):
+        if '-' in part:
+            lo, hi = part.split('-')
+            cpus.update(range(int(lo), int(hi) + 1))
+        elif part:
+            cpus.add(int(part))
+    return cpus
+
+
+def merge(slots, nr_buckets, width):
+    """按 width 个时间槽合并为一列"""
+    cols = {}
+    for slot_id, buckets in slots.items():
+        col = cols.setdefault(slot_id // width, [0] * nr_buckets)
+        for b, v in enumerate(buckets):
+            col[b] += v
+    return cols
+
+
+def bucket_label(b):
+    lo = (1 << b) if b else 0
+    return '%d-%dus' % (lo, (1 << (b + 1)) - 1)
+
+
+def color(v, vmax):
+    # 以对数刻度映射到由浅黄到深红的颜色
+    if not v:
+        return '#f8f8f8'
+    t = math.log(v + 1) / math.log(vmax + 1)
+    return 'rgb(%d,%d,%d)' % (255, int(230 - 200 * t), int(120 - 120 * t))
+
+
+def render(title, cols, first, last, lo, hi, hdr, width):
+    ncols = last - first + 1
+    nrows = hi - lo + 1
+    vmax = max((max(c[lo:hi + 1]) for c in cols.values()), default=0)
+    w = LABEL_W + ncols * CELL_W + 10
+    h = nrows * CELL_H + 40
+    out = ['<h3>%s</h3>' % escape(title),
+           '<svg xmlns="http://www.w3.org/2000/svg" width="%d" height="%d">' % (w, h)]
+    for r, b in enumerate(range(hi, lo - 1, -1)):
+        y = r * CELL_H
+        out.append('<text x="0" y="%d" font-size="10">%s</text>' % (y + CELL_H - 2, bucket_label(b)))
+        for col, buckets in cols.items():
+            v = buckets[b]
+            if not v:
+                continue
+            x = LABEL_W + (col - first) * CELL_W
+            ts = (col * width * hdr['slot_ns'] + hdr['mono_to_real']) / 1e9
+            stamp = time.strftime('%H:%M:%S', time.localtime(ts)) + '.%03d' % (ts * 1000 % 1000)
+            out.append('<rect x="%d" y="%d" width="%d" height="%d" fill="%s"><title>%s %s: %d</title></rect>'
+                       % (x, y, CELL_W, CELL_H, color(v, vmax), stamp, bucket_label(b), v))
+    # 时间轴，每 100 列标注一次
+    for c in range(0, ncols, 100):
+        ts = ((first + c) * width * hdr['slot_ns'] + hdr['mono_to_real']) / 1e9
+        out.append('<text x="%d" y="%d" font-size="10">%s</text>'
+                   % (LABEL_W + c * CELL_W, nrows * CELL_H + 14, time.strftime('%H:%M:%S', time.localtime(ts))))
+    out.append('</svg>')
+    return '\n'.join(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Render a cpu_watcher schedule delay heatmap as HTML/SVG')
+    parser.add_argument('input', help='file recorded by cpu_watcher -H')
+    parser.add_argument('-o', '--output', default='heatmap.html', help='output html file')
+    parser.add_argument('--cpus', help='only render these cpus, e.g. 0,2-3')
+    parser.add_argument('--merge', type=int, default=1, help='merge N time slots into one column')
+    parser.add_argument('--all-only', action='store_true', help='only render the merged heatmap of all cpus')
+    args = parser.parse_args()
+
+    hdr, cpus = load(args.input)
+    if not cpus:
+        sys.exit('%s: no schedule delay recorded' % args.input)
+    if args.cpus:
+        wanted = parse_cpus(args.cpus)
+        cpus = {c: s for c, s in cpus.items() if c in wanted}
+        if not cpus:
+            sys.exit('%s: none of cpus %s recorded any schedule delay' % (args.input, args.cpus))
+
+    width = max(args.merge, 1)
+    per_cpu = {c: merge(s, hdr['nr_buckets'], width) for c, s in cpus.items()}
+    total = {}
+    for cols in per_cpu.values():
+        for col, buckets in cols.items():
+            t = total.setdefault(col, [0] * hdr['nr_buckets'])
+            for b, v in enumerate(buckets):
+                t[b] += v
+
+    # 所有图使用相同的时间轴和延迟范围，便于上下对比
+    used = [b for buckets in total.values() for b, v in enumerate(buckets) if v]
+    if not used:
+        sys.exit('%s: no schedule delay recorded on the selected cpus' % args.input)
+    first, last = min(total), max(total)
+    lo, hi = min(used), max(used)
+
+    body = [render('all cpus', total, first, last, lo, hi, hdr, width)]
+    if not args.all_only:
+        for c in sorted(per_cpu):
+            body.append(render('cpu %d' % c, per_cpu[c], first, last, lo, hi, hdr, width))
+
+    with open(args.output, 'w') as f:
+        f.write('<!DOCTYPE html>\n<html><head><meta charset="utf-8"><title>schedule delay heatmap</title></head>\n')
+        f.write('<body style="font-family:monospace">\n<h2>schedule delay heatmap (slot %d ms)</h2>\n'
+                % (hdr['slot_ns'] * width // 1000000))
+        f.write('\n'.join(body))
+        f.write('\n</body></html>\n')
+    print('wrote %s' % args.output)
+
+
+if __name__ == '__main__':
+    main()
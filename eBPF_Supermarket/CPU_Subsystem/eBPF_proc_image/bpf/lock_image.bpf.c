@@ -21,18 +21,41 @@
 #include <bpf/bpf_core_read.h>
 #include <bpf/bpf_tracing.h>
 #include "proc_image.h"
-#include "lock_image.h"
+#include "bits.bpf.h"
 
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
 const volatile pid_t ignore_tgid = -1;
 const volatile int target_tgid = -1;
+// 为 true 时只在内核中聚合锁竞争统计，不输出逐事件记录
+const volatile bool lock_stats = false;
+// 等待时间超过该阈值（ns）的加锁计为一次竞争
+const volatile u64 contention_ns = 10000;
+
+#define FUTEX_WAIT		0
+#define FUTEX_WAKE		1
+#define FUTEX_LOCK_PI		6
+#define FUTEX_UNLOCK_PI		7
+#define FUTEX_WAIT_BITSET	9
+#define FUTEX_WAKE_BITSET	10
+#define FUTEX_WAIT_REQUEUE_PI	11
+#define FUTEX_LOCK_PI2		13
+#define FUTEX_CMD_MASK		~(128 | 256)
+
+#define SOFTIRQ_OFFSET		(1U << 8)
+#define HARDIRQ_MASK		(0xfU << 16)
+#define NMI_MASK		(0xfU << 20)
+
+// 当前CPU的 preempt_count：x86 上 6.2~6.14 内核位于 pcpu_hot 中，其余版本为 __preempt_count，
+// 两者都不存在的架构上不区分中断上下文
+extern struct pcpu_hot pcpu_hot __ksym __weak;
+extern const int __preempt_count __ksym __weak;
 
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
 	__uint(max_entries, 10240);
 	__type(key, struct proc_flag);
-	__type(value, u64);
+	__type(value, struct lock_wait);
 } proc_lock SEC(".maps");
 
 struct {
@@ -54,11 +77,45 @@ struct {
 	__uint(max_entries,256 * 10240);
 } lock_rb SEC(".maps");
 
+// 线程当前持有的锁
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 10240);
+	__type(key, struct lock_hold_key);
+	__type(value, struct lock_hold);
+} lock_holds SEC(".maps");
+
+// 线程正在等待的内核锁，按 (pid, 锁地址) 区分嵌套的竞争
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 10240);
+	__type(key, struct lock_hold_key);
+	__type(value, struct lock_hold);
+} kernel_lock_waits SEC(".maps");
+
+// 按锁地址聚合的每CPU竞争统计，用户态定期汇总并清空
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__uint(max_entries, 10240);
+	__type(key, struct lock_key);
+	__type(value, struct lock_stat);
+} lock_stat_map SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_STACK_TRACE);
+	__uint(max_entries, 10240);
+	__uint(key_size, sizeof(u32));
+	__uint(value_size, LOCK_STACK_DEPTH * sizeof(u64));
+} lock_stacks SEC(".maps");
+
+#include "lock_image.h"
+
 // 用户态互斥锁
 SEC("uprobe/pthread_mutex_lock")
 int BPF_KPROBE(pthread_mutex_lock_enter, void *__mutex)
 {
-    record_lock_enter(target_tgid,ignore_tgid,1,1,__mutex,&lock_rb,&proc_lock);
+    record_lock_enter(ctx,target_tgid,ignore_tgid,1,1,__mutex,&lock_rb,&proc_lock);
 
     return 0;
 }
@@ -66,7 +123,7 @@ int BPF_KPROBE(pthread_mutex_lock_enter, void *__mutex)
 SEC("uretprobe/pthread_mutex_lock")
 int BPF_KRETPROBE(pthread_mutex_lock_exit,int ret)
 {
-    record_lock_exit(target_tgid,ignore_tgid,2,1,ret,&lock_rb,&proc_lock,&locktype);
+    record_lock_exit(ctx,target_tgid,ignore_tgid,2,1,ret,&lock_rb,&proc_lock,&locktype);
 
     return 0;
 }
@@ -74,7 +131,7 @@ int BPF_KRETPROBE(pthread_mutex_lock_exit,int ret)
 SEC("uprobe/__pthread_mutex_trylock")
 int BPF_KPROBE(__pthread_mutex_trylock_enter, void *__mutex)
 {
-    record_lock_enter(target_tgid,ignore_tgid,1,1,__mutex,&lock_rb,&proc_lock);
+    record_lock_enter(ctx,target_tgid,ignore_tgid,1,1,__mutex,&lock_rb,&proc_lock);
 
     return 0;
 }
@@ -82,7 +139,7 @@ int BPF_KPROBE(__pthread_mutex_trylock_enter, void *__mutex)
 SEC("uretprobe/__pthread_mutex_trylock")
 int BPF_KRETPROBE(__pthread_mutex_trylock_exit,int ret)
 {
-    record_lock_exit(target_tgid,ignore_tgid,2,1,ret,&lock_rb,&proc_lock,&locktype);
+    record_lock_exit(ctx,target_tgid,ignore_tgid,2,1,ret,&lock_rb,&proc_lock,&locktype);
     
     return 0;
 }
@@ -100,7 +157,7 @@ int BPF_KPROBE(pthread_mutex_unlock_enter, void *__rwlock)
 SEC("uretprobe/pthread_mutex_unlock")
 int BPF_KRETPROBE(pthread_mutex_unlock_exit)
 {
-    record_unlock_exit(target_tgid,ignore_tgid,3,1,&lock_rb,&proc_unlock,&locktype);
+    record_unlock_exit(ctx,target_tgid,ignore_tgid,3,1,&lock_rb,&proc_unlock,&locktype);
     
     return 0;
 }
@@ -109,7 +166,7 @@ int BPF_KRETPROBE(pthread_mutex_unlock_exit)
 SEC("uprobe/__pthread_rwlock_rdlock")
 int BPF_KPROBE(__pthread_rwlock_rdlock_enter, void *__rwlock)
 {
-    record_lock_enter(target_tgid,ignore_tgid,4,2,__rwlock,&lock_rb,&proc_lock);
+    record_lock_enter(ctx,target_tgid,ignore_tgid,4,2,__rwlock,&lock_rb,&proc_lock);
 
     return 0;
 }
@@ -117,7 +174,7 @@ int BPF_KPROBE(__pthread_rwlock_rdlock_enter, void *__rwlock)
 SEC("uretprobe/__pthread_rwlock_rdlock")
 int BPF_KRETPROBE(__pthread_rwlock_rdlock_exit,int ret)
 {
-    record_lock_exit(target_tgid,ignore_tgid,5,2,ret,&lock_rb,&proc_lock,&locktype);
+    record_lock_exit(ctx,target_tgid,ignore_tgid,5,2,ret,&lock_rb,&proc_lock,&locktype);
 
     return 0;
 }
@@ -125,7 +182,7 @@ int BPF_KRETPROBE(__pthread_rwlock_rdlock_exit,int ret)
 SEC("uprobe/__pthread_rwlock_tryrdlock")
 int BPF_KPROBE(__pthread_rwlock_tryrdlock_enter, void *__rwlock)
 {
-    record_lock_enter(target_tgid,ignore_tgid,4,2,__rwlock,&lock_rb,&proc_lock);
+    record_lock_enter(ctx,target_tgid,ignore_tgid,4,2,__rwlock,&lock_rb,&proc_lock);
     
     return 0;
 }
@@ -133,7 +190,7 @@ int BPF_KPROBE(__pthread_rwlock_tryrdlock_enter, void *__rwlock)
 SEC("uretprobe/__pthread_rwlock_tryrdlock")
 int BPF_KRETPROBE(__pthread_rwlock_tryrdlock_exit,int ret)
 {
-    record_lock_exit(target_tgid,ignore_tgid,5,2,ret,&lock_rb,&proc_lock,&locktype);
+    record_lock_exit(ctx,target_tgid,ignore_tgid,5,2,ret,&lock_rb,&proc_lock,&locktype);
 
     return 0;
 }
@@ -141,7 +198,7 @@ int BPF_KRETPROBE(__pthread_rwlock_tryrdlock_exit,int ret)
 SEC("uprobe/__pthread_rwlock_wrlock")
 int BPF_KPROBE(__pthread_rwlock_wrlock_enter, void *__rwlock)
 {
-    record_lock_enter(target_tgid,ignore_tgid,7,2,__rwlock,&lock_rb,&proc_lock);
+    record_lock_enter(ctx,target_tgid,ignore_tgid,7,2,__rwlock,&lock_rb,&proc_lock);
     
     return 0;
 }
@@ -149,7 +206,7 @@ int BPF_KPROBE(__pthread_rwlock_wrlock_enter, void *__rwlock)
 SEC("uretprobe/__pthread_rwlock_wrlock")
 int BPF_KRETPROBE(__pthread_rwlock_wrlock_exit,int ret)
 {
-    record_lock_exit(target_tgid,ignore_tgid,8,2,ret,&lock_rb,&proc_lock,&locktype);
+    record_lock_exit(ctx,target_tgid,ignore_tgid,8,2,ret,&lock_rb,&proc_lock,&locktype);
 
     return 0;
 }
@@ -157,7 +214,7 @@ int BPF_KRETPROBE(__pthread_rwlock_wrlock_exit,int ret)
 SEC("uprobe/__pthread_rwlock_trywrlock")
 int BPF_KPROBE(__pthread_rwlock_trywrlock_enter, void *__rwlock)
 {
-    record_lock_enter(target_tgid,ignore_tgid,7,2,__rwlock,&lock_rb,&proc_lock);
+    record_lock_enter(ctx,target_tgid,ignore_tgid,7,2,__rwlock,&lock_rb,&proc_lock);
 
     return 0;
 }
@@ -165,7 +222,7 @@ int BPF_KPROBE(__pthread_rwlock_trywrlock_enter, void *__rwlock)
 SEC("uretprobe/__pthread_rwlock_trywrlock")
 int BPF_KRETPROBE(__pthread_rwlock_trywrlock_exit,int ret)
 {
-    record_lock_exit(target_tgid,ignore_tgid,8,2,ret,&lock_rb,&proc_lock,&locktype);
+    record_lock_exit(ctx,target_tgid,ignore_tgid,8,2,ret,&lock_rb,&proc_lock,&locktype);
 
     return 0;
 }
@@ -181,7 +238,7 @@ int BPF_KPROBE(__pthread_rwlock_unlock_enter, void *__rwlock)
 SEC("uretprobe/__pthread_rwlock_unlock")
 int BPF_KRETPROBE(__pthread_rwlock_unlock_exit)
 {
-    record_unlock_exit(target_tgid,ignore_tgid,0,2,&lock_rb,&proc_unlock,&locktype);
+    record_unlock_exit(ctx,target_tgid,ignore_tgid,0,2,&lock_rb,&proc_unlock,&locktype);
     
     return 0;
 }
@@ -190,7 +247,7 @@ int BPF_KRETPROBE(__pthread_rwlock_unlock_exit)
 SEC("uprobe/pthread_spin_lock")
 int BPF_KPROBE(pthread_spin_lock_enter, void *__spinlock)
 {
-    record_lock_enter(target_tgid,ignore_tgid,10,3,__spinlock,&lock_rb,&proc_lock);
+    record_lock_enter(ctx,target_tgid,ignore_tgid,10,3,__spinlock,&lock_rb,&proc_lock);
 
     return 0;
 }
@@ -198,7 +255,7 @@ int BPF_KPROBE(pthread_spin_lock_enter, void *__spinlock)
 SEC("uretprobe/pthread_spin_lock")
 int BPF_KRETPROBE(pthread_spin_lock_exit,int ret)
 {
-    record_lock_exit(target_tgid,ignore_tgid,11,3,ret,&lock_rb,&proc_lock,&locktype);
+    record_lock_exit(ctx,target_tgid,ignore_tgid,11,3,ret,&lock_rb,&proc_lock,&locktype);
 
     return 0;
 }
@@ -206,7 +263,7 @@ int BPF_KRETPROBE(pthread_spin_lock_exit,int ret)
 SEC("uprobe/pthread_spin_trylock")
 int BPF_KPROBE(pthread_spin_trylock_enter, void *__spinlock)
 {
-    record_lock_enter(target_tgid,ignore_tgid,10,3,__spinlock,&lock_rb,&proc_lock);
+    record_lock_enter(ctx,target_tgid,ignore_tgid,10,3,__spinlock,&lock_rb,&proc_lock);
 
     return 0;
 }
@@ -214,7 +271,7 @@ int BPF_KPROBE(pthread_spin_trylock_enter, void *__spinlock)
 SEC("uretprobe/pthread_spin_trylock")
 int BPF_KRETPROBE(pthread_spin_trylock_exit,int ret)
 {
-    record_lock_exit(target_tgid,ignore_tgid,11,3,ret,&lock_rb,&proc_lock,&locktype);
+    record_lock_exit(ctx,target_tgid,ignore_tgid,11,3,ret,&lock_rb,&proc_lock,&locktype);
     
     return 0;
 }
@@ -230,7 +287,103 @@ int BPF_KPROBE(pthread_spin_unlock_enter, void *__spinlock)
 SEC("uretprobe/pthread_spin_unlock")
 int BPF_KRETPROBE(pthread_spin_unlock_exit)
 {
-    record_unlock_exit(target_tgid,ignore_tgid,12,3,&lock_rb,&proc_unlock,&locktype);
+    record_unlock_exit(ctx,target_tgid,ignore_tgid,12,3,&lock_rb,&proc_unlock,&locktype);
     
     return 0;
-}
\ No newline at end of file
+}
+
+// futex：所有用户态锁（glibc、musl、Go 等）在竞争时都会进入 futex 等待
+SEC("tracepoint/syscalls/sys_enter_futex")
+int sys_enter_futex(struct trace_event_raw_sys_enter *ctx)
+{
+    pid_t pid = bpf_get_current_pid_tgid();
+    int tgid = bpf_get_current_pid_tgid() >> 32;
+    u64 uaddr = ctx->args[0];
+    int op = (int)ctx->args[1] & FUTEX_CMD_MASK;
+    int val = (int)ctx->args[2];
+
+    if(!lock_traced(tgid))
+        return 0;
+
+    switch(op){
+        case FUTEX_WAIT:
+            // glibc 的 lll_lock 和 Go 的 runtime.lock 在竞争时以锁字的值 2 等待，
+            // musl 的锁字竞争时最高位置 1；其余等待多为条件变量等，单独统计
+            record_contention_begin(pid,(val == 2 || val < 0) ? 4 : 6,uaddr);
+            break;
+        case FUTEX_WAIT_BITSET:
+            record_contention_begin(pid,6,uaddr);
+            break;
+        case FUTEX_LOCK_PI:
+        case FUTEX_LOCK_PI2:
+        case FUTEX_WAIT_REQUEUE_PI:
+            record_contention_begin(pid,4,uaddr);
+            break;
+        case FUTEX_WAKE:
+        case FUTEX_WAKE_BITSET:
+        case FUTEX_UNLOCK_PI:
+            record_lock_wake(ctx,tgid,uaddr,BPF_F_USER_STACK);
+            break;
+    }
+
+    return 0;
+}
+
+SEC("tracepoint/syscalls/sys_exit_futex")
+int sys_exit_futex(struct trace_event_raw_sys_exit *ctx)
+{
+    pid_t pid = bpf_get_current_pid_tgid();
+    int tgid = bpf_get_current_pid_tgid() >> 32;
+
+    if(!lock_traced(tgid))
+        return 0;
+
+    // 等待开始时只记录了 4、6 中的一种
+    record_contention_end(ctx,pid,tgid,4,BPF_F_USER_STACK);
+    record_contention_end(ctx,pid,tgid,6,BPF_F_USER_STACK);
+
+    return 0;
+}
+
+// 硬中断、软中断或 NMI 上下文中的锁竞争与被打断的线程无关
+static __always_inline bool in_irq_context(void)
+{
+    int pc = 0;
+
+    if(&pcpu_hot)
+        pc = ((struct pcpu_hot *)bpf_this_cpu_ptr(&pcpu_hot))->preempt_count;
+    else if(&__preempt_count)
+        pc = *(int *)bpf_this_cpu_ptr(&__preempt_count);
+
+    return pc & (NMI_MASK | HARDIRQ_MASK | SOFTIRQ_OFFSET);
+}
+
+// 内核锁竞争（mutex、rwsem、spinlock 等，需要 5.19 及以上内核），
+// 中断上下文中的竞争不计入被打断的线程
+SEC("tp_btf/contention_begin")
+int BPF_PROG(contention_begin, void *lock, unsigned int flags)
+{
+    pid_t pid = bpf_get_current_pid_tgid();
+    int tgid = bpf_get_current_pid_tgid() >> 32;
+
+    if(!lock_traced(tgid) || in_irq_context())
+        return 0;
+
+    record_kernel_contention_begin(pid,(u64)lock);
+
+    return 0;
+}
+
+SEC("tp_btf/contention_end")
+int BPF_PROG(contention_end, void *lock, int ret)
+{
+    pid_t pid = bpf_get_current_pid_tgid();
+    int tgid = bpf_get_current_pid_tgid() >> 32;
+
+    if(!lock_traced(tgid) || in_irq_context())
+        return 0;
+
+    record_kernel_contention_end(ctx,pid,tgid,(u64)lock);
+
+    return 0;
+}
@@ -56,8 +56,9 @@ struct {
 	__type(value,struct schedule_event);
 } tg_schedule SEC(".maps");
 
+// 系统的调度信息按CPU分别累计，避免所有CPU争用同一个条目，由用户态合并
 struct {
-	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
 	__uint(max_entries, 1);
 	__type(key, int);
 	__type(value, struct sum_schedule);
@@ -196,24 +197,14 @@ int BPF_PROG(sched_switch, bool preempt, struct task_struct *prev, struct task_s
     
     /* 记录系统的调度信息 */
     sum_schedule = bpf_map_lookup_elem(&sys_schedule,&key);
-    if(!sum_schedule){
-        struct sum_schedule sum_schedule = {};
-
-        sum_schedule.sum_count ++;
-        sum_schedule.sum_delay += this_delay;
-        if(this_delay > sum_schedule.max_delay)
-            sum_schedule.max_delay = this_delay;
-        if(sum_schedule.min_delay==0 || this_delay<sum_schedule.min_delay)
-            sum_schedule.min_delay = this_delay;
-        bpf_map_update_elem(&sys_schedule,&key,&sum_schedule,BPF_ANY);
-    }else{
-        sum_schedule->sum_count ++;
-        sum_schedule->sum_delay += this_delay;
-        if(this_delay > sum_schedule->max_delay)
-            sum_schedule->max_delay = this_delay;
-        if(sum_schedule->min_delay==0 || this_delay<sum_schedule->min_delay)
-            sum_schedule->min_delay = this_delay;
-    }
+    if(!sum_schedule)
+        return 0;
+    sum_schedule->sum_count ++;
+    sum_schedule->sum_delay += this_delay;
+    if(this_delay > sum_schedule->max_delay)
+        sum_schedule->max_delay = this_delay;
+    if(sum_schedule->min_delay==0 || this_delay<sum_schedule->min_delay)
+        sum_schedule->min_delay = this_delay;
 
     return 0;
 }
@@ -21,66 +21,53 @@
 #include <bpf/bpf_core_read.h>
 #include <bpf/bpf_tracing.h>
 #include "proc_image.h"
+#include "bits.bpf.h"
 
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
 const volatile pid_t target_pid = -1;
 const volatile pid_t target_tgid = -1;
-const volatile int syscalls = 0;
 const volatile pid_t ignore_tgid = -1;
 
+// 线程进入系统调用的时间
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
-	__uint(max_entries, 10240);
+	__uint(max_entries, 65536);
 	__type(key, pid_t);
-	__type(value,struct syscall_seq);
-} proc_syscall SEC(".maps");
+	__type(value, u64);
+} syscall_start SEC(".maps");
 
+// 按 (tgid, 系统调用号) 聚合的每CPU统计，用户态定期汇总并清空
 struct {
-	__uint(type, BPF_MAP_TYPE_RINGBUF);
-	__uint(max_entries,256 * 10240);
-} syscall_rb SEC(".maps");
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__uint(max_entries, 10240);
+	__type(key, struct syscall_key);
+	__type(value, struct syscall_stat);
+} syscall_stats SEC(".maps");
+
+static __always_inline bool trace_enabled(pid_t pid, int tgid)
+{
+	if(tgid == ignore_tgid)
+		return false;
+	if(target_tgid != -1)
+		return tgid == target_tgid;
+
+	return target_pid == -1 || pid == target_pid;
+}
 
 SEC("tracepoint/raw_syscalls/sys_enter")
 int sys_enter(struct trace_event_raw_sys_enter *args)
 {
     pid_t pid = bpf_get_current_pid_tgid();
     int tgid = bpf_get_current_pid_tgid() >> 32;
+    u64 current_time;
 
-    if(tgid!=ignore_tgid/* && (target_pid==-1 || pid==target_pid)*/){
-        u64 current_time = bpf_ktime_get_ns();
-        struct syscall_seq * syscall_seq;
-
-        syscall_seq = bpf_map_lookup_elem(&proc_syscall, &pid);
-        if(!syscall_seq){
-            struct syscall_seq syscall_seq = {};
-
-            syscall_seq.pid = pid;
-            syscall_seq.enter_time = current_time;
-            syscall_seq.count = 1;
-            if((target_tgid==-1 && (target_pid==-1 || pid==target_pid)) || 
-               (target_tgid!=-1 && tgid == target_tgid)){
-                syscall_seq.record_syscall[0] = (int)args->id;
-            }
-            
-            bpf_map_update_elem(&proc_syscall, &pid, &syscall_seq, BPF_ANY);
-        }else{
-            syscall_seq->enter_time = current_time;
-            if(syscall_seq->count == 0){
-                if((target_tgid==-1 && (target_pid==-1 || pid==target_pid)) || (target_tgid!=-1 && tgid == target_tgid)){
-                    syscall_seq->record_syscall[syscall_seq->count] = (int)args->id;
-                }
-                syscall_seq->count ++;
-            }else if (syscall_seq->count <= MAX_SYSCALL_COUNT-1 && syscall_seq->count > 0 && 
-                      syscall_seq->record_syscall+syscall_seq->count <= syscall_seq->record_syscall+(MAX_SYSCALL_COUNT-1)){
-                if((target_tgid==-1 && (target_pid==-1 || pid==target_pid)) || 
-                    (target_tgid!=-1 && tgid == target_tgid)){
-                    syscall_seq->record_syscall[syscall_seq->count] = (int)args->id;
-                }
-                syscall_seq->count ++;
-            }
-        }
-    }
+    if(!trace_enabled(pid, tgid))
+        return 0;
+
+    current_time = bpf_ktime_get_ns();
+    bpf_map_update_elem(&syscall_start, &pid, &current_time, BPF_ANY);
 
     return 0;
 }
@@ -90,76 +77,52 @@ int sys_exit(struct trace_event_raw_sys_exit *args)
 {
     pid_t pid = bpf_get_current_pid_tgid();
     int tgid = bpf_get_current_pid_tgid() >> 32;
-
-    if(tgid!=ignore_tgid/* && (target_pid==-1 || pid==target_pid)*/){
-        u64 current_time = bpf_ktime_get_ns();
-        long long unsigned int this_delay;
-        struct syscall_seq * syscall_seq;
-
-        syscall_seq = bpf_map_lookup_elem(&proc_syscall, &pid);
-        if(!syscall_seq){
+    struct syscall_key key = {};
+    struct syscall_stat *stat;
+    u64 *start, delay;
+
+    if(!trace_enabled(pid, tgid))
+        return 0;
+
+    start = bpf_map_lookup_elem(&syscall_start, &pid);
+    // 跟踪开始前已进入的系统调用没有进入时间，跳过
+    if(!start || !*start)
+        return 0;
+    delay = bpf_ktime_get_ns() - *start;
+    *start = 0;
+
+    key.tgid = tgid;
+    key.nr = (int)args->id;
+    stat = bpf_map_lookup_elem(&syscall_stats, &key);
+    if(!stat){
+        struct syscall_stat zero = {};
+
+        bpf_map_update_elem(&syscall_stats, &key, &zero, BPF_NOEXIST);
+        stat = bpf_map_lookup_elem(&syscall_stats, &key);
+        if(!stat)
             return 0;
-        }
-        
-        this_delay = current_time-syscall_seq->enter_time;
-
-        if(syscall_seq->count < syscalls){
-            syscall_seq->sum_delay += this_delay;
-            if(this_delay > syscall_seq->max_delay)
-                syscall_seq->max_delay = this_delay;
-            if(syscall_seq->min_delay==0 || this_delay<syscall_seq->min_delay)
-                syscall_seq->min_delay = this_delay;
-
-            //bpf_map_update_elem(&proc_syscall, &pid, syscall_seq, BPF_ANY);
-        }else{
-            syscall_seq->sum_delay += this_delay;
-            if(this_delay > syscall_seq->max_delay)
-                syscall_seq->max_delay = this_delay;
-            if(syscall_seq->min_delay==0 || this_delay<syscall_seq->min_delay)
-                syscall_seq->min_delay = this_delay;
-            if((target_tgid==-1 && (target_pid==-1 || pid==target_pid)) || 
-               (target_tgid!=-1 && tgid == target_tgid)){
-                syscall_seq->proc_count += syscall_seq->count;
-                syscall_seq->proc_sd += syscall_seq->sum_delay;
-            }
-
-            struct syscall_seq* e;
-            e = bpf_ringbuf_reserve(&syscall_rb, sizeof(*e), 0);
-            if(!e)
-                return 0;
-            
-            e->pid = pid;
-            e->tgid = tgid;
-            e->sum_delay = syscall_seq->sum_delay;
-            e->max_delay = syscall_seq->max_delay;
-            e->min_delay = syscall_seq->min_delay;
-            e->count = syscall_seq->count;
-            for(int i=0; i<=syscall_seq->count-1 && i<=MAX_SYSCALL_COUNT-1; i++)
-                e->record_syscall[i] = syscall_seq->record_syscall[i];
-            if((target_tgid==-1 && (target_pid==-1 || pid==target_pid)) || 
-               (target_tgid!=-1 && tgid == target_tgid)){
-                e->proc_count = syscall_seq->proc_count;
-                e->proc_sd = syscall_seq->proc_sd;
-            }
-            
-            bpf_ringbuf_submit(e, 0);
-
-            syscall_seq->sum_delay = 0;
-            syscall_seq->count = 0;
-        }
     }
 
+    // 每CPU的值只会被当前CPU修改，无需原子操作
+    stat->count ++;
+    stat->sum_delay += delay;
+    if(delay > stat->max_delay)
+        stat->max_delay = delay;
+    if(stat->min_delay==0 || delay<stat->min_delay)
+        stat->min_delay = delay;
+    stat->slots[log2_slot(delay)] ++;
+
     return 0;
 }
 
-// 从哈希表中删除退出进程的数据，防止哈希表溢出
+// 从哈希表中删除退出线程的数据，防止哈希表溢出
 SEC("tracepoint/sched/sched_process_exit")
 int sched_process_exit(void *ctx)
 {
     struct task_struct *p = (struct task_struct *)bpf_get_current_task();
     pid_t pid = BPF_CORE_READ(p,pid);
 
-    bpf_map_delete_elem(&proc_syscall,&pid);
+    bpf_map_delete_elem(&syscall_start,&pid);
 
     return 0;
-}
\ No newline at end of file
+}
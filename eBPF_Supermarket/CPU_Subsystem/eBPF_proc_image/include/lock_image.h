@@ -15,8 +15,214 @@
 // author: zhangziheng0525@163.com
 //
 // Variable definitions and help functions for lock in the process
+//
+// 锁竞争统计使用 lock_image.bpf.c 中定义的 lock_stats、contention_ns 以及
+// lock_holds、kernel_lock_waits、lock_stat_map、lock_stacks 等 map，因此需在其定义之后包含本文件
+//
+// 调用栈只在出现新的最长等待/持有时间时才采集，每把锁每个CPU只保留最长者的栈，
+// 未竞争的加锁路径上不调用 bpf_get_stackid
+
+static const struct lock_stat zero_stat = {
+    .waiter_stack = -1,
+    .holder_stack = -1,
+};
+
+// 获取锁的每CPU统计，不存在时创建
+static __always_inline struct lock_stat *get_lock_stat(int tgid,int flag,u64 lock_ptr)
+{
+    struct lock_key key = {};
+    struct lock_stat *stat;
+
+    key.tgid = tgid;
+    key.flag = flag;
+    key.lock_ptr = lock_ptr;
+
+    stat = bpf_map_lookup_elem(&lock_stat_map, &key);
+    if(stat)
+        return stat;
+    bpf_map_update_elem(&lock_stat_map, &key, &zero_stat, BPF_NOEXIST);
+
+    return bpf_map_lookup_elem(&lock_stat_map, &key);
+}
+
+// 加锁返回：统计等待时间，成功时记录持有锁的起始时间；trylock 失败计为一次竞争
+static __always_inline void record_lock_acquired(void *ctx,pid_t pid,int tgid,int flag,int ret,const struct lock_wait *wait)
+{
+    u64 now = bpf_ktime_get_ns();
+    u64 wait_time = now - wait->time;
+    struct lock_stat *stat;
+
+    stat = get_lock_stat(tgid, flag, wait->lock_ptr);
+    if(!stat)
+        return;
+
+    if(ret != 0){
+        stat->contended ++;
+        return;
+    }
+
+    // 每CPU的值只会被当前CPU修改，无需原子操作
+    stat->acquired ++;
+    if(wait_time >= contention_ns)
+        stat->contended ++;
+    stat->wait_sum += wait_time;
+    if(wait_time > stat->wait_max){
+        stat->wait_max = wait_time;
+        // 未达到竞争阈值的等待不采集栈
+        stat->waiter_stack = wait_time >= contention_ns ?
+                             bpf_get_stackid(ctx, &lock_stacks, BPF_F_USER_STACK) : -1;
+    }
+    stat->wait_slots[log2_slot(wait_time)] ++;
+
+    struct lock_hold_key hold_key = {};
+    struct lock_hold hold = {};
+
+    hold_key.pid = pid;
+    hold_key.lock_ptr = wait->lock_ptr;
+    hold.time = now;
+    bpf_map_update_elem(&lock_holds, &hold_key, &hold, BPF_ANY);
+}
 
-static int record_lock_enter(int target_tgid,pid_t ignore_tgid,int lock_status,int flag,void *__lock,void *lock_rb,void *proc_lock)
+// 解锁返回：统计持有时间，最长持有者的栈在解锁处采集
+static __always_inline void record_lock_released(void *ctx,pid_t pid,int tgid,int flag,u64 lock_ptr)
+{
+    struct lock_hold_key hold_key = {};
+    struct lock_hold *hold;
+    struct lock_stat *stat;
+    u64 hold_time;
+
+    hold_key.pid = pid;
+    hold_key.lock_ptr = lock_ptr;
+    hold = bpf_map_lookup_elem(&lock_holds, &hold_key);
+    if(!hold)
+        return;
+    hold_time = bpf_ktime_get_ns() - hold->time;
+    bpf_map_delete_elem(&lock_holds, &hold_key);
+
+    stat = get_lock_stat(tgid, flag, lock_ptr);
+    if(!stat)
+        return;
+
+    stat->released ++;
+    stat->hold_sum += hold_time;
+    if(hold_time > stat->hold_max){
+        stat->hold_max = hold_time;
+        stat->holder_stack = bpf_get_stackid(ctx, &lock_stacks, BPF_F_USER_STACK);
+    }
+    stat->hold_slots[log2_slot(hold_time)] ++;
+}
+
+static __always_inline bool lock_traced(int tgid)
+{
+    return tgid!=ignore_tgid && (target_tgid==-1 || tgid==target_tgid);
+}
+
+// futex 阻塞等待开始，每次等待都计为一次竞争；线程同一时刻只会阻塞在一个 futex 上
+static __always_inline void record_contention_begin(pid_t pid,int flag,u64 lock_ptr)
+{
+    struct proc_flag proc_flag = {};
+    struct lock_wait wait = {};
+
+    proc_flag.pid = pid;
+    proc_flag.flag = flag;
+    wait.lock_ptr = lock_ptr;
+    wait.time = bpf_ktime_get_ns();
+
+    bpf_map_update_elem(&proc_lock, &proc_flag, &wait, BPF_ANY);
+}
+
+// 累加一次阻塞等待：等待者仍处于加锁路径上，此时采集的栈与等待开始时一致
+static __always_inline void account_contention(void *ctx,int tgid,int flag,u64 lock_ptr,u64 wait_time,u64 stack_flags)
+{
+    struct lock_stat *stat;
+
+    stat = get_lock_stat(tgid, flag, lock_ptr);
+    if(!stat)
+        return;
+
+    stat->acquired ++;
+    stat->contended ++;
+    stat->wait_sum += wait_time;
+    if(wait_time > stat->wait_max){
+        stat->wait_max = wait_time;
+        stat->waiter_stack = bpf_get_stackid(ctx, &lock_stacks, stack_flags);
+    }
+    stat->wait_slots[log2_slot(wait_time)] ++;
+}
+
+// futex 阻塞等待结束
+static __always_inline void record_contention_end(void *ctx,pid_t pid,int tgid,int flag,u64 stack_flags)
+{
+    struct proc_flag proc_flag = {};
+    struct lock_wait *lock_wait;
+    struct lock_wait wait;
+
+    proc_flag.pid = pid;
+    proc_flag.flag = flag;
+    lock_wait = bpf_map_lookup_elem(&proc_lock, &proc_flag);
+    if(!lock_wait)
+        return;
+    wait = *lock_wait;
+    bpf_map_delete_elem(&proc_lock, &proc_flag);
+
+    account_contention(ctx, tgid, flag, wait.lock_ptr, bpf_ktime_get_ns() - wait.time, stack_flags);
+}
+
+// 内核锁竞争按 (pid, 锁地址) 配对：mutex 慢路径中还可能在 wait_lock 等内层锁上竞争，
+// 内层的 contention_end 不会消耗外层的等待开始
+static __always_inline void record_kernel_contention_begin(pid_t pid,u64 lock_ptr)
+{
+    struct lock_hold_key key = {};
+    struct lock_hold wait = {};
+
+    key.pid = pid;
+    key.lock_ptr = lock_ptr;
+    wait.time = bpf_ktime_get_ns();
+
+    // 内核 mutex 在乐观自旋失败后会再次触发 contention_begin，保留第一次的时间戳
+    bpf_map_update_elem(&kernel_lock_waits, &key, &wait, BPF_NOEXIST);
+}
+
+static __always_inline void record_kernel_contention_end(void *ctx,pid_t pid,int tgid,u64 lock_ptr)
+{
+    struct lock_hold_key key = {};
+    struct lock_hold *wait;
+    u64 wait_time;
+
+    key.pid = pid;
+    key.lock_ptr = lock_ptr;
+    wait = bpf_map_lookup_elem(&kernel_lock_waits, &key);
+    if(!wait)
+        return;
+    wait_time = bpf_ktime_get_ns() - wait->time;
+    bpf_map_delete_elem(&kernel_lock_waits, &key);
+
+    account_contention(ctx, tgid, 5, lock_ptr, wait_time, 0);
+}
+
+// futex 唤醒：唤醒者即释放锁的持有者，记录其最近一次的调用栈；
+// 只更新已有等待统计的地址，没有等待者的唤醒不创建条目
+static __always_inline void record_lock_wake(void *ctx,int tgid,u64 lock_ptr,u64 stack_flags)
+{
+    struct lock_key key = {};
+    struct lock_stat *stat;
+
+    key.tgid = tgid;
+    key.flag = 4;
+    key.lock_ptr = lock_ptr;
+    stat = bpf_map_lookup_elem(&lock_stat_map, &key);
+    if(!stat){
+        key.flag = 6;
+        stat = bpf_map_lookup_elem(&lock_stat_map, &key);
+    }
+    if(!stat)
+        return;
+
+    stat->released ++;
+    stat->holder_stack = bpf_get_stackid(ctx, &lock_stacks, stack_flags);
+}
+
+static int record_lock_enter(void *ctx,int target_tgid,pid_t ignore_tgid,int lock_status,int flag,void *__lock,void *lock_rb,void *proc_lock)
 {
     pid_t pid = bpf_get_current_pid_tgid();
     int tgid = bpf_get_current_pid_tgid() >> 32;
@@ -24,10 +230,16 @@ static int record_lock_enter(int target_tgid,pid_t ignore_tgid,int lock_status,i
     if(tgid!=ignore_tgid && (target_tgid==-1 || (target_tgid!=-1 && tgid==target_tgid))){
         u64 lock_ptr = (u64)__lock;
         struct proc_flag proc_flag = {};
+        struct lock_wait wait = {};
         
         proc_flag.pid = pid;
         proc_flag.flag = flag;
-        if(bpf_map_update_elem(proc_lock, &proc_flag, &lock_ptr, BPF_ANY))
+        wait.lock_ptr = lock_ptr;
+        wait.time = bpf_ktime_get_ns();
+        if(bpf_map_update_elem(proc_lock, &proc_flag, &wait, BPF_ANY))
+            return 0;
+
+        if(lock_stats)
             return 0;
 
         struct lock_event* e;
@@ -38,7 +250,7 @@ static int record_lock_enter(int target_tgid,pid_t ignore_tgid,int lock_status,i
         e->lock_status = lock_status;
         e->pid = pid;
         e->lock_ptr = lock_ptr;
-        e->time = bpf_ktime_get_ns();
+        e->time = wait.time;
         
         bpf_ringbuf_submit(e, 0);
     }
@@ -46,25 +258,32 @@ static int record_lock_enter(int target_tgid,pid_t ignore_tgid,int lock_status,i
     return 0;
 }
 
-static int record_lock_exit(int target_tgid,pid_t ignore_tgid,int lock_status,int flag,int ret,void *lock_rb,void *proc_lock,void *locktype)
+static int record_lock_exit(void *ctx,int target_tgid,pid_t ignore_tgid,int lock_status,int flag,int ret,void *lock_rb,void *proc_lock,void *locktype)
 {
     pid_t pid = bpf_get_current_pid_tgid();
     int tgid = bpf_get_current_pid_tgid() >> 32;
 
     if(tgid!=ignore_tgid && (target_tgid==-1 || (target_tgid!=-1 && tgid==target_tgid))){
-        u64 *lock_ptr;
+        struct lock_wait *lock_wait;
+        struct lock_wait wait;
         u64 temp_lock_ptr;
         struct proc_flag proc_flag = {};
 
         proc_flag.pid = pid;
         proc_flag.flag = flag;
 
-        lock_ptr = bpf_map_lookup_elem(proc_lock, &proc_flag);
-        if(!lock_ptr)
+        lock_wait = bpf_map_lookup_elem(proc_lock, &proc_flag);
+        if(!lock_wait)
             return 0;
-        temp_lock_ptr = *lock_ptr;
+        wait = *lock_wait;
+        temp_lock_ptr = wait.lock_ptr;
         bpf_map_delete_elem(proc_lock, &proc_flag);
 
+        if(lock_stats){
+            record_lock_acquired(ctx,pid,tgid,flag,ret,&wait);
+            return 0;
+        }
+
         if((lock_status==5 || lock_status==8) && ret==0){
             int type;
 
@@ -110,7 +329,7 @@ static int record_unlock_enter(int target_tgid,pid_t ignore_tgid,int flag,void *
     return 0;
 }
 
-static int record_unlock_exit(int target_tgid,pid_t ignore_tgid,int lock_status,int flag,void *lock_rb,void *proc_unlock,void *locktype)
+static int record_unlock_exit(void *ctx,int target_tgid,pid_t ignore_tgid,int lock_status,int flag,void *lock_rb,void *proc_unlock,void *locktype)
 {
     pid_t pid = bpf_get_current_pid_tgid();
     int tgid = bpf_get_current_pid_tgid() >> 32;
@@ -129,6 +348,11 @@ static int record_unlock_exit(int target_tgid,pid_t ignore_tgid,int lock_status,
         temp_lock_ptr = *lock_ptr;
         bpf_map_delete_elem(proc_unlock, &proc_flag);
 
+        if(lock_stats){
+            record_lock_released(ctx,pid,tgid,flag,temp_lock_ptr);
+            return 0;
+        }
+
         if(lock_status ==0){
             int *type;
 
@@ -53,17 +53,21 @@ struct total_rsc{
 };
 
 //syscall_image
-struct syscall_seq{
-	int pid;
+#define MAX_SLOTS 32
+
+// 按 (tgid, 系统调用号) 聚合的统计键
+struct syscall_key{
 	int tgid;
-	long long unsigned int enter_time;
+	int nr;
+};
+
+// 每CPU的系统调用统计，slots 为以 ns 为单位的 log2 延迟直方图
+struct syscall_stat{
+	long long unsigned int count;
 	long long unsigned int sum_delay;
-	long long unsigned int proc_sd;
 	long long unsigned int max_delay;
 	long long unsigned int min_delay;
-	unsigned int count;
-	unsigned int proc_count;
-	int record_syscall[MAX_SYSCALL_COUNT];
+	unsigned int slots[MAX_SLOTS];
 };
 
 // lock_image
@@ -72,6 +76,9 @@ struct proc_flag{
     // 1代表用户态互斥锁
     // 2代表用户态读写锁
 	// 3代表用户态自旋锁
+	// 4代表互斥锁类的futex等待
+	// 5代表内核锁竞争
+	// 6代表其他futex等待（条件变量、信号量、空闲线程池等）
     int flag;
 };
 
@@ -89,6 +96,47 @@ struct lock_event{
     long long unsigned int time;
 };
 
+// 锁竞争栈的最大深度，不能超过 perf_event_max_stack（默认 127），否则栈 map 创建失败
+#define LOCK_STACK_DEPTH 127
+
+// 线程发起加锁请求时记录的信息
+struct lock_wait{
+    long long unsigned int lock_ptr;
+    long long unsigned int time;
+};
+
+// 锁竞争统计的键，flag 含义同 proc_flag
+struct lock_key{
+    int tgid;
+    int flag;
+    long long unsigned int lock_ptr;
+};
+
+struct lock_hold_key{
+    int pid;
+    long long unsigned int lock_ptr;
+};
+
+// 线程持有锁的起始时间
+struct lock_hold{
+    long long unsigned int time;
+};
+
+// 每CPU的锁竞争统计，wait_slots/hold_slots 为以 ns 为单位的 log2 直方图
+struct lock_stat{
+    long long unsigned int acquired;
+    long long unsigned int contended;
+    long long unsigned int wait_sum;
+    long long unsigned int wait_max;
+    long long unsigned int released;
+    long long unsigned int hold_sum;
+    long long unsigned int hold_max;
+    int waiter_stack;
+    int holder_stack;
+    unsigned int wait_slots[MAX_SLOTS];
+    unsigned int hold_slots[MAX_SLOTS];
+};
+
 // keytime_image
 struct child_info{
 	int type;
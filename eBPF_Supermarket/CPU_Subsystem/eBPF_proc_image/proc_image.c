@@ -25,7 +25,10 @@
 #include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <pthread.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
 #include <bpf/libbpf.h>
 #include <bpf/bpf.h>
 #include "proc_image.h"
@@ -34,7 +37,6 @@
 #include "lock_image.skel.h"
 #include "keytime_image.skel.h"
 #include "schedule_image.skel.h"
-#include "hashmap.h"
 #include "helpers.h"
 #include "trace_helpers.h"
 
@@ -47,65 +49,101 @@ static struct env {
 	int ignore_tgid;
     int cpu_id;
     int time;
+	int interval;
 	bool enable_myproc;
-	bool output_resourse;
-	bool output_schedule;
-	bool create_thread;
-	bool exit_thread;
     bool enable_resource;
 	bool first_rsc;
 	int syscalls;
-/*	int first_syscall;
-	int second_syscall;
-	int third_syscall; */
-	u64 sum_delay;
-	u64 sum_count;
-	u64 max_delay;
-	u64 min_delay;
-	bool enable_hashmap;
 	bool enable_syscall;
 	bool enable_lock;
+	bool lock_stats;
+	bool lock_futex;
 	bool quote;
 	int max_args;
 	bool enable_keytime;
 	bool enable_cpu;
 	int stack_count;
 	bool enable_schedule;
+	u64 wakeups;
 } env = {
     .pid = -1,
 	.tgid = -1,
     .cpu_id = -1,
     .time = 0,
+	.interval = 1,
 	.enable_myproc = false,
-	.output_resourse = false,
-	.output_schedule = false,
-	.create_thread = false,
-	.exit_thread = false,
     .enable_resource = false,
 	.first_rsc = true,
 	.syscalls = 0,
-/*	.first_syscall = 0,
-	.second_syscall = 0,
-	.third_syscall = 0, */
-	.sum_delay = 0,
-	.sum_count = 0,
-	.max_delay = 0,
-	.min_delay = 0,
-	.enable_hashmap = false,
 	.enable_syscall = false,
 	.enable_lock = false,
+	.lock_stats = false,
+	.lock_futex = false,
 	.quote = false,
 	.max_args = DEFAULT_MAXARGS,
 	.enable_keytime = false,
 	.enable_cpu = false,
 	.stack_count = 0,
 	.enable_schedule = false,
+	.wakeups = 0,
 };
 
-struct hashmap *map = NULL;
-
 static struct timespec prevtime;
 static struct timespec currentime;
+static struct timespec starttime;
+
+/* epoll 事件来源：所有环形缓冲区共用一个 ring_buffer 管理器，资源和调度画像由 timerfd 定时触发 */
+enum epoll_source {
+	RINGBUF_SOURCE,
+	RESOURCE_SOURCE,
+	SCHEDULE_SOURCE,
+	SYSCALL_SOURCE,
+	LOCK_SOURCE,
+};
+
+#define MAX_EPOLL_EVENTS 8
+
+// 系统调用画像每次汇总输出的最大进程数，锁竞争画像每次输出的最大锁数，以及批量读取 map 的条目数
+#define MAX_SYSCALL_PROCS 20
+#define MAX_LOCK_STATS 10
+#define MAP_BATCH_SIZE 256
+
+// read_map_batch 的回调，values 为该键的值；每CPU map 为各CPU上的 ncpu 个值，否则 ncpu 为 1
+typedef int (*map_entry_fn)(const void *key, const void *values, int ncpu, void *ctx);
+
+// 汇总所有CPU后的 (tgid, 系统调用号) 统计
+struct syscall_total {
+	struct syscall_key key;
+	struct syscall_stat stat;
+};
+
+// 单个进程的汇总，syscalls 指向按调用次数降序排列的 syscall_total 数组片段
+struct syscall_proc {
+	int tgid;
+	u64 count;
+	u64 sum_delay;
+	u64 max_delay;
+	struct syscall_total *syscalls;
+	int nr_syscalls;
+};
+
+struct syscall_totals {
+	struct syscall_total *totals;
+	int n;
+	int cap;
+};
+
+// 汇总所有CPU后的锁竞争统计
+struct lock_total {
+	struct lock_key key;
+	struct lock_stat stat;
+};
+
+struct lock_totals {
+	struct lock_total *totals;
+	int n;
+	int cap;
+};
 
 char *lock_status[] = {"", "mutex_req", "mutex_lock", "mutex_unlock",
 						   "rdlock_req", "rdlock_lock", "rdlock_unlock",
@@ -120,14 +158,13 @@ char *keytime_type[] = {"", "exec_enter", "exec_exit",
 							"onCPU", "offCPU",};
 
 static struct ksyms *ksyms = NULL;
+static struct syms_cache *syms_cache = NULL;
 
 /*
 char *task_state[] = {"TASK_RUNNING", "TASK_INTERRUPTIBLE", "TASK_UNINTERRUPTIBLE", 
                       "", "__TASK_STOPPED", "", "", "", "__TASK_TRACED"};
 */
 
-//u32 syscalls[NR_syscalls] = {};
-
 const char argp_program_doc[] ="Trace process to get process image.\n";
 
 static const struct argp_option opts[] = {
@@ -135,11 +172,14 @@ static const struct argp_option opts[] = {
 	{ "tgid", 'P', "TGID", 0, "Thread group to trace" },
     { "cpuid", 'c', "CPUID", 0, "Set For Tracing  per-CPU Process(other processes don't need to set this parameter)" },
     { "time", 't', "TIME-SEC", 0, "Max Running Time(0 for infinite)" },
+	{ "interval", 'i', "INTERVAL-SEC", 0, "Output interval of resource, syscall and schedule information (default 1s)" },
 	{ "myproc", 'm', NULL, 0, "Trace the process of the tool itself (not tracked by default)" },
 	{ "all", 'a', NULL, 0, "Start all functions(but not track tool progress)" },
     { "resource", 'r', NULL, 0, "Collects resource usage information about processes" },
-	{ "syscall", 's', "SYSCALLS", 0, "Collects syscall sequence (1~50) information about processes" },
+	{ "syscall", 's', "SYSCALLS", 0, "Collects per-process syscall statistics, showing the top SYSCALLS (1~50) syscalls of each process" },
 	{ "lock", 'l', NULL, 0, "Collects lock information about processes" },
+	{ "lockstat", 'L', NULL, 0, "Collects lock contention statistics about processes (wait/hold time histograms and stacks, no per-event output)" },
+	{ "futex", 'f', NULL, 0, "Collects lock contention statistics from futex syscalls and kernel contention tracepoints instead of pthread uprobes" },
 	{ "quote", 'q', NULL, 0, "Add quotemarks (\") around arguments" },
 	{ "keytime", 'k', "ENABLE_CPU", 0, "Collects keytime information about processes(0:except CPU kt_info,1:all kt_info)" },
 	{ "schedule", 'S', NULL, 0, "Collects schedule information about processes (trace tool process)" },
@@ -187,6 +227,14 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 				env.time = strtol(arg, NULL, 10);
 				if(env.time) alarm(env.time);
 				break;
+		case 'i':
+				errno = 0;
+				env.interval = strtol(arg, NULL, 10);
+				if(errno || env.interval <= 0){
+					warn("Invalid INTERVAL: %s\n", arg);
+					argp_usage(state);
+				}
+				break;
 		case 'm':
 				env.enable_myproc = true;
 				break;
@@ -204,7 +252,7 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
                 break;
 		case 's':
                 syscalls = strtol(arg, NULL, 10);
-				if(syscalls<=0 && syscalls>50){
+				if(syscalls<=0 || syscalls>MAX_SYSCALL_COUNT){
 					warn("Invalid SYSCALLS: %s\n", arg);
 					argp_usage(state);
 				}
@@ -214,6 +262,15 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 		case 'l':
                 env.enable_lock = true;
                 break;
+		case 'L':
+				env.enable_lock = true;
+				env.lock_stats = true;
+				break;
+		case 'f':
+				env.enable_lock = true;
+				env.lock_stats = true;
+				env.lock_futex = true;
+				break;
 		case 'q':
 				env.quote = true;
 				break;
@@ -313,32 +370,193 @@ delete_elem:
 
 	// 获取当前高精度时间
     clock_gettime(CLOCK_REALTIME, &prevtime);
-	env.output_resourse = false;
 
 	return 0;
 }
 
+/*
+ * 批量读取 map，对每个键调用 fn；drain 为 true 时同时清空 map。
+ * 优先使用批量操作，内核不支持时退化为逐个 get_next_key/lookup(/delete)。
+ */
+static int read_map_batch(struct bpf_map *map, bool drain, map_entry_fn fn, void *ctx)
+{
+	// 是否支持批量操作取决于 map 类型，按类型分别记录退化结果
+	static bool no_batch[64];
+	enum bpf_map_type type = bpf_map__type(map);
+	bool *fallback = (unsigned)type < sizeof(no_batch) / sizeof(no_batch[0]) ? &no_batch[type] : NULL;
+	int fd = bpf_map__fd(map);
+	size_t key_size = bpf_map__key_size(map);
+	size_t value_size;
+	char *keys = NULL, *values = NULL, *last = NULL;
+	void *in = NULL, *prev = NULL;
+	u64 out_batch;
+	u32 count;
+	bool done = false;
+	int ncpu = 1, err = 0;
+
+	if(type == BPF_MAP_TYPE_PERCPU_HASH || type == BPF_MAP_TYPE_PERCPU_ARRAY){
+		ncpu = libbpf_num_possible_cpus();
+		if(ncpu <= 0)
+			return -1;
+		// 每CPU的值按 8 字节对齐
+		value_size = (bpf_map__value_size(map) + 7) / 8 * 8 * ncpu;
+	}else{
+		value_size = bpf_map__value_size(map);
+	}
+
+	keys = malloc(key_size * MAP_BATCH_SIZE);
+	values = malloc(value_size * MAP_BATCH_SIZE);
+	last = malloc(key_size);
+	if(!keys || !values || !last){
+		err = -ENOMEM;
+		goto out;
+	}
+
+	while(!done){
+		count = MAP_BATCH_SIZE;
+		if(fallback && *fallback)
+			err = -EOPNOTSUPP;
+		else if(drain)
+			err = bpf_map_lookup_and_delete_batch(fd, in, &out_batch, keys, values, &count, NULL);
+		else
+			err = bpf_map_lookup_batch(fd, in, &out_batch, keys, values, &count, NULL);
+		if(err == -ENOENT){
+			done = true;
+		}else if(err == -EINVAL || err == -ENOTSUP || err == -EOPNOTSUPP){
+			/* 不支持批量操作：清空时每次取第一个键，读出后删除；否则沿上一个键向后遍历 */
+			if(fallback)
+				*fallback = true;
+			count = 0;
+			while(count < MAP_BATCH_SIZE && !bpf_map_get_next_key(fd, drain ? NULL : prev, keys + count * key_size)){
+				if(bpf_map_lookup_elem(fd, keys + count * key_size, values + count * value_size))
+					break;
+				if(drain && bpf_map_delete_elem(fd, keys + count * key_size))
+					break;
+				if(!drain)
+					prev = keys + count * key_size;
+				count++;
+			}
+			done = count < MAP_BATCH_SIZE;
+		}else if(err < 0){
+			fprintf(stderr, "failed to read map %s: %d\n", bpf_map__name(map), err);
+			goto out;
+		}
+		in = &out_batch;
+		err = 0;
+
+		for(u32 i=0; i<count && !err; i++)
+			err = fn(keys + i * key_size, values + i * value_size, ncpu, ctx);
+
+		/* 下一轮从本轮最后一个键继续，keys 缓冲区会被覆盖，先保存下来 */
+		if(prev && count){
+			memcpy(last, prev, key_size);
+			prev = last;
+		}
+	}
+
+out:
+	free(keys);
+	free(values);
+	free(last);
+
+	return err;
+}
+
+// 确保 *array 至少能容纳 n 个大小为 size 的元素
+static int reserve_array(void **array, int *cap, int n, size_t size)
+{
+	void *tmp;
+
+	if(n <= *cap)
+		return 0;
+
+	tmp = realloc(*array, (size_t)n * 2 * size);
+	if(!tmp)
+		return -ENOMEM;
+	*array = tmp;
+	*cap = n * 2;
+
+	return 0;
+}
+
+// print_schedule 输出每个进程时共用的系统调度信息和时间
+struct schedule_ctx {
+	struct sum_schedule sys;
+	u64 sys_avg_delay;
+	int hour, min, sec;
+};
+
+// 合并 sys_schedule 在各CPU上的部分统计
+static int read_sys_schedule(struct bpf_map *sys_map, struct sum_schedule *sum)
+{
+	struct sum_schedule *vals;
+	int key = 0, ncpu, err;
+
+	ncpu = libbpf_num_possible_cpus();
+	if(ncpu <= 0)
+		return -1;
+	vals = calloc(ncpu, sizeof(*vals));
+	if(!vals)
+		return -ENOMEM;
+
+	err = bpf_map_lookup_elem(bpf_map__fd(sys_map), &key, vals);
+	if (err < 0) {
+		fprintf(stderr, "failed to lookup infos: %d\n", err);
+		free(vals);
+		return -1;
+	}
+
+	memset(sum, 0, sizeof(*sum));
+	for(int i=0; i<ncpu; i++){
+		sum->sum_count += vals[i].sum_count;
+		sum->sum_delay += vals[i].sum_delay;
+		if(vals[i].max_delay > sum->max_delay)
+			sum->max_delay = vals[i].max_delay;
+		if(vals[i].min_delay && (!sum->min_delay || vals[i].min_delay < sum->min_delay))
+			sum->min_delay = vals[i].min_delay;
+	}
+	free(vals);
+
+	return 0;
+}
+
+static int print_proc_schedule(const void *key, const void *value, int ncpu, void *ctx)
+{
+	const struct schedule_event *proc_event = value;
+	struct schedule_ctx *sc = ctx;
+	u64 proc_avg_delay;
+
+	if(!proc_event->count)
+		return 0;
+	proc_avg_delay = proc_event->sum_delay/proc_event->count;
+
+	printf("%02d:%02d:%02d  ",sc->hour,sc->min,sc->sec);
+	if(env.tgid != -1)	printf("%-6d  ",env.tgid);
+	printf("%-6d  %-4d  | %-15lf %-15lf | %-15lf %-15lf | %-15lf %-15lf |\n",
+			proc_event->pid,proc_event->prio,proc_avg_delay/1000000.0,sc->sys_avg_delay/1000000.0,
+			proc_event->max_delay/1000000.0,sc->sys.max_delay/1000000.0,proc_event->min_delay/1000000.0,sc->sys.min_delay/1000000.0);
+
+	return 0;
+}
+
+/*
+ * 系统调度信息每个输出间隔只合并一次，
+ * 所有进程或线程组的调度信息通过批量读取遍历。
+ */
 static int print_schedule(struct bpf_map *proc_map,struct bpf_map *target_map,struct bpf_map *tg_map,struct bpf_map *sys_map)
 {
-	struct proc_id lookup_key = {-1}, next_key;
-	int l_key = -1, n_key;
 	int err;
-	int proc_fd = bpf_map__fd(proc_map);
 	int target_fd = bpf_map__fd(target_map);
-	int tg_fd = bpf_map__fd(tg_map);
-	int sys_fd = bpf_map__fd(sys_map);
 	struct schedule_event proc_event;
-	struct sum_schedule sys_event;
+	struct schedule_ctx sc = {};
 	time_t now = time(NULL);
 	struct tm *localTime = localtime(&now);
-    int hour = localTime->tm_hour;
-    int min = localTime->tm_min;
-    int sec = localTime->tm_sec;
-	u64 proc_avg_delay;
-	u64 target_avg_delay;
-	u64 sys_avg_delay;
 	int key = 0;
 
+	sc.hour = localTime->tm_hour;
+	sc.min = localTime->tm_min;
+	sc.sec = localTime->tm_sec;
+
 	if(prev_image != SCHEDULE_IMAGE){
 		printf("SCHEDULE ----------------------------------------------------------------------------------------------------------------------\n");
 		printf("%-8s  ","TIME");
@@ -347,149 +565,174 @@ static int print_schedule(struct bpf_map *proc_map,struct bpf_map *target_map,st
 		prev_image = SCHEDULE_IMAGE;
 	}
 
-	if(env.pid==-1 && env.tgid==-1){
-		while (!bpf_map_get_next_key(proc_fd, &lookup_key, &next_key)) {
-			err = bpf_map_lookup_elem(proc_fd, &next_key, &proc_event);
-			if (err < 0) {
-				fprintf(stderr, "failed to lookup infos: %d\n", err);
-				return -1;
-			}
-			proc_avg_delay = proc_event.sum_delay/proc_event.count;
-
-			err = bpf_map_lookup_elem(sys_fd, &key, &sys_event);
-			if (err < 0) {
-				fprintf(stderr, "failed to lookup infos: %d\n", err);
-				return -1;
-			}
-			sys_avg_delay = sys_event.sum_delay/sys_event.sum_count;
+	err = read_sys_schedule(sys_map, &sc.sys);
+	if(err < 0)
+		return err;
+	if(!sc.sys.sum_count)
+		return 0;
+	sc.sys_avg_delay = sc.sys.sum_delay/sc.sys.sum_count;
 
-			printf("%02d:%02d:%02d  %-6d  %-4d  | %-15lf %-15lf | %-15lf %-15lf | %-15lf %-15lf |\n",
-					hour,min,sec,proc_event.pid,proc_event.prio,proc_avg_delay/1000000.0,sys_avg_delay/1000000.0,
-					proc_event.max_delay/1000000.0,sys_event.max_delay/1000000.0,proc_event.min_delay/1000000.0,sys_event.min_delay/1000000.0);
-			
-			lookup_key = next_key;
-		}
+	if(env.pid==-1 && env.tgid==-1){
+		err = read_map_batch(proc_map, false, print_proc_schedule, &sc);
 	}else if(env.pid!=-1 && env.tgid==-1){
 		err = bpf_map_lookup_elem(target_fd, &key, &proc_event);
 		if (err < 0) {
 			fprintf(stderr, "failed to lookup infos: %d\n", err);
 			return -1;
 		}
-
-		if(proc_event.count != 0){	
-			target_avg_delay = proc_event.sum_delay/proc_event.count;
-			
-			err = bpf_map_lookup_elem(sys_fd, &key, &sys_event);
-			if (err < 0) {
-				fprintf(stderr, "failed to lookup infos: %d\n", err);
-				return -1;
-			}
-			sys_avg_delay = sys_event.sum_delay/sys_event.sum_count;
-
-			printf("%02d:%02d:%02d  %-6d  %-4d  | %-15lf %-15lf | %-15lf %-15lf | %-15lf %-15lf |\n",
-					hour,min,sec,proc_event.pid,proc_event.prio,target_avg_delay/1000000.0,sys_avg_delay/1000000.0,
-					proc_event.max_delay/1000000.0,sys_event.max_delay/1000000.0,proc_event.min_delay/1000000.0,sys_event.min_delay/1000000.0);
-		}
+		// count 为 0 表示目标进程还未被调度或已经退出
+		err = print_proc_schedule(&key, &proc_event, 1, &sc);
 	}else if(env.pid==-1 && env.tgid!=-1){
-		while (!bpf_map_get_next_key(tg_fd, &l_key, &n_key)) {
-			err = bpf_map_lookup_elem(tg_fd, &n_key, &proc_event);
-			if (err < 0) {
-				fprintf(stderr, "failed to lookup infos: %d\n", err);
-				return -1;
-			}
-			proc_avg_delay = proc_event.sum_delay/proc_event.count;
+		err = read_map_batch(tg_map, false, print_proc_schedule, &sc);
+	}
 
-			err = bpf_map_lookup_elem(sys_fd, &key, &sys_event);
-			if (err < 0) {
-				fprintf(stderr, "failed to lookup infos: %d\n", err);
-				return -1;
-			}
-			sys_avg_delay = sys_event.sum_delay/sys_event.sum_count;
+	return err;
+}
 
-			printf("%02d:%02d:%02d  %-6d  %-6d  %-4d  | %-15lf %-15lf | %-15lf %-15lf | %-15lf %-15lf |\n",
-					hour,min,sec,env.tgid,proc_event.pid,proc_event.prio,proc_avg_delay/1000000.0,sys_avg_delay/1000000.0,
-					proc_event.max_delay/1000000.0,sys_event.max_delay/1000000.0,proc_event.min_delay/1000000.0,sys_event.min_delay/1000000.0);
-			
-			l_key = n_key;
-		}
+// 将一个 (tgid, 系统调用号) 在所有CPU上的值累加后加入汇总数组
+static int reduce_syscall_stat(const void *key, const void *values, int ncpu, void *ctx)
+{
+	const struct syscall_stat *stats = values;
+	struct syscall_totals *st = ctx;
+	struct syscall_total *total;
+
+	if(reserve_array((void **)&st->totals, &st->cap, st->n + 1, sizeof(*st->totals)))
+		return -ENOMEM;
+	total = &st->totals[st->n];
+	memset(total, 0, sizeof(*total));
+	total->key = *(const struct syscall_key *)key;
+
+	for(int cpu=0; cpu<ncpu; cpu++){
+		const struct syscall_stat *v = &stats[cpu];
+
+		if(!v->count)
+			continue;
+		total->stat.count += v->count;
+		total->stat.sum_delay += v->sum_delay;
+		if(v->max_delay > total->stat.max_delay)
+			total->stat.max_delay = v->max_delay;
+		if(total->stat.min_delay==0 || v->min_delay<total->stat.min_delay)
+			total->stat.min_delay = v->min_delay;
+		for(int i=0; i<MAX_SLOTS; i++)
+			total->stat.slots[i] += v->slots[i];
 	}
 
-	env.output_schedule = false;
+	// 刚创建尚未计数的条目不参与汇总
+	if(total->stat.count)
+		st->n++;
 
 	return 0;
 }
 
-static int print_syscall(void *ctx, void *data,unsigned long data_sz)
+// 同一进程的条目相邻，进程内按调用次数降序
+static int cmp_syscall_total(const void *a, const void *b)
+{
+	const struct syscall_total *ta = a, *tb = b;
+
+	if(ta->key.tgid != tb->key.tgid)
+		return ta->key.tgid < tb->key.tgid ? -1 : 1;
+	if(ta->stat.count != tb->stat.count)
+		return ta->stat.count > tb->stat.count ? -1 : 1;
+
+	return ta->key.nr - tb->key.nr;
+}
+
+static int cmp_syscall_proc(const void *a, const void *b)
 {
-	const struct syscall_seq *e = data;
-	u64 avg_delay;
+	const struct syscall_proc *pa = a, *pb = b;
+
+	if(pa->count != pb->count)
+		return pa->count > pb->count ? -1 : 1;
+
+	return pa->tgid - pb->tgid;
+}
+
+// 周期性的 top-K 汇总：每个进程输出调用次数最多的 env.syscalls 个系统调用
+static int print_syscall(struct bpf_map *stats_map)
+{
+	struct syscall_totals st = {};
+	struct syscall_total *totals;
+	struct syscall_proc *procs = NULL;
+	struct syscall_proc sys = {};
+	int n, nr_procs = 0, err = 0;
+	bool single = env.pid != -1 || env.tgid != -1;
 	time_t now = time(NULL);
 	struct tm *localTime = localtime(&now);
     int hour = localTime->tm_hour;
     int min = localTime->tm_min;
     int sec = localTime->tm_sec;
 
+	err = read_map_batch(stats_map, true, reduce_syscall_stat, &st);
+	totals = st.totals;
+	n = st.n;
+	if(err || !n)
+		goto out;
+
+	qsort(totals, n, sizeof(*totals), cmp_syscall_total);
+
+	procs = calloc(n, sizeof(*procs));
+	if(!procs){
+		err = -ENOMEM;
+		goto out;
+	}
+	for(int i=0; i<n; i++){
+		struct syscall_proc *proc;
+
+		if(!nr_procs || procs[nr_procs-1].tgid != totals[i].key.tgid){
+			proc = &procs[nr_procs++];
+			proc->tgid = totals[i].key.tgid;
+			proc->syscalls = &totals[i];
+		}else{
+			proc = &procs[nr_procs-1];
+		}
+		proc->nr_syscalls++;
+		proc->count += totals[i].stat.count;
+		proc->sum_delay += totals[i].stat.sum_delay;
+		if(totals[i].stat.max_delay > proc->max_delay)
+			proc->max_delay = totals[i].stat.max_delay;
+
+		sys.count += totals[i].stat.count;
+		sys.sum_delay += totals[i].stat.sum_delay;
+		if(totals[i].stat.max_delay > sys.max_delay)
+			sys.max_delay = totals[i].stat.max_delay;
+	}
+	qsort(procs, nr_procs, sizeof(*procs), cmp_syscall_proc);
+
 	if(prev_image != SYSCALL_IMAGE){
-        printf("SYSCALL ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------\n");
-		printf("%-8s  ","TIME");
-		if(env.tgid != -1)	printf("%-6s  ","TGID");
-        printf("%-6s  %-14s  %-14s  %-14s  %-103s  %-8s\n",
-				"PID","1st/num","2nd/num","3nd/num","| P_AVG_DELAY(ns) S_AVG_DELAY(ns) | P_MAX_DELAY(ns) S_MAX_DELAY(ns) | P_MIN_DELAY(ns) S_MIN_DELAY(ns) |","SYSCALLS");
+        printf("SYSCALL ---------------------------------------------------------------------------------------------------------------------------------\n");
+		printf("%-8s  %-6s  %-10s  %s  %s\n","TIME","TGID","COUNT",
+				"| P_AVG_DELAY(ns) S_AVG_DELAY(ns) | P_MAX_DELAY(ns) S_MAX_DELAY(ns) |","TOP_SYSCALLS(NR/COUNT/AVG_DELAY(ns))");
 
 		prev_image = SYSCALL_IMAGE;
     }
 
-	// 更新系统的系统调用信息
-	// update_syscalls(syscalls, e, &env.first_syscall, &env.second_syscall, &env.third_syscall);
-	env.sum_delay += e->sum_delay;
-	if(e->max_delay > env.max_delay)
-		env.max_delay = e->max_delay;
-	if(env.min_delay==0 || e->min_delay<env.min_delay)
-		env.min_delay = e->min_delay;
-	env.sum_count += e->count;
-	avg_delay = env.sum_delay/env.sum_count;
-
-	if(!env.enable_hashmap){
-		map = hashmap_new(sizeof(struct syscall_hash), 0, 0, 0, 
-						  user_hash, user_compare, NULL, NULL);
-		env.enable_hashmap = true;
-	}
+	for(int i=0; i<nr_procs && i<MAX_SYSCALL_PROCS; i++){
+		struct syscall_proc *proc = &procs[i];
 
-	if((env.pid==-1 && env.tgid==-1) || e->pid==env.pid || e->tgid==env.tgid){
-		printf("%02d:%02d:%02d  ",hour,min,sec);
-		if(env.tgid != -1)	printf("%-6d  ",env.tgid);
-		printf("%-6d  ",e->pid);
-
-		struct syscall_hash *syscall_hash = (struct syscall_hash *)hashmap_get(map,&(struct syscall_hash){.key=e->pid});
-		if(syscall_hash){
-			// 若存在，则获取syscalls数组，更新这个value
-			update_syscalls(syscall_hash->value.syscalls, e, &syscall_hash->value.first_syscall, 
-							&syscall_hash->value.second_syscall, &syscall_hash->value.third_syscall);
-			printf("%-3d/%-10d  %-3d/%-10d  %-3d/%-10d  | %-15lld %-15lld | %-15lld %-15lld | %-15lld %-15lld |  ",
-					syscall_hash->value.first_syscall,syscall_hash->value.syscalls[syscall_hash->value.first_syscall],
-					syscall_hash->value.second_syscall,syscall_hash->value.syscalls[syscall_hash->value.second_syscall],
-					syscall_hash->value.third_syscall,syscall_hash->value.syscalls[syscall_hash->value.third_syscall],
-					e->proc_sd/e->proc_count,avg_delay,e->max_delay,env.max_delay,e->min_delay,env.min_delay);
-		} else {
-			// 若不存在，则新创建一个syscalls数组，初始化为0，更新这个value，以及更新哈希表
-			struct syscall_hash syscall_hash = {};
-			syscall_hash.key = e->pid;
-			update_syscalls(syscall_hash.value.syscalls, e, &syscall_hash.value.first_syscall, &syscall_hash.value.second_syscall, &syscall_hash.value.third_syscall);
-			hashmap_set(map, &syscall_hash);
-			printf("%-3d/%-10d  %-3d/%-10d  %-3d/%-10d  | %-15lld %-15lld | %-15lld %-15lld | %-15lld %-15lld |  ",
-					syscall_hash.value.first_syscall,syscall_hash.value.syscalls[syscall_hash.value.first_syscall],
-					syscall_hash.value.second_syscall,syscall_hash.value.syscalls[syscall_hash.value.second_syscall],
-					syscall_hash.value.third_syscall,syscall_hash.value.syscalls[syscall_hash.value.third_syscall],
-					e->proc_sd/e->proc_count,avg_delay,e->max_delay,env.max_delay,e->min_delay,env.min_delay);
+		printf("%02d:%02d:%02d  %-6d  %-10llu  | %-15llu %-15llu | %-15llu %-15llu |  ",
+				hour,min,sec,proc->tgid,proc->count,proc->sum_delay/proc->count,sys.sum_delay/sys.count,
+				proc->max_delay,sys.max_delay);
+		for(int j=0; j<proc->nr_syscalls && j<env.syscalls; j++){
+			const struct syscall_total *t = &proc->syscalls[j];
+
+			printf("%s%d/%llu/%llu",j ? "," : "",t->key.nr,t->stat.count,t->stat.sum_delay/t->stat.count);
 		}
-		
-		for(int i=0; i<e->count; i++){
-			if(i == e->count-1)	printf("%d\n",e->record_syscall[i]);
-			else	printf("%d,",e->record_syscall[i]);
+		putchar('\n');
+
+		// 跟踪指定进程时，输出其 top-K 系统调用的延迟分布
+		if(single){
+			for(int j=0; j<proc->nr_syscalls && j<env.syscalls; j++){
+				printf("syscall %d:\n",proc->syscalls[j].key.nr);
+				print_log2_hist(proc->syscalls[j].stat.slots, MAX_SLOTS, "nsecs");
+			}
 		}
 	}
 
-	return 0;
+out:
+	free(procs);
+	free(totals);
+
+	return err;
 }
 
 static int print_lock(void *ctx, void *data,unsigned long data_sz)
@@ -516,6 +759,174 @@ static int print_lock(void *ctx, void *data,unsigned long data_sz)
 	return 0;
 }
 
+// 将一把锁在所有CPU上的统计合并，最大等待/持有时间对应的栈一并保留
+static int reduce_lock_stat(const void *key, const void *values, int ncpu, void *ctx)
+{
+	const struct lock_stat *stats = values;
+	struct lock_totals *lt = ctx;
+	struct lock_total *total;
+
+	if(reserve_array((void **)&lt->totals, &lt->cap, lt->n + 1, sizeof(*lt->totals)))
+		return -ENOMEM;
+	total = &lt->totals[lt->n];
+	memset(total, 0, sizeof(*total));
+	total->key = *(const struct lock_key *)key;
+	total->stat.waiter_stack = -1;
+	total->stat.holder_stack = -1;
+
+	for(int cpu=0; cpu<ncpu; cpu++){
+		const struct lock_stat *v = &stats[cpu];
+
+		total->stat.acquired += v->acquired;
+		total->stat.contended += v->contended;
+		total->stat.wait_sum += v->wait_sum;
+		total->stat.released += v->released;
+		total->stat.hold_sum += v->hold_sum;
+		if(v->wait_max > total->stat.wait_max){
+			total->stat.wait_max = v->wait_max;
+			total->stat.waiter_stack = v->waiter_stack;
+		}
+		if(v->hold_max > total->stat.hold_max ||
+		   (!total->stat.hold_max && total->stat.holder_stack < 0 && v->released)){
+			total->stat.hold_max = v->hold_max;
+			total->stat.holder_stack = v->holder_stack;
+		}
+		for(int i=0; i<MAX_SLOTS; i++){
+			total->stat.wait_slots[i] += v->wait_slots[i];
+			total->stat.hold_slots[i] += v->hold_slots[i];
+		}
+	}
+
+	if(total->stat.acquired || total->stat.contended || total->stat.released)
+		lt->n++;
+
+	return 0;
+}
+
+// 竞争次数多的锁在前，其次按总等待时间；非互斥锁类的 futex 等待排在锁之后
+static int cmp_lock_total(const void *a, const void *b)
+{
+	const struct lock_total *la = a, *lb = b;
+
+	if((la->key.flag == 6) != (lb->key.flag == 6))
+		return la->key.flag == 6 ? 1 : -1;
+
+	if(la->stat.contended != lb->stat.contended)
+		return la->stat.contended > lb->stat.contended ? -1 : 1;
+	if(la->stat.wait_sum != lb->stat.wait_sum)
+		return la->stat.wait_sum > lb->stat.wait_sum ? -1 : 1;
+
+	return 0;
+}
+
+static void print_lock_stack(int fd, int stack_id, int tgid, bool kernel, const char *title)
+{
+	u64 ips[LOCK_STACK_DEPTH] = {};
+	const struct syms *syms;
+	const struct sym *sym;
+	const struct ksym *ksym;
+
+	printf("    %s:\n", title);
+	if(stack_id < 0 || bpf_map_lookup_elem(fd, &stack_id, ips)){
+		printf("        [lost]\n");
+		return;
+	}
+
+	if(kernel){
+		for(int i=0; i<LOCK_STACK_DEPTH && ips[i]; i++){
+			ksym = ksyms ? ksyms__map_addr(ksyms, ips[i]) : NULL;
+			if(ksym)
+				printf("        0x%llx %s+0x%llx\n", ips[i], ksym->name, ips[i] - ksym->addr);
+			else
+				printf("        0x%llx [unknown]\n", ips[i]);
+		}
+		return;
+	}
+
+	syms = syms_cache__get_syms(syms_cache, tgid);
+	for(int i=0; i<LOCK_STACK_DEPTH && ips[i]; i++){
+		sym = syms ? syms__map_addr(syms, ips[i]) : NULL;
+		if(sym)
+			printf("        0x%llx %s+0x%lx\n", ips[i], sym->name, sym->offset);
+		else
+			printf("        0x%llx [unknown]\n", ips[i]);
+	}
+}
+
+// 周期性输出竞争最激烈的锁，以及最长等待者和最长持有者的用户栈
+static int print_lock_stats(struct bpf_map *stat_map, struct bpf_map *stack_map)
+{
+	static const char *lock_type[] = {"", "mutex", "rwlock", "spinlock", "futex", "kernel", "fwait"};
+	struct lock_totals lt = {};
+	int stack_fd = bpf_map__fd(stack_map);
+	int err;
+	time_t now = time(NULL);
+	struct tm *localTime = localtime(&now);
+    int hour = localTime->tm_hour;
+    int min = localTime->tm_min;
+    int sec = localTime->tm_sec;
+
+	err = read_map_batch(stat_map, true, reduce_lock_stat, &lt);
+	if(err || !lt.n)
+		goto out;
+
+	if(!syms_cache){
+		syms_cache = syms_cache__new(0);
+		if(!syms_cache){
+			fprintf(stderr, "failed to create syms_cache\n");
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+	if(env.lock_futex && !ksyms){
+		ksyms = ksyms__load();
+		if(!ksyms)
+			fprintf(stderr, "failed to load kallsyms\n");
+	}
+
+	qsort(lt.totals, lt.n, sizeof(*lt.totals), cmp_lock_total);
+
+	if(prev_image != LOCK_IMAGE){
+        printf("LOCKSTAT --------------------------------------------------------------------------------------------------------------------\n");
+		printf("%-8s  %-6s  %-18s  %-8s  %-10s  %-10s  %s\n","TIME","TGID","LockAddr","TYPE","ACQUIRED","CONTENDED",
+				"| AVG_WAIT(ns)    MAX_WAIT(ns)    | AVG_HOLD(ns)    MAX_HOLD(ns)    |");
+		prev_image = LOCK_IMAGE;
+	}
+
+	for(int i=0; i<lt.n && i<MAX_LOCK_STATS; i++){
+		const struct lock_total *t = &lt.totals[i];
+		const struct lock_stat *st = &t->stat;
+
+		printf("%02d:%02d:%02d  %-6d  0x%-16llx  %-8s  %-10llu  %-10llu  | %-15llu %-15llu | %-15llu %-15llu |\n",
+				hour,min,sec,t->key.tgid,t->key.lock_ptr,
+				t->key.flag>0 && t->key.flag<=6 ? lock_type[t->key.flag] : "unknown",
+				st->acquired,st->contended,st->acquired ? st->wait_sum/st->acquired : 0,st->wait_max,
+				st->released ? st->hold_sum/st->released : 0,st->hold_max);
+		if(st->contended){
+			bool kernel = t->key.flag == 5;
+
+			print_lock_stack(stack_fd, st->waiter_stack, t->key.tgid, kernel, "top waiter");
+			// futex 没有持有时间，记录的是最近一次唤醒者；内核锁没有唤醒记录
+			if(st->released)
+				print_lock_stack(stack_fd, st->holder_stack, t->key.tgid, kernel,
+								 t->key.flag == 4 || t->key.flag == 6 ? "last waker" : "top holder");
+		}
+		// 跟踪指定进程时，输出等待和持有时间的分布
+		if(env.tgid != -1){
+			printf("    wait time:\n");
+			print_log2_hist((unsigned int *)st->wait_slots, MAX_SLOTS, "nsecs");
+			printf("    hold time:\n");
+			print_log2_hist((unsigned int *)st->hold_slots, MAX_SLOTS, "nsecs");
+		}
+	}
+
+out:
+	// 栈 map 不在此清空：相同的栈共用同一个 id，内核侧在统计清空后新建的条目仍会引用已有的栈
+	free(lt.totals);
+
+	return err;
+}
+
 static void inline quoted_symbol(char c) {
 	switch(c) {
 		case '"':
@@ -726,15 +1137,71 @@ static int keytime_attach(struct keytime_image_bpf *skel)
 	return 0;
 }
 
-void *enable_function(void *arg) {
-    env.create_thread = true;
-    sleep(1);
-    if(env.enable_resource)	env.output_resourse = true;
-	if(env.enable_schedule)	env.output_schedule = true;
-    env.create_thread = false;
-    env.exit_thread = true;
+// 将环形缓冲区加入共享的 ring_buffer 管理器，第一次调用时创建管理器
+static int add_ring_buffer(struct ring_buffer **rb, struct bpf_map *map, ring_buffer_sample_fn sample_cb)
+{
+	if(!*rb){
+		*rb = ring_buffer__new(bpf_map__fd(map), sample_cb, NULL, NULL);
+		return *rb ? 0 : (errno ? -errno : -1);
+	}
+
+	return ring_buffer__add(*rb, bpf_map__fd(map), sample_cb, NULL);
+}
+
+// 创建周期为 interval 秒的 timerfd，并加入 epoll 集合
+static int add_timer(int epoll_fd, int interval, enum epoll_source source)
+{
+	struct itimerspec its = {
+		.it_interval = { .tv_sec = interval },
+		.it_value = { .tv_sec = interval },
+	};
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.u32 = source,
+	};
+	int fd, err;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(fd < 0)
+		return -errno;
+
+	if(timerfd_settime(fd, 0, &its, NULL) < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0){
+		err = -errno;
+		close(fd);
+		return err;
+	}
+
+	return fd;
+}
+
+// 读取 timerfd 的到期次数，返回值大于 0 表示需要输出
+static int timer_expired(int fd)
+{
+	u64 expirations;
+
+	if(read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return errno == EAGAIN ? 0 : -errno;
+
+	return expirations > 0;
+}
+
+// 输出 proc_image 自身（事件消费者）的 CPU 开销
+static void print_consumer_usage(void)
+{
+	struct rusage usage;
+	struct timespec endtime;
+	double wall, user, sys;
+
+	if(getrusage(RUSAGE_SELF, &usage) < 0)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &endtime);
 
-    return NULL;
+	wall = endtime.tv_sec - starttime.tv_sec + (endtime.tv_nsec - starttime.tv_nsec) / 1000000000.0;
+	user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0;
+	sys = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+
+	fprintf(stderr, "\nproc_image consumer: wall %.3fs  user %.3fs  sys %.3fs  cpu %.2f%%  wakeups %llu\n",
+			wall, user, sys, wall > 0 ? 100.0 * (user + sys) / wall : 0.0, env.wakeups);
 }
 
 static void sig_handler(int signo)
@@ -746,14 +1213,14 @@ int main(int argc, char **argv)
 {
 	struct resource_image_bpf *resource_skel = NULL;
 	struct syscall_image_bpf *syscall_skel = NULL;
-	struct ring_buffer *syscall_rb = NULL;
 	struct lock_image_bpf *lock_skel = NULL;
-	struct ring_buffer *lock_rb = NULL;
 	struct keytime_image_bpf *keytime_skel = NULL;
-	struct ring_buffer *keytime_rb = NULL;
 	struct schedule_image_bpf *schedule_skel = NULL;
-	pthread_t thread_enable;
-	int err;
+	struct bpf_program *prog;
+	struct ring_buffer *rb = NULL;
+	struct epoll_event events[MAX_EPOLL_EVENTS];
+	int epoll_fd = -1, resource_fd = -1, syscall_fd = -1, lock_fd = -1, schedule_fd = -1;
+	int err, n;
 	static const struct argp argp = {
 		.options = opts,
 		.parser = parse_arg,
@@ -771,6 +1238,14 @@ int main(int argc, char **argv)
 	libbpf_set_print(libbpf_print_fn);
 
 	signal(SIGALRM,sig_handler);
+	signal(SIGINT,sig_handler);
+	signal(SIGTERM,sig_handler);
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		fprintf(stderr, "Failed to create epoll instance\n");
+		return 1;
+	}
 
 	if(env.enable_resource){
 		resource_skel = resource_image_bpf__open();
@@ -806,7 +1281,6 @@ int main(int argc, char **argv)
 
 		syscall_skel->rodata->target_pid = env.pid;
 		syscall_skel->rodata->target_tgid = env.tgid;
-		syscall_skel->rodata->syscalls = env.syscalls;
 		if(!env.enable_myproc)	syscall_skel->rodata->ignore_tgid = env.ignore_tgid;
 
 		err = syscall_image_bpf__load(syscall_skel);
@@ -820,15 +1294,6 @@ int main(int argc, char **argv)
 			fprintf(stderr, "Failed to attach BPF syscall skeleton\n");
 			goto cleanup;
 		}
-
-		/* 设置环形缓冲区轮询 */
-		//ring_buffer__new() API，允许在不使用额外选项数据结构下指定回调
-		syscall_rb = ring_buffer__new(bpf_map__fd(syscall_skel->maps.syscall_rb), print_syscall, NULL, NULL);
-		if (!syscall_rb) {
-			err = -1;
-			fprintf(stderr, "Failed to create syscall ring buffer\n");
-			goto cleanup;
-		}
 	}
 
 	if(env.enable_lock){
@@ -840,6 +1305,20 @@ int main(int argc, char **argv)
 
 		if(!env.enable_myproc)	lock_skel->rodata->ignore_tgid = env.ignore_tgid;
 		lock_skel->rodata->target_tgid = env.tgid;
+		lock_skel->rodata->lock_stats = env.lock_stats;
+
+		/* futex 模式只加载 tracepoint 程序，否则只加载 uprobe 程序 */
+		bpf_object__for_each_program(prog, lock_skel->obj) {
+			bool is_uprobe = !strncmp(bpf_program__section_name(prog), "uprobe", 6) ||
+							 !strncmp(bpf_program__section_name(prog), "uretprobe", 9);
+
+			bpf_program__set_autoload(prog, env.lock_futex ? !is_uprobe : is_uprobe);
+		}
+		if(env.lock_futex && !tracepoint_exists("lock", "contention_begin")){
+			fprintf(stderr, "contention tracepoints are not supported, only futex contention is collected\n");
+			bpf_program__set_autoload(lock_skel->progs.contention_begin, false);
+			bpf_program__set_autoload(lock_skel->progs.contention_end, false);
+		}
 
 		err = lock_image_bpf__load(lock_skel);
 		if (err) {
@@ -848,19 +1327,19 @@ int main(int argc, char **argv)
 		}
 		
 		/* 附加跟踪点处理程序 */
-		err = lock_attach(lock_skel);
+		err = env.lock_futex ? lock_image_bpf__attach(lock_skel) : lock_attach(lock_skel);
 		if (err) {
 			fprintf(stderr, "Failed to attach BPF lock skeleton\n");
 			goto cleanup;
 		}
 		
-		/* 设置环形缓冲区轮询 */
-		//ring_buffer__new() API，允许在不使用额外选项数据结构下指定回调
-		lock_rb = ring_buffer__new(bpf_map__fd(lock_skel->maps.lock_rb), print_lock, NULL, NULL);
-		if (!lock_rb) {
-			err = -1;
-			fprintf(stderr, "Failed to create lock ring buffer\n");
-			goto cleanup;
+		/* 加入共享的环形缓冲区管理器，统计模式下没有逐事件输出 */
+		if(!env.lock_stats){
+			err = add_ring_buffer(&rb, lock_skel->maps.lock_rb, print_lock);
+			if (err) {
+				fprintf(stderr, "Failed to add lock ring buffer\n");
+				goto cleanup;
+			}
 		}
 	}
 
@@ -895,12 +1374,10 @@ int main(int argc, char **argv)
 			goto cleanup;
 		}
 		
-		/* 设置环形缓冲区轮询 */
-		//ring_buffer__new() API，允许在不使用额外选项数据结构下指定回调
-		keytime_rb = ring_buffer__new(bpf_map__fd(keytime_skel->maps.keytime_rb), print_keytime, NULL, NULL);
-		if (!keytime_rb) {
-			err = -1;
-			fprintf(stderr, "Failed to create keytime ring buffer\n");
+		/* 加入共享的环形缓冲区管理器 */
+		err = add_ring_buffer(&rb, keytime_skel->maps.keytime_rb, print_keytime);
+		if (err) {
+			fprintf(stderr, "Failed to add keytime ring buffer\n");
 			goto cleanup;
 		}
 	}
@@ -929,104 +1406,139 @@ int main(int argc, char **argv)
 		}
 	}
 
-	/* 处理事件 */
-	while (!exiting) {
-		if(env.enable_resource || env.enable_schedule){
-			// 等待新线程结束，回收资源
-			if(env.exit_thread){
-				env.exit_thread = false;
-				if (pthread_join(thread_enable, NULL) != 0) {
-					perror("pthread_join");
-					exit(EXIT_FAILURE);
-				}
-			}
+	if(rb){
+		struct epoll_event event = {
+			.events = EPOLLIN,
+			.data.u32 = RINGBUF_SOURCE,
+		};
 
-			// 创建新线程，设置 output
-			if(!env.create_thread){
-				if (pthread_create(&thread_enable, NULL, enable_function, NULL) != 0) {
-					perror("pthread_create");
-					exit(EXIT_FAILURE);
-				}
-			}
+		err = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ring_buffer__epoll_fd(rb), &event);
+		if (err) {
+			err = -errno;
+			fprintf(stderr, "Failed to add ring buffer to epoll\n");
+			goto cleanup;
 		}
+	}
 
-		if(env.enable_resource && env.output_resourse){
-			err = print_resource(resource_skel->maps.total);
-			/* Ctrl-C will cause -EINTR */
-			if (err == -EINTR) {
-				err = 0;
-				break;
-			}
-			if (err < 0) {
-				break;
-			}
+	if(env.enable_resource){
+		resource_fd = add_timer(epoll_fd, env.interval, RESOURCE_SOURCE);
+		if (resource_fd < 0) {
+			err = resource_fd;
+			fprintf(stderr, "Failed to create resource timer\n");
+			goto cleanup;
 		}
+	}
 
-		if(env.enable_syscall){
-			err = ring_buffer__poll(syscall_rb, 0);
-			/* Ctrl-C will cause -EINTR */
-			if (err == -EINTR) {
-				err = 0;
-				break;
-			}
-			if (err < 0) {
-				printf("Error polling syscall ring buffer: %d\n", err);
-				break;
-			}
+	if(env.enable_syscall){
+		syscall_fd = add_timer(epoll_fd, env.interval, SYSCALL_SOURCE);
+		if (syscall_fd < 0) {
+			err = syscall_fd;
+			fprintf(stderr, "Failed to create syscall timer\n");
+			goto cleanup;
 		}
+	}
 
-		if(env.enable_lock){
-			err = ring_buffer__poll(lock_rb, 0);
-			/* Ctrl-C will cause -EINTR */
-			if (err == -EINTR) {
-				err = 0;
-				break;
-			}
-			if (err < 0) {
-				printf("Error polling lock ring buffer: %d\n", err);
-				break;
-			}
+	if(env.lock_stats){
+		lock_fd = add_timer(epoll_fd, env.interval, LOCK_SOURCE);
+		if (lock_fd < 0) {
+			err = lock_fd;
+			fprintf(stderr, "Failed to create lock timer\n");
+			goto cleanup;
 		}
+	}
 
-		if(env.enable_keytime){
-			err = ring_buffer__poll(keytime_rb, 0);
-			/* Ctrl-C will cause -EINTR */
-			if (err == -EINTR) {
-				err = 0;
-				break;
-			}
-			if (err < 0) {
-				printf("Error polling keytime ring buffer: %d\n", err);
-				break;
-			}
+	if(env.enable_schedule){
+		schedule_fd = add_timer(epoll_fd, env.interval, SCHEDULE_SOURCE);
+		if (schedule_fd < 0) {
+			err = schedule_fd;
+			fprintf(stderr, "Failed to create schedule timer\n");
+			goto cleanup;
 		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &starttime);
 
-		if(env.enable_schedule && env.output_schedule){
-			err = print_schedule(schedule_skel->maps.proc_schedule,schedule_skel->maps.target_schedule,
-								 schedule_skel->maps.tg_schedule,schedule_skel->maps.sys_schedule);
-			/* Ctrl-C will cause -EINTR */
+	/* 处理事件：阻塞等待环形缓冲区数据或定时器到期，空闲时不占用CPU */
+	while (!exiting) {
+		n = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+		if (n < 0) {
+			err = -errno;
+			/* 信号（Ctrl-C、SIGALRM）会导致 -EINTR */
 			if (err == -EINTR) {
 				err = 0;
-				break;
+				continue;
 			}
-			if (err < 0) {
+			fprintf(stderr, "Error waiting for events: %d\n", err);
+			break;
+		}
+		env.wakeups++;
+
+		for (int i = 0; i < n; i++) {
+			switch (events[i].data.u32) {
+			case RINGBUF_SOURCE:
+				err = ring_buffer__consume(rb);
+				if (err < 0) {
+					printf("Error consuming ring buffer: %d\n", err);
+					goto out;
+				}
+				break;
+			case RESOURCE_SOURCE:
+				err = timer_expired(resource_fd);
+				if (err > 0)
+					err = print_resource(resource_skel->maps.total);
+				if (err < 0)
+					goto out;
+				break;
+			case SYSCALL_SOURCE:
+				err = timer_expired(syscall_fd);
+				if (err > 0)
+					err = print_syscall(syscall_skel->maps.syscall_stats);
+				if (err < 0)
+					goto out;
+				break;
+			case LOCK_SOURCE:
+				err = timer_expired(lock_fd);
+				if (err > 0)
+					err = print_lock_stats(lock_skel->maps.lock_stat_map, lock_skel->maps.lock_stacks);
+				if (err < 0)
+					goto out;
+				break;
+			case SCHEDULE_SOURCE:
+				err = timer_expired(schedule_fd);
+				if (err > 0)
+					err = print_schedule(schedule_skel->maps.proc_schedule,schedule_skel->maps.target_schedule,
+										 schedule_skel->maps.tg_schedule,schedule_skel->maps.sys_schedule);
+				if (err < 0)
+					goto out;
 				break;
 			}
 		}
+		err = 0;
 	}
 
+out:
+	print_consumer_usage();
+
 /* 卸载BPF程序 */
 cleanup:
+	if (resource_fd >= 0)
+		close(resource_fd);
+	if (syscall_fd >= 0)
+		close(syscall_fd);
+	if (lock_fd >= 0)
+		close(lock_fd);
+	if (schedule_fd >= 0)
+		close(schedule_fd);
+	if (epoll_fd >= 0)
+		close(epoll_fd);
+	ring_buffer__free(rb);
 	resource_image_bpf__destroy(resource_skel);
-	ring_buffer__free(syscall_rb);
 	syscall_image_bpf__destroy(syscall_skel);
-	ring_buffer__free(lock_rb);
 	lock_image_bpf__destroy(lock_skel);
-	ring_buffer__free(keytime_rb);
 	keytime_image_bpf__destroy(keytime_skel);
 	schedule_image_bpf__destroy(schedule_skel);
-	hashmap_free(map);
 	ksyms__free(ksyms);
+	syms_cache__free(syms_cache);
 
 	return err < 0 ? -err : 0;
 }
\ No newline at end of file
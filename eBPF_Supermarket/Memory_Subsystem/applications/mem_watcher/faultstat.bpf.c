@@ -0,0 +1,171 @@
+
+/* 请一定注意vmlinux.h头文件是依赖于特定架构的，本机编译的时候需要自行生成，
+生成方法：
+1、切换至本代码../../vmlinux/你的架构目录下；
+2、安装Linux开发工具包：sudo apt install linux-tools-$(uname -r)
+3、删除那个vmlinux_数字.h文件（记住它的名字）；
+4、生成vmlinux.h文件：bpftool btf dump file /sys/kernel/btf/vmlinux format c > vmlinux.h
+5、将生成的vmlinux.h文件名字改成刚刚删除的vmlinux_数字.h
+如果编译不通过，提示找不到vmlinux.h文件，那么请在本代码同级目录下运行生成vmlinux.h命令 */
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+#include <bpf/bpf_core_read.h>
+#include "mem_watcher.h"
+
+char LICENSE[] SEC("license") = "Dual BSD/GPL";
+
+/* 返回 VM_FAULT_RETRY 的缺页会以 FAULT_FLAG_TRIED 重新进入 handle_mm_fault，
+ * 与内核 mm_account_fault 一样只在完成时统计一次，起始时间从第一次进入算起，
+ * 重试过的缺页计为主缺页 */
+struct fault_start {
+	u64 ts;
+	u64 address;
+	struct fault_key key;
+	bool retried;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 10240);
+	__type(key, u32); // tid
+	__type(value, struct fault_start);
+} starts SEC(".maps");
+
+/* 按 (进程, 映射) 聚合的缺页统计，用户态每个输出间隔读取并清空 */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, FAULT_MAX_ENTRIES);
+	__type(key, struct fault_key);
+	__type(value, struct fault_stat);
+} fault_stats SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_STACK_TRACE);
+	__uint(max_entries, 1024);
+	__type(key, u32);
+	__uint(value_size, 127 * sizeof(u64));
+} stack_traces SEC(".maps");
+
+const volatile pid_t user_pid = 0;
+const volatile pid_t target_pid = 0;
+const volatile bool user_stacks = false;
+
+static __always_inline u32 log2_u32(u32 v) {
+	u32 r, shift;
+
+	r = (v > 0xFFFF) << 4; v >>= r;
+	shift = (v > 0xFF) << 3; v >>= shift; r |= shift;
+	shift = (v > 0xF) << 2; v >>= shift; r |= shift;
+	shift = (v > 0x3) << 1; v >>= shift; r |= shift;
+	r |= (v >> 1);
+	return r;
+}
+
+static __always_inline u32 log2_u64(u64 v) {
+	u32 hi = v >> 32;
+
+	if (hi)
+		return log2_u32(hi) + 32;
+	return log2_u32(v);
+}
+
+SEC("kprobe/handle_mm_fault")
+int BPF_KPROBE(handle_mm_fault, struct vm_area_struct *vma, unsigned long address) {
+	u64 id = bpf_get_current_pid_tgid();
+	pid_t pid = id >> 32;
+	u32 tid = (u32)id;
+	struct fault_start start = {}, *prev;
+	struct mm_struct *mm;
+	struct file *file;
+	unsigned long vm_start, vm_end;
+
+	if (pid == user_pid)
+		return 0;
+	if (target_pid && pid != target_pid)
+		return 0;
+
+	// 同一地址的重试沿用第一次的起始时间；地址不同说明上次重试已被放弃
+	prev = bpf_map_lookup_elem(&starts, &tid);
+	if (prev && prev->retried && prev->address == address)
+		return 0;
+
+	start.ts = bpf_ktime_get_ns();
+	start.address = address;
+	start.key.pid = pid;
+
+	file = BPF_CORE_READ(vma, vm_file);
+	if (file) {
+		start.key.kind = FAULT_FILE;
+		start.key.dev = BPF_CORE_READ(file, f_inode, i_sb, s_dev);
+		start.key.ino = BPF_CORE_READ(file, f_inode, i_ino);
+	}
+	else {
+		// 匿名映射再区分出堆和栈，其余（mmap 的匿名内存）统一归为 anon
+		mm = BPF_CORE_READ(vma, vm_mm);
+		vm_start = BPF_CORE_READ(vma, vm_start);
+		vm_end = BPF_CORE_READ(vma, vm_end);
+		if (vm_start <= BPF_CORE_READ(mm, brk) && vm_end >= BPF_CORE_READ(mm, start_brk))
+			start.key.kind = FAULT_HEAP;
+		else if (vm_start <= BPF_CORE_READ(mm, start_stack) && vm_end >= BPF_CORE_READ(mm, start_stack))
+			start.key.kind = FAULT_STACK;
+		else
+			start.key.kind = FAULT_ANON;
+	}
+
+	bpf_map_update_elem(&starts, &tid, &start, BPF_ANY);
+	return 0;
+}
+
+SEC("kretprobe/handle_mm_fault")
+int BPF_KRETPROBE(handle_mm_fault_exit, unsigned int ret) {
+	u32 tid = (u32)bpf_get_current_pid_tgid();
+	struct fault_start *start;
+	struct fault_stat *stat, zero = {};
+	u64 delta;
+	u32 slot;
+	bool major;
+
+	start = bpf_map_lookup_elem(&starts, &tid);
+	if (!start)
+		return 0;
+
+	if (ret & VM_FAULT_RETRY) {
+		start->retried = true;
+		return 0;
+	}
+
+	delta = bpf_ktime_get_ns() - start->ts;
+	major = (ret & VM_FAULT_MAJOR) || start->retried;
+
+	stat = bpf_map_lookup_elem(&fault_stats, &start->key);
+	if (!stat) {
+		zero.stack_id = -1;
+		bpf_get_current_comm(&zero.comm, sizeof(zero.comm));
+		bpf_map_update_elem(&fault_stats, &start->key, &zero, BPF_NOEXIST);
+		stat = bpf_map_lookup_elem(&fault_stats, &start->key);
+		if (!stat)
+			goto out;
+	}
+
+	if (major) {
+		__sync_fetch_and_add(&stat->major, 1);
+		if (user_stacks)
+			stat->stack_id = bpf_get_stackid(ctx, &stack_traces, BPF_F_USER_STACK);
+	}
+	else {
+		__sync_fetch_and_add(&stat->minor, 1);
+	}
+	__sync_fetch_and_add(&stat->total_ns, delta);
+	if (delta > stat->max_ns)
+		stat->max_ns = delta;
+
+	slot = log2_u64(delta / 1000);
+	if (slot >= FAULT_MAX_SLOTS)
+		slot = FAULT_MAX_SLOTS - 1;
+	__sync_fetch_and_add(&stat->slots[slot], 1);
+
+out:
+	bpf_map_delete_elem(&starts, &tid);
+	return 0;
+}
@@ -0,0 +1,14 @@
+#include <argp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <bpf/libbpf.h>
+#include "mem_watcher.h"
+#include "faultstat.skel.h"
+#include <sys/select.h>
+#include <unistd.h>
+
+int main(int argc, char **argv) {
+	
+}
\ No newline at end of file
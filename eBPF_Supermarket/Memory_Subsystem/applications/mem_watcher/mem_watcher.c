@@ -21,9 +21,12 @@
 #include <errno.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <sys/resource.h>
 #include <bpf/libbpf.h>
+#include <bpf/bpf.h>
 #include <sys/select.h>
 #include <unistd.h>
 #include "paf.skel.h"
@@ -31,6 +34,7 @@
 #include "procstat.skel.h"
 #include "sysstat.skel.h"
 #include "memleak.skel.h"
+#include "faultstat.skel.h"
 #include "mem_watcher.h"
 
 #include "blazesym.h"
@@ -86,11 +90,19 @@ static struct env {
 	bool procstat;
 	bool sysstat;
 	bool memleak;
+	bool fault;
 
 	bool part2;
 
 	long choose_pid;
 	bool rss;
+	bool ustack;
+
+	int interval;
+
+	int memleak_pid;
+	int top;
+	long memleak_sample;
 } env = {
 	.time = 0,
 	.paf = false,
@@ -98,8 +110,14 @@ static struct env {
 	.procstat = false,
 	.sysstat = false,
 	.memleak = false,
+	.fault = false,
+	.ustack = false,
 	.rss = false,
 	.part2 = false,
+	.interval = 0,
+	.memleak_pid = 0,
+	.top = 10,
+	.memleak_sample = 0,
 };
 
 const char argp_program_doc[] = "mem_watcher is in use ....\n";
@@ -121,8 +139,16 @@ static const struct argp_option opts[] = {
 	{"part2", 'n', NULL, 0, "系统内存状态报告2", 7},
 
 	{"memleak", 'l', "PID", 0, "print memleak (内存泄漏检测)", 8},
+	{0, 0, 0, 0, "memleak additional function:"},
+	{"sample-bytes", 'b', "BYTES", 0, "平均每BYTES字节采样一次分配，0表示跟踪所有分配(默认)"},
+
+	{"fault", 'f', 0, 0, "print faultstat (缺页延迟分析)", 9},
+	{0, 0, 0, 0, "faultstat additional function:"},
+	{"ustack", 'U', NULL, 0, "记录 major 缺页的用户态调用栈"},
 
-	{"time", 't', "TIME-SEC", 0, "Max Running Time(0 for infinite)", 9},
+	{"time", 't', "TIME-SEC", 0, "Max Running Time(0 for infinite)", 10},
+	{"top", 'T', "N", 0, "memleak/faultstat 每次输出的条目数，默认10"},
+	{"interval", 'i', "SEC", 0, "procstat/faultstat/memleak 输出间隔，默认分别为1秒、1秒和5秒"},
 	{NULL, 'h', NULL, OPTION_HIDDEN, "show the full help"},
 	{0},
 };
@@ -158,8 +184,36 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
 	case 'R':
 		env.rss = true;
 		break;
+	case 'f':
+		env.fault = true;
+		break;
+	case 'U':
+		env.ustack = true;
+		break;
 	case 'l':
 		env.memleak = true;
+		env.memleak_pid = strtol(arg, NULL, 10);
+		break;
+	case 'i':
+		env.interval = strtol(arg, NULL, 10);
+		if (env.interval <= 0) {
+			fprintf(stderr, "Invalid interval: %s\n", arg);
+			argp_usage(state);
+		}
+		break;
+	case 'T':
+		env.top = strtol(arg, NULL, 10);
+		if (env.top <= 0) {
+			fprintf(stderr, "Invalid top: %s\n", arg);
+			argp_usage(state);
+		}
+		break;
+	case 'b':
+		env.memleak_sample = strtol(arg, NULL, 10);
+		if (env.memleak_sample < 0 || env.memleak_sample > (1L << 28)) {
+			fprintf(stderr, "Invalid sample bytes: %s\n", arg);
+			argp_usage(state);
+		}
 		break;
 	default:
 		return ARGP_ERR_UNKNOWN;
@@ -201,96 +255,469 @@ static void print_frame(const char *name, uintptr_t input_addr, uintptr_t addr,
 	}
 }
 
-static void show_stack_trace(__u64 *stack, int stack_sz, pid_t pid) {
-    const struct blaze_symbolize_inlined_fn *inlined;
-    const struct blaze_result *result;
-    const struct blaze_sym *sym;
-    int i, j;
-
-    assert(sizeof(uintptr_t) == sizeof(uint64_t));
-
-    if (pid) {
-        struct blaze_symbolize_src_process src = {
-            .pid = pid,
-        };
-        result = blaze_symbolize_process(symbolizer, &src, (const uintptr_t *)stack, stack_sz);
-    }
-    else {
-        struct blaze_symbolize_src_kernel src = {};
-        result = blaze_symbolize_kernel(symbolizer, &src, (const uintptr_t *)stack, stack_sz);
-    }
-
-
-    for (i = 0; i < stack_sz; i++) {
-        if (!result || result->cnt <= i || result->syms[i].name == NULL) {
-            printf(" %2d [<%016llx>]\n", i, stack[i]);
-            continue;
-        }
-
-        sym = &result->syms[i];
-        print_frame(sym->name, stack[i], sym->addr, sym->offset, &sym->code_info);
-
-        for (j = 0; j < sym->inlined_cnt; j++) {
-            inlined = &sym->inlined[j];
-            print_frame(sym->name, 0, 0, 0, &inlined->code_info);
-        }
-    }
-
-    blaze_result_free(result);
+/* 某个调用栈在一次快照中尚未释放的内存 */
+struct leak_stack {
+	__u64 stack_id;
+	__u64 size;
+	__u64 nr_allocs;
+	int streak;        //连续增长的快照数
+	double rate;       //相对窗口内最早快照的增长速率(B/s)
+	double alloc_rate; //未释放分配次数的增长速率(次/s)
+};
+
+/* 一次快照，stacks 按 stack_id 升序排列 */
+struct leak_snapshot {
+	double time;
+	size_t nr;
+	struct leak_stack *stacks;
+};
+
+// 增长速率按最近 MEMLEAK_MAX_SNAPSHOTS 个快照计算，窗口越长越能反映缓慢的泄漏
+#define MEMLEAK_MAX_SNAPSHOTS 16
+
+static struct leak_snapshot snapshots[MEMLEAK_MAX_SNAPSHOTS];
+static int nr_snapshots, snapshot_head;
+
+static int cmp_leak_stack_id(const void *a, const void *b) {
+	const struct leak_stack *x = a, *y = b;
+
+	return x->stack_id < y->stack_id ? -1 : x->stack_id > y->stack_id;
+}
+
+static int cmp_leak_stack_rate(const void *a, const void *b) {
+	const struct leak_stack *x = *(const struct leak_stack **)a, *y = *(const struct leak_stack **)b;
+
+	if (x->rate != y->rate)
+		return x->rate < y->rate ? 1 : -1;
+	return x->size < y->size ? 1 : x->size > y->size ? -1 : 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+	__u64 x = *(const __u64 *)a, y = *(const __u64 *)b;
+
+	return x < y ? -1 : x > y;
 }
 
+static struct leak_stack *find_leak_stack(struct leak_snapshot *snap, __u64 stack_id) {
+	struct leak_stack key = { .stack_id = stack_id };
+
+	return bsearch(&key, snap->stacks, snap->nr, sizeof(key), cmp_leak_stack_id);
+}
+
+/* 批量读取 combined_allocs，内核不支持批量操作时退化为逐个 get_next_key/lookup */
+static int read_combined_allocs(struct bpf_map *map, struct leak_snapshot *snap) {
+	static __u64 keys[COMBINED_ALLOCS_MAX_ENTRIES];
+	static union combined_alloc_info vals[COMBINED_ALLOCS_MAX_ENTRIES];
+	int fd = bpf_map__fd(map);
+	__u32 count, total = 0;
+	__u64 out_batch;
+	void *in = NULL;
+	int err;
+
+	for (;;) {
+		count = COMBINED_ALLOCS_MAX_ENTRIES - total;
+		if (!count)
+			break;
+		err = bpf_map_lookup_batch(fd, in, &out_batch, keys + total, vals + total, &count, NULL);
+		total += count;
+		if (err == -ENOENT)
+			break;
+		if (err == -EINVAL || err == -ENOTSUP || err == -EOPNOTSUPP) {
+			__u64 *prev = NULL;
+
+			total = 0;
+			while (total < COMBINED_ALLOCS_MAX_ENTRIES && !bpf_map_get_next_key(fd, prev, &keys[total])) {
+				if (!bpf_map_lookup_elem(fd, &keys[total], &vals[total])) {
+					prev = &keys[total];
+					total++;
+				}
+			}
+			break;
+		}
+		if (err < 0) {
+			fprintf(stderr, "failed to read combined_allocs: %d\n", err);
+			return err;
+		}
+		in = &out_batch;
+	}
+
+	snap->stacks = calloc(total ? total : 1, sizeof(*snap->stacks));
+	if (!snap->stacks)
+		return -ENOMEM;
+	snap->nr = 0;
+	for (__u32 i = 0; i < total; i++) {
+		if (!vals[i].total_size)
+			continue;
+		snap->stacks[snap->nr].stack_id = keys[i];
+		snap->stacks[snap->nr].size = vals[i].total_size;
+		snap->stacks[snap->nr].nr_allocs = vals[i].number_of_allocs;
+		snap->nr++;
+	}
+	qsort(snap->stacks, snap->nr, sizeof(*snap->stacks), cmp_leak_stack_id);
+
+	return 0;
+}
+
+/* 将需要输出的调用栈中的地址去重后，每个进程只调用一次 blazesym 进行符号化 */
+static const struct blaze_result *symbolize_addrs(__u64 *addrs, size_t nr, pid_t pid) {
+	assert(sizeof(uintptr_t) == sizeof(uint64_t));
+
+	if (pid) {
+		struct blaze_symbolize_src_process src = {
+			.pid = pid,
+		};
+		return blaze_symbolize_process(symbolizer, &src, (const uintptr_t *)addrs, nr);
+	}
+	else {
+		struct blaze_symbolize_src_kernel src = {};
+		return blaze_symbolize_kernel(symbolizer, &src, (const uintptr_t *)addrs, nr);
+	}
+}
+
+static void show_stack_trace(__u64 *stack, int stack_sz, __u64 *addrs, size_t nr_addrs,
+							 const struct blaze_result *result) {
+	const struct blaze_symbolize_inlined_fn *inlined;
+	const struct blaze_sym *sym;
+	__u64 *found;
+	size_t idx;
+	int i, j;
+
+	for (i = 0; i < stack_sz; i++) {
+		found = bsearch(&stack[i], addrs, nr_addrs, sizeof(*addrs), cmp_u64);
+		idx = found ? (size_t)(found - addrs) : 0;
+		if (!found || !result || result->cnt <= idx || result->syms[idx].name == NULL) {
+			printf(" %2d [<%016llx>]\n", i, stack[i]);
+			continue;
+		}
+
+		sym = &result->syms[idx];
+		print_frame(sym->name, stack[i], sym->addr, sym->offset, &sym->code_info);
+
+		for (j = 0; j < sym->inlined_cnt; j++) {
+			inlined = &sym->inlined[j];
+			print_frame(sym->name, 0, 0, 0, &inlined->code_info);
+		}
+	}
+}
+
+/*
+ * 每次调用生成一个未释放内存的快照，与窗口内最早的快照比较得到每个调用栈的增长速率，
+ * 输出增长最快的调用栈。缓慢泄漏表现为持续为正的增长速率和不断增加的连续增长次数。
+ */
 int print_outstanding_combined_allocs(struct memleak_bpf *skel, pid_t pid) {
-    const size_t combined_allocs_key_size = bpf_map__key_size(skel->maps.combined_allocs);
-    const size_t stack_traces_key_size = bpf_map__key_size(skel->maps.stack_traces);
-
-    for (__u64 prev_key = 0, curr_key = 0; ; prev_key = curr_key) {
-
-        if (bpf_map__get_next_key(skel->maps.combined_allocs,
-            &prev_key, &curr_key, combined_allocs_key_size)) {
-            if (errno == ENOENT) {
-                break; //no more keys, done!
-            }
-            perror("map get next key failed!");
-
-            return -errno;
-        }
-
-        // stack_id = curr_key
-        union combined_alloc_info cinfo;
-        memset(&cinfo, 0, sizeof(cinfo));
-
-        if (bpf_map__lookup_elem(skel->maps.combined_allocs,
-            &curr_key, combined_allocs_key_size, &cinfo, sizeof(cinfo), 0)) {
-            if (errno == ENOENT) {
-                continue;
-            }
-
-            perror("map lookup failed!");
-            return -errno;
-        }
-
-        if (bpf_map__lookup_elem(skel->maps.stack_traces,
-            &curr_key, stack_traces_key_size, g_stacks, g_stacks_size, 0)) {
-            perror("failed to lookup stack traces!");
-            return -errno;
-        }
-
-        printf("stack_id=0x%llx with outstanding allocations: total_size=%llu nr_allocs=%llu\n",
-            curr_key, (__u64)cinfo.total_size, (__u64)cinfo.number_of_allocs);
-
-        int stack_sz = 0;
-        for (int i = 0; i < perf_max_stack_depth; i++) {
-            if (g_stacks[i] == 0) {
-                break;
-            }
-            stack_sz++;
-            //printf("[%3d] 0x%llx\n", i, g_stacks[i]);
-        }
-
-        show_stack_trace(g_stacks, stack_sz, pid);
-    }
+	struct leak_snapshot *cur, *oldest = NULL, *prev = NULL;
+	struct leak_stack **top = NULL, *st, *old;
+	__u64 *stacks = NULL, *addrs = NULL;
+	const struct blaze_result *result = NULL;
+	size_t nr_top, nr_addrs = 0, n;
+	__u64 total_size = 0, total_allocs = 0;
+	double window = 0, total_rate = 0;
+	struct timespec ts;
+	int err = 0, i, k;
+
+	// snapshot_head 指向下一个要写入的位置，窗口已满时覆盖最早的快照
+	if (nr_snapshots == MEMLEAK_MAX_SNAPSHOTS) {
+		free(snapshots[snapshot_head].stacks);
+		snapshots[snapshot_head].stacks = NULL;
+		nr_snapshots--;
+	}
+	if (nr_snapshots) {
+		prev = &snapshots[(snapshot_head + MEMLEAK_MAX_SNAPSHOTS - 1) % MEMLEAK_MAX_SNAPSHOTS];
+		oldest = &snapshots[(snapshot_head + MEMLEAK_MAX_SNAPSHOTS - nr_snapshots) % MEMLEAK_MAX_SNAPSHOTS];
+	}
+	cur = &snapshots[snapshot_head];
 
-    return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	cur->time = ts.tv_sec + ts.tv_nsec / 1e9;
+	err = read_combined_allocs(skel->maps.combined_allocs, cur);
+	if (err)
+		return err;
+	snapshot_head = (snapshot_head + 1) % MEMLEAK_MAX_SNAPSHOTS;
+	nr_snapshots++;
+
+	if (oldest)
+		window = cur->time - oldest->time;
+	for (n = 0; n < cur->nr; n++) {
+		st = &cur->stacks[n];
+		total_size += st->size;
+		total_allocs += st->nr_allocs;
+		if (prev && (old = find_leak_stack(prev, st->stack_id)) != NULL)
+			st->streak = st->size > old->size ? old->streak + 1 : 0;
+		else
+			st->streak = prev ? 1 : 0;
+		if (window > 0) {
+			old = find_leak_stack(oldest, st->stack_id);
+			st->rate = ((double)st->size - (old ? old->size : 0)) / window;
+			st->alloc_rate = ((double)st->nr_allocs - (old ? old->nr_allocs : 0)) / window;
+			total_rate += st->rate;
+		}
+	}
+	if (window > 0) {
+		// 窗口内已经全部释放的调用栈同样计入总增长速率
+		for (n = 0; n < oldest->nr; n++)
+			if (!find_leak_stack(cur, oldest->stacks[n].stack_id))
+				total_rate -= oldest->stacks[n].size / window;
+	}
+
+	time_t now = time(NULL);
+	struct tm *tm = localtime(&now);
+	printf("[%02d:%02d:%02d] outstanding: %zu stacks, %llu bytes in %llu allocs",
+		   tm->tm_hour, tm->tm_min, tm->tm_sec, cur->nr, total_size, total_allocs);
+	if (env.memleak_sample)
+		printf(" (bytes extrapolated, allocs sampled every ~%ld bytes)", env.memleak_sample);
+	if (window > 0)
+		printf(", growth %+.1f B/s over %.0fs\n", total_rate, window);
+	else
+		printf(", collecting baseline\n");
+
+	/* 按增长速率（无历史时按未释放大小）选出前 top 个调用栈 */
+	top = malloc((cur->nr ? cur->nr : 1) * sizeof(*top));
+	if (!top) {
+		err = -ENOMEM;
+		goto out;
+	}
+	for (n = 0, nr_top = 0; n < cur->nr; n++)
+		if (window <= 0 || cur->stacks[n].rate > 0)
+			top[nr_top++] = &cur->stacks[n];
+	qsort(top, nr_top, sizeof(*top), cmp_leak_stack_rate);
+	if (nr_top > (size_t)env.top)
+		nr_top = env.top;
+
+	/* 读取调用栈并收集所有地址 */
+	stacks = calloc(nr_top ? nr_top : 1, g_stacks_size);
+	addrs = malloc((nr_top ? nr_top : 1) * g_stacks_size);
+	if (!stacks || !addrs) {
+		err = -ENOMEM;
+		goto out;
+	}
+	for (n = 0; n < nr_top; n++) {
+		__u32 stack_id = top[n]->stack_id;
+		__u64 *stack = stacks + n * perf_max_stack_depth;
+
+		if (bpf_map_lookup_elem(bpf_map__fd(skel->maps.stack_traces), &stack_id, stack))
+			continue;
+		for (i = 0; i < perf_max_stack_depth && stack[i]; i++)
+			addrs[nr_addrs++] = stack[i];
+	}
+	qsort(addrs, nr_addrs, sizeof(*addrs), cmp_u64);
+	for (n = 0, k = 0; n < nr_addrs; n++)
+		if (!k || addrs[n] != addrs[k - 1])
+			addrs[k++] = addrs[n];
+	nr_addrs = k;
+	if (nr_addrs)
+		result = symbolize_addrs(addrs, nr_addrs, pid);
+
+	for (n = 0; n < nr_top; n++) {
+		__u64 *stack = stacks + n * perf_max_stack_depth;
+		int stack_sz = 0;
+
+		st = top[n];
+		printf("stack_id=0x%llx with outstanding allocations: total_size=%llu nr_allocs=%llu",
+			   st->stack_id, st->size, st->nr_allocs);
+		if (window > 0)
+			printf(" growth=%+.1f B/s (%+.2f allocs/s) grew in %d consecutive snapshots",
+				   st->rate, st->alloc_rate, st->streak);
+		printf("\n");
+
+		while (stack_sz < perf_max_stack_depth && stack[stack_sz])
+			stack_sz++;
+		show_stack_trace(stack, stack_sz, addrs, nr_addrs, result);
+	}
+
+out:
+	blaze_result_free(result);
+	free(top);
+	free(stacks);
+	free(addrs);
+	return err;
+}
+
+struct fault_entry {
+	struct fault_key key;
+	struct fault_stat stat;
+};
+
+static const char *fault_kind_names[] = {
+	[FAULT_ANON] = "[anon]",
+	[FAULT_HEAP] = "[heap]",
+	[FAULT_STACK] = "[stack]",
+};
+
+/* 在 /proc/<pid>/maps 中按设备号和 inode 查找文件映射的路径 */
+static void fault_mapping_name(const struct fault_key *key, char *buf, size_t sz) {
+	unsigned int major, minor;
+	unsigned long long ino;
+	char path[64], line[4096];
+	int n;
+	FILE *f;
+
+	if (key->kind != FAULT_FILE) {
+		snprintf(buf, sz, "%s", fault_kind_names[key->kind]);
+		return;
+	}
+
+	snprintf(buf, sz, "dev %llu:%llu ino %llu", key->dev >> 20, key->dev & 0xfffff, key->ino);
+	snprintf(path, sizeof(path), "/proc/%d/maps", key->pid);
+	f = fopen(path, "r");
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%*s %*s %*s %x:%x %llu %n", &major, &minor, &ino, &n) != 3)
+			continue;
+		if (ino == key->ino && major == key->dev >> 20 && minor == (key->dev & 0xfffff)) {
+			line[strcspn(line, "\n")] = '\0';
+			snprintf(buf, sz, "%s", line + n);
+			break;
+		}
+	}
+	fclose(f);
+}
+
+static __u64 fault_percentile(const struct fault_stat *st, double pct) {
+	__u64 total = st->minor + st->major, sum = 0;
+	int i;
+
+	for (i = 0; i < FAULT_MAX_SLOTS; i++) {
+		sum += st->slots[i];
+		if (sum >= total * pct)
+			return 1ULL << (i + 1);
+	}
+	return 1ULL << FAULT_MAX_SLOTS;
+}
+
+static void print_fault_hist(const struct fault_stat *st) {
+	unsigned int max = 0;
+	int i, idx_max = -1;
+
+	for (i = 0; i < FAULT_MAX_SLOTS; i++) {
+		if (st->slots[i] > 0)
+			idx_max = i;
+		if (st->slots[i] > max)
+			max = st->slots[i];
+	}
+
+	printf("%24s : %-10s |%-40s|\n", "usecs", "count", "distribution");
+	for (i = 0; i <= idx_max; i++) {
+		unsigned long long low = i ? 1ULL << i : 0, high = (1ULL << (i + 1)) - 1;
+		int stars = max ? (int)((__u64)st->slots[i] * 40 / max) : 0;
+
+		printf("%10llu -> %-10llu : %-10u |%.*s%*s|\n", low, high, st->slots[i],
+			   stars, "****************************************", 40 - stars, "");
+	}
+}
+
+static void print_fault_stack(int fd, int stack_id, pid_t pid) {
+	static __u64 addrs[127];
+	const struct blaze_result *result;
+	int i, nr = 0, sz = 0;
+
+	if (bpf_map_lookup_elem(fd, &stack_id, g_stacks))
+		return;
+	while (sz < perf_max_stack_depth && g_stacks[sz])
+		sz++;
+	memcpy(addrs, g_stacks, sz * sizeof(*addrs));
+	qsort(addrs, sz, sizeof(*addrs), cmp_u64);
+	for (i = 0; i < sz; i++)
+		if (!nr || addrs[i] != addrs[nr - 1])
+			addrs[nr++] = addrs[i];
+
+	result = symbolize_addrs(addrs, nr, pid);
+	printf("    last major fault user stack:\n");
+	show_stack_trace(g_stacks, sz, addrs, nr, result);
+	blaze_result_free(result);
+}
+
+static int cmp_fault_entry(const void *a, const void *b) {
+	const struct fault_entry *x = a, *y = b;
+
+	return x->stat.total_ns < y->stat.total_ns ? 1 : x->stat.total_ns > y->stat.total_ns ? -1 : 0;
+}
+
+/* 批量读取并清空 fault_stats，读取与删除一次完成，不会丢失两者之间 BPF 侧的累加；
+ * 内核不支持批量操作时退化为每次取第一个键读取后删除
+ */
+static int drain_fault_stats(int fd, struct fault_key *keys, struct fault_stat *vals, __u32 *nr) {
+	__u32 count, total = 0;
+	struct fault_key out_batch;
+	void *in = NULL;
+	int err;
+
+	for (;;) {
+		count = FAULT_MAX_ENTRIES - total;
+		if (!count)
+			break;
+		err = bpf_map_lookup_and_delete_batch(fd, in, &out_batch, keys + total, vals + total, &count, NULL);
+		total += count;
+		if (err == -ENOENT)
+			break;
+		if (err == -EINVAL || err == -ENOTSUP || err == -EOPNOTSUPP) {
+			struct fault_key key;
+
+			while (total < FAULT_MAX_ENTRIES && !bpf_map_get_next_key(fd, NULL, &key)) {
+				if (!bpf_map_lookup_elem(fd, &key, &vals[total]))
+					keys[total++] = key;
+				bpf_map_delete_elem(fd, &key);
+			}
+			break;
+		}
+		if (err < 0) {
+			fprintf(stderr, "failed to read fault_stats: %d\n", err);
+			return err;
+		}
+		in = &out_batch;
+	}
+	*nr = total;
+
+	return 0;
+}
+
+/* 读取并清空 fault_stats，按缺页总耗时输出前 top 个 (进程, 映射) */
+static int print_fault_stats(struct faultstat_bpf *skel) {
+	static struct fault_entry entries[FAULT_MAX_ENTRIES];
+	static struct fault_key keys[FAULT_MAX_ENTRIES];
+	static struct fault_stat vals[FAULT_MAX_ENTRIES];
+	int fd = bpf_map__fd(skel->maps.fault_stats);
+	__u64 minor = 0, major = 0;
+	__u32 nr_keys = 0;
+	size_t nr = 0, i;
+	char name[256];
+	struct tm *tm;
+	time_t t;
+	int err;
+
+	err = drain_fault_stats(fd, keys, vals, &nr_keys);
+	if (err)
+		return err;
+	for (i = 0; i < nr_keys; i++) {
+		entries[nr].key = keys[i];
+		entries[nr].stat = vals[i];
+		minor += vals[i].minor;
+		major += vals[i].major;
+		nr++;
+	}
+	qsort(entries, nr, sizeof(entries[0]), cmp_fault_entry);
+
+	time(&t);
+	tm = localtime(&t);
+	printf("[%02d:%02d:%02d] faults: minor %llu major %llu\n", tm->tm_hour, tm->tm_min, tm->tm_sec, minor, major);
+	printf("%-8s %-16s %-10s %-10s %-10s %-10s %-10s %s\n",
+		   "PID", "COMM", "MINOR", "MAJOR", "AVG(us)", "P99(us)", "MAX(us)", "MAPPING");
+	for (i = 0; i < nr && i < (size_t)env.top; i++) {
+		struct fault_stat *st = &entries[i].stat;
+
+		fault_mapping_name(&entries[i].key, name, sizeof(name));
+		printf("%-8d %-16s %-10llu %-10llu %-10.1f <%-9llu %-10.1f %s\n",
+			   entries[i].key.pid, st->comm, st->minor, st->major,
+			   st->total_ns / 1000.0 / (st->minor + st->major), fault_percentile(st, 0.99),
+			   st->max_ns / 1000.0, name);
+		if (env.choose_pid)
+			print_fault_hist(st);
+		if (env.ustack && st->stack_id >= 0)
+			print_fault_stack(bpf_map__fd(skel->maps.stack_traces), st->stack_id, entries[i].key.pid);
+	}
+	printf("\n");
+
+	return 0;
 }
 
 static int libbpf_print_fn(enum libbpf_print_level level, const char *format, va_list args) {
@@ -393,6 +820,52 @@ static int handle_event_procstat(void *ctx, void *data, size_t data_sz) {
 	return 0;
 }
 
+/* 读取一次 task 迭代器，得到所有进程同一时刻的内存状态 */
+static int print_procstat_snapshot(struct bpf_link *link) {
+	static char *buf;
+	static size_t buf_sz;
+	size_t len = 0;
+	ssize_t n;
+	int fd, err = 0;
+
+	fd = bpf_iter_create(bpf_link__fd(link));
+	if (fd < 0) {
+		fprintf(stderr, "Failed to create task iterator: %d\n", -errno);
+		return -errno;
+	}
+
+	for (;;) {
+		if (buf_sz - len < 4096) {
+			char *tmp = realloc(buf, buf_sz + 64 * 1024);
+
+			if (!tmp) {
+				err = -ENOMEM;
+				goto out;
+			}
+			buf = tmp;
+			buf_sz += 64 * 1024;
+		}
+		n = read(fd, buf + len, buf_sz - len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			err = -errno;
+			fprintf(stderr, "Failed to read task iterator: %d\n", err);
+			goto out;
+		}
+		if (n == 0)
+			break;
+		len += n;
+	}
+
+	for (size_t off = 0; off + sizeof(struct procstat_event) <= len; off += sizeof(struct procstat_event))
+		handle_event_procstat(NULL, buf + off, sizeof(struct procstat_event));
+
+out:
+	close(fd);
+	return err;
+}
+
 static int handle_event_sysstat(void *ctx, void *data, size_t data_sz) {
 	const struct sysstat_event *e = data;
 	struct tm *tm;
@@ -411,6 +884,54 @@ static int handle_event_sysstat(void *ctx, void *data, size_t data_sz) {
 	return 0;
 }
 
+// 每隔 BLOOM_ROTATE_INTERVALS 个输出间隔轮换一次采样地址的布隆过滤器
+#define BLOOM_ROTATE_INTERVALS 12
+
+/*
+ * 布隆过滤器无法删除已释放的地址，长时间运行后会被填满而失去过滤作用。
+ * 用 allocs 中仍存活的地址重建一个新过滤器放入槽0，原槽0移到槽1，丢弃最旧的一代；
+ * 重建期间新增的分配仍写入原槽0，移到槽1后继续可查，不会漏判。
+ */
+static int rotate_sampled_addrs(struct memleak_bpf *skel) {
+	LIBBPF_OPTS(bpf_map_create_opts, opts, .map_extra = 3);
+	int outer_fd = bpf_map__fd(skel->maps.sampled_addrs);
+	int allocs_fd = bpf_map__fd(skel->maps.allocs);
+	__u64 key, next_key, *prev = NULL;
+	__u32 slot = 0, id;
+	int new_fd, cur_fd, err;
+
+	new_fd = bpf_map_create(BPF_MAP_TYPE_BLOOM_FILTER, "sampled_addrs", 0, sizeof(__u64),
+							ALLOCS_MAX_ENTRIES, &opts);
+	if (new_fd < 0)
+		return -errno;
+
+	while (!bpf_map_get_next_key(allocs_fd, prev, &next_key)) {
+		key = next_key;
+		prev = &key;
+		bpf_map_update_elem(new_fd, NULL, &key, BPF_ANY);
+	}
+
+	err = bpf_map_lookup_elem(outer_fd, &slot, &id);
+	if (err)
+		goto out;
+	cur_fd = bpf_map_get_fd_by_id(id);
+	if (cur_fd < 0) {
+		err = -errno;
+		goto out;
+	}
+	slot = 1;
+	err = bpf_map_update_elem(outer_fd, &slot, &cur_fd, BPF_ANY);
+	close(cur_fd);
+	if (err)
+		goto out;
+	slot = 0;
+	err = bpf_map_update_elem(outer_fd, &slot, &new_fd, BPF_ANY);
+
+out:
+	close(new_fd);
+	return err;
+}
+
 pid_t own_pid;
 
 int attach_uprobes(struct memleak_bpf *skel) {
@@ -460,6 +981,7 @@ int main(int argc, char **argv) {
 	struct procstat_bpf *skel_procstat;
 	struct sysstat_bpf *skel_sysstat;
 	struct memleak_bpf *skel;
+	struct faultstat_bpf *skel_fault;
 
 	int err, i;
 	LIBBPF_OPTS(bpf_uprobe_opts, uprobe_opts);
@@ -557,7 +1079,8 @@ int main(int argc, char **argv) {
 			return 1;
 		}
 
-		skel_procstat->bss->user_pid = own_pid;
+		skel_procstat->rodata->user_pid = own_pid;
+		skel_procstat->rodata->target_pid = env.choose_pid;
 
 		/* Load & verify BPF programs */
 		err = procstat_bpf__load(skel_procstat);
@@ -566,21 +1089,13 @@ int main(int argc, char **argv) {
 			goto procstat_cleanup;
 		}
 
-		/* Attach tracepoints */
+		/* Attach task iterator */
 		err = procstat_bpf__attach(skel_procstat);
 		if (err) {
 			fprintf(stderr, "Failed to attach BPF skeleton\n");
 			goto procstat_cleanup;
 		}
 
-		/* Set up ring buffer polling */
-		rb = ring_buffer__new(bpf_map__fd(skel_procstat->maps.rb), handle_event_procstat, NULL, NULL);
-		if (!rb) {
-			err = -1;
-			fprintf(stderr, "Failed to create ring buffer\n");
-			goto procstat_cleanup;
-		}
-
 		/* Process events */
 		if (env.rss == true) {
 			printf("%-8s %-8s %-8s %-8s %-8s %-8s %-8s\n", "TIME", "PID", "VMSIZE", "VMDATA", "VMSTK", "VMPTE", "VMSWAP");
@@ -588,6 +1103,14 @@ int main(int argc, char **argv) {
 		else {
 			printf("%-8s %-8s %-8s %-8s %-8s %-8s\n", "TIME", "PID", "SIZE", "RSSANON", "RSSFILE", "RSSSHMEM");
 		}
+
+		while (!exiting) {
+			err = print_procstat_snapshot(skel_procstat->links.dump_task);
+			if (err)
+				break;
+			sleep(env.interval ? env.interval : 1);
+		}
+		goto procstat_cleanup;
 	}
 
 	else if (env.sysstat) {
@@ -631,13 +1154,51 @@ int main(int argc, char **argv) {
 		}
 	}
 
-	else if (env.memleak) {
-		if (argc != 3) {
-			printf("usage:%s attach_pid\n", argv[0]);
-			return -1;
+	else if (env.fault) {
+		skel_fault = faultstat_bpf__open();
+		if (!skel_fault) {
+			fprintf(stderr, "Failed to open BPF skeleton\n");
+			return 1;
+		}
+
+		skel_fault->rodata->user_pid = own_pid;
+		skel_fault->rodata->target_pid = env.choose_pid;
+		skel_fault->rodata->user_stacks = env.ustack;
+
+		err = faultstat_bpf__load(skel_fault);
+		if (err) {
+			fprintf(stderr, "Failed to load and verify BPF skeleton\n");
+			goto faultstat_cleanup;
+		}
+
+		err = faultstat_bpf__attach(skel_fault);
+		if (err) {
+			fprintf(stderr, "Failed to attach BPF skeleton\n");
+			goto faultstat_cleanup;
 		}
 
-		attach_pid = atoi(argv[2]);
+		if (env.ustack) {
+			g_stacks_size = perf_max_stack_depth * sizeof(*g_stacks);
+			g_stacks = (__u64 *)calloc(1, g_stacks_size);
+			symbolizer = blaze_symbolizer_new();
+			if (!g_stacks || !symbolizer) {
+				fprintf(stderr, "Fail to create a symbolizer\n");
+				err = -1;
+				goto faultstat_cleanup;
+			}
+		}
+
+		while (!exiting) {
+			sleep(env.interval ? env.interval : 1);
+			err = print_fault_stats(skel_fault);
+			if (err)
+				break;
+		}
+		goto faultstat_cleanup;
+	}
+
+	else if (env.memleak) {
+		attach_pid = env.memleak_pid;
 
 		strcpy(binary_path, "/lib/x86_64-linux-gnu/libc.so.6");
 
@@ -654,6 +1215,25 @@ int main(int argc, char **argv) {
 		bpf_map__set_value_size(skel->maps.stack_traces, perf_max_stack_depth * sizeof(__u64));
 		bpf_map__set_max_entries(skel->maps.stack_traces, stack_map_max_entries);
 
+		/* 采样时用布隆过滤器过滤未被采样指针的 free，内核不支持或不采样时退化为不使用的占位 map */
+		skel->rodata->sample_period = env.memleak_sample;
+		skel->rodata->use_bloom = env.memleak_sample &&
+			libbpf_probe_bpf_map_type(BPF_MAP_TYPE_BLOOM_FILTER, NULL) > 0;
+		if (!skel->rodata->use_bloom) {
+			struct bpf_map *filters[] = {
+				skel->maps.sampled_addrs0,
+				skel->maps.sampled_addrs1,
+				bpf_map__inner_map(skel->maps.sampled_addrs),
+			};
+
+			for (int i = 0; i < 3; i++) {
+				bpf_map__set_type(filters[i], BPF_MAP_TYPE_ARRAY);
+				bpf_map__set_key_size(filters[i], sizeof(__u32));
+				bpf_map__set_max_entries(filters[i], 1);
+				bpf_map__set_map_extra(filters[i], 0);
+			}
+		}
+
 		/* Load & verify BPF programs */
 		err = memleak_bpf__load(skel);
 		if (err) {
@@ -687,15 +1267,24 @@ int main(int argc, char **argv) {
 			goto memleak_cleanup;
 		}
 
-		for (i = 0;; i++) {
-			/* trigger our BPF programs */
-			print_outstanding_combined_allocs(skel, attach_pid);
-			sleep(1);
+		for (int ticks = 1; !exiting; ticks++) {
+			sleep(env.interval ? env.interval : 5);
+			err = print_outstanding_combined_allocs(skel, attach_pid);
+			if (err)
+				break;
+			if (skel->rodata->use_bloom && ticks % BLOOM_ROTATE_INTERVALS == 0) {
+				err = rotate_sampled_addrs(skel);
+				if (err) {
+					fprintf(stderr, "failed to rotate sampled address filter: %d\n", err);
+					break;
+				}
+			}
 		}
+		goto memleak_cleanup;
 	}
 
 	while (!exiting) {
-		if (env.paf || env.pr || env.procstat || env.sysstat) {
+		if (env.paf || env.pr || env.sysstat) {
 			err = ring_buffer__poll(rb, 1000 /* timeout, ms */);
 			/* Ctrl-C will cause -EINTR */
 			if (err == -EINTR) {
@@ -744,9 +1333,17 @@ sysstat_cleanup:
 	sysstat_bpf__destroy(skel_sysstat);
 	return err < 0 ? -err : 0;
 
+faultstat_cleanup:
+	faultstat_bpf__destroy(skel_fault);
+	blaze_symbolizer_free(symbolizer);
+	free(g_stacks);
+	return err < 0 ? -err : 0;
+
 memleak_cleanup:
 	memleak_bpf__destroy(skel);
 	blaze_symbolizer_free(symbolizer);
 	free(g_stacks);
+	for (i = 0; i < MEMLEAK_MAX_SNAPSHOTS; i++)
+		free(snapshots[i].stacks);
 	return err < 0 ? -err : 0;
 }
\ No newline at end of file
@@ -120,6 +120,8 @@ struct sysstat_event {
 /*memleak.h*/
 #define ALLOCS_MAX_ENTRIES 1000000
 #define COMBINED_ALLOCS_MAX_ENTRIES 10240
+#define SAMPLE_PROB_STEPS 16 // 采样概率表的精度：每 1/16 个采样周期一项
+#define SAMPLE_PROB_MAX 128  // 超过 8 个采样周期的分配总是被采样
  
 struct alloc_info {
     __u64 size;
@@ -134,4 +136,33 @@ union combined_alloc_info {
     __u64 bits;
 };
 
+/*faultstat.h*/
+#define FAULT_MAX_SLOTS 32
+#define FAULT_MAX_ENTRIES 10240
+
+/* 缺页所在映射的类型，FAULT_FILE 由 dev/ino 区分具体文件 */
+enum fault_mapping {
+    FAULT_ANON,
+    FAULT_HEAP,
+    FAULT_STACK,
+    FAULT_FILE,
+};
+
+struct fault_key {
+    pid_t pid;
+    __u32 kind;
+    __u64 dev;
+    __u64 ino;
+};
+
+struct fault_stat {
+    __u64 minor;
+    __u64 major;
+    __u64 total_ns;
+    __u64 max_ns;
+    int stack_id;                    // 最近一次 major 缺页的用户态调用栈，-1 表示没有
+    char comm[TASK_COMM_LEN];
+    __u32 slots[FAULT_MAX_SLOTS];    // 缺页延迟的 log2 直方图，单位 us
+};
+
 #endif /* __MEM_WATCHER_H */
\ No newline at end of file
@@ -62,12 +62,101 @@ struct {
     __type(value, u64); // 用户态指针变量 memptr
 } memptrs SEC(".maps");
 
+/* 被采样的分配地址，free 时先查询该过滤器，未被采样的指针无需查询 allocs
+ * 布隆过滤器不能删除元素，因此分两代：分配写入槽0，free 查询两个槽；
+ * 用户态定期用 allocs 中仍存活的地址重建新过滤器放入槽0，原槽0移到槽1，最旧的一代被丢弃 */
+struct bloom_filter {
+    __uint(type, BPF_MAP_TYPE_BLOOM_FILTER);
+    __uint(max_entries, ALLOCS_MAX_ENTRIES);
+    __uint(map_extra, 3); // 哈希函数个数
+    __type(value, u64);
+} sampled_addrs0 SEC(".maps"), sampled_addrs1 SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __uint(max_entries, 2);
+    __type(key, u32);
+    __array(values, struct bloom_filter);
+} sampled_addrs SEC(".maps") = {
+    .values = { &sampled_addrs0, &sampled_addrs1 },
+};
+
+const volatile u64 sample_period = 0; // 平均每 sample_period 字节采样一次，0 表示跟踪所有分配
+const volatile bool use_bloom = false;
+
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
-static int gen_alloc_enter(size_t size) {
+/* sample_prob[x] = (1 - exp(-x / SAMPLE_PROB_STEPS)) * 2^32，
+ * 相邻两项之间按线性插值取值，见 sample_alloc
+ */
+static const u32 sample_prob[SAMPLE_PROB_MAX + 1] = {
+    0, 260218913, 504671960, 734314345, 950043402, 1152702096,
+    1343082320, 1521927990, 1689937948, 1847768697, 1996036965, 2135322113,
+    2266168400, 2389087111, 2504558554, 2613033936, 2714937127, 2810666315,
+    2900595566, 2985076278, 3064438563, 3138992530, 3209029500, 3274823145,
+    3336630555, 3394693243, 3449238090, 3500478233, 3548613891, 3593833158,
+    3636312728, 3676218591, 3713706680, 3748923480, 3782006603, 3813085320,
+    3842281073, 3869707945, 3895473106, 3919677236, 3942414911, 3963774980,
+    3983840908, 4002691103, 4020399222, 4037034461, 4052661821, 4067342368,
+    4081133465, 4094089002, 4106259603, 4117692824, 4128433341, 4138523123,
+    4148001596, 4156905798, 4165270521, 4173128452, 4180510294, 4187444893,
+    4193959346, 4200079108, 4205828093, 4211228764, 4216302225, 4221068301,
+    4225545615, 4229751662, 4233702877, 4237414701, 4240901636, 4244177309,
+    4247254519, 4250145290, 4252860918, 4255412014, 4257808548, 4260059882,
+    4262174816, 4264161611, 4266028033, 4267781375, 4269428486, 4270975805,
+    4272429376, 4273794879, 4275077651, 4276282704, 4277414746, 4278478201,
+    4279477225, 4280415721, 4281297356, 4282125576, 4282903616, 4283634518,
+    4284321136, 4284966154, 4285572093, 4286141319, 4286676058, 4287178399,
+    4287650304, 4288093618, 4288510073, 4288901297, 4289268817, 4289614070,
+    4289938406, 4290243091, 4290529316, 4290798200, 4291050792, 4291288081,
+    4291510994, 4291720400, 4291917120, 4292101921, 4292275525, 4292438611,
+    4292591816, 4292735739, 4292870942, 4292997954, 4293117270, 4293229358,
+    4293334654, 4293433571, 4293526494,
+};
+
+/* 按字节的泊松采样（与 tcmalloc 相同）：大小为 size 的分配被采中的概率为
+ * 1 - exp(-size / sample_period)，采中后按概率的倒数放大为 weight，
+ * 使 combined_allocs 中的 total_size 是未释放字节数的无偏估计
+ */
+static __always_inline bool sample_alloc(u64 size, u64 *weight) {
+    u64 x, frac;
+    u32 prob;
+
+    if (!sample_period || size >= sample_period * (SAMPLE_PROB_MAX / SAMPLE_PROB_STEPS)) {
+        *weight = size;
+        return true;
+    }
+
+    /* 在 sample_prob[x] 与 sample_prob[x + 1] 之间线性插值，frac 为 16 位定点小数；
+     * x == 0 时即 size * 2^32 / sample_period，小分配的概率与其大小成正比，
+     * 不会被抬高到整整一个表项
+     */
+    x = size * SAMPLE_PROB_STEPS / sample_period;
+    if (x >= SAMPLE_PROB_MAX)
+        x = SAMPLE_PROB_MAX - 1;
+    frac = ((size * SAMPLE_PROB_STEPS - x * sample_period) << 16) / sample_period;
+    prob = sample_prob[x] + (((u64)(sample_prob[x + 1] - sample_prob[x]) * frac) >> 16);
+    if (!prob || bpf_get_prandom_u32() >= prob)
+        return false;
+
+    *weight = (size << 32) / prob;
+    return true;
+}
+
+static bool record_alloc_size(size_t size) {
     const pid_t pid = bpf_get_current_pid_tgid() >> 32;
+    u64 weight;
 
-    bpf_map_update_elem(&sizes, &pid, &size, BPF_ANY);
+    if (!sample_alloc(size, &weight))
+        return false;
+
+    bpf_map_update_elem(&sizes, &pid, &weight, BPF_ANY);
+
+    return true;
+}
+
+static int gen_alloc_enter(size_t size) {
+    record_alloc_size(size);
 
     return 0;
 }
@@ -91,6 +180,13 @@ static int gen_alloc_exit2(void *ctx, u64 address) {
         info.stack_id = bpf_get_stackid(ctx, &stack_traces, USER_STACKID_FLAGS);
 
         bpf_map_update_elem(&allocs, &addr, &info, BPF_ANY);
+        if (use_bloom) {
+            u32 slot = 0;
+            void *filter = bpf_map_lookup_elem(&sampled_addrs, &slot);
+
+            if (filter)
+                bpf_map_push_elem(filter, &addr, BPF_ANY);
+        }
 
         union combined_alloc_info add_cinfo = {
             .total_size = info.size,
@@ -113,8 +209,25 @@ static int gen_alloc_exit(struct pt_regs *ctx) {
     return gen_alloc_exit2(ctx, PT_REGS_RC(ctx));
 }
 
+static __always_inline bool maybe_sampled(u64 addr) {
+    void *filter;
+    u32 slot;
+
+    // 布隆过滤器只有误报没有漏判，两代都查询失败说明该指针一定未被采样
+    for (slot = 0; slot < 2; slot++) {
+        filter = bpf_map_lookup_elem(&sampled_addrs, &slot);
+        if (filter && !bpf_map_peek_elem(filter, &addr))
+            return true;
+    }
+
+    return false;
+}
+
 static int gen_free_enter(const void *address) {
-    const u64 addr = (u64)address;
+    u64 addr = (u64)address;
+
+    if (use_bloom && !maybe_sampled(addr))
+        return 0;
 
     const struct alloc_info *info = bpf_map_lookup_elem(&allocs, &addr);
     if (NULL == info) {
@@ -157,9 +270,13 @@ SEC("uprobe")
 int BPF_KPROBE(posix_memalign_enter, void **memptr, size_t alignment, size_t size) {
     const u64 memptr64 = (u64)(size_t)memptr;
     const u64 pid = bpf_get_current_pid_tgid() >> 32;
+
+    if (!record_alloc_size(size))
+        return 0;
+
     bpf_map_update_elem(&memptrs, &pid, &memptr64, BPF_ANY);
 
-    return gen_alloc_enter(size);
+    return 0;
 }
  
 SEC("uretprobe")
@@ -15,64 +15,48 @@
 
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
-struct {
-	__uint(type, BPF_MAP_TYPE_HASH);
-	__uint(max_entries, 256 * 1024);
-	__type(key, pid_t);
-	__type(value, int);
-} last_val SEC(".maps");
-
-struct {
-	__uint(type, BPF_MAP_TYPE_RINGBUF);
-	__uint(max_entries, 256 * 1024);
-} rb SEC(".maps");
-
-pid_t user_pid = 0;
-
-
-SEC("kprobe/finish_task_switch")
-int BPF_KPROBE(finish_task_switch, struct task_struct *prev) {
-	struct procstat_event *e;
+const volatile pid_t user_pid = 0;   // mem_watcher 自身，不输出
+const volatile pid_t target_pid = 0; // 只输出该进程，0 表示所有进程
+
+/* 用户态每个采样周期读取一次该迭代器，遍历所有进程输出一次内存状态快照，
+ * 两次快照之间没有任何开销
+ */
+SEC("iter/task")
+int dump_task(struct bpf_iter__task *ctx) {
+	struct seq_file *seq = ctx->meta->seq;
+	struct task_struct *task = ctx->task;
+	struct procstat_event e = {};
 	struct mm_rss_stat rss = {};
 	struct mm_struct *mms;
 	long long *t;
-	pid_t pid = bpf_get_current_pid_tgid() >> 32;
-	if (pid == user_pid)
+
+	if (!task)
 		return 0;
 
-	pid_t p_pid = BPF_CORE_READ(prev, pid);
-	if (p_pid == user_pid)
+	// 同一进程的线程共享 mm，只输出线程组的主线程；内核线程没有 mm
+	e.pid = BPF_CORE_READ(task, pid);
+	if (e.pid != BPF_CORE_READ(task, tgid) || e.pid == user_pid)
 		return 0;
-	
-	int val = 1;
-	int *last_pid;
-	last_pid = bpf_map_lookup_elem(&last_val, &p_pid);
-	if (!last_pid) {
-		bpf_map_update_elem(&last_val, &p_pid, &val, BPF_ANY);
-	}
-	else if(*last_pid == val) {
+	if (target_pid && e.pid != target_pid)
 		return 0;
-	}
-
-	e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
-	if (!e)
+	mms = BPF_CORE_READ(task, mm);
+	if (!mms)
 		return 0;
 
-	e->pid = BPF_CORE_READ(prev, pid);
-	e->vsize = BPF_CORE_READ(prev, mm, total_vm);
-	e->Vdata = BPF_CORE_READ(prev, mm, data_vm);
-	e->Vstk = BPF_CORE_READ(prev, mm, stack_vm);
-	e->nvcsw = BPF_CORE_READ(prev, nvcsw);
-	e->nivcsw = BPF_CORE_READ(prev, nivcsw);
+	e.vsize = BPF_CORE_READ(mms, total_vm);
+	e.Vdata = BPF_CORE_READ(mms, data_vm);
+	e.Vstk = BPF_CORE_READ(mms, stack_vm);
+	e.nvcsw = BPF_CORE_READ(task, nvcsw);
+	e.nivcsw = BPF_CORE_READ(task, nivcsw);
 
-	rss = BPF_CORE_READ(prev, mm, rss_stat);
+	rss = BPF_CORE_READ(mms, rss_stat);
 	t = (long long *)(rss.count);
-	e->rssfile = *t;
-	e->rssanon = *(t + 1);
-	e->vswap = *(t + 2);
-	e->rssshmem = *(t + 3);
-	e->size = *t + *(t + 1) + *(t + 3);
+	e.rssfile = *t;
+	e.rssanon = *(t + 1);
+	e.vswap = *(t + 2);
+	e.rssshmem = *(t + 3);
+	e.size = *t + *(t + 1) + *(t + 3);
 
-	bpf_ringbuf_submit(e, 0);
+	bpf_seq_write(seq, &e, sizeof(e));
 	return 0;
-}
\ No newline at end of file
+}
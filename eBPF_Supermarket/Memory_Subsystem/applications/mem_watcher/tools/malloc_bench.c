@@ -0,0 +1,114 @@
+// Copyright 2023 The LMP Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// malloc 压力测试，用于比较 mem_watcher -l 在不同采样周期下对被测进程吞吐量的影响
+//
+// Usage: malloc_bench [SECONDS] [THREADS] [DELAY]
+//   (default: 10 seconds, 4 threads, 5 seconds delay before starting)
+// 启动后先打印 pid 并等待 DELAY 秒，以便在此期间执行 mem_watcher -l <pid>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SLOTS 1024     // 每个线程同时持有的内存块数
+#define LEAK_EVERY 4096 // 每 LEAK_EVERY 次分配故意泄漏一次
+
+static int duration = 10;
+static volatile int stop;
+
+struct bench_thread {
+	pthread_t tid;
+	unsigned int seed;
+	unsigned long long ops;
+};
+
+static size_t rand_size(unsigned int *seed) {
+	// 大部分是小对象，少量大对象，接近常见服务的分配分布
+	unsigned int r = rand_r(seed);
+
+	if (r % 100 < 90)
+		return 16 + r % 256;
+	if (r % 100 < 99)
+		return 4096 + r % 65536;
+	return 1 << 20;
+}
+
+static void *bench(void *arg) {
+	struct bench_thread *t = arg;
+	void *slots[SLOTS] = {};
+	unsigned long long ops = 0;
+	int i;
+
+	while (!stop) {
+		i = rand_r(&t->seed) % SLOTS;
+		if (ops % LEAK_EVERY)
+			free(slots[i]);
+		slots[i] = malloc(rand_size(&t->seed));
+		ops++;
+	}
+	for (i = 0; i < SLOTS; i++)
+		free(slots[i]);
+	t->ops = ops;
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	int threads = argc > 2 ? atoi(argv[2]) : 4;
+	int delay = argc > 3 ? atoi(argv[3]) : 5;
+	struct bench_thread *t;
+	unsigned long long total = 0;
+	struct timespec start, end;
+	double elapsed;
+	int i;
+
+	if (argc > 1)
+		duration = atoi(argv[1]);
+	if (duration <= 0 || threads <= 0 || delay < 0) {
+		fprintf(stderr, "Usage: %s [SECONDS] [THREADS] [DELAY]\n", argv[0]);
+		return 1;
+	}
+
+	printf("pid %d, starting in %d seconds\n", getpid(), delay);
+	fflush(stdout);
+	sleep(delay);
+
+	t = calloc(threads, sizeof(*t));
+	if (!t) {
+		perror("calloc");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < threads; i++) {
+		t[i].seed = i + 1;
+		pthread_create(&t[i].tid, NULL, bench, &t[i]);
+	}
+	sleep(duration);
+	stop = 1;
+	for (i = 0; i < threads; i++) {
+		pthread_join(t[i].tid, NULL);
+		total += t[i].ops;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	elapsed = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%d threads, %llu malloc/free pairs in %.2fs, %.0f ops/s\n",
+	       threads, total, elapsed, total / elapsed);
+
+	free(t);
+	return 0;
+}
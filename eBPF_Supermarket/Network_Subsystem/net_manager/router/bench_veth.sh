@@ -0,0 +1,90 @@
+#!/bin/bash
+# 在两个网络命名空间之间用 veth 搭建转发拓扑，分别测量内核转发和 XDP 路由加速下的吞吐量：
+#
+#   rtbench_src: rts0 10.201.1.2 <--> rts1 10.201.1.1 (本机，挂载 XDP)
+#   rtbench_dst: rtd0 10.201.2.2 <--> rtd1 10.201.2.1 (本机，挂载 XDP)
+#
+# 用法：sudo ./bench_veth.sh [SECONDS]，需要 iperf3 和 ethtool，在 router 目录下编译后运行
+# 重定向到 veth 的帧由对端的 NAPI 接收，对端需要挂载 XDP 程序或打开 GRO（5.13 及以上内核）
+
+DURATION=${1:-10}
+SRC=rtbench_src
+DST=rtbench_dst
+DEVS="rts1 rtd1"
+
+cd "$(dirname "$0")" || exit 1
+
+for cmd in ip iperf3 ethtool; do
+	if ! command -v $cmd >/dev/null; then
+		echo "$cmd not found" >&2
+		exit 1
+	fi
+done
+
+FORWARD=$(sysctl -n net.ipv4.ip_forward)
+
+cleanup() {
+	[ -n "$SYNC_PID" ] && kill $SYNC_PID 2>/dev/null
+	for dev in $DEVS; do
+		./xdp_loader -U -d $dev >/dev/null 2>&1
+	done
+	ip netns pids $DST 2>/dev/null | xargs -r kill
+	ip netns del $SRC 2>/dev/null
+	ip netns del $DST 2>/dev/null
+	sysctl -qw net.ipv4.ip_forward=$FORWARD
+}
+trap cleanup EXIT
+
+setup() {
+	ip netns add $SRC
+	ip netns add $DST
+	ip link add rts1 type veth peer name rts0 netns $SRC
+	ip link add rtd1 type veth peer name rtd0 netns $DST
+
+	ip addr add 10.201.1.1/24 dev rts1
+	ip addr add 10.201.2.1/24 dev rtd1
+	ip link set rts1 up
+	ip link set rtd1 up
+
+	ip -n $SRC addr add 10.201.1.2/24 dev rts0
+	ip -n $SRC link set rts0 up
+	ip -n $SRC link set lo up
+	ip -n $SRC route add default via 10.201.1.1
+	ip netns exec $SRC ethtool -K rts0 gro on >/dev/null
+
+	ip -n $DST addr add 10.201.2.2/24 dev rtd0
+	ip -n $DST link set rtd0 up
+	ip -n $DST link set lo up
+	ip -n $DST route add default via 10.201.2.1
+	ip netns exec $DST ethtool -K rtd0 gro on >/dev/null
+
+	sysctl -qw net.ipv4.ip_forward=1
+	# 先打通一次，让两端的邻居表项就绪
+	ip netns exec $SRC ping -c 1 -W 1 10.201.2.2 >/dev/null
+}
+
+run() {
+	echo "== $1: TCP"
+	ip netns exec $SRC iperf3 -c 10.201.2.2 -t $DURATION -f m | grep -E "sender|receiver"
+	echo "== $1: UDP 64B"
+	ip netns exec $SRC iperf3 -c 10.201.2.2 -t $DURATION -u -b 0 -l 64 -f m | grep -E "receiver"
+}
+
+setup || exit 1
+ip netns exec $DST iperf3 -s -D >/dev/null
+sleep 0.5
+run "kernel forwarding"
+
+for dev in $DEVS; do
+	./xdp_loader -F -d $dev || exit 1
+done
+./rtcache_sync rts1 5000 $DURATION > rtcache_sync.log &
+SYNC_PID=$!
+
+run "xdp router"
+
+kill $SYNC_PID 2>/dev/null
+wait $SYNC_PID
+SYNC_PID=
+echo "== route cache on rts1"
+cat rtcache_sync.log
@@ -12,6 +12,15 @@ typedef __u32 xdp_act;
 
 #define MAX_RULES 256
 
+// 转发结果缓存的容量（LRU，按目的地址精确匹配）
+#define RTCACHE_MAX_ENTRIES 65536
+// rtcache_sync 每次 lookup_batch 读取的表项数
+#define RTCACHE_BATCH 1024
+// 缓存表项默认有效期，过期后重新走 bpf_fib_lookup
+#define RTCACHE_TTL_NS (5ULL * 1000000000ULL)
+// tx_port 以 ifindex 为键，容量即可转发的设备数
+#define TX_PORT_MAX 256
+
 
 //#define DEBUG_PRINT
 //#define DEBUG_PRINT_EVERY
@@ -21,11 +30,28 @@ struct datarec {
 	__u64 rx_bytes;
 };
 
-// 转发表项
+// 转发表项，键为目的IPv4地址（网络字节序）
 struct rt_item {
-	__u32 saddr;
+	__u32 ifindex; // 出接口
+	__u32 nexthop; // 下一跳地址，直连路由时等于目的地址
+	__u64 expires; // 过期时间（bpf_ktime_get_ns），rtcache_static4 中的静态表项为 0
 	__u8 eth_source[ETH_ALEN]; // 封装帧的源MAC地址。
 	__u8 eth_dest[ETH_ALEN]; // 封装帧的目标MAC地址。
+	__u32 mtu; // 出接口方向的路由 MTU（L3 长度），超过的报文不走缓存
+};
+
+// 运行参数，rtcache_conf 只有一个元素，ttl_ns 为 0 时使用 RTCACHE_TTL_NS
+struct rt_conf {
+	__u64 ttl_ns;
+};
+
+// 缓存命中情况，rtcache_stats 的下标
+enum rt_stat {
+	RT_STAT_HIT,      // 命中缓存直接转发
+	RT_STAT_MISS,     // 未命中，走 bpf_fib_lookup
+	RT_STAT_EXPIRED,  // 命中但已过期，走 bpf_fib_lookup
+	RT_STAT_FILL,     // bpf_fib_lookup 成功后写入缓存
+	RT_STAT_MAX,
 };
 
 #ifndef XDP_ACTION_MAX
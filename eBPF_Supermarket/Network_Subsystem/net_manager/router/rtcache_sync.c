@@ -0,0 +1,430 @@
+// Copyright 2023 The LMP Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// 监听 netlink 的路由、邻居和接口变化，删除 rtcache_map4 中受影响的转发结果，
+// 并把新出现的接口加入 tx_port
+//
+// Usage: rtcache_sync <dev> [TTL_MS] [INTERVAL]
+//   TTL_MS 为缓存表项有效期（默认 5000），INTERVAL 秒输出一次命中统计（默认 1，0 表示不输出）
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h> /* libbpf_num_possible_cpus */
+
+#include "map_common.h"
+#include "common_kern_user.h"
+
+// 内核 include/net/neighbour.h 中的定义，uapi 没有导出
+#define NUD_VALID (NUD_PERMANENT | NUD_NOARP | NUD_REACHABLE | NUD_PROBE | NUD_STALE | NUD_DELAY)
+
+enum rt_match_kind {
+    MATCH_ALL,      // 全部动态表项
+    MATCH_PREFIX,   // 目的地址落在 addr/mask 内
+    MATCH_NEXTHOP,  // 下一跳为 addr，lladdr 非空时只删除目的MAC与之不同的表项
+    MATCH_IFINDEX,  // 出接口为 ifindex
+    MATCH_MTU,      // 出接口为 ifindex 且记录的 MTU 与 mtu 不同
+};
+
+struct rt_match {
+    enum rt_match_kind kind;
+    __u32 addr;
+    __u32 mask;
+    __u32 ifindex;
+    __u32 mtu;
+    const __u8 *lladdr;
+};
+
+// 各接口最近一次看到的 MTU，RTM_NEWLINK 也会因载波、混杂模式等变化发出，只有 MTU 真正改变时才失效
+struct link_mtu {
+    __u32 ifindex;
+    __u32 mtu;
+};
+
+static char *ifname;
+static int rtcache_map4, tx_port, rtcache_conf, rtcache_stats;
+static struct link_mtu link_mtus[TX_PORT_MAX];
+static int nr_link_mtus;
+static __u64 invalidated;
+static volatile sig_atomic_t exiting;
+
+static void sig_handler(int sig){
+    exiting = 1;
+}
+
+int load_bpf_map(){
+    rtcache_map4 = open_map(ifname, "rtcache_map4");
+    tx_port = open_map(ifname, "tx_port");
+    rtcache_conf = open_map(ifname, "rtcache_conf");
+    rtcache_stats = open_map(ifname, "rtcache_stats");
+    if(rtcache_map4 < 0 || tx_port < 0 || rtcache_conf < 0 || rtcache_stats < 0){
+        fprintf(stderr, "load bpf map error,check device name\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int rt_match(const struct rt_match *m, __u32 daddr, const struct rt_item *item){
+    switch(m->kind){
+    case MATCH_ALL:
+        return 1;
+    case MATCH_PREFIX:
+        return (daddr & m->mask) == m->addr;
+    case MATCH_NEXTHOP:
+        if(item->nexthop != m->addr)
+            return 0;
+        if(m->ifindex && item->ifindex != m->ifindex)
+            return 0;
+        return !m->lladdr || memcmp(item->eth_dest, m->lladdr, ETH_ALEN);
+    case MATCH_IFINDEX:
+        return item->ifindex == m->ifindex;
+    case MATCH_MTU:
+        return item->ifindex == m->ifindex && item->mtu != m->mtu;
+    }
+    return 0;
+}
+
+// 删除所有命中 m 的表项，xmac_load 写入的静态表项在 rtcache_static4 中，不受影响。
+// 数据面会随时淘汰或填充 LRU 表项，get_next_key 遇到刚被淘汰的键会从头开始遍历，
+// 所以用按哈希桶推进的 lookup_batch 收集键，再统一删除
+static int rtcache_invalidate(const struct rt_match *m){
+    static __u32 keys[RTCACHE_MAX_ENTRIES];
+    static __u32 batch_keys[RTCACHE_BATCH];
+    static struct rt_item items[RTCACHE_BATCH];
+    __u32 in_batch, out_batch, count;
+    void *in = NULL;
+    int n = 0, err;
+
+    do{
+        count = RTCACHE_BATCH;
+        err = bpf_map_lookup_batch(rtcache_map4, in, &out_batch, batch_keys, items, &count, NULL);
+        if(err < 0 && errno != ENOENT){
+            fprintf(stderr, "lookup rtcache_map4: %s\n", strerror(errno));
+            break;
+        }
+        for(__u32 i = 0; i < count; i++){
+            if(rt_match(m, batch_keys[i], &items[i]) && n < RTCACHE_MAX_ENTRIES)
+                keys[n++] = batch_keys[i];
+        }
+        in_batch = out_batch;
+        in = &in_batch;
+    }while(err == 0);
+
+    for(int i = 0; i < n; i++)
+        bpf_map_delete_elem(rtcache_map4, &keys[i]);
+    invalidated += n;
+
+    return n;
+}
+
+static void parse_rtattr(struct rtattr *tb[], int max, struct rtattr *rta, int len){
+    memset(tb, 0, sizeof(*tb) * (max + 1));
+    for(; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)){
+        if(rta->rta_type <= max)
+            tb[rta->rta_type] = rta;
+    }
+}
+
+// 路由变化只影响落在该前缀内的目的地址，默认路由变化时等价于全部失效
+static void handle_route(struct nlmsghdr *nlh){
+    struct rtmsg *rtm = NLMSG_DATA(nlh);
+    struct rtattr *tb[RTA_MAX + 1];
+    struct rt_match m = { .kind = MATCH_PREFIX };
+    char buf[INET_ADDRSTRLEN];
+    int n;
+
+    if(rtm->rtm_family != AF_INET)
+        return;
+    parse_rtattr(tb, RTA_MAX, RTM_RTA(rtm), RTM_PAYLOAD(nlh));
+
+    if(tb[RTA_DST])
+        memcpy(&m.addr, RTA_DATA(tb[RTA_DST]), sizeof(m.addr));
+    m.mask = rtm->rtm_dst_len ? htonl(~0U << (32 - rtm->rtm_dst_len)) : 0;
+    m.addr &= m.mask;
+
+    n = rtcache_invalidate(&m);
+    if(verbose)
+        printf("%s %s/%d: %d entries invalidated\n",
+               nlh->nlmsg_type == RTM_NEWROUTE ? "route add" : "route del",
+               inet_ntop(AF_INET, &m.addr, buf, sizeof(buf)), rtm->rtm_dst_len, n);
+}
+
+// 邻居表项只在失效或 MAC 地址改变时才需要删除，REACHABLE/STALE 之间的状态迁移不影响转发结果
+static void handle_neigh(struct nlmsghdr *nlh){
+    struct ndmsg *ndm = NLMSG_DATA(nlh);
+    struct rtattr *tb[NDA_MAX + 1];
+    struct rt_match m = { .kind = MATCH_NEXTHOP };
+    char buf[INET_ADDRSTRLEN];
+    int n;
+
+    if(ndm->ndm_family != AF_INET)
+        return;
+    parse_rtattr(tb, NDA_MAX, (struct rtattr *)((char *)ndm + NLMSG_ALIGN(sizeof(*ndm))),
+                 nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ndm)));
+    if(!tb[NDA_DST])
+        return;
+
+    memcpy(&m.addr, RTA_DATA(tb[NDA_DST]), sizeof(m.addr));
+    m.ifindex = ndm->ndm_ifindex;
+    if(nlh->nlmsg_type == RTM_NEWNEIGH && (ndm->ndm_state & NUD_VALID) &&
+       tb[NDA_LLADDR] && RTA_PAYLOAD(tb[NDA_LLADDR]) == ETH_ALEN)
+        m.lladdr = RTA_DATA(tb[NDA_LLADDR]);
+
+    n = rtcache_invalidate(&m);
+    if(verbose && n)
+        printf("neigh %s: %d entries invalidated\n",
+               inet_ntop(AF_INET, &m.addr, buf, sizeof(buf)), n);
+}
+
+// 记录接口的 MTU，返回它是否与上次看到的不同；第一次看到的接口无从比较，按改变处理
+static int link_mtu_changed(__u32 ifindex, __u32 mtu){
+    int i;
+
+    for(i = 0; i < nr_link_mtus; i++){
+        if(link_mtus[i].ifindex == ifindex)
+            break;
+    }
+    if(i == nr_link_mtus){
+        if(nr_link_mtus == TX_PORT_MAX)
+            return 1;
+        link_mtus[nr_link_mtus].ifindex = ifindex;
+        link_mtus[nr_link_mtus++].mtu = mtu;
+        return 1;
+    }
+    if(link_mtus[i].mtu == mtu)
+        return 0;
+    link_mtus[i].mtu = mtu;
+    return 1;
+}
+
+// 启动时记下现有接口的 MTU，之后的 RTM_NEWLINK 才能判断 MTU 是否真的改变
+static void init_link_mtus(){
+    struct if_nameindex *ifs, *p;
+    struct ifreq ifr;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+        return;
+    ifs = if_nameindex();
+    for(p = ifs; p && p->if_index; p++){
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, p->if_name, IFNAMSIZ - 1);
+        if(ioctl(fd, SIOCGIFMTU, &ifr) == 0)
+            link_mtu_changed(p->if_index, ifr.ifr_mtu);
+    }
+    if(ifs)
+        if_freenameindex(ifs);
+    close(fd);
+}
+
+static void forget_link_mtu(__u32 ifindex){
+    for(int i = 0; i < nr_link_mtus; i++){
+        if(link_mtus[i].ifindex == ifindex){
+            link_mtus[i] = link_mtus[--nr_link_mtus];
+            return;
+        }
+    }
+}
+
+// 新接口加入 tx_port；接口被删除时 DEVMAP_HASH 会自行移除对应表项。
+// 接口 MTU 改变时删除从它转发且记录的 MTU 与之不同的表项，由 bpf_fib_lookup 按新 MTU 重新填充
+static void handle_link(struct nlmsghdr *nlh){
+    struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+    struct rtattr *tb[IFLA_MAX + 1];
+    struct rt_match m = { .kind = MATCH_IFINDEX, .ifindex = ifi->ifi_index };
+    __u32 ifindex = ifi->ifi_index;
+    int n;
+
+    if(nlh->nlmsg_type == RTM_NEWLINK)
+        bpf_map_update_elem(tx_port, &ifindex, &ifindex, 0);
+    if(nlh->nlmsg_type == RTM_DELLINK)
+        forget_link_mtu(ifindex);
+    if(nlh->nlmsg_type == RTM_DELLINK || !(ifi->ifi_flags & IFF_UP)){
+        rtcache_invalidate(&m);
+        return;
+    }
+
+    parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(nlh));
+    if(!tb[IFLA_MTU])
+        return;
+    m.kind = MATCH_MTU;
+    memcpy(&m.mtu, RTA_DATA(tb[IFLA_MTU]), sizeof(m.mtu));
+    if(!link_mtu_changed(ifindex, m.mtu))
+        return;
+    n = rtcache_invalidate(&m);
+    if(verbose && n)
+        printf("link %u mtu %u: %d entries invalidated\n", ifindex, m.mtu, n);
+}
+
+static int nl_open(){
+    struct sockaddr_nl sa = {
+        .nl_family = AF_NETLINK,
+        .nl_groups = RTMGRP_LINK | RTMGRP_NEIGH | RTMGRP_IPV4_ROUTE,
+    };
+    int rcvbuf = 1 << 20;
+    int fd;
+
+    fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if(fd < 0){
+        perror("socket");
+        return -1;
+    }
+    // 路由表大量变化时尽量避免 ENOBUFS 丢消息
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if(bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0){
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int nl_recv(int fd){
+    static const struct rt_match all = { .kind = MATCH_ALL };
+    char buf[16384] __attribute__((aligned(NLMSG_ALIGNTO)));
+    struct nlmsghdr *nlh;
+    int len;
+
+    len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if(len < 0){
+        if(errno == EAGAIN || errno == EINTR)
+            return 0;
+        if(errno == ENOBUFS){
+            // 丢失了变更通知，无法判断哪些表项过时，只能全部失效
+            fprintf(stderr, "netlink overrun, flushing route cache\n");
+            rtcache_invalidate(&all);
+            return 0;
+        }
+        perror("recv");
+        return -1;
+    }
+
+    for(nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)){
+        switch(nlh->nlmsg_type){
+        case RTM_NEWROUTE:
+        case RTM_DELROUTE:
+            handle_route(nlh);
+            break;
+        case RTM_NEWNEIGH:
+        case RTM_DELNEIGH:
+            handle_neigh(nlh);
+            break;
+        case RTM_NEWLINK:
+        case RTM_DELLINK:
+            handle_link(nlh);
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static void read_stats(__u64 total[RT_STAT_MAX]){
+    int nr_cpus = libbpf_num_possible_cpus();
+    __u64 values[nr_cpus];
+
+    for(__u32 i = 0; i < RT_STAT_MAX; i++){
+        total[i] = 0;
+        if(bpf_map_lookup_elem(rtcache_stats, &i, values) < 0)
+            continue;
+        for(int c = 0; c < nr_cpus; c++)
+            total[i] += values[c];
+    }
+}
+
+static void print_stats(__u64 cur[RT_STAT_MAX], __u64 prev[RT_STAT_MAX], int interval){
+    __u64 hit = cur[RT_STAT_HIT] - prev[RT_STAT_HIT];
+    __u64 miss = cur[RT_STAT_MISS] - prev[RT_STAT_MISS];
+    __u64 expired = cur[RT_STAT_EXPIRED] - prev[RT_STAT_EXPIRED];
+    __u64 fill = cur[RT_STAT_FILL] - prev[RT_STAT_FILL];
+    __u64 lookups = hit + miss + expired;
+
+    printf("hit %10llu/s  miss %8llu/s  expired %8llu/s  fill %8llu/s  hit ratio %6.2f%%  invalidated %llu\n",
+           hit / interval, miss / interval, expired / interval, fill / interval,
+           lookups ? 100.0 * hit / lookups : 0.0, invalidated);
+}
+
+int main(int argc, char *argv[]){
+    static const struct rt_match all = { .kind = MATCH_ALL };
+    __u64 cur[RT_STAT_MAX], prev[RT_STAT_MAX];
+    struct rt_conf conf = {};
+    struct pollfd pfd;
+    int interval = 1;
+    __u32 key = 0;
+    time_t last;
+
+    if(argc < 2){
+        fprintf(stderr, "Usage: %s <dev> [TTL_MS] [INTERVAL]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    ifname = argv[1];
+    if(argc > 2)
+        conf.ttl_ns = strtoull(argv[2], NULL, 10) * 1000000ULL;
+    if(argc > 3)
+        interval = atoi(argv[3]);
+
+    if(load_bpf_map() < 0)
+        return EXIT_FAILURE;
+    if(bpf_map_update_elem(rtcache_conf, &key, &conf, 0) < 0){
+        fprintf(stderr, "update rtcache_conf: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    pfd.fd = nl_open();
+    pfd.events = POLLIN;
+    if(pfd.fd < 0)
+        return EXIT_FAILURE;
+
+    // 启动前发生的变化无从得知，先清掉已有的动态表项
+    init_link_mtus();
+    rtcache_invalidate(&all);
+    printf("syncing route cache of %s, ttl %llums\n", ifname,
+           (conf.ttl_ns ? conf.ttl_ns : RTCACHE_TTL_NS) / 1000000ULL);
+
+    signal(SIGINT, sig_handler);
+    signal(SIGTERM, sig_handler);
+
+    read_stats(prev);
+    last = time(NULL);
+    while(!exiting){
+        if(poll(&pfd, 1, 1000) > 0 && nl_recv(pfd.fd) < 0)
+            break;
+        if(interval > 0 && time(NULL) - last >= interval){
+            read_stats(cur);
+            print_stats(cur, prev, interval);
+            memcpy(prev, cur, sizeof(prev));
+            last = time(NULL);
+        }
+    }
+
+    close(pfd.fd);
+    return 0;
+}
@@ -121,6 +121,7 @@ int main(int argc, char **argv)
 {
 	int i;
 	int map_fd;
+	struct if_nameindex *ifs;  // 系统中的所有接口
 	struct xdp_program *program;  // XDP程序对象指针
 	int err;  // 错误码
 	int len;  // 字符串长度
@@ -206,8 +207,24 @@ int main(int argc, char **argv)
 		return EXIT_FAIL_BPF;
 	}
 
-	i = 0;
-	bpf_map_update_elem(map_fd, &i, &cfg.ifindex, 0);	
-	printf("redirect from ifnum=%d to ifnum=%d\n", cfg.ifindex, cfg.ifindex);
+	// tx_port 以 ifindex 为键，把当前所有接口都加入，之后新增的接口由 rtcache_sync 补充
+	ifs = if_nameindex();
+	if (!ifs) {
+		fprintf(stderr, "ERR: if_nameindex: %s\n", strerror(errno));
+		return EXIT_FAIL;
+	}
+	for (i = 0; ifs[i].if_index; i++) {
+		__u32 ifindex = ifs[i].if_index;
+
+		if (bpf_map_update_elem(map_fd, &ifindex, &ifindex, 0) < 0) {
+			fprintf(stderr, "WARN: add %s to tx_port: %s\n",
+				ifs[i].if_name, strerror(errno));
+			continue;
+		}
+		if (verbose)
+			printf("redirect from ifnum=%d to %s(ifnum=%d)\n",
+			       cfg.ifindex, ifs[i].if_name, ifindex);
+	}
+	if_freenameindex(ifs);
 	return EXIT_OK;
 }
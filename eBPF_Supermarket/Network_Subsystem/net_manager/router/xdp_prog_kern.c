@@ -45,21 +45,44 @@ struct {
 	__uint(max_entries, XDP_ACTION_MAX);
 } xdp_stats_map SEC(".maps");
 
-// 转发接口
+// 转发接口，键和值都是出接口的 ifindex。
+// DEVMAP_HASH 允许 ifindex 稀疏分布，经它重定向的帧由内核按设备攒批后在 NAPI 结束时统一发送
 struct {
-	__uint(type, BPF_MAP_TYPE_DEVMAP);
-	__type(key, int);
-	__type(value, int);
-	__uint(max_entries, 256);
+	__uint(type, BPF_MAP_TYPE_DEVMAP_HASH);
+	__type(key, __u32);
+	__type(value, __u32);
+	__uint(max_entries, TX_PORT_MAX);
 } tx_port SEC(".maps");
 
-// 路由转发表缓存
+// 路由转发结果缓存，键为目的地址，由 bpf_fib_lookup 的结果填充，rtcache_sync 根据路由/邻居变化删除
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__type(key, __u32);
+	__type(value, struct rt_item);
+	__uint(max_entries, RTCACHE_MAX_ENTRIES);
+} rtcache_map4 SEC(".maps");
+
+// xmac_load 写入的静态表项，与动态表项分开存放，不会被 LRU 淘汰，查找时优先于 rtcache_map4
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
 	__type(key, __u32);
 	__type(value, struct rt_item);
 	__uint(max_entries, MAX_RULES);
-} rtcache_map4 SEC(".maps");
+} rtcache_static4 SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, struct rt_conf);
+	__uint(max_entries, 1);
+} rtcache_conf SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, __u64);
+	__uint(max_entries, RT_STAT_MAX);
+} rtcache_stats SEC(".maps");
 
 
 static __always_inline
@@ -103,87 +126,114 @@ static __always_inline int ip_decrease_ttl(struct iphdr *iph)
 
 
 static __always_inline
-int mac_zero(const __u8 *mac_addr) {
-    // 检查MAC地址是否不全为零
-    for (int i = 0; i < ETH_ALEN; i++) {
-        if (mac_addr[i] != 0)
-            return 1; // 如果有一个字节不为零，返回1表示不为零
-    }
-    return 0; // 如果所有字节都为零，返回0表示全为零
+void rt_stat_inc(__u32 idx)
+{
+	__u64 *cnt = bpf_map_lookup_elem(&rtcache_stats, &idx);
+
+	if (cnt)
+		(*cnt)++;
 }
 
 
 static __always_inline
-int ipv4_match(__u32 conn_addr, __u32 rule_addr) {
-    // 直接比较IPv4地址和网络地址
-	if( (!rule_addr) || (conn_addr == rule_addr) ) //0 , match all
-		return 1;
-	return 0;
+__u64 rtcache_ttl(void)
+{
+	__u32 key = 0;
+	struct rt_conf *conf = bpf_map_lookup_elem(&rtcache_conf, &key);
+
+	if (conf && conf->ttl_ns)
+		return conf->ttl_ns;
+	return RTCACHE_TTL_NS;
 }
 
 
-static int match_rules_loop(__u32 index, void *ctx)
+// 精确查找目的地址的转发结果，先查静态表项再查动态缓存，过期的表项当作未命中处理；
+// 超过表项 MTU 的报文同样按未命中处理，由 bpf_fib_lookup 返回 FRAG_NEEDED 后交给协议栈
+static __always_inline
+struct rt_item *rtcache_lookup(__u32 daddr, __u16 tot_len)
 {
-	struct rt_item *p_ctx = (struct rt_item *)ctx;
+	struct rt_item *item = bpf_map_lookup_elem(&rtcache_static4, &daddr);
 
-
-	struct rt_item *p_r = bpf_map_lookup_elem(&rtcache_map4, &index);
-	if(!p_r){
-		return 1; //out of range
+	if (item && tot_len <= item->mtu) {
+		rt_stat_inc(RT_STAT_HIT);
+		return item;
 	}
-	
-
-	if( ipv4_match(p_ctx->saddr, p_r->saddr) ) {
-	
-		memcpy(p_ctx->eth_source, p_r->eth_source, ETH_ALEN);
-		memcpy(p_ctx->eth_dest, p_r->eth_dest, ETH_ALEN);
-		
-
-		/*
-		bpf_printk("MAC: %02x:%02x:%02x:%02x:%02x:%02x", 
-           p_ctx->eth_source[0], p_ctx->eth_source[1], p_ctx->eth_source[2],
-           p_ctx->eth_source[3], p_ctx->eth_source[4], p_ctx->eth_source[5]);
-		
-		bpf_printk("MAC: %02x:%02x:%02x:%02x:%02x:%02x", 
-           p_ctx->eth_dest[0], p_ctx->eth_dest[1], p_ctx->eth_dest[2],
-           p_ctx->eth_dest[3], p_ctx->eth_dest[4], p_ctx->eth_dest[5]);
-		
-		
-		bpf_printk("Port: %u", p_ctx->ifindex);
-		*/
-		
 
-		return 1;
+	item = bpf_map_lookup_elem(&rtcache_map4, &daddr);
+	if (!item || tot_len > item->mtu) {
+		rt_stat_inc(RT_STAT_MISS);
+		return NULL;
 	}
+	if (item->expires < bpf_ktime_get_ns()) {
+		rt_stat_inc(RT_STAT_EXPIRED);
+		return NULL;
+	}
+	rt_stat_inc(RT_STAT_HIT);
+	return item;
+}
 
 
-	return 1;
+static __always_inline
+void fib_params_v4(struct bpf_fib_lookup *fib, struct iphdr *iph, __u32 ifindex)
+{
+	fib->family = AF_INET;
+	fib->tos = iph->tos;
+	fib->l4_protocol = iph->protocol;
+	fib->sport	= 0;
+	fib->dport	= 0;
+	fib->tot_len	= bpf_ntohs(iph->tot_len);
+	fib->ipv4_src = iph->saddr;
+	fib->ipv4_dst = iph->daddr;
+	fib->ifindex = ifindex;
 }
 
 
+// 以最大长度再查一次路由，bpf_fib_lookup 返回 FRAG_NEEDED 并在 mtu_result 中给出路由 MTU；
+// 5.12 之前的内核不回填 mtu_result，只能以本报文的长度作为已确认可转发的下限
+static __always_inline
+__u32 route_mtu(struct xdp_md *ctx, struct iphdr *iph)
+{
+	struct bpf_fib_lookup probe = {};
+
+	fib_params_v4(&probe, iph, ctx->ingress_ifindex);
+	probe.tot_len = 0xffff;
+	if (bpf_fib_lookup(ctx, &probe, sizeof(probe), 0) == BPF_FIB_LKUP_RET_FRAG_NEEDED &&
+	    probe.mtu_result != 0xffff)
+		return probe.mtu_result;
+	return bpf_ntohs(iph->tot_len);
+}
+
 
-static __always_inline 
-int match_rules(struct rt_item *conn)
+// bpf_fib_lookup 成功后 ipv4_dst 已被改写为下一跳地址，一并记下供邻居变化时失效
+static __always_inline
+void rtcache_fill(struct xdp_md *ctx, struct iphdr *iph, struct bpf_fib_lookup *fib)
 {
-	struct rt_item *ctx = conn;
-	
-	bpf_loop(MAX_RULES, match_rules_loop, ctx, 0);
+	__u32 daddr = iph->daddr;
+	struct rt_item item = {
+		.ifindex = fib->ifindex,
+		.nexthop = fib->ipv4_dst,
+		.expires = bpf_ktime_get_ns() + rtcache_ttl(),
+		.mtu = route_mtu(ctx, iph),
+	};
+
+	memcpy(item.eth_source, fib->smac, ETH_ALEN);
+	memcpy(item.eth_dest, fib->dmac, ETH_ALEN);
+	if (!bpf_map_update_elem(&rtcache_map4, &daddr, &item, BPF_ANY))
+		rt_stat_inc(RT_STAT_FILL);
+}
 
-	
-	/*
-	bpf_printk("MAC: %02x:%02x:%02x:%02x:%02x:%02x", 
-           coon_r.eth_source[0], coon_r.eth_source[1], coon_r.eth_source[2],
-           coon_r.eth_source[3], coon_r.eth_source[4], coon_r.eth_source[5]);
 
-	bpf_printk("MAC: %02x:%02x:%02x:%02x:%02x:%02x", 
-           coon_r.eth_dest[0], coon_r.eth_dest[1], coon_r.eth_dest[2],
-           coon_r.eth_dest[3], coon_r.eth_dest[4], coon_r.eth_dest[5]);
+// 先确认出接口在 tx_port 中再改写报文，否则原样交给协议栈
+static __always_inline
+xdp_act forward(struct ethhdr *eth, __u32 ifindex, const __u8 *smac, const __u8 *dmac)
+{
+	xdp_act action = bpf_redirect_map(&tx_port, ifindex, XDP_PASS);
 
-	bpf_printk("Port: %u", coon_r.ifindex);
-	*/
-	
-	
-	return 1;
+	if (action != XDP_REDIRECT)
+		return action;
+	memcpy(eth->h_dest, dmac, ETH_ALEN);
+	memcpy(eth->h_source, smac, ETH_ALEN);
+	return action;
 }
 
 
@@ -200,10 +250,8 @@ int xdp_rtcache_prog(struct xdp_md *ctx)
 	struct ethhdr *eth = data;
 	struct ipv6hdr *ip6h;
 	struct iphdr *iph;
-	unsigned int ip4_saddr = 0;
-	//unsigned ifindex = 2;
 	int rc;
-	struct rt_item nitem = {.saddr = 0, .eth_source = {0}, .eth_dest = {0}};
+	struct rt_item *item;
 
 
 	nh.pos = data;
@@ -224,44 +272,26 @@ int xdp_rtcache_prog(struct xdp_md *ctx)
 			goto out;
 		
 
-		ip4_saddr = iph->saddr;
-
-		nitem.saddr = ip4_saddr;
-		
-		// 首先精确查找转发表，如果找到就直接转发，不必再经历最长前缀匹配的慢速通配查找
-		match_rules(&nitem);
-	
-		
-
-		if (mac_zero(nitem.eth_dest)) {
-			ip_decrease_ttl(iph);
-			memcpy(eth->h_dest, nitem.eth_dest, ETH_ALEN);
-			memcpy(eth->h_source, nitem.eth_source, ETH_ALEN);
-			action = bpf_redirect_map(&tx_port, 0, 0);
-
+		// 首先精确查找转发结果缓存，如果找到就直接转发，不必再经历最长前缀匹配的慢速查找
+		item = rtcache_lookup(iph->daddr, bpf_ntohs(iph->tot_len));
+		if (item) {
+			action = forward(eth, item->ifindex, item->eth_source, item->eth_dest);
+			if (action == XDP_REDIRECT)
+				ip_decrease_ttl(iph);
 			goto out;
 		}
 
 		// 否则执行最长前缀匹配了
-		ifib.family = AF_INET;
-		ifib.tos = iph->tos;
-		ifib.l4_protocol = iph->protocol;
-		ifib.sport	= 0;
-		ifib.dport	= 0;
-		ifib.tot_len	= bpf_ntohs(iph->tot_len);
-		ifib.ipv4_src = iph->saddr;
-		ifib.ipv4_dst = iph->daddr;
-		ifib.ifindex = ctx->ingress_ifindex;
+		fib_params_v4(&ifib, iph, ctx->ingress_ifindex);
 		
 
 		rc = bpf_fib_lookup(ctx, &ifib, sizeof(ifib), 0);
 		switch (rc) {
 		case BPF_FIB_LKUP_RET_SUCCESS:         /* lookup successful */
-			ip_decrease_ttl(iph);
-	
-			memcpy(eth->h_dest, ifib.dmac, ETH_ALEN);
-			memcpy(eth->h_source, ifib.smac, ETH_ALEN);
-			action = bpf_redirect(ifib.ifindex, 0);
+			rtcache_fill(ctx, iph, &ifib);
+			action = forward(eth, ifib.ifindex, ifib.smac, ifib.dmac);
+			if (action == XDP_REDIRECT)
+				ip_decrease_ttl(iph);
 			goto out;
 			break;
 		case BPF_FIB_LKUP_RET_BLACKHOLE:    /* dest is blackholed; can be dropped */
@@ -305,11 +335,9 @@ int xdp_rtcache_prog(struct xdp_md *ctx)
 		rc = bpf_fib_lookup(ctx, &ifib, sizeof(ifib), 0);
 		switch (rc) {
 		case BPF_FIB_LKUP_RET_SUCCESS:         /* lookup successful */
-			ip6h->hop_limit--;
-
-			memcpy(eth->h_dest, ifib.dmac, ETH_ALEN);
-			memcpy(eth->h_source, ifib.smac, ETH_ALEN);
-			action = bpf_redirect(ifib.ifindex, 0);
+			action = forward(eth, ifib.ifindex, ifib.smac, ifib.dmac);
+			if (action == XDP_REDIRECT)
+				ip6h->hop_limit--;
 			goto out;
 			break;
 		case BPF_FIB_LKUP_RET_BLACKHOLE:    /* dest is blackholed; can be dropped */
@@ -3,6 +3,9 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
 
 #include <bpf/bpf.h>
 
@@ -12,7 +15,7 @@
 
 char *ifname;
 
-int rtcache_map4;
+int rtcache_static4;
 
 int print_usage(int id){
     switch(id){
@@ -28,8 +31,8 @@ int print_usage(int id){
 
 
 int load_bpf_map(){
-    rtcache_map4 = open_map(ifname, "rtcache_map4");
-    if(rtcache_map4 < 0){
+    rtcache_static4 = open_map(ifname, "rtcache_static4");
+    if(rtcache_static4 < 0){
         fprintf(stderr, "load bpf map error,check device name\n");
         return -1;
     }
@@ -38,33 +41,45 @@ int load_bpf_map(){
 }
 
 
-static __u32 ip_to_u32(__u8 *ip_u8) {
-    __u32 ip_u32 = 0;
-    ip_u32 = (ip_u8[0]<<24) | (ip_u8[1]<<16) | (ip_u8[2]<<8) | (ip_u8[3]);
-    //printf("%hhu.%hhu.%hhu.%hhu,%u\n",ip_u8[0],ip_u8[1],ip_u8[2],ip_u8[3],ip_u32);
-    return ip_u32;
-}
+// 静态表项单独存放在 rtcache_static4 中，bpf_fib_lookup 填充的表项由 rtcache_sync 维护。
+// 边遍历边删除会让 get_next_key 从头开始，所以先收集键再统一删除
+int clear_map(){
+    __u32 key, next_key;
+    __u32 keys[MAX_RULES];
+    int n = 0;
 
+    if(bpf_map_get_next_key(rtcache_static4, NULL, &next_key) < 0)
+        return 0;
+    do{
+        key = next_key;
+        if(n < MAX_RULES)
+            keys[n++] = key;
+    }while(bpf_map_get_next_key(rtcache_static4, &key, &next_key) == 0);
 
-int clear_map(){
-    __u8 keys[MAX_RULES];
-    for(int i=0; i<MAX_RULES; i++){
-        keys[i] = i;
-    }
+    for(int i = 0; i < n; i++)
+        bpf_map_delete_elem(rtcache_static4, &keys[i]);
 
-    DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
-		.elem_flags = 0,
-		.flags = 0,
-	);
+    return n;
+}
 
-    __u32 count = MAX_RULES - 1;
 
-    bpf_map_delete_batch(rtcache_map4, &keys, &count, &opts);
+// 静态表项没有路由信息，以出接口的 MTU 作为转发上限
+static int get_dev_mtu(const char *dev){
+    struct ifreq ifr = {};
+    int fd, ret;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if(fd < 0)
+        return -1;
+    strncpy(ifr.ifr_name, dev, IFNAMSIZ - 1);
+    ret = ioctl(fd, SIOCGIFMTU, &ifr);
+    close(fd);
 
-    return count;
+    return ret < 0 ? -1 : ifr.ifr_mtu;
 }
 
 
+// 每行一条：目的地址 源MAC 目的MAC [出接口]，不写出接口时从 <dev> 原路转发
 int load_handler(int argc, char *argv[]){
     if(argc < 1){
         print_usage(1);
@@ -85,30 +100,49 @@ int load_handler(int argc, char *argv[]){
     struct rt_item rules[MAX_RULES];
 
     __u32 i = 0;
-    keys[0] = 0;
+    int lineno = 0;
     char line[MAX_RULES];
 
-    while (fgets(line, sizeof(line), file) != NULL) {
+    while (i < MAX_RULES && fgets(line, sizeof(line), file) != NULL) {
         line[strcspn(line, "\n")] = '\0';
+        lineno++;
 
-        __u8 saddr[4];
-        __u8 eth_source[ETH_ALEN];
-        __u8 eth_dest[ETH_ALEN];
-        
+        char daddr[INET_ADDRSTRLEN];
+        char dev[IF_NAMESIZE] = "";
+        __u8 *eth_source = rules[i].eth_source;
+        __u8 *eth_dest = rules[i].eth_dest;
 
-        sscanf(line, "%hhu.%hhu.%hhu.%hhu %hhx:%hhx:%hhx:%hhx:%hhx:%hhx %hhx:%hhx:%hhx:%hhx:%hhx:%hhx" ,
-            &saddr[0] ,&saddr[1] ,&saddr[2] ,&saddr[3],
+        int n = sscanf(line, "%15s %hhx:%hhx:%hhx:%hhx:%hhx:%hhx %hhx:%hhx:%hhx:%hhx:%hhx:%hhx %15s" ,
+            daddr,
             &eth_source[0], &eth_source[1], &eth_source[2], &eth_source[3], &eth_source[4], &eth_source[5], 
-            &eth_dest[0], &eth_dest[1], &eth_dest[2], &eth_dest[3], &eth_dest[4], &eth_dest[5]);
-
-        rules[i].saddr = ip_to_u32(saddr);
-        memcpy(rules[i].eth_source, eth_source, ETH_ALEN);
-        memcpy(rules[i].eth_dest, eth_dest, ETH_ALEN);
-
-        keys[i] = i;
+            &eth_dest[0], &eth_dest[1], &eth_dest[2], &eth_dest[3], &eth_dest[4], &eth_dest[5],
+            dev);
+        if(n <= 0 || daddr[0] == '#')
+            continue;
+        if(n < 13 || inet_pton(AF_INET, daddr, &keys[i]) != 1){
+            fprintf(stderr, "%s:%d: invalid entry: %s\n", path, lineno, line);
+            fclose(file);
+            return EXIT_FAILURE;
+        }
+
+        rules[i].ifindex = if_nametoindex(dev[0] ? dev : ifname);
+        if(!rules[i].ifindex){
+            fprintf(stderr, "%s:%d: unknown device %s\n", path, lineno, dev[0] ? dev : ifname);
+            fclose(file);
+            return EXIT_FAILURE;
+        }
+        int mtu = get_dev_mtu(dev[0] ? dev : ifname);
+        if(mtu < 0){
+            fprintf(stderr, "%s:%d: cannot get mtu of %s\n", path, lineno, dev[0] ? dev : ifname);
+            fclose(file);
+            return EXIT_FAILURE;
+        }
+        rules[i].nexthop = keys[i];
+        rules[i].expires = 0;
+        rules[i].mtu = mtu;
         i += 1;
-       
     } 
+    fclose(file);
     printf("%d rules loaded\n",i);
 
     DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
@@ -117,13 +151,13 @@ int load_handler(int argc, char *argv[]){
 	);
     clear_map();
 
-    bpf_map_update_batch(rtcache_map4, keys, rules, &i, &opts);
+    bpf_map_update_batch(rtcache_static4, keys, rules, &i, &opts);
     return 0;  
 }
 
 int clear_handler(int argc, char *argv[]){
     int ret = clear_map();
-    printf("%d rules are cleared\n", ret-1);
+    printf("%d rules are cleared\n", ret);
     return 0;
 }
 
@@ -164,7 +198,8 @@ int main(int argc, char *argv[]){
 	char *command = argv[1];
     ifname = argv[2];
 
-    load_bpf_map();
+    if(load_bpf_map() < 0)
+        return EXIT_FAILURE;
     if (strcmp(command, "load") == 0) {
         //argc - 2 表示传递给 load_handler 函数的参数数量，argc - 2 表示从第 3 个参数（argv[3]）开始，
         //而 argv + 3 表示从命令行参数数组中的第四个元素开始的指针，
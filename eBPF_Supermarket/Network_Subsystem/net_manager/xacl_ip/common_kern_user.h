@@ -10,16 +10,17 @@ typedef __u32 xdp_act;
 
 #define ALERT_ERR_STR "[XACL] ERROR:"
 
-//#define KERNEL_5_17
-#define KERNEL_5_10
+/* 规则集由 xacladm 编译为每个字段一棵 LPM 树（端口范围拆分成前缀），树节点的值是
+ * 命中该前缀的规则位图。XDP 中把各字段查到的位图按位与，最低位即为第一条命中的规则，
+ * 开销只与位图长度有关，与规则条数无关。 */
+#define MAX_RULES 4096
+#define RULE_BITMAP_WORDS (MAX_RULES / 64)
+#define MAX_PREFIXES 65536 // 每棵 LPM 树的最大前缀数
 
-#ifdef KERNEL_5_10
-#define MAX_RULES 256
-#endif
-
-#ifdef KERNEL_5_17
-#define MAX_RULES 0XFFFF
-#endif
+/* 规则按两代存放，xacladm 写入未生效的一代后切换 xacl_gen，更新对数据面是原子的 */
+#define XACL_GENS 2
+/* 切换 xacl_gen 后等待的毫秒数，远大于单个包在 XDP 中的处理时间，之后旧一代才可被复用 */
+#define XACL_GRACE_MS 50
 
 //#define DEBUG_PRINT
 //#define DEBUG_PRINT_EVERY
@@ -37,17 +38,28 @@ struct conn_ipv4 {
 	__u16 ip_proto;
 };
 
+/* 配置文件中的一条规则，端口为闭区间 [sport, sport_max]，0 表示任意端口 */
 struct rules_ipv4 {
 	__u32 saddr;
 	__u32 daddr;
 	__u8  saddr_mask;
 	__u8  daddr_mask;
 	__u16 sport;
+	__u16 sport_max;
 	__u16 dport;
+	__u16 dport_max;
 	__u16 ip_proto;
 	__u16 action;
-	__u16 prev_rule;
-	__u16 next_rule;
+};
+
+/* LPM 树的键，data 为网络字节序：地址占全部 32 位，端口占高 16 位 */
+struct lpm_key {
+	__u32 prefixlen;
+	__u32 data;
+};
+
+struct rule_bitmap {
+	__u64 bits[RULE_BITMAP_WORDS];
 };
 
 #ifndef XDP_ACTION_MAX
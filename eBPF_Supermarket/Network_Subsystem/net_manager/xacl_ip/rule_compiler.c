@@ -0,0 +1,290 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <bpf/bpf.h>
+
+#include "rule_compiler.h"
+
+const char *xacl_trie_names[XACL_GENS][FIELD_NR] = {
+    {"saddr_trie_0", "daddr_trie_0", "sport_trie_0", "dport_trie_0"},
+    {"saddr_trie_1", "daddr_trie_1", "sport_trie_1", "dport_trie_1"},
+};
+
+const char *xacl_proto_names[XACL_GENS] = {"proto_bitmap_0", "proto_bitmap_1"};
+
+/* 某条规则在某个字段上的一个前缀，value 为左对齐的主机字节序 */
+struct prefix_entry {
+    __u32 value;
+    __u32 len;
+    __u32 rule;
+};
+
+struct field_set {
+    struct prefix_entry *e;
+    int nr;
+    int cap;
+};
+
+#define NO_RULE MAX_RULES // 只用于保证 /0 前缀一定存在的占位条目
+
+static __u32 prefix_mask(__u32 len){
+    return len ? 0xFFFFFFFFU << (32 - len) : 0;
+}
+
+static int add_prefix(struct field_set *f, __u32 value, __u32 len, __u32 rule){
+    if(f->nr == f->cap){
+        int cap = f->cap ? f->cap * 2 : 1024;
+        struct prefix_entry *e = realloc(f->e, cap * sizeof(*e));
+
+        if(!e)
+            return -ENOMEM;
+        f->e = e;
+        f->cap = cap;
+    }
+    f->e[f->nr].value = value & prefix_mask(len);
+    f->e[f->nr].len = len;
+    f->e[f->nr].rule = rule;
+    f->nr++;
+    return 0;
+}
+
+/* 把端口闭区间 [lo, hi] 拆成最少的对齐前缀，lo == hi == 0 表示任意端口 */
+static int add_port_range(struct field_set *f, __u16 lo, __u16 hi, __u32 rule){
+    __u32 l = lo, h = hi;
+    int err;
+
+    if(!lo && !hi)
+        return add_prefix(f, 0, 0, rule);
+    while(l <= h){
+        __u32 bits = 0;
+
+        while(bits < 16 && !(l & ((2U << bits) - 1)) && l + (2U << bits) - 1 <= h)
+            bits++;
+        err = add_prefix(f, l << 16, 16 - bits, rule);
+        if(err)
+            return err;
+        l += 1U << bits;
+    }
+    return 0;
+}
+
+static int cmp_prefix(const void *a, const void *b){
+    const struct prefix_entry *x = a, *y = b;
+
+    if(x->len != y->len)
+        return x->len < y->len ? -1 : 1;
+    if(x->value != y->value)
+        return x->value < y->value ? -1 : 1;
+    return 0;
+}
+
+static int lower_bound(const struct prefix_entry *e, int nr, __u32 len, __u32 value){
+    struct prefix_entry key = {.value = value, .len = len};
+    int lo = 0, hi = nr;
+
+    while(lo < hi){
+        int mid = (lo + hi) / 2;
+
+        if(cmp_prefix(&e[mid], &key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void clear_trie(int fd){
+    struct lpm_key next;
+
+    while(!bpf_map_get_next_key(fd, NULL, &next)){
+        if(bpf_map_delete_elem(fd, &next))
+            break;
+    }
+}
+
+/*
+ * 每个不同的前缀 d 写入一个位图：所有前缀包含 d 的规则。
+ * 任意两个都包含某地址的前缀必然相互嵌套，因此最长匹配查到的 d 的位图
+ * 恰好是该地址在这个字段上命中的全部规则。
+ */
+static int compile_field(int fd, struct field_set *f){
+    struct rule_bitmap bm;
+    int err = add_prefix(f, 0, 0, NO_RULE);
+
+    if(err)
+        return err;
+    qsort(f->e, f->nr, sizeof(*f->e), cmp_prefix);
+    clear_trie(fd);
+
+    for(int i = 0; i < f->nr; i++){
+        const struct prefix_entry *d = &f->e[i];
+        struct lpm_key key;
+
+        if(i && !cmp_prefix(d, &f->e[i - 1]))
+            continue;
+        memset(&bm, 0, sizeof(bm));
+        for(__u32 l = 0; l <= d->len; l++){
+            __u32 v = d->value & prefix_mask(l);
+
+            for(int j = lower_bound(f->e, f->nr, l, v);
+                j < f->nr && f->e[j].len == l && f->e[j].value == v; j++){
+                if(f->e[j].rule != NO_RULE)
+                    bm.bits[f->e[j].rule / 64] |= 1ULL << (f->e[j].rule % 64);
+            }
+        }
+        key.prefixlen = d->len;
+        key.data = htonl(d->value);
+        if(bpf_map_update_elem(fd, &key, &bm, BPF_ANY) < 0){
+            fprintf(stderr, "%s failed to update prefix trie: %s\n", ALERT_ERR_STR, strerror(errno));
+            return -errno;
+        }
+    }
+    return 0;
+}
+
+static int compile_proto(int fd, const struct rules_ipv4 *rules, int nr){
+    struct rule_bitmap bm;
+
+    for(__u32 p = 0; p < 256; p++){
+        memset(&bm, 0, sizeof(bm));
+        for(int i = 0; i < nr; i++){
+            if(!rules[i].ip_proto || rules[i].ip_proto == p)
+                bm.bits[i / 64] |= 1ULL << (i % 64);
+        }
+        if(bpf_map_update_elem(fd, &p, &bm, BPF_ANY) < 0)
+            return -errno;
+    }
+    return 0;
+}
+
+/* 端口字段：N 或 N-M，0 表示任意 */
+static int parse_port(const char *s, __u16 *lo, __u16 *hi){
+    unsigned int a, b;
+
+    if(sscanf(s, "%u-%u", &a, &b) == 2){
+        if(a > b || b > 65535)
+            return -1;
+    }else if(sscanf(s, "%u", &a) == 1 && a <= 65535){
+        b = a;
+    }else{
+        return -1;
+    }
+    *lo = a;
+    *hi = b;
+    return 0;
+}
+
+static __u32 ip_to_u32(__u8 *ip_u8) {
+    return (ip_u8[0]<<24) | (ip_u8[1]<<16) | (ip_u8[2]<<8) | (ip_u8[3]);
+}
+
+/* 解析一行规则，返回 0 成功，1 为空行或注释，-1 格式错误 */
+int parse_rule_ipv4(const char *line, struct rules_ipv4 *rule){
+    __u8 saddr[4], daddr[4];
+    char sport[32], dport[32], proto[10], action[10];
+
+    while(*line == ' ' || *line == '\t')
+        line++;
+    if(*line == '\0' || *line == '\n' || *line == '#')
+        return 1;
+
+    memset(rule, 0, sizeof(*rule));
+    if(sscanf(line, "%hhu.%hhu.%hhu.%hhu/%hhu %hhu.%hhu.%hhu.%hhu/%hhu %31s %31s %9s %9s",
+           &saddr[0] ,&saddr[1] ,&saddr[2] ,&saddr[3] ,&rule->saddr_mask,
+           &daddr[0] ,&daddr[1] ,&daddr[2] ,&daddr[3] ,&rule->daddr_mask,
+           sport, dport, proto, action) != 14)
+        return -1;
+    if(rule->saddr_mask > 32 || rule->daddr_mask > 32 ||
+       parse_port(sport, &rule->sport, &rule->sport_max) ||
+       parse_port(dport, &rule->dport, &rule->dport_max))
+        return -1;
+
+    rule->saddr = ip_to_u32(saddr);
+    rule->daddr = ip_to_u32(daddr);
+
+    if(strcmp("TCP", proto) == 0){
+        rule->ip_proto = IPPROTO_TCP;
+    }else if(strcmp("UDP", proto) == 0){
+        rule->ip_proto = IPPROTO_UDP;
+    }else if(strcmp("ICMP", proto) == 0){
+        rule->ip_proto = IPPROTO_ICMP;
+    }else{
+        rule->ip_proto = 0;
+    }
+
+    if(strcmp("ALLOW", action) == 0){
+        rule->action = XDP_PASS;
+    }else if(strcmp("DENY", action) == 0){
+        rule->action = XDP_DROP;
+    }else{
+        rule->action = XDP_ABORTED;
+    }
+    return 0;
+}
+
+/*
+ * 把规则集编译进当前未生效的一代 map，全部成功后才切换 xacl_gen，
+ * 任何一步失败时数据面继续使用旧规则；切换后等待 XACL_GRACE_MS 再返回
+ */
+int compile_rules_ipv4(const struct xacl_map_fds *fds, const struct rules_ipv4 *rules, int nr){
+    struct field_set fields[FIELD_NR] = {};
+    const struct xacl_gen_fds *g;
+    __u32 zero = 0, cur = 0, next;
+    int err = 0;
+
+    if(nr > MAX_RULES){
+        fprintf(stderr, "%s too many rules: %d (max %d)\n", ALERT_ERR_STR, nr, MAX_RULES);
+        return -E2BIG;
+    }
+    bpf_map_lookup_elem(fds->gen_fd, &zero, &cur);
+    next = (cur & 1) ^ 1;
+    g = &fds->gen[next];
+
+    for(int i = 0; i < nr && !err; i++){
+        err = add_prefix(&fields[FIELD_SADDR], rules[i].saddr, rules[i].saddr_mask, i) ||
+              add_prefix(&fields[FIELD_DADDR], rules[i].daddr, rules[i].daddr_mask, i) ||
+              add_port_range(&fields[FIELD_SPORT], rules[i].sport, rules[i].sport_max, i) ||
+              add_port_range(&fields[FIELD_DPORT], rules[i].dport, rules[i].dport_max, i);
+    }
+    if(err){
+        err = -ENOMEM;
+        goto out;
+    }
+
+    for(int f = 0; f < FIELD_NR; f++){
+        err = compile_field(g->trie[f], &fields[f]);
+        if(err)
+            goto out;
+    }
+    err = compile_proto(g->proto, rules, nr);
+    if(err)
+        goto out;
+    for(int i = 0; i < nr; i++){
+        __u32 key = next * MAX_RULES + i, action = rules[i].action;
+
+        if(bpf_map_update_elem(fds->actions, &key, &action, BPF_ANY) < 0){
+            err = -errno;
+            goto out;
+        }
+    }
+
+    if(bpf_map_update_elem(fds->gen_fd, &zero, &next, BPF_ANY) < 0){
+        err = -errno;
+        goto out;
+    }
+    /* 切换前读到旧代号的包可能仍在查旧一代，等它们处理完再返回，
+     * 下一次 load 清空这一代时就不会影响在途的包 */
+    usleep(XACL_GRACE_MS * 1000);
+
+out:
+    for(int f = 0; f < FIELD_NR; f++)
+        free(fields[f].e);
+    if(err)
+        fprintf(stderr, "%s failed to compile rules: %s\n", ALERT_ERR_STR, strerror(-err));
+    return err;
+}
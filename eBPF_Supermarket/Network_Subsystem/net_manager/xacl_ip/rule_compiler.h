@@ -0,0 +1,32 @@
+#ifndef __RULE_COMPILER_H
+#define __RULE_COMPILER_H
+
+#include "common_kern_user.h"
+
+enum xacl_field {
+    FIELD_SADDR,
+    FIELD_DADDR,
+    FIELD_SPORT,
+    FIELD_DPORT,
+    FIELD_NR,
+};
+
+/* 一代规则所用的全部 map */
+struct xacl_gen_fds {
+    int trie[FIELD_NR];
+    int proto;
+};
+
+struct xacl_map_fds {
+    struct xacl_gen_fds gen[XACL_GENS];
+    int actions;
+    int gen_fd;
+};
+
+extern const char *xacl_trie_names[XACL_GENS][FIELD_NR];
+extern const char *xacl_proto_names[XACL_GENS];
+
+extern int parse_rule_ipv4(const char *line, struct rules_ipv4 *rule);
+extern int compile_rules_ipv4(const struct xacl_map_fds *fds, const struct rules_ipv4 *rules, int nr);
+
+#endif
@@ -0,0 +1,171 @@
+// Copyright 2023 The LMP Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// 用 BPF_PROG_TEST_RUN 测量不同规则条数下 xdp_entry 的处理速度，不需要挂载到网卡
+//
+// Usage: xacl_bench [xdp_prog_kern.o] [REPEAT]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "../common/common_params.h"
+#include "../common/common_user_bpf_xdp.h"
+#include "common_kern_user.h"
+#include "rule_compiler.h"
+
+struct test_pkt {
+    struct ethhdr eth;
+    struct iphdr ip;
+    struct tcphdr tcp;
+} __attribute__((packed));
+
+static void build_pkt(struct test_pkt *pkt, __u32 saddr, __u16 dport){
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->eth.h_proto = htons(ETH_P_IP);
+    pkt->ip.version = 4;
+    pkt->ip.ihl = 5;
+    pkt->ip.ttl = 64;
+    pkt->ip.protocol = IPPROTO_TCP;
+    pkt->ip.tot_len = htons(sizeof(pkt->ip) + sizeof(pkt->tcp));
+    pkt->ip.saddr = htonl(saddr);
+    pkt->ip.daddr = htonl(0xC0A80102); // 192.168.1.2
+    pkt->tcp.source = htons(12345);
+    pkt->tcp.dest = htons(dport);
+    pkt->tcp.doff = 5;
+}
+
+/* 第 i 条规则：源地址 10.x.y.0/24、目的端口 1000+i 的 TCP 包丢弃 */
+static void build_rules(struct rules_ipv4 *rules, int nr){
+    memset(rules, 0, nr * sizeof(*rules));
+    for(int i = 0; i < nr; i++){
+        rules[i].saddr = 0x0A000000 | (i << 8);
+        rules[i].saddr_mask = 24;
+        rules[i].dport = rules[i].dport_max = 1000 + i;
+        rules[i].ip_proto = IPPROTO_TCP;
+        rules[i].action = XDP_DROP;
+    }
+}
+
+static int run(int prog_fd, struct test_pkt *pkt, int repeat, __u32 *retval, __u32 *duration){
+    DECLARE_LIBBPF_OPTS(bpf_test_run_opts, opts,
+        .data_in = pkt,
+        .data_size_in = sizeof(*pkt),
+        .repeat = repeat,
+    );
+    int err = bpf_prog_test_run_opts(prog_fd, &opts);
+
+    *retval = opts.retval;
+    *duration = opts.duration;
+    return err;
+}
+
+int main(int argc, char *argv[]){
+    const char *filename = argc > 1 ? argv[1] : "xdp_prog_kern.o";
+    int repeat = argc > 2 ? atoi(argv[2]) : 1000000;
+    static const int sizes[] = {16, 256, MAX_RULES};
+    struct xacl_map_fds fds;
+    struct bpf_object *obj;
+    struct bpf_program *prog;
+    struct rules_ipv4 *rules;
+    struct test_pkt miss, hit;
+    __u32 retval, hit_ret, duration;
+    int prog_fd, err;
+
+    obj = bpf_object__open_file(filename, NULL);
+    if(libbpf_get_error(obj)){
+        fprintf(stderr, "%s failed to open %s\n", ALERT_ERR_STR, filename);
+        return EXIT_FAILURE;
+    }
+    if(bpf_object__load(obj)){
+        fprintf(stderr, "%s failed to load %s\n", ALERT_ERR_STR, filename);
+        return EXIT_FAILURE;
+    }
+    prog = bpf_object__find_program_by_name(obj, "xdp_entry");
+    prog_fd = prog ? bpf_program__fd(prog) : -1;
+    if(prog_fd < 0){
+        fprintf(stderr, "%s xdp_entry not found\n", ALERT_ERR_STR);
+        return EXIT_FAILURE;
+    }
+    for(int g = 0; g < XACL_GENS; g++){
+        for(int f = 0; f < FIELD_NR; f++)
+            fds.gen[g].trie[f] = bpf_object__find_map_fd_by_name(obj, xacl_trie_names[g][f]);
+        fds.gen[g].proto = bpf_object__find_map_fd_by_name(obj, xacl_proto_names[g]);
+    }
+    fds.actions = bpf_object__find_map_fd_by_name(obj, "rule_actions");
+    fds.gen_fd = bpf_object__find_map_fd_by_name(obj, "xacl_gen");
+    for(int g = 0; g < XACL_GENS; g++){
+        for(int f = 0; f < FIELD_NR; f++){
+            if(fds.gen[g].trie[f] < 0){
+                fprintf(stderr, "%s map %s not found\n", ALERT_ERR_STR, xacl_trie_names[g][f]);
+                return EXIT_FAILURE;
+            }
+        }
+        if(fds.gen[g].proto < 0){
+            fprintf(stderr, "%s map %s not found\n", ALERT_ERR_STR, xacl_proto_names[g]);
+            return EXIT_FAILURE;
+        }
+    }
+    if(fds.actions < 0 || fds.gen_fd < 0){
+        fprintf(stderr, "%s map %s not found\n", ALERT_ERR_STR, fds.actions < 0 ? "rule_actions" : "xacl_gen");
+        return EXIT_FAILURE;
+    }
+
+    rules = calloc(MAX_RULES, sizeof(*rules));
+    if(!rules)
+        return EXIT_FAILURE;
+
+    printf("%-8s %-10s %-14s %-10s\n", "RULES", "NS/PKT", "PKTS/S", "LAST-HIT");
+    for(unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++){
+        int nr = sizes[i];
+
+        build_rules(rules, nr);
+        err = compile_rules_ipv4(&fds, rules, nr);
+        if(err)
+            break;
+
+        // 不命中任何规则的包对逐条匹配是最坏情况；再用命中最后一条规则的包验证结果
+        build_pkt(&miss, 0xC0A80101, 80);
+        build_pkt(&hit, 0x0A000005 | ((nr - 1) << 8), 1000 + nr - 1);
+        if(run(prog_fd, &hit, 1, &hit_ret, &duration) || hit_ret != XDP_DROP){
+            fprintf(stderr, "%s rule %d did not match (retval %u)\n", ALERT_ERR_STR, nr - 1, hit_ret);
+            err = -1;
+            break;
+        }
+        err = run(prog_fd, &miss, repeat, &retval, &duration);
+        if(err){
+            fprintf(stderr, "%s BPF_PROG_TEST_RUN failed: %s\n", ALERT_ERR_STR, strerror(errno));
+            break;
+        }
+        if(retval != XDP_PASS){
+            fprintf(stderr, "%s unmatched packet was not passed (retval %u)\n", ALERT_ERR_STR, retval);
+            err = -1;
+            break;
+        }
+        printf("%-8d %-10u %-14.0f %-10s\n", nr, duration,
+               duration ? 1e9 / duration : 0, action2str(hit_ret));
+    }
+
+    free(rules);
+    bpf_object__close(obj);
+    return err ? EXIT_FAILURE : 0;
+}
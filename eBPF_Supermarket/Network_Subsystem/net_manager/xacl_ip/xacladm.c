@@ -8,10 +8,11 @@
 
 #include "map_common.h"
 #include "common_kern_user.h"
+#include "rule_compiler.h"
 
 char *ifname;
 
-int rules_ipv4_map;
+struct xacl_map_fds map_fds;
 
 int print_usage(int id){
     switch(id){
@@ -26,40 +27,26 @@ int print_usage(int id){
 }
 
 int load_bpf_map(){
-    rules_ipv4_map = open_map(ifname, "rules_ipv4_map");
-    if(rules_ipv4_map < 0){
-        fprintf(stderr, "load bpf map error,check device name\n");
-        return -1;
+    for(int g = 0; g < XACL_GENS; g++){
+        for(int f = 0; f < FIELD_NR; f++){
+            map_fds.gen[g].trie[f] = open_map(ifname, xacl_trie_names[g][f]);
+            if(map_fds.gen[g].trie[f] < 0)
+                goto err;
+        }
+        map_fds.gen[g].proto = open_map(ifname, xacl_proto_names[g]);
+        if(map_fds.gen[g].proto < 0)
+            goto err;
     }
+    map_fds.actions = open_map(ifname, "rule_actions");
+    map_fds.gen_fd = open_map(ifname, "xacl_gen");
+    if(map_fds.actions < 0 || map_fds.gen_fd < 0)
+        goto err;
 
     return 0;
-}
-
-
-static __u32 ip_to_u32(__u8 *ip_u8) {
-    __u32 ip_u32 = 0;
-    ip_u32 = (ip_u8[0]<<24) | (ip_u8[1]<<16) | (ip_u8[2]<<8) | (ip_u8[3]);
-    //printf("%hhu.%hhu.%hhu.%hhu,%u\n",ip_u8[0],ip_u8[1],ip_u8[2],ip_u8[3],ip_u32);
-    return ip_u32;
-}
-
-
-int clear_map(){
-    __u16 keys[MAX_RULES];
-    for(int i=0; i<MAX_RULES; i++){
-        keys[i] = i;
-    }
-
-    DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
-		.elem_flags = 0,
-		.flags = 0,
-	);
-
-    __u32 count = MAX_RULES - 1;
-
-    bpf_map_delete_batch(rules_ipv4_map, &keys, &count, &opts);
 
-    return count;
+err:
+    fprintf(stderr, "load bpf map error,check device name\n");
+    return -1;
 }
 
 int load_handler(int argc, char *argv[]){
@@ -77,81 +64,51 @@ int load_handler(int argc, char *argv[]){
         return 1;
     }
 
-    __u16 keys[MAX_RULES];
-    struct rules_ipv4 rules[MAX_RULES];
+    struct rules_ipv4 *rules = calloc(MAX_RULES, sizeof(*rules));
+    if(!rules){
+        fclose(file);
+        return 1;
+    }
 
-    __u32 i = 1;
-    keys[0] = 0;
+    int i = 0, lineno = 0, ret;
     char line[256];
+    struct rules_ipv4 rule;
     while (fgets(line, sizeof(line), file) != NULL) {
-        line[strcspn(line, "\n")] = '\0';
-
-        __u8 saddr[4];
-        __u8 daddr[4];
-        char proto[10];
-        char action[10];
-        sscanf(line, "%hhu.%hhu.%hhu.%hhu/%hhu %hhu.%hhu.%hhu.%hhu/%hhu %hu %hu %s %s",
-           &saddr[0] ,&saddr[1] ,&saddr[2] ,&saddr[3] ,&rules[i].saddr_mask, 
-           &daddr[0] ,&daddr[1] ,&daddr[2] ,&daddr[3] ,&rules[i].daddr_mask, 
-           &rules[i].sport, &rules[i].dport, proto, action);
-
-        rules[i].saddr = ip_to_u32(saddr);
-        rules[i].daddr = ip_to_u32(daddr);
-
-        if(strcmp("TCP", proto) == 0){
-            rules[i].ip_proto = IPPROTO_TCP;
-        }else if(strcmp("UDP", proto) == 0){
-            rules[i].ip_proto = IPPROTO_UDP;
-        }else if(strcmp("ICMP", proto) == 0){
-            rules[i].ip_proto = IPPROTO_ICMP;
-        }else{
-            rules[i].ip_proto = 0;
+        lineno++;
+        memset(&rule, 0, sizeof(rule));
+        ret = parse_rule_ipv4(line, &rule);
+        if(ret < 0){
+            fprintf(stderr, "%s %s:%d: invalid rule: %s", ALERT_ERR_STR, path, lineno, line);
+            goto out;
         }
-
-        if(strcmp("ALLOW", action) == 0){
-            rules[i].action = XDP_PASS;
-        }else if(strcmp("DENY", action) == 0){
-            rules[i].action = XDP_DROP;
-        }else{
-            rules[i].action = XDP_ABORTED;
+        if(ret > 0)
+            continue;
+        // 只有真正的规则才计入上限，注释和空行不受影响
+        if(i == MAX_RULES){
+            fprintf(stderr, "%s more than %d rules in %s\n", ALERT_ERR_STR, MAX_RULES, path);
+            ret = -1;
+            goto out;
         }
-
-        rules[i-1].next_rule = i;
-        rules[i].prev_rule = i - 1;
-        rules[i].next_rule = 0;
-        keys[i] = i;
-
-        i += 1;
+        rules[i++] = rule;
     }
-    printf("%d rules loaded\n",i-1);
-    rules[0].prev_rule = i - 1;
-
-    DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
-		.elem_flags = 0,
-		.flags = 0,
-	);
-    clear_map();
-    // 使用 libbpf 库中的 bpf_map_update_batch 函数批量更新 BPF 映射。
-    // 这个函数用于一次性更新多个键值对，以提高效率。
 
-    // rules_ipv4_map: 要更新的 BPF 映射的文件描述符（FD）。
-    // keys: 包含要更新的键（key）的数组。
-    // rules: 包含要更新的值的数组。
-    // &i: 这是一个指向整数的指针，表示要更新的键值对的数量。在调用函数后，该整数将包含实际更新的键值对数量。
-    // &opts: 用于配置更新选项的结构体，这里是通过 DECLARE_LIBBPF_OPTS 宏声明并初始化的。
+    // 编译到未生效的一代 map 后再切换，加载过程中数据面始终使用完整的旧规则或新规则
+    ret = compile_rules_ipv4(&map_fds, rules, i);
+    if(ret == 0)
+        printf("%d rules loaded\n",i);
 
-    // 在这里，代码中的 bpf_map_update_batch 操作的目的是将多个键值对一次性更新到 BPF 映射中。
-    // 这样可以通过一次系统调用来完成多个更新操作，提高了效率。
-
-    bpf_map_update_batch(rules_ipv4_map, keys, rules, &i, &opts);
-
-    return 0;   
+out:
+    fclose(file);
+    free(rules);
+    return ret ? EXIT_FAILURE : 0;
 }
 
 int clear_handler(int argc, char *argv[]){
-    int ret = clear_map();
-    printf("%d rules are cleared\n", ret-1);
-    return 0;
+    int ret = compile_rules_ipv4(&map_fds, NULL, 0);
+
+    if(ret == 0)
+        printf("rules are cleared\n");
+    return ret ? EXIT_FAILURE : 0;
 }
 
 
@@ -178,7 +135,8 @@ int main(int argc, char *argv[]){ //xacladm load enp1s0 ./conf.d/ipv4.conf
     ./conf.d/black_ipv4.conf 是第三个参数，可能是配置文件的路径或其他输入数据，也取决于程序的实现。
     */
 
-    load_bpf_map();
+    if(load_bpf_map() < 0)
+        return EXIT_FAILURE;
     if (strcmp(command, "load") == 0) {
 
         //argc - 2 表示传递给 load_handler 函数的参数数量，argc - 2 表示从第 3 个参数（argv[3]）开始，
@@ -32,13 +32,58 @@ struct {
 	__uint(max_entries, XDP_ACTION_MAX);
 } xdp_stats_map SEC(".maps");
 
+#define RULE_TRIE(name)						\
+struct {								\
+	__uint(type, BPF_MAP_TYPE_LPM_TRIE);				\
+	__type(key, struct lpm_key);					\
+	__type(value, struct rule_bitmap);				\
+	__uint(max_entries, MAX_PREFIXES);				\
+	__uint(map_flags, BPF_F_NO_PREALLOC);				\
+} name SEC(".maps")
+
+/* 每个字段每一代一棵 LPM 树 */
+RULE_TRIE(saddr_trie_0);
+RULE_TRIE(saddr_trie_1);
+RULE_TRIE(daddr_trie_0);
+RULE_TRIE(daddr_trie_1);
+RULE_TRIE(sport_trie_0);
+RULE_TRIE(sport_trie_1);
+RULE_TRIE(dport_trie_0);
+RULE_TRIE(dport_trie_1);
+
+/* 协议号直接索引 */
 struct {
-	__uint(type, BPF_MAP_TYPE_HASH);
-	__type(key, __u16);
-	__type(value, struct rules_ipv4);
-	__uint(max_entries, MAX_RULES);
-} rules_ipv4_map SEC(".maps");
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, struct rule_bitmap);
+	__uint(max_entries, 256);
+} proto_bitmap_0 SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, struct rule_bitmap);
+	__uint(max_entries, 256);
+} proto_bitmap_1 SEC(".maps");
+
+/* 第 gen 代第 i 条规则的动作位于 gen * MAX_RULES + i */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, __u32);
+	__uint(max_entries, XACL_GENS * MAX_RULES);
+} rule_actions SEC(".maps");
 
+/* 当前生效的规则代 */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, __u32);
+	__uint(max_entries, 1);
+} xacl_gen SEC(".maps");
+
+#define GEN_LOOKUP(gen, map, key) \
+	((gen) ? bpf_map_lookup_elem(&map##_1, key) : bpf_map_lookup_elem(&map##_0, key))
 
 static __always_inline
 __u32 xdp_stats_record_action(struct xdp_md *ctx, __u32 action)
@@ -67,80 +112,56 @@ __u32 xdp_stats_record_action(struct xdp_md *ctx, __u32 action)
 	return action;
 }
 
-struct match_rules_loop_ctx{
-	__u16 action;
-	__u16 next_rule;
-	struct conn_ipv4 *conn;
-};
-
 static __always_inline
-int ipv4_cidr_match(__u32 ip_addr, __u32 network_addr, __u8 cidr) {
-	if(network_addr == 0 && cidr == 0)
-        return 1;
-	
-    __u32 subnet_mask = (0xFFFFFFFFU << (32 - cidr)) & 0xFFFFFFFFU;
-
-    __u32 masked_ip = ip_addr & subnet_mask;
-    __u32 masked_network = network_addr & subnet_mask;
-
-    return masked_ip == masked_network;
-}
-
-static __always_inline
-int port_match(__u16 conn_port, __u16 rule_port){
-	if( (!rule_port) || (rule_port == conn_port) ) //0 , match all
-		return 1;
-	return 0;
-}
-
-static int match_rules_ipv4_loop(__u32 index, void *ctx)
+__u32 lowest_bit(__u64 w)
 {
-	struct match_rules_loop_ctx *p_ctx = (struct match_rules_loop_ctx *)ctx;
-	if(index != p_ctx->next_rule)
-		return 0;
-
-	struct rules_ipv4 *p_r = bpf_map_lookup_elem(&rules_ipv4_map, &index);
-	if(!p_r){
-		return 1; //out of range
-	}
-
-	p_ctx->next_rule = p_r->next_rule;
-
-	if(index == 0)
-		goto out_match_rules_ipv4_loop;
-
-	if( ipv4_cidr_match(p_ctx->conn->saddr, p_r->saddr, p_r->saddr_mask) && 
-		ipv4_cidr_match(p_ctx->conn->daddr, p_r->daddr, p_r->daddr_mask) &&
-		port_match(p_ctx->conn->sport, p_r->sport) &&
-		port_match(p_ctx->conn->dport, p_r->dport) &&
-		port_match(p_ctx->conn->ip_proto, p_r->ip_proto) ) 
-	{
-		p_ctx->action = p_r->action;
-		return 1;
-	}
-
-out_match_rules_ipv4_loop:
-	if(p_r->next_rule == 0)
-		return 1; //go out loop
-
-	return 0;
+	__u32 n = 0;
+
+	if (!(w & 0xFFFFFFFFULL)) { n += 32; w >>= 32; }
+	if (!(w & 0xFFFF)) { n += 16; w >>= 16; }
+	if (!(w & 0xFF)) { n += 8; w >>= 8; }
+	if (!(w & 0xF)) { n += 4; w >>= 4; }
+	if (!(w & 0x3)) { n += 2; w >>= 2; }
+	if (!(w & 0x1)) { n += 1; }
+	return n;
 }
 
 static __always_inline
 xdp_act match_rules_ipv4(struct conn_ipv4 *conn)
 {
-	struct match_rules_loop_ctx ctx = {.action = XDP_PASS, .conn = conn, .next_rule = 0};
-	#ifdef KERNEL_5_17
-	bpf_loop(MAX_RULES, match_rules_ipv4_loop, &ctx, 0);
-	#endif
-	#ifdef KERNEL_5_10
-	#pragma unroll
-	for(int i=0; i<MAX_RULES; i++){
-		if(match_rules_ipv4_loop(i,&ctx))
-			break;
+	struct rule_bitmap *sa, *da, *sp, *dp, *pr;
+	struct lpm_key key;
+	__u32 zero = 0, proto = conn->ip_proto & 0xFF, gen, rule, *p;
+
+	p = bpf_map_lookup_elem(&xacl_gen, &zero);
+	if (!p)
+		return XDP_PASS;
+	gen = *p & 1;
+
+	key.prefixlen = 32;
+	key.data = bpf_htonl(conn->saddr);
+	sa = GEN_LOOKUP(gen, saddr_trie, &key);
+	key.data = bpf_htonl(conn->daddr);
+	da = GEN_LOOKUP(gen, daddr_trie, &key);
+	key.prefixlen = 16;
+	key.data = bpf_htonl((__u32)conn->sport << 16);
+	sp = GEN_LOOKUP(gen, sport_trie, &key);
+	key.data = bpf_htonl((__u32)conn->dport << 16);
+	dp = GEN_LOOKUP(gen, dport_trie, &key);
+	pr = GEN_LOOKUP(gen, proto_bitmap, &proto);
+	if (!sa || !da || !sp || !dp || !pr)
+		return XDP_PASS;
+
+	for (int i = 0; i < RULE_BITMAP_WORDS; i++) {
+		__u64 w = sa->bits[i] & da->bits[i] & sp->bits[i] & dp->bits[i] & pr->bits[i];
+
+		if (!w)
+			continue;
+		rule = gen * MAX_RULES + i * 64 + lowest_bit(w);
+		p = bpf_map_lookup_elem(&rule_actions, &rule);
+		return p ? *p : XDP_PASS;
 	}
-	#endif
-	return ctx.action;
+	return XDP_PASS;
 }
 
 SEC("xdp")
@@ -8,6 +8,16 @@
 
 #define MAX_CONNS 0XFFFFF
 
+// 各状态连接的超时时间（纳秒），过期的连接在查找时删除，其余由 gc 定时器周期清理
+#define CT_TIMEOUT_SYN         (30ULL * 1000000000ULL)     // 半连接，SYN 洪泛时尽快回收
+#define CT_TIMEOUT_ESTABLISHED (432000ULL * 1000000000ULL) // 5 天，与 nf_conntrack 一致
+#define CT_TIMEOUT_FIN         (120ULL * 1000000000ULL)
+#define CT_TIMEOUT_CLOSE       (10ULL * 1000000000ULL)
+// 刷新过期时间的最小间隔，避免每个包都写连接表项
+#define CT_REFRESH_NS          (1ULL * 1000000000ULL)
+// gc 定时器周期，每次遍历整张连接表，开销见 xdp_prog_kern.c 中的 ct_gc_fire
+#define CT_GC_INTERVAL         (10ULL * 1000000000ULL)
+
 //#define DEBUG_PRINT
 //#define DEBUG_PRINT_EVERY
 
@@ -27,6 +37,18 @@ struct conn_ipv4_key {
 struct conn_ipv4_val {
 	__u32 tcp_state;
 	__u32 rid;
+	__u64 expires; // 过期时间（bpf_ktime_get_ns）
+};
+
+// 连接跟踪计数，ct_stats 的下标。LRU 淘汰不会通知 BPF 程序，
+// 被淘汰的连接数由用户态用 插入 - 各类删除 - 当前表项数 估算
+enum ct_stat {
+	CT_STAT_INSERT,      // 新建连接
+	CT_STAT_INSERT_FAIL, // 新建连接失败
+	CT_STAT_CLOSE,       // 四次挥手结束或收到 RST 而删除
+	CT_STAT_EXPIRED,     // 查找时发现已过期而删除
+	CT_STAT_GC,          // gc 定时器删除的过期连接
+	CT_STAT_MAX,
 };
 
 enum {
@@ -32,14 +32,47 @@ struct {
 	__uint(max_entries, XDP_ACTION_MAX);
 } xdp_stats_map SEC(".maps");
 
-// 定义一个用于存储连接信息的哈希映射
+#ifndef CLOCK_MONOTONIC
+#define CLOCK_MONOTONIC 1
+#endif
+
+// 定义一个用于存储连接信息的哈希映射。
+// 使用 LRU，表满时淘汰最久未访问的连接（通常是洪泛产生的半连接），而不是拒绝新连接
 struct {
-	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
 	__type(key, struct conn_ipv4_key);
 	__type(value, struct conn_ipv4_val);
 	__uint(max_entries, MAX_CONNS);
 } conn_ipv4_map SEC(".maps");
 
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, __u64);
+	__uint(max_entries, CT_STAT_MAX);
+} ct_stats SEC(".maps");
+
+// 每个CPU各自轮询分配 rid，避免所有CPU争用同一个计数器
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, __u32);
+	__uint(max_entries, 1);
+} rr_map SEC(".maps");
+
+struct ct_gc {
+	struct bpf_timer timer;
+	__u32 started;
+};
+
+// gc 定时器，第一个包到达时启动
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, struct ct_gc);
+	__uint(max_entries, 1);
+} ct_gc_map SEC(".maps");
+
 
 // 辅助函数，用于记录 XDP 操作统计信息
 static __always_inline
@@ -92,21 +125,132 @@ int swap_conn_src_dst(struct conn_ipv4_key *conn)
 }
 
 
-// 全局变量，用于循环轮询的循环计数器
-int rr = 0;
-
 // 定义一个始终内联的辅助函数，用于获取轮询循环计数器的值
 static __always_inline
 int get_rs_rr(){
+	__u32 key = 0;
+	__u32 *rr = bpf_map_lookup_elem(&rr_map, &key);
+
+	if(!rr)
+		return 1;
 
 	// 如果循环计数器超过 6，则重置为 0
-	if(rr >= 6){
-		rr = 0;
+	if(*rr >= 6){
+		*rr = 0;
 	}
 
 	// 自增循环计数器并返回其当前值
-	rr++;
-	return rr;
+	(*rr)++;
+	return *rr;
+}
+
+
+static __always_inline
+void ct_stat_add(__u32 idx, __u64 n)
+{
+	__u64 *cnt = bpf_map_lookup_elem(&ct_stats, &idx);
+
+	if (cnt)
+		*cnt += n;
+}
+
+
+static __always_inline
+__u64 ct_timeout(__u32 state)
+{
+	switch (state) {
+	case TCP_S_SYN_SENT:
+	case TCP_S_SYN_RECV:
+		return CT_TIMEOUT_SYN;
+	case TCP_S_ESTABLISHED:
+		return CT_TIMEOUT_ESTABLISHED;
+	case TCP_S_FIN_WAIT1:
+	case TCP_S_FIN_WAIT2:
+	case TCP_S_CLOSE_WAIT:
+		return CT_TIMEOUT_FIN;
+	default:
+		return CT_TIMEOUT_CLOSE;
+	}
+}
+
+
+// 只有删除成功才计数，多个CPU同时删除同一连接时不会重复统计
+static __always_inline
+void ct_delete(struct conn_ipv4_key *key, __u32 reason)
+{
+	if (!bpf_map_delete_elem(&conn_ipv4_map, key))
+		ct_stat_add(reason, 1);
+}
+
+
+// 查找连接，已过期的连接就地删除并当作不存在
+static __always_inline
+struct conn_ipv4_val *ct_lookup(struct conn_ipv4_key *key, __u64 now)
+{
+	struct conn_ipv4_val *val = bpf_map_lookup_elem(&conn_ipv4_map, key);
+
+	if (val && val->expires < now) {
+		ct_delete(key, CT_STAT_EXPIRED);
+		return NULL;
+	}
+	return val;
+}
+
+
+// 状态变化使超时缩短时立即更新，否则至少间隔 CT_REFRESH_NS 才延长一次
+static __always_inline
+void ct_refresh(struct conn_ipv4_val *val, __u64 now)
+{
+	__u64 expires = now + ct_timeout(val->tcp_state);
+
+	if (expires < val->expires || expires > val->expires + CT_REFRESH_NS)
+		val->expires = expires;
+}
+
+
+struct ct_gc_ctx {
+	__u64 now;
+	__u64 expired;
+};
+
+static long ct_gc_check(void *map, struct conn_ipv4_key *key,
+			struct conn_ipv4_val *val, struct ct_gc_ctx *ctx)
+{
+	if (val->expires < ctx->now && !bpf_map_delete_elem(&conn_ipv4_map, key))
+		ctx->expired++;
+	return 0;
+}
+
+// 遍历整张连接表删除过期连接，然后重新启动定时器。
+// 定时器回调在单个CPU的软中断上下文中执行，开销与表的桶数（MAX_CONNS 向上取整到 2 的幂）
+// 和现有连接数成正比，表满时约 1M 次回调，按每次数十纳秒估算为数十毫秒，期间该CPU不处理收包。
+// bpf_for_each_map_elem 不能从上次停下的位置继续，按个数截断会让表头部的活跃连接被反复检查、
+// 尾部永远得不到清理，所以保留整表遍历，用 CT_GC_INTERVAL 摊薄开销；
+// 过期连接在查找时也会删除，gc 只负责回收不再有报文的连接，对延迟敏感时可以调大 CT_GC_INTERVAL
+static int ct_gc_fire(void *map, __u32 *key, struct ct_gc *gc)
+{
+	struct ct_gc_ctx ctx = { .now = bpf_ktime_get_ns() };
+
+	bpf_for_each_map_elem(&conn_ipv4_map, ct_gc_check, &ctx, 0);
+	ct_stat_add(CT_STAT_GC, ctx.expired);
+	bpf_timer_start(&gc->timer, CT_GC_INTERVAL, 0);
+	return 0;
+}
+
+// bpf_timer 只能由 BPF 程序初始化，多个CPU同时初始化时只有一个成功，其余返回 -EBUSY
+static __always_inline
+void ct_gc_start(void)
+{
+	__u32 key = 0;
+	struct ct_gc *gc = bpf_map_lookup_elem(&ct_gc_map, &key);
+
+	if (!gc || gc->started)
+		return;
+	if (!bpf_timer_init(&gc->timer, &ct_gc_map, CLOCK_MONOTONIC)) {
+		bpf_timer_set_callback(&gc->timer, ct_gc_fire);
+		bpf_timer_start(&gc->timer, CT_GC_INTERVAL, 0);
+	}
+	gc->started = 1;
 }
 
 SEC("xdp")
@@ -123,6 +267,9 @@ int xdp_entry(struct xdp_md *ctx)
 	struct udphdr *udph;
 	// 定义IPv4连接关键信息
 	struct conn_ipv4_key conn_k = {.saddr = 0, .daddr = 0, .sport = 0, .dport = 0, .proto = 0};
+	// 连接在映射表中的键（发起方方向）
+	struct conn_ipv4_key ct_k;
+	__u64 now;
 
 	nh.pos = data;
 	
@@ -152,35 +299,47 @@ int xdp_entry(struct xdp_md *ctx)
 			// 获取TCP连接信息
 			conn_k.sport = bpf_ntohs(tcph -> source);
 			conn_k.dport = bpf_ntohs(tcph -> dest);
+
+			ct_gc_start();
+			now = bpf_ktime_get_ns();
 			
 			// 查找IPv4连接映射表中的值
 			// 如果找到，就说明该连接已经存在，可以在原有连接信息的基础上进行处理。
 			// 如果没有找到，可能是首次遇到这个连接，可以进行一些初始化操作，例如创建新的连接信息并添加到哈希表中。
-			struct conn_ipv4_val *p_conn_v = bpf_map_lookup_elem(&conn_ipv4_map, &conn_k);
+			struct conn_ipv4_val *p_conn_v = ct_lookup(&conn_k, now);
 			if(!p_conn_v){
 				// 如果查找失败，交换源目地址和端口信息后再次查找
 				swap_conn_src_dst(&conn_k);
-				p_conn_v = bpf_map_lookup_elem(&conn_ipv4_map, &conn_k);
+				p_conn_v = ct_lookup(&conn_k, now);
 
 				// 如果再次查找失败，且TCP报文是SYN并且不是ACK，则创建新的连接项
 				if(!p_conn_v){
 					if(tcph->syn && !tcph->ack){
-						struct conn_ipv4_val conn_v = {.tcp_state = TCP_S_SYN_SENT};
+						struct conn_ipv4_val conn_v = {.tcp_state = TCP_S_SYN_SENT, .expires = now + CT_TIMEOUT_SYN};
 						conn_v.rid = get_rs_rr();
 						swap_conn_src_dst(&conn_k);
 						// 将新的连接项插入到 IPv4 连接映射中
-						bpf_map_update_elem(&conn_ipv4_map, &conn_k, &conn_v, BPF_ANY);
+						if(bpf_map_update_elem(&conn_ipv4_map, &conn_k, &conn_v, BPF_NOEXIST))
+							ct_stat_add(CT_STAT_INSERT_FAIL, 1);
+						else
+							ct_stat_add(CT_STAT_INSERT, 1);
+						#ifdef DEBUG_PRINT
 						// 输出日志信息，表示创建了一个新的连接项
 						bpf_printk("conn(%u:%u->%u:%u),state:%s,rid:%d",conn_k.saddr, conn_k.sport, conn_k.daddr, conn_k.dport, "SYN_SENT", conn_v.rid);	
+						#endif
 					}
 					goto out;
 				}
 			}
-			// 如果查找成功，继续处理连接项
+			// 如果查找成功，继续处理连接项。记下它在映射表中的键，后面交换 conn_k 不影响删除
+			ct_k = conn_k;
+
 			// 如果TCP报文的标志位包含RST（复位），则删除连接项并输出相应的日志信息
 			if(tcph->rst){
-				bpf_map_delete_elem(&conn_ipv4_map, &conn_k);
+				#ifdef DEBUG_PRINT
 				bpf_printk("conn(%u:%u->%u:%u),state:%s,rid:%d",conn_k.saddr, conn_k.sport, conn_k.daddr, conn_k.dport, "RST", p_conn_v->rid);
+				#endif
+				ct_delete(&ct_k, CT_STAT_CLOSE);
 				goto out;
 			}
 
@@ -215,7 +374,9 @@ int xdp_entry(struct xdp_md *ctx)
 			// 如果连接项的TCP状态为FIN_WAIT1且收到了ACK，将TCP状态更新为CLOSE_WAIT
 			if(p_conn_v->tcp_state == TCP_S_FIN_WAIT1 && tcph->ack){
 				p_conn_v->tcp_state = TCP_S_CLOSE_WAIT;
+				#ifdef DEBUG_PRINT
 				bpf_printk("conn(%u:%u->%u:%u),state:%s,rid:%d",conn_k.saddr, conn_k.sport, conn_k.daddr, conn_k.dport, "CLOSE_WAIT", p_conn_v->rid);
+				#endif
 			}
 			
 			// 如果连接项的TCP状态为CLOSE_WAIT且收到了FIN和ACK，将TCP状态更新为FIN_WAIT2
@@ -223,17 +384,21 @@ int xdp_entry(struct xdp_md *ctx)
 				p_conn_v->tcp_state = TCP_S_FIN_WAIT2;
 				goto out_tcp_conn;
 			}
-			const char *tcp_state_str;
-
-			// 根据连接状态设置对应的字符串
 			out_tcp_conn:
 				if(p_conn_v->tcp_state == TCP_S_CLOSE){
+					#ifdef DEBUG_PRINT
+					bpf_printk("conn(%u:%u->%u:%u),state:%s,rid:%d",conn_k.saddr, conn_k.sport, conn_k.daddr, conn_k.dport, "CLOSE", p_conn_v->rid);
+					#endif
 					// 如果是CLOSE状态，从映射表中删除连接信息
-					bpf_map_delete_elem(&conn_ipv4_map, &conn_k);
-				}else{
-					// 否则更新映射表中的连接信息
-					bpf_map_update_elem(&conn_ipv4_map, &conn_k, p_conn_v, BPF_EXIST);
+					ct_delete(&ct_k, CT_STAT_CLOSE);
+					goto out;
 				}
+				// 否则更新连接的过期时间，p_conn_v 指向映射表中的值，无需再 update
+				ct_refresh(p_conn_v, now);
+
+				#ifdef DEBUG_PRINT
+				const char *tcp_state_str;
+
 				// 根据连接状态打印日志
 				switch(p_conn_v->tcp_state) {
 					case TCP_S_SYN_SENT:
@@ -261,6 +426,7 @@ int xdp_entry(struct xdp_md *ctx)
 						tcp_state_str = "";
 				}
 				bpf_printk("conn(%u:%u->%u:%u),state:%s,rid:%d",conn_k.saddr, conn_k.sport, conn_k.daddr, conn_k.dport, tcp_state_str, p_conn_v->rid);				
+				#endif
 				goto out;
 		}
 		else if(nh_type == IPPROTO_UDP){
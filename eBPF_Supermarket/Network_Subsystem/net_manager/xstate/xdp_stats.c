@@ -191,21 +191,114 @@ static void stats_collect(int map_fd, __u32 map_type,
 	}
 }
 
+/* 连接跟踪统计，ct_stats 为每CPU计数，表项数由遍历 conn_ipv4_map 得到 */
+struct ct_record {
+	__u64 timestamp;
+	__u64 stats[CT_STAT_MAX];
+	__u64 entries;
+};
+
+static int ct_stats_fd = -1;
+static int conn_map_fd = -1;
+
+#define CT_BATCH 4096
+
+/* 按批读取统计表项数，内核不支持批量操作时逐个遍历 */
+static __u64 ct_count(int fd)
+{
+	static struct conn_ipv4_key keys[CT_BATCH];
+	static struct conn_ipv4_val vals[CT_BATCH];
+	struct conn_ipv4_key key, next_key;
+	__u32 batch, count;
+	__u64 total = 0;
+	void *in = NULL;
+	int err;
+
+	do {
+		count = CT_BATCH;
+		err = bpf_map_lookup_batch(fd, in, &batch, keys, vals, &count, NULL);
+		if (err && errno != ENOENT)
+			goto slow;
+		total += count;
+		in = &batch;
+	} while (!err);
+	return total;
+
+slow:
+	total = 0;
+	if (bpf_map_get_next_key(fd, NULL, &next_key))
+		return 0;
+	do {
+		total++;
+		key = next_key;
+	} while (!bpf_map_get_next_key(fd, &key, &next_key));
+	return total;
+}
+
+static void ct_collect(struct ct_record *rec)
+{
+	unsigned int nr_cpus = libbpf_num_possible_cpus();
+	__u64 values[nr_cpus];
+	__u32 key;
+	int i;
+
+	rec->timestamp = gettime();
+	for (key = 0; key < CT_STAT_MAX; key++) {
+		rec->stats[key] = 0;
+		if (bpf_map_lookup_elem(ct_stats_fd, &key, values))
+			continue;
+		for (i = 0; i < nr_cpus; i++)
+			rec->stats[key] += values[i];
+	}
+	rec->entries = ct_count(conn_map_fd);
+}
+
+static void ct_print(struct ct_record *rec, struct ct_record *prev)
+{
+	double period = (double)(rec->timestamp - prev->timestamp) / NANOSEC_PER_SEC;
+	__u64 removed = rec->stats[CT_STAT_CLOSE] + rec->stats[CT_STAT_EXPIRED] +
+			rec->stats[CT_STAT_GC] + rec->entries;
+	/* LRU 淘汰没有计数，按 插入 - 删除 - 现存 估算累计值 */
+	__u64 evicted = rec->stats[CT_STAT_INSERT] > removed ?
+			rec->stats[CT_STAT_INSERT] - removed : 0;
+
+	if (period <= 0)
+		return;
+
+#define CT_RATE(i) ((rec->stats[i] - prev->stats[i]) / period)
+	printf("%-12s %'11lld entries (%5.1f%% of %d)"
+	       " insert %'.0f/s fail %'.0f/s close %'.0f/s"
+	       " expired %'.0f/s gc %'.0f/s evicted %'lld\n\n",
+	       "conntrack", rec->entries, 100.0 * rec->entries / MAX_CONNS, MAX_CONNS,
+	       CT_RATE(CT_STAT_INSERT), CT_RATE(CT_STAT_INSERT_FAIL),
+	       CT_RATE(CT_STAT_CLOSE), CT_RATE(CT_STAT_EXPIRED),
+	       CT_RATE(CT_STAT_GC), evicted);
+#undef CT_RATE
+}
+
 static void stats_poll(int map_fd, __u32 map_type, int interval)
 {
 	struct stats_record prev, record = { 0 };
+	struct ct_record ct_prev, ct_rec = { 0 };
 
 	/* Trick to pretty printf with thousands separators use %' */
 	setlocale(LC_NUMERIC, "en_US");
 
 	/* Get initial reading quickly */
 	stats_collect(map_fd, map_type, &record);
+	if (ct_stats_fd >= 0)
+		ct_collect(&ct_rec);
 	usleep(1000000/4);
 
 	while (1) {
 		prev = record; /* struct copy */
 		stats_collect(map_fd, map_type, &record);
 		stats_print(&record, &prev);
+		if (ct_stats_fd >= 0) {
+			ct_prev = ct_rec;
+			ct_collect(&ct_rec);
+			ct_print(&ct_rec, &ct_prev);
+		}
 		sleep(interval);
 	}
 }
@@ -270,6 +363,12 @@ int main(int argc, char **argv)
 		       );
 	}
 
+	/* 旧版本的 BPF 程序没有连接跟踪统计，只输出动作统计 */
+	ct_stats_fd = open_bpf_map_file(pin_dir, "ct_stats", NULL);
+	conn_map_fd = open_bpf_map_file(pin_dir, "conn_ipv4_map", NULL);
+	if (conn_map_fd < 0)
+		ct_stats_fd = -1;
+
 	stats_poll(stats_map_fd, info.type, interval);
 	return EXIT_OK;
 }
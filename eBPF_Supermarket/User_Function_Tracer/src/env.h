@@ -25,31 +25,34 @@
 #include "vector.h"
 
 struct env {
-  char *argv[32];                    /**< -c/-commond */
-  bool avg_self;                     /**< --avg-self */
-  bool avg_total;                    /**< --avg-total */
-  bool flat;                         /**< --flat */
-  enum FORMAT format;                /**< --format */
-  char *func_pattern;                /**< -f/--function */
-  char *lib_pattern;                 /**< -l/--lib */
-  bool show_libname;                 /**< --libname */
-  unsigned int max_depth;            /**< --max-depth */
-  char *nest_lib_pattern;            /**< --nest-lib */
-  char *no_func_pattern;             /**< --no-function */
-  char *no_lib_pattern;              /**< --no-lib */
-  bool no_aslr;                      /**< --no-randomize-addr */
-  FILE *out;                         /**< -o/--output */
-  bool percent_self;                 /**< --percent-self */
-  bool percent_total;                /**< --percent-total */
-  pid_t pid;                         /**< -p/--pid */
-  bool do_record;                    /**< --record */
-  bool do_report;                    /**< --report */
-  unsigned long long sample_time_ns; /**< --sample-time */
-  bool show_tid;                     /**< --tid */
-  struct vector *tids;               /**< --tid-filter */
-  bool show_timestamp;               /**< --timestamp */
-  unsigned long long min_duration;   /**< --time-filter */
-  char *user;                        /**< -u/--user */
+  char *argv[32];                       /**< -c/-commond */
+  bool avg_self;                        /**< --avg-self */
+  bool avg_total;                       /**< --avg-total */
+  bool flat;                            /**< --flat */
+  enum FORMAT format;                   /**< --format */
+  char *func_pattern;                   /**< -f/--function */
+  char *lib_pattern;                    /**< -l/--lib */
+  bool show_libname;                    /**< --libname */
+  unsigned long long max_calls_per_sec; /**< --max-calls-per-sec */
+  unsigned int max_depth;               /**< --max-depth */
+  char *nest_lib_pattern;               /**< --nest-lib */
+  char *no_func_pattern;                /**< --no-function */
+  char *no_lib_pattern;                 /**< --no-lib */
+  bool no_aslr;                         /**< --no-randomize-addr */
+  FILE *out;                            /**< -o/--output */
+  FILE *perfetto_out;                   /**< --perfetto */
+  bool percent_self;                    /**< --percent-self */
+  bool percent_total;                   /**< --percent-total */
+  pid_t pid;                            /**< -p/--pid */
+  bool do_record;                       /**< --record */
+  bool do_report;                       /**< --report */
+  unsigned int sample_rate;             /**< --sample-rate */
+  unsigned long long sample_time_ns;    /**< --sample-time */
+  bool show_tid;                        /**< --tid */
+  struct vector *tids;                  /**< --tid-filter */
+  bool show_timestamp;                  /**< --timestamp */
+  unsigned long long min_duration;      /**< --time-filter */
+  char *user;                           /**< -u/--user */
 };
 
 #endif  // UTRACE_ENV_H
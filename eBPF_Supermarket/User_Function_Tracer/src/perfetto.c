@@ -0,0 +1,213 @@
+// Copyright 2023 The LMP Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// author: jinyufeng2000@gmail.com
+//
+// Write the traced data in Perfetto protobuf format, which can be opened by "ui.perfetto.dev"
+
+#include "perfetto.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief field numbers and enum values from the protos in perfetto/protos/perfetto/trace
+ */
+enum {
+  TRACE_PACKET = 1,                    /**< Trace.packet */
+  PACKET_TIMESTAMP = 8,                /**< TracePacket.timestamp */
+  PACKET_SEQUENCE_ID = 10,             /**< TracePacket.trusted_packet_sequence_id */
+  PACKET_TRACK_EVENT = 11,             /**< TracePacket.track_event */
+  PACKET_INTERNED_DATA = 12,           /**< TracePacket.interned_data */
+  PACKET_SEQUENCE_FLAGS = 13,          /**< TracePacket.sequence_flags */
+  PACKET_TRACK_DESCRIPTOR = 60,        /**< TracePacket.track_descriptor */
+  TRACK_UUID = 1,                      /**< TrackDescriptor.uuid */
+  TRACK_PARENT_UUID = 5,               /**< TrackDescriptor.parent_uuid */
+  TRACK_PROCESS = 3,                   /**< TrackDescriptor.process */
+  TRACK_THREAD = 4,                    /**< TrackDescriptor.thread */
+  PROCESS_PID = 1,                     /**< ProcessDescriptor.pid */
+  PROCESS_NAME = 6,                    /**< ProcessDescriptor.process_name */
+  THREAD_PID = 1,                      /**< ThreadDescriptor.pid */
+  THREAD_TID = 2,                      /**< ThreadDescriptor.tid */
+  EVENT_TYPE = 9,                      /**< TrackEvent.type */
+  EVENT_NAME_IID = 10,                 /**< TrackEvent.name_iid */
+  EVENT_TRACK_UUID = 11,               /**< TrackEvent.track_uuid */
+  INTERNED_EVENT_NAMES = 2,            /**< InternedData.event_names */
+  EVENT_NAME_IID_FIELD = 1,            /**< EventName.iid */
+  EVENT_NAME_NAME = 2,                 /**< EventName.name */
+  TYPE_SLICE_BEGIN = 1,                /**< TrackEvent.Type.TYPE_SLICE_BEGIN */
+  TYPE_SLICE_END = 2,                  /**< TrackEvent.Type.TYPE_SLICE_END */
+  SEQ_INCREMENTAL_STATE_CLEARED = 1,   /**< TracePacket.SequenceFlags */
+  SEQ_NEEDS_INCREMENTAL_STATE = 2,     /**< TracePacket.SequenceFlags */
+};
+
+enum { WIRE_VARINT = 0, WIRE_LEN = 2 };
+
+#define SEQUENCE_ID 1 /**< all packets are written on one sequence */
+
+/**
+ * @brief append a base-128 varint to `buf`
+ */
+static void pb_varint(struct vector *buf, uint64_t value) {
+  unsigned char byte;
+  do {
+    byte = value & 0x7f;
+    value >>= 7;
+    if (value) byte |= 0x80;
+    vector_push_back(buf, &byte);
+  } while (value);
+}
+
+/**
+ * @brief append a varint field to `buf`
+ */
+static void pb_uint(struct vector *buf, uint32_t field, uint64_t value) {
+  pb_varint(buf, (uint64_t)field << 3 | WIRE_VARINT);
+  pb_varint(buf, value);
+}
+
+/**
+ * @brief append a length-delimited field to `buf`
+ */
+static void pb_bytes(struct vector *buf, uint32_t field, const void *data, size_t len) {
+  pb_varint(buf, (uint64_t)field << 3 | WIRE_LEN);
+  pb_varint(buf, len);
+  const size_t size = vector_size(buf);
+  vector_resize(buf, size + len);
+  if (len) memcpy(vector_get(buf, size), data, len);
+}
+
+/**
+ * @brief append an encoded nested message `msg` as a field to `buf`
+ */
+static void pb_message(struct vector *buf, uint32_t field, const struct vector *msg) {
+  pb_bytes(buf, field, msg->data, vector_size(msg));
+}
+
+/**
+ * @brief uuid of the track of thread `tid`
+ */
+static uint64_t thread_uuid(pid_t pid, int tid) { return (uint64_t)pid << 32 | (uint32_t)tid; }
+
+/**
+ * @brief write the encoded `perfetto->packet` as one Trace.packet
+ */
+static void perfetto_flush_packet(struct perfetto *perfetto) {
+  struct vector *trace = perfetto->message;
+  vector_clear(trace);
+  pb_message(trace, TRACE_PACKET, perfetto->packet);
+  fwrite(trace->data, 1, vector_size(trace), perfetto->out);
+}
+
+/**
+ * @brief tid compare function used by vector_find()
+ */
+static int tid_equal(const void *lhs, const void *rhs) { return *(int *)lhs != *(int *)rhs; }
+
+/**
+ * @brief write the track descriptor of thread `tid` when seeing it for the first time
+ */
+static void perfetto_write_thread(struct perfetto *perfetto, int tid) {
+  if (vector_find(perfetto->tids, &tid, tid_equal)) return;
+  vector_push_back(perfetto->tids, &tid);
+
+  struct vector *thread = perfetto->nested, *track = perfetto->message;
+  vector_clear(thread);
+  pb_uint(thread, THREAD_PID, perfetto->pid);
+  pb_uint(thread, THREAD_TID, tid);
+  vector_clear(track);
+  pb_uint(track, TRACK_UUID, thread_uuid(perfetto->pid, tid));
+  pb_uint(track, TRACK_PARENT_UUID, perfetto->pid);
+  pb_message(track, TRACK_THREAD, thread);
+  vector_clear(perfetto->packet);
+  pb_message(perfetto->packet, PACKET_TRACK_DESCRIPTOR, track);
+  pb_uint(perfetto->packet, PACKET_SEQUENCE_ID, SEQUENCE_ID);
+  perfetto_flush_packet(perfetto);
+}
+
+struct perfetto *perfetto_init(FILE *out, pid_t pid, const char *cmdline) {
+  struct perfetto *perfetto = malloc(sizeof(struct perfetto));
+  perfetto->out = out;
+  perfetto->pid = pid;
+  perfetto->names = strtab_init();
+  perfetto->tids = vector_init(sizeof(int), NULL);
+  perfetto->packet = vector_init(sizeof(unsigned char), NULL);
+  perfetto->message = vector_init(sizeof(unsigned char), NULL);
+  perfetto->nested = vector_init(sizeof(unsigned char), NULL);
+
+  // the process track, which also clears the incremental state (interned names) of the sequence
+  struct vector *process = perfetto->nested, *track = perfetto->message;
+  pb_uint(process, PROCESS_PID, pid);
+  if (cmdline) pb_bytes(process, PROCESS_NAME, cmdline, strlen(cmdline));
+  pb_uint(track, TRACK_UUID, pid);
+  pb_message(track, TRACK_PROCESS, process);
+  pb_message(perfetto->packet, PACKET_TRACK_DESCRIPTOR, track);
+  pb_uint(perfetto->packet, PACKET_SEQUENCE_ID, SEQUENCE_ID);
+  pb_uint(perfetto->packet, PACKET_SEQUENCE_FLAGS, SEQ_INCREMENTAL_STATE_CLEARED);
+  perfetto_flush_packet(perfetto);
+  return perfetto;
+}
+
+void perfetto_write_event(struct perfetto *perfetto, int tid, const char *name,
+                          unsigned long long timestamp, bool ret) {
+  perfetto_write_thread(perfetto, tid);
+
+  struct vector *event = perfetto->message;
+  vector_clear(perfetto->packet);
+  pb_uint(perfetto->packet, PACKET_TIMESTAMP, timestamp);
+  if (!ret) {
+    // intern the name, and emit it along with the first event using it
+    const size_t size = strtab_size(perfetto->names);
+    const uint64_t iid = strtab_id(strtab_intern(perfetto->names, name, strlen(name))) + 1;
+    if (strtab_size(perfetto->names) > size) {
+      struct vector *event_name = perfetto->nested, *interned = perfetto->message;
+      vector_clear(event_name);
+      pb_uint(event_name, EVENT_NAME_IID_FIELD, iid);
+      pb_bytes(event_name, EVENT_NAME_NAME, name, strlen(name));
+      vector_clear(interned);
+      pb_message(interned, INTERNED_EVENT_NAMES, event_name);
+      pb_message(perfetto->packet, PACKET_INTERNED_DATA, interned);
+    }
+    vector_clear(event);
+    pb_uint(event, EVENT_TYPE, TYPE_SLICE_BEGIN);
+    pb_uint(event, EVENT_NAME_IID, iid);
+  } else {
+    vector_clear(event);
+    pb_uint(event, EVENT_TYPE, TYPE_SLICE_END);
+  }
+  pb_uint(event, EVENT_TRACK_UUID, thread_uuid(perfetto->pid, tid));
+  pb_message(perfetto->packet, PACKET_TRACK_EVENT, event);
+  pb_uint(perfetto->packet, PACKET_SEQUENCE_ID, SEQUENCE_ID);
+  pb_uint(perfetto->packet, PACKET_SEQUENCE_FLAGS, SEQ_NEEDS_INCREMENTAL_STATE);
+  perfetto_flush_packet(perfetto);
+}
+
+void perfetto_write_slice(struct perfetto *perfetto, int tid, const char *name,
+                          unsigned long long start_ts, unsigned long long end_ts) {
+  perfetto_write_event(perfetto, tid, name, start_ts, false);
+  perfetto_write_event(perfetto, tid, name, end_ts, true);
+}
+
+void perfetto_free(struct perfetto *perfetto) {
+  if (perfetto) {
+    fflush(perfetto->out);
+    strtab_free(perfetto->names);
+    vector_free(perfetto->tids);
+    vector_free(perfetto->packet);
+    vector_free(perfetto->message);
+    vector_free(perfetto->nested);
+    free(perfetto);
+  }
+}
@@ -0,0 +1,71 @@
+// Copyright 2023 The LMP Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// author: jinyufeng2000@gmail.com
+//
+// Write the traced data in Perfetto protobuf format, which can be opened by "ui.perfetto.dev"
+
+#ifndef UTRACE_PERFETTO_H
+#define UTRACE_PERFETTO_H
+
+#include <stdio.h>
+#include <sys/types.h>  // for pid_t
+
+#include "strtab.h"
+#include "vector.h"
+
+/**
+ * @brief stream `Trace` messages, i.e. a sequence of `TracePacket`s, into a file
+ * @details function names are interned per packet sequence, and each thread gets its own track
+ */
+struct perfetto {
+  FILE *out;              /**< the output file, not responsible for fclosing */
+  pid_t pid;              /**< process ID of the traced program */
+  struct strtab *names;   /**< interned function names, whose iid is strtab_id() + 1 */
+  struct vector *tids;    /**< threads whose track descriptor has been written (int) */
+  struct vector *packet;  /**< scratch buffer for encoding one TracePacket */
+  struct vector *message; /**< scratch buffer for encoding one nested message */
+  struct vector *nested;  /**< scratch buffer for encoding one doubly nested message */
+};
+
+/**
+ * @brief create and init a perfetto writer, and write the process track descriptor
+ * @param[in] out the output file
+ * @param[in] pid process ID of the traced program
+ * @param[in] cmdline command line of the traced program, used as the process name
+ * @return struct perfetto malloced from heap
+ */
+struct perfetto *perfetto_init(FILE *out, pid_t pid, const char *cmdline);
+
+/**
+ * @brief write a slice begin (`ret` is false) or slice end (`ret` is true) event of function
+ *        `name` on thread `tid` at `timestamp`
+ */
+void perfetto_write_event(struct perfetto *perfetto, int tid, const char *name,
+                          unsigned long long timestamp, bool ret);
+
+/**
+ * @brief write a complete slice of function `name` on thread `tid`
+ * @details slices can be written when functions exit, i.e. not in timestamp order, since the trace
+ *          processor sorts events by timestamp when loading the file
+ */
+void perfetto_write_slice(struct perfetto *perfetto, int tid, const char *name,
+                          unsigned long long start_ts, unsigned long long end_ts);
+
+/**
+ * @brief free the `perfetto` writer and flush the written packets
+ */
+void perfetto_free(struct perfetto *perfetto);
+
+#endif  // UTRACE_PERFETTO_H
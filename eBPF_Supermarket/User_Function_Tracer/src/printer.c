@@ -162,7 +162,7 @@ static void print_trace_entry_flat(struct printer *printer, enum FUNC_STATE stat
 
 void print_trace(struct printer *printer, struct vmem_table *vmem_table,
                  struct thread_local *thread_local, struct record *record,
-                 const struct user_record *r) {
+                 struct perfetto *perfetto, const struct user_record *r) {
   struct user_record curr;
   unsigned int index = thread_local_get_index(thread_local, r->krecord.tid);
   enum FUNC_STATE state = thread_local_get_state(thread_local, index);
@@ -177,6 +177,9 @@ void print_trace(struct printer *printer, struct vmem_table *vmem_table,
       env.flat ? print_trace_entry_flat(printer, state, &curr)
                : print_trace_entry_graph(printer, state, &curr);
       if (env.do_record && !env.do_report) record_entry(record, &curr);  // also record this entry
+      if (perfetto)  // the slice is complete now
+        perfetto_write_slice(perfetto, curr.krecord.tid, curr.name, prer->krecord.timestamp,
+                             curr.krecord.timestamp);
     } else if (state == STATE_EXEC) {  // entered a function previously
       if (env.min_duration) {
         while (prer->krecord.ustack_sz > r->krecord.ustack_sz) {
@@ -200,6 +203,9 @@ void print_trace(struct printer *printer, struct vmem_table *vmem_table,
           ? print_trace_entry_flat(printer, env.show_timestamp ? STATE_EXIT : STATE_EXEC, &curr)
           : print_trace_entry_graph(printer, env.show_timestamp ? STATE_EXIT : STATE_EXEC, &curr);
       if (env.do_record && !env.do_report) record_entry(record, &curr);  // record `prer`
+      if (perfetto)  // the slice is complete now
+        perfetto_write_slice(perfetto, curr.krecord.tid, curr.name, prer->krecord.timestamp,
+                             curr.krecord.timestamp);
     }
     thread_local_pop_record(thread_local, index);
     thread_local_set_state(thread_local, index, STATE_EXIT);
@@ -230,7 +236,7 @@ void print_trace(struct printer *printer, struct vmem_table *vmem_table,
     }
     if (env.min_duration) {
       while (thread_local_record_size(thread_local, index) > 0 &&
-             thread_local_get_record_back(thread_local, index)->krecord.ustack_sz + 1 !=
+             thread_local_get_record_back(thread_local, index)->krecord.ustack_sz >=
                  curr.krecord.ustack_sz)
         thread_local_pop_record(thread_local, index);  // this function has be filtered by time
     }
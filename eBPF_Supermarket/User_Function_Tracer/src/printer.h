@@ -23,6 +23,7 @@
 
 #include <stdio.h>
 
+#include "perfetto.h"
 #include "record.h"
 #include "thread_local.h"
 #include "vmem.h"
@@ -73,11 +74,12 @@ void print_split_line(struct printer *printer);
  * @param[in] vmem_table to resolve the corresponding symbol for a given address
  * @param[in] thread_local to maintain infos for each thread
  * @param[in] record to also record the traced entry when specifying `--record`
+ * @param[in] perfetto to also stream the traced entry when specifying `--perfetto`, or NULL
  * @param[in] user_record the traced entry to be printed
  */
 void print_trace(struct printer *printer, struct vmem_table *vmem_table,
                  struct thread_local *thread_local, struct record *record,
-                 const struct user_record *r);
+                 struct perfetto *perfetto, const struct user_record *r);
 
 /**
  * @brief free the `printer`
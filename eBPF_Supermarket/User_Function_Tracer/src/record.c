@@ -45,6 +45,9 @@ static void fwrite_str(const char *str, FILE *fp) {
 }
 
 void record_header(struct record *record, int argc, char **argv) {
+  const unsigned int version = RECORD_VERSION;
+  fwrite(RECORD_MAGIC, sizeof(RECORD_MAGIC), 1, record->out);
+  fwrite(&version, sizeof(version), 1, record->out);
   time_t t;
   time(&t);
   char *cur_time = ctime(&t);
@@ -66,6 +69,7 @@ void record_entry(struct record *record, struct user_record *user_record) {
   // we can compute `ustack_sz` and `duration_ns`, so we do not record them
   fwrite_str(user_record->name, record->out);
   fwrite_str(user_record->libname ? user_record->libname : "", record->out);
+  fwrite(&user_record->krecord.weight, sizeof(user_record->krecord.weight), 1, record->out);
   fwrite(&user_record->krecord.ret, sizeof(user_record->krecord.ret), 1, record->out);
 }
 
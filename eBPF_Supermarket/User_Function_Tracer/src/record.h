@@ -24,6 +24,9 @@
 #include <stdio.h>
 #include <sys/types.h>
 
+#define RECORD_MAGIC "UTRACE" /**< leading bytes of "./utrace.data", including the '\0' */
+#define RECORD_VERSION 2      /**< bumped whenever the layout written by record_entry() changes */
+
 struct record {
   FILE *out; /**< point to file "./trace.data" */
   pid_t pid; /**< process ID of the traced program */
@@ -39,9 +42,10 @@ struct record *record_init(pid_t pid);
  * @brief record some basic info
  * @param[in] argc main()'s argc
  * @param[in] argv main()'s argv
- * @details record 1. the traced time
- *                 2. the trace command
- *                 3. the pid of the traced program
+ * @details record 1. RECORD_MAGIC and RECORD_VERSION
+ *                 2. the traced time
+ *                 3. the trace command
+ *                 4. the pid of the traced program
  */
 void record_header(struct record *record, int argc, char **argv);
 
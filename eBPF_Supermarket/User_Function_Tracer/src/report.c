@@ -18,32 +18,21 @@
 
 #include "report.h"
 
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "env.h"
 #include "glob.h"
 #include "log.h"
+#include "perfetto.h"
+#include "record.h"
+#include "strtab.h"
 #include "util.h"
 
-/**
- * @brief free the malloced `name` and `libname` in each user_record
- */
-static void user_record_free(void *user_record) {
-  struct user_record *urecord = user_record;
-  free(urecord->name);
-  free(urecord->libname);
-}
-
-struct report *report_init(struct printer *printer) {
-  struct report *report = malloc(sizeof(struct report));
-  report->in = fopen("./utrace.data", "rb");
-  if (!report->in) die("fopen");
-  report->printer = printer;
-  report->records = vector_init(sizeof(struct user_record), user_record_free);
-  return report;
-}
-
 /**
  * @brief maintain function time for summary
  */
@@ -62,6 +51,66 @@ struct summary_info {
   const char *libname;               /**< library name */
 };
 
+/**
+ * @brief maintain the folded stack time for flame graph
+ */
+struct flame_graph_info {
+  const char *stack;               /**< function stack, concated by ';' */
+  size_t len;                      /**< length of `stack` */
+  unsigned long long self_time_ns; /**< time spent in the last function of the stack itself */
+};
+
+/**
+ * @brief the trace entries of one thread and the results analyzed from them
+ */
+struct thread_trace {
+  int tid;                           /**< thread ID */
+  struct vector *offsets;            /**< offsets of the raw entries in "./utrace.data" */
+  struct strtab *funcs;              /**< interned "name\0libname" of traced functions */
+  struct vector *records;            /**< filtered entries in timestamp order */
+  struct vector *function_infos;     /**< struct summary_info indexed by function ID */
+  unsigned long long sum_total_time; /**< the sum of total time of all calls */
+  unsigned long long sum_self_time;  /**< the sum of self time of all calls */
+  bool sampled;                      /**< whether some calls are sampled */
+  struct strtab *call_tree_keys;     /**< interned (parent node, function ID) */
+  struct vector *call_tree;          /**< struct flame_graph_node indexed by key ID */
+};
+
+/**
+ * @brief free the vectors and string tables in each thread_trace
+ */
+static void thread_trace_free(void *thread_trace) {
+  struct thread_trace *thread = thread_trace;
+  vector_free(thread->offsets);
+  vector_free(thread->records);
+  vector_free(thread->function_infos);
+  vector_free(thread->call_tree);
+  strtab_free(thread->call_tree_keys);
+  strtab_free(thread->funcs);
+}
+
+struct report *report_init(struct printer *printer) {
+  struct report *report = malloc(sizeof(struct report));
+  report->fd = open("./utrace.data", O_RDONLY);
+  if (report->fd == -1) die("open");
+  struct stat st;
+  if (fstat(report->fd, &st) == -1) die("fstat");
+  report->size = st.st_size;
+  report->data = NULL;
+  if (report->size) {
+    // map the whole file so that worker threads can parse it concurrently without copying
+    report->data = mmap(NULL, report->size, PROT_READ, MAP_PRIVATE, report->fd, 0);
+    if (report->data == MAP_FAILED) die("mmap");
+  }
+  report->printer = printer;
+  report->trace_time = NULL;
+  report->cmdline = NULL;
+  report->pid = 0;
+  report->threads = vector_init(sizeof(struct thread_trace), thread_trace_free);
+  report->records = vector_init(sizeof(struct user_record), NULL);
+  return report;
+}
+
 /**
  * @brief sort by function total_time in descending order
  * @param[in] lhs struct summary_info*
@@ -96,95 +145,119 @@ static int tid_cmp(const void *lhs, const void *rhs) {
 }
 
 /**
- * @brief analyze the traced data
+ * @brief analyze the traced data of one thread
+ * @details `thread->records` should be in timestamp order
  */
-static void report_summary(struct report *report) {
-  struct vector *tids = vector_init(sizeof(int), NULL);
+static void thread_trace_summary(struct thread_trace *thread) {
   struct vector *stack = vector_init(sizeof(size_t), NULL);
+  const struct summary_info empty_info = {};
+
+  thread->function_infos = vector_init(sizeof(struct summary_info), NULL);
+  vector_resize(thread->function_infos, strtab_size(thread->funcs));
+  for (size_t i = 0; i < vector_size(thread->function_infos); i++)
+    vector_set(thread->function_infos, i, &empty_info);
+
+  for (size_t j = 0; j < vector_size(thread->records); j++) {
+    const struct user_record *r = vector_const_get(thread->records, j);
+    // function IDs are the indexes of the corresponding function_infos
+    struct summary_info *info = vector_get(thread->function_infos, strtab_id(r->name));
+    if (r->krecord.ret) {
+      // each sampled call stands for `weight` calls, so extrapolate the sums by it
+      const unsigned long long weight = r->krecord.weight ? r->krecord.weight : 1;
+      if (weight > 1) thread->sampled = true;
+      // update sum total time
+      info->sum_total_time += r->duration_ns * weight;
+      // update min total time
+      if (!info->min_total_time)
+        info->min_total_time = r->duration_ns;
+      else if (r->duration_ns < info->min_total_time)
+        info->min_total_time = r->duration_ns;
+      // update max total time
+      if (r->duration_ns > info->max_total_time) info->max_total_time = r->duration_ns;
+      thread->sum_total_time += r->duration_ns * weight;
+
+      unsigned long long cur_self_time =
+          r->duration_ns -
+          info->sub_self_time[r->krecord.ustack_sz];  // exclude sub functions' time
+      info->sub_self_time[r->krecord.ustack_sz] = 0;
+      // update sum self time
+      info->sum_self_time += cur_self_time * weight;
+      // update min self time
+      if (!info->min_self_time)
+        info->min_self_time = cur_self_time;
+      else if (cur_self_time < info->min_self_time)
+        info->min_self_time = cur_self_time;
+      // update max self time
+      if (cur_self_time > info->max_self_time) info->max_self_time = cur_self_time;
+      thread->sum_self_time += cur_self_time * weight;
+      info->calls += weight;
+
+      vector_pop_back(stack);
+      if (!vector_empty(stack)) {
+        // remove the time used by sub-functions, e.g., if f() calls g(), self_time(f()) should
+        // exclude total_time(g())
+        const struct user_record *prer =
+            vector_const_get(thread->records, *(size_t *)vector_back(stack));
+        struct summary_info *pre_info =
+            vector_get(thread->function_infos, strtab_id(prer->name));
+        pre_info->sub_self_time[prer->krecord.ustack_sz] += r->duration_ns;
+      }
+    } else {
+      info->name = r->name;
+      info->libname = r->libname;
+      vector_push_back(stack, &j);
+    }
+  }
+
+  vector_free(stack);
+}
+
+/**
+ * @brief merge the min/max time of `info` into `merged`, where 0 means unset for min time
+ */
+static void summary_info_merge(struct summary_info *merged, const struct summary_info *info) {
+  merged->sum_total_time += info->sum_total_time;
+  if (!merged->min_total_time ||
+      (info->min_total_time && info->min_total_time < merged->min_total_time))
+    merged->min_total_time = info->min_total_time;
+  if (info->max_total_time > merged->max_total_time) merged->max_total_time = info->max_total_time;
+  merged->sum_self_time += info->sum_self_time;
+  if (!merged->min_self_time ||
+      (info->min_self_time && info->min_self_time < merged->min_self_time))
+    merged->min_self_time = info->min_self_time;
+  if (info->max_self_time > merged->max_self_time) merged->max_self_time = info->max_self_time;
+  merged->calls += info->calls;
+}
+
+/**
+ * @brief merge the per-thread summaries and output them
+ */
+static void report_summary(struct report *report) {
+  struct strtab *funcs = strtab_init();  // functions are identified by "name\0libname"
   struct vector *function_infos = vector_init(sizeof(struct summary_info), NULL);
 
   unsigned long long all_sum_total_time = 0;
   unsigned long long all_sum_self_time = 0;
-  for (size_t i = 0; i < vector_size(report->records); i++) {
-    const struct user_record *curr = vector_const_get(report->records, i);
-    // process each thread independently
-    if (vector_find(tids, &curr->krecord.tid, tid_cmp))
-      continue;  // thread `tid` has been processed
-
-    for (size_t j = i; j < vector_size(report->records); j++) {
-      const struct user_record *r = vector_const_get(report->records, j);
-      if (r->krecord.tid != curr->krecord.tid)
-        continue;  // only process user_record in thread `tid` now
-      if (r->krecord.ret) {
-        // update the corresponding function_info, which is guaranteed to exist
-        struct summary_info *info;
-        for (size_t index = 0; index < vector_size(function_infos); index++) {
-          info = vector_get(function_infos, index);
-          if (!strcmp(info->name, r->name) && !strcmp(info->libname, r->libname)) break;
-        }
-        // update sum total time
-        info->sum_total_time += r->duration_ns;
-        // update min total time
-        if (!info->min_total_time)
-          info->min_total_time = r->duration_ns;
-        else if (r->duration_ns < info->min_total_time)
-          info->min_total_time = r->duration_ns;
-        // update max total time
-        if (r->duration_ns > info->max_total_time) info->max_total_time = r->duration_ns;
-        all_sum_total_time += r->duration_ns;
-
-        unsigned long long cur_self_time =
-            r->duration_ns -
-            info->sub_self_time[r->krecord.ustack_sz];  // exclude sub functions' time
-        info->sub_self_time[r->krecord.ustack_sz] = 0;
-        // update sum self time
-        info->sum_self_time += cur_self_time;
-        // update min self time
-        if (!info->min_self_time)
-          info->min_self_time = cur_self_time;
-        else if (cur_self_time < info->min_self_time)
-          info->min_self_time = cur_self_time;
-        // update max self time
-        if (cur_self_time > info->max_self_time) info->max_self_time = cur_self_time;
-        all_sum_self_time += cur_self_time;
-        info->calls++;
-
-        vector_pop_back(stack);
-        if (!vector_empty(stack)) {
-          // remove the time used by sub-functions, e.g., if f() calls g(), self_time(f()) should
-          // exclude total_time(g())
-          const struct user_record *prer =
-              vector_const_get(report->records, *(size_t *)vector_back(stack));
-          for (size_t k = vector_size(function_infos); k > 0; k--) {
-            struct summary_info *pre_info = vector_get(function_infos, k - 1);
-            if (!strcmp(pre_info->name, prer->name) && !strcmp(pre_info->libname, prer->libname)) {
-              pre_info->sub_self_time[prer->krecord.ustack_sz] += r->duration_ns;
-              break;
-            }
-          }
-        }
+  bool sampled = false;  // whether durations are extrapolated from sampled calls
+  for (size_t i = 0; i < vector_size(report->threads); i++) {
+    const struct thread_trace *thread = vector_const_get(report->threads, i);
+    all_sum_total_time += thread->sum_total_time;
+    all_sum_self_time += thread->sum_self_time;
+    sampled |= thread->sampled;
+    for (size_t j = 0; j < vector_size(thread->function_infos); j++) {
+      const struct summary_info *info = vector_const_get(thread->function_infos, j);
+      if (!info->calls) continue;  // all calls of this function are filtered
+      const char *key =
+          strtab_intern(funcs, info->name, strlen(info->name) + 1 + strlen(info->libname));
+      if (strtab_id(key) == vector_size(function_infos)) {  // seen for the first time
+        struct summary_info merged = *info;
+        merged.name = key;
+        merged.libname = key + strlen(key) + 1;
+        vector_push_back(function_infos, &merged);
       } else {
-        // if the corresponding function_info does not exist, create it
-        size_t index = 0;
-        for (; index < vector_size(function_infos); index++) {
-          const struct summary_info *info = vector_const_get(function_infos, index);
-          if (!strcmp(info->name, r->name) && !strcmp(info->libname, r->libname)) break;
-        }
-        if (index == vector_size(function_infos)) {
-          struct summary_info info;
-          info.sum_total_time = info.min_total_time = info.max_total_time = 0;
-          info.sum_self_time = info.min_self_time = info.max_self_time = 0;
-          memset(info.sub_self_time, 0, sizeof(info.sub_self_time));
-          info.calls = 0;
-          info.name = r->name;
-          info.libname = r->libname;
-          vector_push_back(function_infos, &info);
-        }
-        vector_push_back(stack, &j);
+        summary_info_merge(vector_get(function_infos, strtab_id(key)), info);
       }
     }
-
-    vector_push_back(tids, &curr->krecord.tid);
   }
   (env.avg_self || env.percent_self) ? vector_sort(function_infos, self_time_greater)
                                      : vector_sort(function_infos, total_time_greater);
@@ -262,10 +335,10 @@ static void report_summary(struct report *report) {
   }
   print_chars(report->printer, '=', width);
   print_chars(report->printer, '\n', 1);
+  if (sampled) LOG(report->printer->out, "TIME and CALLS are extrapolated from sampled calls\n");
 
-  vector_free(tids);
-  vector_free(stack);
   vector_free(function_infos);
+  strtab_free(funcs);
 }
 
 /**
@@ -298,21 +371,35 @@ static void report_chrome(struct report *report) {
 }
 
 /**
- * @brief maintain folded stack counts
+ * @brief report the traced data in Perfetto protobuf format
  */
-struct flame_graph_info {
-  char *stack;                /**< function stack, concated by ';' */
-  int tid;                    /**< thread ID */
-  unsigned long long samples; /**< sample count */
+static void report_perfetto(struct report *report) {
+  struct perfetto *perfetto = perfetto_init(report->printer->out, report->pid, report->cmdline);
+  for (size_t i = 0; i < vector_size(report->records); i++) {
+    const struct user_record *r = vector_const_get(report->records, i);
+    perfetto_write_event(perfetto, r->krecord.tid, r->name, r->krecord.timestamp, r->krecord.ret);
+  }
+  perfetto_free(perfetto);
+}
+
+/**
+ * @brief a node in the call tree of one thread, each node corresponds to a folded stack
+ */
+struct flame_graph_node {
+  size_t parent;                   /**< index of the parent node, or ROOT_NODE */
+  const char *name;                /**< function name of the last frame */
+  unsigned long long self_time_ns; /**< time spent in the last function of the stack itself */
 };
 
+#define ROOT_NODE ((size_t)-1)
+
 /**
- * @brief free the malloced `stack` in each flmae_graph_info
+ * @brief a frame of the call stack being walked
  */
-void flame_graph_info_free(void *flame_graph_info) {
-  struct flame_graph_info *info = flame_graph_info;
-  free(info->stack);
-}
+struct flame_graph_frame {
+  size_t node;                    /**< index of the call tree node */
+  unsigned long long sub_time_ns; /**< the sum of sub-functions' total time */
+};
 
 /**
  * @brief sort by `strlen(stack)` in ascending order
@@ -320,90 +407,108 @@ void flame_graph_info_free(void *flame_graph_info) {
  * @param[in] rhs struct flame_graph_info*
  */
 static int stack_len_less(const void *lhs, const void *rhs) {
-  const size_t len1 = strlen(((struct flame_graph_info *)lhs)->stack);
-  const size_t len2 = strlen(((struct flame_graph_info *)rhs)->stack);
+  const size_t len1 = ((struct flame_graph_info *)lhs)->len;
+  const size_t len2 = ((struct flame_graph_info *)rhs)->len;
   return len1 < len2 ? -1 : (len1 > len2 ? 1 : 0);
 }
 
 /**
- * @brief report the traced data for generating flame graph by ""brendangregg/FlameGraph""
+ * @brief build the call tree of one thread and sum up the self time of each node
+ * @details `thread->records` should be in timestamp order; nodes are interned by the key
+ *          (parent node, function ID), so the folded stack strings are only built when merging
  */
-static void report_flame_graph(struct report *report) {
-  struct vector *tids = vector_init(sizeof(int), NULL);
-  struct vector *stackcollapse =
-      vector_init(sizeof(struct flame_graph_info), flame_graph_info_free);
-
-  char buf[4096];
-  for (size_t i = 0; i < vector_size(report->records); i++) {
-    const struct user_record *curr = vector_const_get(report->records, i);
-    // process each thread independently
-    if (vector_find(tids, &curr->krecord.tid, tid_cmp))
-      continue;  // thread `tid` has been processed
-
-    size_t len = 0;
-    for (size_t j = i; j < vector_size(report->records); j++) {
-      const struct user_record *r = vector_const_get(report->records, j);
-      if (r->krecord.tid != curr->krecord.tid)
-        continue;  // only process user_record in thread `tid` now
-      if (r->krecord.ret) {
-        // update the flame_graph_info corresponding to the current stack in stackcollapse
-        size_t index = vector_size(stackcollapse);
-        for (; index > 0; --index) {
-          const struct flame_graph_info *info = vector_const_get(stackcollapse, index - 1);
-          if (!strcmp(info->stack, buf)) break;
-        }
-        if (!index) {
-          struct flame_graph_info info;
-          info.stack = strdup(buf);
-          info.tid = r->krecord.tid;
-          info.samples = 0;
-          vector_push_back(stackcollapse, &info);
-          index = vector_size(stackcollapse) - 1;
-        } else {
-          --index;
-        }
-        struct flame_graph_info *info = vector_get(stackcollapse, index);
-        info->samples += r->duration_ns / env.sample_time_ns;
-        len -= strlen(r->name);
-        if (len > 0) buf[--len] = '\0';  // overwrite the ';'
-      } else {
-        if (len > 0) buf[len++] = ';';  // use ';' to join each function
-        strcpy(buf + len, r->name);
-        len += strlen(r->name);
+static void thread_trace_flame_graph(struct thread_trace *thread) {
+  struct vector *frames = vector_init(sizeof(struct flame_graph_frame), NULL);
+
+  thread->call_tree_keys = strtab_init();
+  thread->call_tree = vector_init(sizeof(struct flame_graph_node), NULL);
+  for (size_t j = 0; j < vector_size(thread->records); j++) {
+    const struct user_record *r = vector_const_get(thread->records, j);
+    if (r->krecord.ret) {
+      if (vector_empty(frames)) continue;
+      const struct flame_graph_frame *frame = vector_back(frames);
+      struct flame_graph_node *node = vector_get(thread->call_tree, frame->node);
+      // exclude sub-functions' time, i.e. (f).self_time should exclude (f;g).total_time
+      if (r->duration_ns > frame->sub_time_ns)
+        node->self_time_ns += r->duration_ns - frame->sub_time_ns;
+      vector_pop_back(frames);
+      if (!vector_empty(frames))
+        ((struct flame_graph_frame *)vector_back(frames))->sub_time_ns += r->duration_ns;
+    } else {
+      const size_t key[2] = {
+        vector_empty(frames) ? ROOT_NODE : ((struct flame_graph_frame *)vector_back(frames))->node,
+        strtab_id(r->name),
+      };
+      const size_t index =
+          strtab_id(strtab_intern(thread->call_tree_keys, (const char *)key, sizeof(key)));
+      if (index == vector_size(thread->call_tree)) {  // a new folded stack
+        struct flame_graph_node node = {
+          .parent = key[0],
+          .name = r->name,
+          .self_time_ns = 0,
+        };
+        vector_push_back(thread->call_tree, &node);
       }
+      struct flame_graph_frame frame = {
+        .node = index,
+        .sub_time_ns = 0,
+      };
+      vector_push_back(frames, &frame);
     }
-
-    vector_push_back(tids, &curr->krecord.tid);
   }
 
-  vector_sort(stackcollapse, stack_len_less);
-  // remove inclusive samples, i.e. (f).samples should exclude (f;g).samples
-  for (size_t i = vector_size(stackcollapse); i > 0; i--) {
-    struct flame_graph_info *info1 = vector_get(stackcollapse, i - 1);
-    unsigned long long inclusive_samples = 0;
-    for (size_t j = i + 1; j < vector_size(stackcollapse); j++) {
-      const struct flame_graph_info *info2 = vector_const_get(stackcollapse, j);
-      if (info1->tid != info2->tid) continue;
-      // check info1->stack is contained by info2->stack
-      char *s1 = info1->stack, *s2 = info2->stack;
-      while (*s1 != '\0') {
-        if (*s1 != *s2) break;
-        ++s1, ++s2;
+  vector_free(frames);
+}
+
+/**
+ * @brief merge the per-thread call trees and output the folded stack counts for generating flame
+ *        graph by "brendangregg/FlameGraph"
+ */
+static void report_flame_graph(struct report *report) {
+  struct strtab *stacks = strtab_init();
+  struct vector *stackcollapse = vector_init(sizeof(struct flame_graph_info), NULL);
+  struct vector *buf = vector_init(sizeof(char), NULL);  // the folded stack being built
+
+  for (size_t i = 0; i < vector_size(report->threads); i++) {
+    struct thread_trace *thread = vector_get(report->threads, i);
+    for (size_t j = 0; j < vector_size(thread->call_tree); j++) {
+      const struct flame_graph_node *node = vector_const_get(thread->call_tree, j);
+      if (!node->self_time_ns) continue;
+      // build the folded stack from the leaf to the root, using ';' to join each function
+      vector_clear(buf);
+      for (size_t k = j; k != ROOT_NODE;) {
+        const struct flame_graph_node *frame = vector_const_get(thread->call_tree, k);
+        const size_t len = strlen(frame->name), old_len = vector_size(buf);
+        vector_resize(buf, old_len + len + (k != j));
+        memmove(vector_get(buf, len + (k != j)), vector_get(buf, 0), old_len);
+        memcpy(vector_get(buf, 0), frame->name, len);
+        if (k != j) *(char *)vector_get(buf, len) = ';';
+        k = frame->parent;
       }
-      if (*s1 == '\0' && *s2 == ';') inclusive_samples += info2->samples;
+      const char *stack = strtab_intern(stacks, buf->data, vector_size(buf));
+      if (strtab_id(stack) == vector_size(stackcollapse)) {  // seen for the first time
+        struct flame_graph_info info = {
+          .stack = stack,
+          .len = vector_size(buf),
+          .self_time_ns = 0,
+        };
+        vector_push_back(stackcollapse, &info);
+      }
+      struct flame_graph_info *info = vector_get(stackcollapse, strtab_id(stack));
+      info->self_time_ns += node->self_time_ns;
     }
-    if (inclusive_samples < info1->samples)
-      info1->samples -= inclusive_samples;
-    else
-      info1->samples = 0;
   }
+
+  vector_sort(stackcollapse, stack_len_less);
   for (size_t i = 0; i < vector_size(stackcollapse); i++) {
     const struct flame_graph_info *info = vector_const_get(stackcollapse, i);
-    if (info->samples > 0) LOG(report->printer->out, "%s %llu\n", info->stack, info->samples);
+    const unsigned long long samples = info->self_time_ns / env.sample_time_ns;
+    if (samples > 0) LOG(report->printer->out, "%s %llu\n", info->stack, samples);
   }
 
-  vector_free(tids);
+  vector_free(buf);
   vector_free(stackcollapse);
+  strtab_free(stacks);
 }
 
 /**
@@ -415,7 +520,7 @@ static void report_call_graph(struct report *report) {
       thread_local_init();  // print_trace() needs to store info per thread
   for (size_t i = 0; i < vector_size(report->records); i++) {
     const struct user_record *r = vector_const_get(report->records, i);
-    print_trace(report->printer, NULL, thread_local, NULL, r);
+    print_trace(report->printer, NULL, thread_local, NULL, NULL, r);
   }
   thread_local_free(thread_local);
 }
@@ -431,114 +536,288 @@ static int timestamp_less(const void *lhs, const void *rhs) {
   return timstamp1 < timstamp2 ? -1 : (timstamp1 > timstamp2 ? 1 : 0);
 }
 
+/**
+ * @brief a read cursor over the mapped "./utrace.data"
+ */
+struct cursor {
+  const char *pos; /**< the current position */
+  const char *end; /**< the end of the mapped file */
+};
+
+/**
+ * @brief copy `n` bytes at the cursor to `buf`
+ * @return false if there are less than `n` bytes left
+ */
+static bool cursor_read(struct cursor *cursor, void *buf, size_t n) {
+  if ((size_t)(cursor->end - cursor->pos) < n) return false;
+  memcpy(buf, cursor->pos, n);
+  cursor->pos += n;
+  return true;
+}
+
+/**
+ * @brief read a string at the cursor without copying
+ * @param[out] len the string length
+ * @return the string, which is not null-terminated, or NULL if the file is truncated
+ * @details len (size_t) + str (const char *[])
+ */
+static const char *cursor_read_str(struct cursor *cursor, size_t *len) {
+  if (!cursor_read(cursor, len, sizeof(size_t))) return NULL;
+  if ((size_t)(cursor->end - cursor->pos) < *len) return NULL;
+  const char *str = cursor->pos;
+  cursor->pos += *len;
+  return str;
+}
+
 /**
  * @brief read a string from file
- * @param[in] fp point to the file to be read
  * @return a malloced string
- * @details len (size_t) + str (const char *[])
  */
-static char *read_str(FILE *fp) {
+static char *read_str(struct cursor *cursor) {
   size_t len;
-  fread(&len, sizeof(size_t), 1, fp);
-  char *buf = malloc(sizeof(char) * (len + 1));
-  fread(buf, sizeof(char), len, fp);
-  buf[len] = '\0';
-  return buf;
+  const char *str = cursor_read_str(cursor, &len);
+  return str ? strndup(str, len) : strdup("");
 }
 
-void do_report(struct report *report) {
-  // first read the recored header
-  report->trace_time = read_str(report->in);
-  report->cmdline = read_str(report->in);
-  report->pid = fread(&report->pid, sizeof(report->pid), 1, report->in);
-  // then read each trace entry
-  struct user_record r;
+/**
+ * @brief a raw trace entry read from file, whose strings point into the mapped file
+ */
+struct raw_record {
+  struct kernel_record krecord; /**< kernel-side data */
+  const char *name;             /**< function name, not null-terminated */
+  size_t name_len;              /**< length of `name` */
+  const char *libname;          /**< library name, not null-terminated */
+  size_t libname_len;           /**< length of `libname` */
+};
+
+/**
+ * @brief read a trace entry at the cursor
+ * @return false if the file is truncated
+ * @details the layout is written by record_entry()
+ */
+static bool read_record(struct cursor *cursor, struct raw_record *r) {
+  return cursor_read(cursor, &r->krecord.tid, sizeof(r->krecord.tid)) &&
+         cursor_read(cursor, &r->krecord.timestamp, sizeof(r->krecord.timestamp)) &&
+         (r->name = cursor_read_str(cursor, &r->name_len)) &&
+         (r->libname = cursor_read_str(cursor, &r->libname_len)) &&
+         cursor_read(cursor, &r->krecord.weight, sizeof(r->krecord.weight)) &&
+         cursor_read(cursor, &r->krecord.ret, sizeof(r->krecord.ret));
+}
+
+/**
+ * @brief get the offsets of the raw entries of thread `tid`, creating its thread_trace if needed
+ * @return NULL if thread `tid` is filtered by "--tid-filter"
+ */
+static struct vector *thread_trace_offsets(struct report *report, int tid) {
+  if (!vector_empty(env.tids) && !vector_find(env.tids, &tid, tid_cmp)) return NULL;
+  for (size_t i = 0; i < vector_size(report->threads); i++) {
+    struct thread_trace *thread = vector_get(report->threads, i);
+    if (thread->tid == tid) return thread->offsets;
+  }
+  struct thread_trace thread = {
+    .tid = tid,
+    .offsets = vector_init(sizeof(size_t), NULL),
+    .funcs = strtab_init(),
+    .records = vector_init(sizeof(struct user_record), NULL),
+  };
+  vector_push_back(report->threads, &thread);
+  return thread.offsets;
+}
+
+/**
+ * @brief split the trace entries by thread ID
+ * @details only the offsets are saved, the entries are parsed later by thread_trace_build()
+ */
+static void partition_records(struct report *report, struct cursor *cursor) {
+  struct vector *offsets = NULL;
+  struct raw_record r;
+  bool has_tid = false;
+  int tid = 0;
   while (true) {
-    if (!fread(&r.krecord.tid, sizeof(r.krecord.tid), 1, report->in)) break;
-    fread(&r.krecord.timestamp, sizeof(r.krecord.timestamp), 1, report->in);
-    r.name = read_str(report->in);
-    r.libname = read_str(report->in);
-    fread(&r.krecord.ret, sizeof(r.krecord.ret), 1, report->in);
-    vector_push_back(report->records, &r);
+    const size_t offset = cursor->pos - report->data;
+    if (!read_record(cursor, &r)) break;
+    if (!has_tid || r.krecord.tid != tid) {  // entries of one thread usually come in bursts
+      has_tid = true;
+      tid = r.krecord.tid;
+      offsets = thread_trace_offsets(report, tid);
+    }
+    if (offsets) vector_push_back(offsets, &offset);
   }
+}
 
-  struct vector *tids = vector_init(sizeof(int), NULL);
+/**
+ * @brief the state of a function w.r.t. "-f/--function" and "-l/--lib" filters
+ */
+enum FUNC_FILTER { FILTER_UNKNOWN, FILTER_PASS, FILTER_DROP };
+
+/**
+ * @brief parse and filter the trace entries of one thread, then analyze them for the report
+ * @param[in] index the index of the thread_trace in `report->threads`
+ * @param[in] arg struct report*
+ * @details run on worker threads by parallel_for(), so it only touches its own thread_trace
+ */
+static void thread_trace_build(size_t index, void *arg) {
+  struct report *report = arg;
+  struct thread_trace *thread = vector_get(report->threads, index);
   struct vector *pending_records = vector_init(sizeof(struct user_record), NULL);
-  struct vector *filtered_records = vector_init(sizeof(struct user_record), NULL);
-  // filter records through various filters, e.g., "--tid-filter", "-f/--function", "--max-depth"
+  struct vector *filters = vector_init(sizeof(char), NULL);  // enum FUNC_FILTER of each function
+  struct vector *key = vector_init(sizeof(char), NULL);      // "name\0libname" of a function
+
+  // filter records through various filters, e.g., "-f/--function", "--max-depth"
   // at the same time, we can compute `krecord.ustack_sz` and `duration_ns` for each entry
-  for (size_t i = 0; i < vector_size(report->records); i++) {
-    const struct user_record *curr = vector_const_get(report->records, i);
-    if (!vector_empty(env.tids) && !vector_find(env.tids, &curr->krecord.tid, tid_cmp)) continue;
-    // process each thread independently
-    if (vector_find(tids, &curr->krecord.tid, tid_cmp))
-      continue;  // thread `tid` has been processed
-
-    unsigned int ustack_sz = 0;
-    for (size_t j = i; j < vector_size(report->records); j++) {
-      struct user_record *r = vector_get(report->records, j);
-      if (r->krecord.tid != curr->krecord.tid)
-        continue;            // only process user_record in thread `tid` now
-      if (r->krecord.ret) {  // exit a function
-        if (ustack_sz - 1 > env.max_depth) continue;  // filterd by max stack depth
-        if (!vector_empty(pending_records)) {
-          struct user_record *prer = vector_back(pending_records);
-          if (!strcmp(prer->name, r->name) && !strcmp(prer->libname, r->libname)) {
-            r->krecord.ustack_sz = (ustack_sz--) - 1;
-            r->duration_ns = r->krecord.timestamp - prer->krecord.timestamp;
-            if (r->duration_ns >= env.min_duration) {  // pass time-filter
-              vector_push_back(filtered_records, prer);
-              vector_push_back(filtered_records, r);
-              vector_pop_back(pending_records);
-            }
+  unsigned int ustack_sz = 0;
+  for (size_t j = 0; j < vector_size(thread->offsets); j++) {
+    struct cursor cursor = {
+      .pos = report->data + *(size_t *)vector_get(thread->offsets, j),
+      .end = report->data + report->size,
+    };
+    struct raw_record raw;
+    read_record(&cursor, &raw);  // never fails, since it has been read by partition_records()
+
+    // intern the function, so that functions can be compared by address and indexed by ID
+    vector_resize(key, raw.name_len + 1 + raw.libname_len);
+    memcpy(vector_get(key, 0), raw.name, raw.name_len);
+    *(char *)vector_get(key, raw.name_len) = '\0';
+    memcpy(vector_get(key, raw.name_len + 1), raw.libname, raw.libname_len);
+    struct user_record curr = {
+      .krecord = raw.krecord,
+      .name = (char *)strtab_intern(thread->funcs, key->data, vector_size(key)),
+    };
+    curr.libname = curr.name + raw.name_len + 1;
+    struct user_record *r = &curr;
+
+    if (r->krecord.ret) {  // exit a function
+      if (ustack_sz - 1 > env.max_depth) continue;  // filterd by max stack depth
+      if (!vector_empty(pending_records)) {
+        struct user_record *prer = vector_back(pending_records);
+        if (prer->name == r->name) {  // the same "name\0libname"
+          r->krecord.ustack_sz = (ustack_sz--) - 1;
+          r->duration_ns = r->krecord.timestamp - prer->krecord.timestamp;
+          if (r->duration_ns >= env.min_duration) {  // pass time-filter
+            vector_push_back(thread->records, prer);
+            vector_push_back(thread->records, r);
+            vector_pop_back(pending_records);
           }
-        } else {
-          // filtered
         }
-      } else {                                        // enter a function
-        if (ustack_sz + 1 > env.max_depth) continue;  // filterd by max stack depth
+      } else {
+        // filtered
+      }
+    } else {                                        // enter a function
+      if (ustack_sz + 1 > env.max_depth) continue;  // filterd by max stack depth
+      const size_t id = strtab_id(r->name);
+      while (vector_size(filters) <= id) vector_push_back(filters, &(char){ FILTER_UNKNOWN });
+      char *filter = vector_get(filters, id);
+      if (*filter == FILTER_UNKNOWN) {  // match the patterns only once for each function
+        *filter = FILTER_PASS;
         if (!glob_match_ext(r->name, env.func_pattern) ||
             (env.no_func_pattern &&
              glob_match_ext(r->name, env.no_func_pattern)))  // filterd by function name
-          continue;
+          *filter = FILTER_DROP;
         if (!glob_match_ext(r->libname, env.lib_pattern) ||
             (env.no_lib_pattern &&
              glob_match_ext(r->libname, env.no_lib_pattern)))  // filterd by library name
-          continue;
-        r->krecord.ustack_sz = (++ustack_sz) - 1;
-        r->duration_ns = 0;
-        vector_push_back(pending_records, r);
+          *filter = FILTER_DROP;
       }
+      if (*filter == FILTER_DROP) continue;
+      r->krecord.ustack_sz = (++ustack_sz) - 1;
+      r->duration_ns = 0;
+      vector_push_back(pending_records, r);
     }
-
-    vector_push_back(tids, &curr->krecord.tid);
   }
-  vector_free(tids);
   vector_free(pending_records);
-  struct vector *tmp = report->records;
-  report->records = filtered_records;
-  // since we process each thread independently, the order may be confused
-  vector_sort(report->records, timestamp_less);
+  vector_free(filters);
+  vector_free(key);
+  vector_free(thread->offsets);
+  thread->offsets = NULL;
+  // entries are pushed in pairs when exiting functions, so restore the timestamp order
+  vector_sort(thread->records, timestamp_less);
+
+  if (env.format == SUMMARY) {
+    thread_trace_summary(thread);
+  } else if (env.format == FLAME_GRAPH) {
+    thread_trace_flame_graph(thread);
+  } else {
+    return;  // the records are merged across threads later
+  }
+  // the summary and the call tree keep the interned names only, so drop the records early to
+  // bound the memory by the threads being analyzed instead of the whole trace
+  vector_free(thread->records);
+  thread->records = NULL;
+}
+
+/**
+ * @brief merge the sorted entries of all threads into `report->records` in timestamp order
+ * @details there are at most MAX_THREAD_NUM threads, so we simply scan all heads for the minimum
+ */
+static void merge_records(struct report *report) {
+  const size_t n = vector_size(report->threads);
+  size_t *heads = calloc(n, sizeof(size_t));
+  size_t total = 0;
+  for (size_t i = 0; i < n; i++)
+    total += vector_size(((struct thread_trace *)vector_get(report->threads, i))->records);
+  vector_reserve(report->records, total);
+
+  while (true) {
+    const struct user_record *min = NULL;
+    size_t min_index = 0;
+    for (size_t i = 0; i < n; i++) {
+      const struct thread_trace *thread = vector_const_get(report->threads, i);
+      if (heads[i] == vector_size(thread->records)) continue;
+      const struct user_record *r = vector_const_get(thread->records, heads[i]);
+      if (!min || r->krecord.timestamp < min->krecord.timestamp) {
+        min = r;
+        min_index = i;
+      }
+    }
+    if (!min) break;
+    vector_push_back(report->records, min);
+    ++heads[min_index];
+  }
+  free(heads);
+}
+
+void do_report(struct report *report) {
+  struct cursor cursor = {
+    .pos = report->data,
+    .end = report->data + report->size,
+  };
+  // first check the format of the recorded file, then read the recorded header
+  char magic[sizeof(RECORD_MAGIC)];
+  unsigned int version;
+  if (!cursor_read(&cursor, magic, sizeof(magic)) || memcmp(magic, RECORD_MAGIC, sizeof(magic)) ||
+      !cursor_read(&cursor, &version, sizeof(version)) || version != RECORD_VERSION) {
+    ERROR("./utrace.data is not recorded by this version of utrace, please record it again");
+    exit(EXIT_FAILURE);
+  }
+  report->trace_time = read_str(&cursor);
+  report->cmdline = read_str(&cursor);
+  cursor_read(&cursor, &report->pid, sizeof(report->pid));
+  // then split the trace entries by thread, and process each thread independently in parallel
+  partition_records(report, &cursor);
+  parallel_for(vector_size(report->threads), thread_trace_build, report);
 
   if (env.format == SUMMARY) {
     report_summary(report);
-  } else if (env.format == CHROME) {
-    report_chrome(report);
   } else if (env.format == FLAME_GRAPH) {
     report_flame_graph(report);
   } else {
-    report_call_graph(report);
+    merge_records(report);
+    if (env.format == CHROME)
+      report_chrome(report);
+    else if (env.format == PERFETTO)
+      report_perfetto(report);
+    else
+      report_call_graph(report);
   }
-
-  report->records = tmp;
-  vector_free(filtered_records);
 }
 
 void report_free(struct report *report) {
   if (report) {
-    fclose(report->in);
+    if (report->data) munmap((void *)report->data, report->size);
+    close(report->fd);
     free(report->trace_time);
     free(report->cmdline);
+    vector_free(report->threads);
     vector_free(report->records);
     free(report);
   }
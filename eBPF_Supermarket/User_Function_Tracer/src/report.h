@@ -35,15 +35,20 @@ enum FORMAT {
   FLAME_GRAPH, /**< folded stack counts, can be processed by "brendangregg/FlameGraph" to generate
                     a flame graph */
   CALL_GRAPH,  /**< the default function call graph format */
+  PERFETTO,    /**< Perfetto protobuf format, can be read by "ui.perfetto.dev" */
 };
 
 struct report {
-  FILE *in;                /**< point to file "./trace.data" */
+  int fd;                  /**< file descriptor of "./utrace.data" */
+  const char *data;        /**< "./utrace.data" mapped into memory */
+  size_t size;             /**< size of "./utrace.data" */
   struct printer *printer; /**< used to print the traced data */
   char *trace_time;        /**< the traced time recorded in the header of "./trace.data" */
   char *cmdline;           /**< the trace command recorded in the header of "./trace.data" */
   pid_t pid; /**< the pid of the traced program recorded in the header of "./trace.data" */
-  struct vector *records; /**< the trace entries (struct user_record) */
+  struct vector *threads; /**< the trace entries partitioned by thread ID (struct thread_trace) */
+  struct vector *records; /**< the filtered trace entries of all threads in timestamp order
+                               (struct user_record), only merged for chrome and call-graph */
 };
 
 /**
@@ -53,7 +58,9 @@ struct report {
 struct report *report_init(struct printer *printer);
 
 /**
- * @brief report the traced data in format `report->format`
+ * @brief report the traced data in format `env.format`
+ * @details the trace entries of each thread are parsed, filtered and analyzed on worker threads,
+ *          then the per-thread results are merged
  */
 void do_report(struct report *report);
 
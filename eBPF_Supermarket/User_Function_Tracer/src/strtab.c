@@ -0,0 +1,119 @@
+// Copyright 2023 The LMP Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// author: jinyufeng2000@gmail.com
+//
+// A string table that interns strings, each unique string is stored once and has a dense ID
+
+#include "strtab.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+/**
+ * @brief one interned string, `str` is placed right after the header so that the header can be
+ *        found from the string itself
+ */
+struct strtab_entry {
+  size_t id;          /**< dense ID */
+  size_t len;         /**< length of `str` excluding the trailing '\0' */
+  uint64_t hash;      /**< cached hash of `str` */
+  char str[];         /**< the interned string */
+};
+
+#define STRTAB_INIT_CAPACITY 64
+
+/**
+ * @brief FNV-1a hash of the first `len` bytes of `str`
+ */
+static uint64_t strtab_hash(const char *str, size_t len) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char)str[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+struct strtab *strtab_init() {
+  struct strtab *strtab = malloc(sizeof(struct strtab));
+  if (!strtab) die("malloc");
+  strtab->size = 0;
+  strtab->capacity = STRTAB_INIT_CAPACITY;
+  strtab->slots = calloc(strtab->capacity, sizeof(struct strtab_entry *));
+  if (!strtab->slots) die("calloc");
+  return strtab;
+}
+
+/**
+ * @brief double the hash slots and rehash all entries
+ */
+static void strtab_grow(struct strtab *strtab) {
+  size_t capacity = strtab->capacity << 1;
+  struct strtab_entry **slots = calloc(capacity, sizeof(struct strtab_entry *));
+  if (!slots) die("calloc");
+  for (size_t i = 0; i < strtab->capacity; i++) {
+    struct strtab_entry *entry = strtab->slots[i];
+    if (!entry) continue;
+    size_t j = entry->hash & (capacity - 1);
+    while (slots[j]) j = (j + 1) & (capacity - 1);
+    slots[j] = entry;
+  }
+  free(strtab->slots);
+  strtab->slots = slots;
+  strtab->capacity = capacity;
+}
+
+const char *strtab_intern(struct strtab *strtab, const char *str, size_t len) {
+  uint64_t hash = strtab_hash(str, len);
+  size_t i = hash & (strtab->capacity - 1);
+  struct strtab_entry *entry;
+  // linear probing until finding `str` or an empty slot
+  while ((entry = strtab->slots[i])) {
+    if (entry->hash == hash && entry->len == len && !memcmp(entry->str, str, len))
+      return entry->str;
+    i = (i + 1) & (strtab->capacity - 1);
+  }
+
+  entry = malloc(sizeof(struct strtab_entry) + len + 1);
+  if (!entry) die("malloc");
+  entry->id = strtab->size++;
+  entry->len = len;
+  entry->hash = hash;
+  memcpy(entry->str, str, len);
+  entry->str[len] = '\0';
+  strtab->slots[i] = entry;
+  // keep the load factor below 1/2
+  if (strtab->size * 2 > strtab->capacity) strtab_grow(strtab);
+  return entry->str;
+}
+
+size_t strtab_size(const struct strtab *strtab) { return strtab->size; }
+
+size_t strtab_id(const char *str) {
+  const struct strtab_entry *entry =
+      (const struct strtab_entry *)(str - offsetof(struct strtab_entry, str));
+  return entry->id;
+}
+
+void strtab_free(struct strtab *strtab) {
+  if (strtab) {
+    for (size_t i = 0; i < strtab->capacity; i++) free(strtab->slots[i]);
+    free(strtab->slots);
+    free(strtab);
+  }
+}
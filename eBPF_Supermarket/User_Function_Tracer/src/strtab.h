@@ -0,0 +1,62 @@
+// Copyright 2023 The LMP Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// author: jinyufeng2000@gmail.com
+//
+// A string table that interns strings, each unique string is stored once and has a dense ID
+
+#ifndef UTRACE_STRTAB_H
+#define UTRACE_STRTAB_H
+
+#include <stddef.h>
+
+struct strtab_entry;
+
+struct strtab {
+  size_t size;                 /**< number of interned strings */
+  size_t capacity;             /**< number of hash slots, always a power of 2 */
+  struct strtab_entry **slots; /**< open addressing hash slots */
+};
+
+/**
+ * @brief create and init an empty string table
+ * @return struct strtab malloced from heap
+ */
+struct strtab *strtab_init();
+
+/**
+ * @brief intern the first `len` bytes of `str`, which need not be null-terminated
+ * @return the interned copy owned by the table, which is always null-terminated; equal inputs
+ *         return the same pointer, so interned strings can be compared by their addresses
+ * @details `str` may contain '\0' to intern several strings as one key
+ */
+const char *strtab_intern(struct strtab *strtab, const char *str, size_t len);
+
+/**
+ * @brief get the number of interned strings
+ */
+size_t strtab_size(const struct strtab *strtab);
+
+/**
+ * @brief get the ID of the interned string `str`, IDs are dense in [0, strtab_size())
+ * @param[in] str a string returned by strtab_intern()
+ */
+size_t strtab_id(const char *str);
+
+/**
+ * @brief free the `strtab` and all interned strings
+ */
+void strtab_free(struct strtab *strtab);
+
+#endif  // UTRACE_STRTAB_H
@@ -20,6 +20,7 @@
 
 #include <ctype.h>
 #include <linux/limits.h>  // for macro PATH_MAX
+#include <pthread.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -114,3 +115,45 @@ size_t resolve_addr(size_t addr) {
   if (addr > 0x400000) return addr - 0x400000;    // 64-bit load addr
   return addr;
 }
+
+/**
+ * @brief the shared state of workers created by parallel_for()
+ */
+struct parallel_for_ctx {
+  size_t n;                        /**< number of calls */
+  size_t next;                     /**< the next pending `i`, taken atomically */
+  void (*fn)(size_t i, void *arg); /**< the called function */
+  void *arg;                       /**< the argument passed to `fn` */
+};
+
+static void *parallel_for_worker(void *arg) {
+  struct parallel_for_ctx *ctx = arg;
+  for (size_t i; (i = __atomic_fetch_add(&ctx->next, 1, __ATOMIC_RELAXED)) < ctx->n;)
+    ctx->fn(i, ctx->arg);
+  return NULL;
+}
+
+void parallel_for(size_t n, void (*fn)(size_t i, void *arg), void *arg) {
+  struct parallel_for_ctx ctx = {
+    .n = n,
+    .next = 0,
+    .fn = fn,
+    .arg = arg,
+  };
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t workers = cpus > 0 ? (size_t)cpus : 1;
+  if (workers > n) workers = n;
+  pthread_t *threads = workers > 1 ? malloc(sizeof(pthread_t) * workers) : NULL;
+  if (!threads) {  // not worth creating threads, or out of memory
+    parallel_for_worker(&ctx);
+    return;
+  }
+
+  size_t created = 0;
+  for (; created < workers; created++) {
+    if (pthread_create(&threads[created], NULL, parallel_for_worker, &ctx)) break;
+  }
+  if (!created) parallel_for_worker(&ctx);  // fall back to the current thread
+  for (size_t i = 0; i < created; i++) pthread_join(threads[i], NULL);
+  free(threads);
+}
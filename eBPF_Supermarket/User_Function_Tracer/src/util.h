@@ -75,4 +75,11 @@ unsigned long long duration_str2ns(const char *duration);
  */
 size_t resolve_addr(size_t addr);
 
+/**
+ * @brief call `fn(i, arg)` for each `i` in [0, n) on worker threads
+ * @details at most one worker per online CPU is created, and each worker takes the next pending
+ *          `i` until all are done; returns after all calls finished
+ */
+void parallel_for(size_t n, void (*fn)(size_t i, void *arg), void *arg);
+
 #endif  // UTRACE_UTIL_H
@@ -39,18 +39,48 @@ struct {
 
 #define TID_SHIFT 10
 /**
- * @brief record the timestamp when the last function started for each thread
+ * @brief the state saved when a function started
+ */
+struct start_info {
+  __u64 timestamp; /**< the start timestamp */
+  __u64 weight;    /**< number of calls the sampled call stands for, 0 if it is not sampled */
+};
+
+/**
+ * @brief record the start info of the last function for each thread
  * @param[in] key global ID, computed by ``(tid << TID_SHIFT | stack_sz)`,
  *            which uniquely corresponds to a pair `(tid, stack_sz)`
- * @param[out] value the start timestamp
+ * @param[out] value the start info
  */
 struct {
   __uint(type, BPF_MAP_TYPE_HASH);
   __type(key, __u32);
-  __type(value, __u64);
+  __type(value, struct start_info);
   __uint(max_entries, (MAX_THREAD_NUM) * (MAX_STACK_SIZE));
 } function_start SEC(".maps");
 
+/**
+ * @brief the sampling state of one function
+ */
+struct sample_info {
+  __u64 skipped;      /**< calls skipped since the last sampled call (including the current one) */
+  __u64 window_start; /**< start timestamp of the current one-second rate limiting window */
+  __u64 window_calls; /**< sampled calls in the current rate limiting window */
+};
+
+/**
+ * @brief maintain the sampling state for each function on each CPU (shrunk to 1 entry by the
+ *        user-side when sampling is disabled)
+ * @param[in] key function address
+ * @param[out] value the sampling state
+ */
+struct {
+  __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+  __type(key, __u64);
+  __type(value, struct sample_info);
+  __uint(max_entries, MAX_SAMPLED_FUNC_NUM);
+} function_sample SEC(".maps");
+
 /**
  * @brief send the traced data `kernel_record` to the user-side
  */
@@ -59,15 +89,51 @@ struct {
   __uint(max_entries, 2048 * 4096);
 } records SEC(".maps");
 
-const volatile unsigned int max_depth = 0;          /**< set by --max-depth */
-const volatile unsigned long long min_duration = 0; /**< set by --time-filter */
+const volatile unsigned int max_depth = 0;               /**< set by --max-depth */
+const volatile unsigned long long min_duration = 0;      /**< set by --time-filter */
+const volatile unsigned int sample_rate = 1;             /**< set by --sample-rate */
+const volatile unsigned long long max_calls_per_sec = 0; /**< set by --max-calls-per-sec */
+
+/**
+ * @brief decide whether the call of the function at `addr` should be recorded
+ * @return the number of calls the recorded call stands for, or 0 if it should be skipped
+ */
+static __always_inline __u64 sample_function(__u64 addr, __u64 ts) {
+  struct sample_info *info, zero = {};
+  __u64 weight;
+
+  if (sample_rate <= 1 && !max_calls_per_sec) return 1;  // sampling is disabled
+
+  info = bpf_map_lookup_elem(&function_sample, &addr);
+  if (!info) {
+    bpf_map_update_elem(&function_sample, &addr, &zero, BPF_NOEXIST);
+    info = bpf_map_lookup_elem(&function_sample, &addr);
+    if (!info) return 1;  // the map is full, fall back to tracing every call
+  }
+
+  ++info->skipped;
+  if (info->skipped < sample_rate) return 0;  // only record every `sample_rate`-th call
+
+  if (max_calls_per_sec) {
+    if (ts - info->window_start >= 1000000000ULL) {  // start a new one-second window
+      info->window_start = ts;
+      info->window_calls = 0;
+    }
+    if (info->window_calls >= max_calls_per_sec) return 0;  // rate limited
+    ++info->window_calls;
+  }
+
+  weight = info->skipped;
+  info->skipped = 0;
+  return weight;
+}
 
 // triggered every time a function is entered
 SEC("uprobe/trace")
 int uprobe(struct pt_regs *ctx) {
   struct kernel_record *r;
   int tid;
-  __u64 ts;
+  struct start_info start;
   __u32 *local_size_pt;
   __u32 local_size, global_id;
 
@@ -82,25 +148,36 @@ int uprobe(struct pt_regs *ctx) {
     return 0;
   }
 
+  local_size = local_size_pt ? *local_size_pt + 1 : 0;
+  bpf_map_update_elem(&stack_size, &tid, &local_size, BPF_ANY);
+  global_id = (tid << TID_SHIFT) | local_size;  // compute the global ID
+
+  // apply sampling filter, the depth is still maintained for the skipped calls
+  start.weight = sample_function(PT_REGS_IP(ctx), bpf_ktime_get_ns());
+  if (!start.weight) {
+    start.timestamp = 0;
+    bpf_map_update_elem(&function_start, &global_id, &start, BPF_ANY);
+    return 0;
+  }
+
   r = bpf_ringbuf_reserve(&records, sizeof(*r), 0);
-  if (!r) return 0;
+  if (!r) {
+    start.weight = 0;  // the entry is lost, so also drop the exit
+    start.timestamp = 0;
+    bpf_map_update_elem(&function_start, &global_id, &start, BPF_ANY);
+    return 0;
+  }
 
   r->tid = tid;
   bpf_get_stack(ctx, &r->ustack, sizeof(r->ustack), BPF_F_USER_STACK);
-  if (local_size_pt) {
-    r->ustack_sz = local_size = *local_size_pt + 1;
-  } else {
-    r->ustack_sz = local_size = 0;
-  }
-
-  bpf_map_update_elem(&stack_size, &tid, &local_size, BPF_ANY);
-  global_id = (tid << TID_SHIFT) | local_size;  // compute the global ID
+  r->ustack_sz = local_size;
+  r->weight = start.weight;
 
-  r->timestamp = ts = bpf_ktime_get_ns();  // record timestamp as late as possible
+  r->timestamp = start.timestamp = bpf_ktime_get_ns();  // record timestamp as late as possible
   r->ret = false;
   bpf_ringbuf_submit(r, 0);
 
-  bpf_map_update_elem(&function_start, &global_id, &ts, BPF_ANY);
+  bpf_map_update_elem(&function_start, &global_id, &start, BPF_ANY);
 
   return 0;
 }
@@ -110,7 +187,7 @@ SEC("uretprobe/trace")
 int uretprobe(struct pt_regs *ctx) {
   struct kernel_record *r;
   int tid;
-  __u64 *start_ts_pt;
+  struct start_info *start_pt;
   __u32 *local_size_pt;
   __u32 global_id;
   __u64 end_ts = bpf_ktime_get_ns(), duration_ns;  // record timestamp as early as possible
@@ -128,25 +205,30 @@ int uretprobe(struct pt_regs *ctx) {
   }
 
   global_id = (tid << TID_SHIFT) | *local_size_pt;
-  start_ts_pt = bpf_map_lookup_elem(&function_start, &global_id);
-  if (start_ts_pt) {
-    duration_ns = end_ts - *start_ts_pt;
+  start_pt = bpf_map_lookup_elem(&function_start, &global_id);
+  if (start_pt) {
+    duration_ns = end_ts - start_pt->timestamp;
   } else {
     return 0;
   }
 
-  if (duration_ns < min_duration) {  // apply time filter
+  if (!start_pt->weight || duration_ns < min_duration) {  // apply sampling filter and time filter
     --*local_size_pt;
     bpf_map_update_elem(&stack_size, &tid, local_size_pt, BPF_ANY);
     return 0;
   }
 
   r = bpf_ringbuf_reserve(&records, sizeof(*r), 0);
-  if (!r) return 0;
+  if (!r) {
+    --*local_size_pt;
+    bpf_map_update_elem(&stack_size, &tid, local_size_pt, BPF_ANY);
+    return 0;
+  }
 
   r->tid = tid;
   bpf_get_stack(ctx, r->ustack, sizeof(r->ustack), BPF_F_USER_STACK);
   r->ustack_sz = *local_size_pt;
+  r->weight = start_pt->weight;
 
   r->timestamp = end_ts;
   r->ret = true;
@@ -34,6 +34,7 @@
 #include "gdb.h"
 #include "glob.h"
 #include "log.h"
+#include "perfetto.h"
 #include "record.h"
 #include "report.h"
 #include "util.h"
@@ -47,15 +48,18 @@ enum {
   OPT_FORMAT,
   OPT_LIB,
   OPT_LIBNAME,
+  OPT_MAX_CALLS_PER_SEC,
   OPT_MAX_DEPTH,
   OPT_NEST_LIB,
   OPT_NO_ASLR,
   OPT_NO_FUNCTION,
   OPT_NO_LIB,
+  OPT_PERFETTO,
   OPT_PERCENT_SELF,
   OPT_PERCENT_TOTAL,
   OPT_RECORD,
   OPT_REPORT,
+  OPT_SAMPLE_RATE,
   OPT_SAMPLE_TIME,
   OPT_TID,
   OPT_TID_FILTER,
@@ -82,13 +86,16 @@ static const struct argp_option opts[] = {
   { "debug", 'd', NULL, 0, "Show debug information", 0 },
   { "flat", OPT_FLAT, NULL, 0, "Display in a flat output format", 0 },
   { "format", OPT_FORMAT, "FORMAT", 0,
-    "Use FORMAT (summary, chrome, flame-graph and call-graph, default is call-graph) in report",
+    "Use FORMAT (summary, chrome, perfetto, flame-graph and call-graph, default is call-graph) in "
+    "report; perfetto requires -o/--output",
     0 },
   { "function", 'f', "FUNC_PATTERN", 0,
     "Only trace functions matching FUNC_PATTERN (in glob format, default \"*\")", 0 },
   { "lib", 'l', "LIB_PATTERN", 0,
     "Only trace libcalls to libraries matching LIB_PATTERN (in glob format, default \"*\")", 0 },
   { "libname", OPT_LIBNAME, NULL, 0, "Append libname to symbol name", 0 },
+  { "max-calls-per-sec", OPT_MAX_CALLS_PER_SEC, "CALLS", 0,
+    "Record at most CALLS calls per second of each function on each CPU", 0 },
   { "max-depth", OPT_MAX_DEPTH, "DEPTH", 0, "Hide functions with stack depths greater than DEPTH",
     0 },
   { "nest-lib", OPT_NEST_LIB, "NEST_LIB_PATTERN", 0,
@@ -101,12 +108,18 @@ static const struct argp_option opts[] = {
     0 },
   { "output", 'o', "OUTPUT_FILE", 0, "Send trace output to OUTPUT_FILE instead of stderr", 0 },
   { "pid", 'p', "PID", 0, "PID of the traced program", 0 },
+  { "perfetto", OPT_PERFETTO, "PERFETTO_FILE", 0,
+    "Also stream the trace to PERFETTO_FILE in Perfetto protobuf format while tracing", 0 },
   { "percent-self", OPT_PERCENT_SELF, NULL, 0, "Show percentage of self function time in report",
     0 },
   { "percent-total", OPT_PERCENT_TOTAL, NULL, 0, "Show percentage of total function time in report",
     0 },
   { "record", OPT_RECORD, NULL, 0, "Save the trace data", 0 },
   { "report", OPT_REPORT, NULL, 0, "Analyze the pre-saved trace data", 0 },
+  { "sample-rate", OPT_SAMPLE_RATE, "N", 0,
+    "Only record every N-th call of each function (default 1), durations are extrapolated in "
+    "summary report",
+    0 },
   { "sample-time", OPT_SAMPLE_TIME, "TIME", 0,
     "Apply TIME as the sampling time (defaut 1us) when generating flame graph in report", 0 },
   { "tid", OPT_TID, NULL, 0, "Display thread ID", 0 },
@@ -120,6 +133,7 @@ static const struct argp_option opts[] = {
 bool debug; /**< -d/--debug */
 struct env env;
 static struct record *record;
+static struct perfetto *perfetto;
 static struct printer *printer;
 
 // parse command line arguments to set the struct `env`
@@ -158,6 +172,8 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
         env.format = CHROME;
       else if (!strncmp(arg, "flame-graph", 11))
         env.format = FLAME_GRAPH;
+      else if (!strncmp(arg, "perfetto", 8))
+        env.format = PERFETTO;
       // otherwise, env.format is the default CALL_GRAPH
       break;
     case 'f':                  // -f/--function
@@ -179,6 +195,13 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
     case OPT_LIBNAME:  // --libname
       env.show_libname = true;
       break;
+    case OPT_MAX_CALLS_PER_SEC:  // --max-calls-per-sec
+      env.max_calls_per_sec = strtoull(arg, NULL, 10);
+      if (!env.max_calls_per_sec) {
+        ERROR("The parameter for --max-calls-per-sec should be greater than 0");
+        return 1;
+      }
+      break;
     case OPT_MAX_DEPTH:  // --max-depth
       env.max_depth = atoi(arg);
       if (env.max_depth <= 0) {
@@ -225,6 +248,10 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
         return 1;
       }
       break;
+    case OPT_PERFETTO:  // --perfetto
+      env.perfetto_out = fopen(arg, "wb");
+      if (!env.perfetto_out) die("fopen");
+      break;
     case OPT_PERCENT_SELF:  // --percent-self
       env.percent_self = true;
       break;
@@ -237,6 +264,13 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
     case OPT_REPORT:  // --report
       env.do_report = true;
       break;
+    case OPT_SAMPLE_RATE:  // --sample-rate
+      env.sample_rate = atoi(arg);
+      if ((int)env.sample_rate <= 0) {
+        ERROR("The parameter for --sample-rate should be greater than 0");
+        return 1;
+      }
+      break;
     case OPT_SAMPLE_TIME:  // --sample-time
       env.sample_time_ns = duration_str2ns(arg);
       if (!env.sample_time_ns) {
@@ -374,7 +408,7 @@ static int handle_event(void *ctx, void *data, size_t data_sz) {
   struct user_record user_record = {
     .krecord = *((struct kernel_record *)data),
   };
-  print_trace(printer, vmem_table, thread_local, record, &user_record);
+  print_trace(printer, vmem_table, thread_local, record, perfetto, &user_record);
   return 0;
 }
 
@@ -403,6 +437,7 @@ int main(int argc, char **argv) {
   env.out = stderr;                           // output to stderr by default
   env.format = CALL_GRAPH;                    // report in call-graph format by default
   env.sample_time_ns = 1000;                  // sample every 1us (1000ns) by default
+  env.sample_rate = 1;                        // record every call by default
   env.tids = vector_init(sizeof(int), NULL);  // set tid filter to empty
   err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
   if (err) {
@@ -410,6 +445,10 @@ int main(int argc, char **argv) {
   } else if (!env.do_report && !env.argv[0] && !env.pid) {
     // either "--pid" or "-c/--command" should be specified
     fail("Please specify the traced program or its pid");
+  } else if (env.do_report && env.format == PERFETTO &&
+             (env.out == stderr || isatty(fileno(env.out)))) {
+    // the Perfetto trace is binary protobuf, keep it apart from the diagnostics and the terminal
+    fail("Please specify a file with -o/--output for --format perfetto");
   }
   if (!env.func_pattern) env.func_pattern = strdup("*");  // trace all functions by default
   if (!env.lib_pattern) env.lib_pattern = strdup("*");    // trace all libcalls by default
@@ -455,9 +494,15 @@ int main(int argc, char **argv) {
   skel = utrace_bpf__open();
   if (!skel) fail("Failed to open and load BPF skeleton");
 
-  // set depth filter and time filter
+  // set depth filter, time filter and sampling filter
   skel->rodata->max_depth = env.max_depth;
   skel->rodata->min_duration = env.min_duration;
+  skel->rodata->sample_rate = env.sample_rate;
+  skel->rodata->max_calls_per_sec = env.max_calls_per_sec;
+
+  // the per-CPU sampling state is only used when sampling is enabled
+  if (env.sample_rate <= 1 && !env.max_calls_per_sec)
+    bpf_map__set_max_entries(skel->maps.function_sample, 1);
 
   err = utrace_bpf__load(skel);
   if (err) fail("Failed to load and verify BPF skeleton");
@@ -541,6 +586,7 @@ int main(int argc, char **argv) {
     record = record_init(pid);
     record_header(record, argc, argv);
   }
+  if (env.perfetto_out) perfetto = perfetto_init(env.perfetto_out, pid, program);
 
   // process events
   while (!exiting) {
@@ -581,6 +627,8 @@ cleanup:
   vector_free(env.tids);
   free(program);
   record_free(record);
+  perfetto_free(perfetto);
+  if (env.perfetto_out) fclose(env.perfetto_out);
   printer_free(printer);
 
   utrace_bpf__destroy(skel);
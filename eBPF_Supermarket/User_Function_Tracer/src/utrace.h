@@ -23,6 +23,7 @@
 
 #define MAX_STACK_SIZE 32
 #define MAX_THREAD_NUM 32
+#define MAX_SAMPLED_FUNC_NUM 65536
 
 /**
  * @brief represent the traced data recorded in kernel-side and passed to user-side
@@ -32,6 +33,7 @@ struct kernel_record {
   unsigned int ustack_sz;       /**< user stack size */
   unsigned long long ustack[1]; /**< user stack; we only need to record the current address */
   unsigned long long timestamp; /**< timestamp */
+  unsigned long long weight;    /**< number of calls this record stands for when sampling */
   bool ret;                     /**< is function ret */
 };
 
@@ -0,0 +1,128 @@
+// Copyright 2023 The LMP Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://github.com/linuxkerneltravel/lmp/blob/develop/LICENSE
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// author: jinyufeng2000@gmail.com
+//
+// Generate a synthetic "./utrace.data" for benchmarking "utrace --report"
+//
+// Usage: gen_trace [RECORDS] [THREADS] [FUNCTIONS]
+//   (default: 100000000 records, 8 threads, 1000 functions)
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_STACK_SIZE 32
+#define MAX_THREAD_NUM 32
+#define FANOUT 4  // number of callees of each function
+#define RECORD_MAGIC "UTRACE"  // same as src/record.h
+#define RECORD_VERSION 2
+
+static void fwrite_str(const char *str, FILE *fp) {
+  size_t len = strlen(str);
+  fwrite(&len, sizeof(size_t), 1, fp);
+  fwrite(str, sizeof(char), len, fp);
+}
+
+static void fwrite_record(FILE *fp, int tid, unsigned long long timestamp, const char *name,
+                          bool ret) {
+  unsigned long long weight = 1;
+  fwrite(&tid, sizeof(tid), 1, fp);
+  fwrite(&timestamp, sizeof(timestamp), 1, fp);
+  fwrite_str(name, fp);
+  fwrite_str("", fp);
+  fwrite(&weight, sizeof(weight), 1, fp);
+  fwrite(&ret, sizeof(ret), 1, fp);
+}
+
+int main(int argc, char **argv) {
+  unsigned long long records = argc > 1 ? strtoull(argv[1], NULL, 10) : 100000000ULL;
+  int threads = argc > 2 ? atoi(argv[2]) : 8;
+  int functions = argc > 3 ? atoi(argv[3]) : 1000;
+  if (threads <= 0 || threads > MAX_THREAD_NUM || functions <= 0) {
+    fprintf(stderr, "Usage: %s [RECORDS] [THREADS (1-%d)] [FUNCTIONS]\n", argv[0], MAX_THREAD_NUM);
+    return 1;
+  }
+
+  FILE *fp = fopen("./utrace.data", "wb");
+  if (!fp) {
+    perror("fopen");
+    return 1;
+  }
+  static char buf[1 << 20];
+  setvbuf(fp, buf, _IOFBF, sizeof(buf));
+
+  // write the same header as record_header()
+  const unsigned int version = RECORD_VERSION;
+  fwrite(RECORD_MAGIC, sizeof(RECORD_MAGIC), 1, fp);
+  fwrite(&version, sizeof(version), 1, fp);
+  time_t t;
+  time(&t);
+  char *cur_time = ctime(&t);
+  cur_time[strlen(cur_time) - 1] = '\0';
+  fwrite_str(cur_time, fp);
+  fwrite_str("gen_trace", fp);
+  int pid = 1000;
+  fwrite(&pid, sizeof(pid), 1, fp);
+
+  char **names = malloc(sizeof(char *) * functions);
+  for (int i = 0; i < functions; i++) {
+    names[i] = malloc(32);
+    snprintf(names[i], 32, "func_%d", i);
+  }
+
+  int stacks[MAX_THREAD_NUM][MAX_STACK_SIZE];
+  int depths[MAX_THREAD_NUM] = { 0 };
+  unsigned long long timestamp = 1000000000ULL;
+  unsigned long long written = 0;
+  srand(42);
+  // random walk on each thread's stack, interleaving threads by timestamp; like a real program,
+  // each function only calls a few others and deep stacks are rare, so the number of distinct
+  // stacks stays bounded instead of growing with the trace
+  while (written < records) {
+    int i = rand() % threads;
+    timestamp += 1 + rand() % 1000;
+    bool enter = !depths[i] ||
+                 (depths[i] < MAX_STACK_SIZE - 1 && rand() % (depths[i] + 2) < 2);
+    // leave room for closing all open functions
+    unsigned long long open = 0;
+    for (int j = 0; j < threads; j++) open += depths[j];
+    if (written + open + 2 > records) enter = false;
+    if (enter) {
+      int caller = depths[i] ? stacks[i][depths[i] - 1] : i;
+      stacks[i][depths[i]] = (caller * 31 + 1 + rand() % FANOUT) % functions;
+      fwrite_record(fp, pid + i, timestamp, names[stacks[i][depths[i]++]], false);
+    } else if (depths[i]) {
+      fwrite_record(fp, pid + i, timestamp, names[stacks[i][--depths[i]]], true);
+    } else {
+      break;
+    }
+    ++written;
+  }
+  for (int i = 0; i < threads; i++) {
+    while (depths[i]) {
+      timestamp += 1 + rand() % 1000;
+      fwrite_record(fp, pid + i, timestamp, names[stacks[i][--depths[i]]], true);
+      ++written;
+    }
+  }
+  fprintf(stderr, "Generated %llu records of %d threads in ./utrace.data\n", written, threads);
+
+  for (int i = 0; i < functions; i++) free(names[i]);
+  free(names);
+  fclose(fp);
+  return 0;
+}